@@ -0,0 +1,912 @@
+//
+// Copyright © 2022-2024, David Priver <david@davidpriver.com>
+//
+// Throughput benchmarks for the parser and friends. Not part of the tests.
+//
+//   make bench
+//
+// runs this twice: once as-is and once built with DRJ_HAVE_SIMD=0 so the
+// scalar paths can be compared. Pass a substring to only run matching
+// benchmarks.
+//
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS 1
+#endif
+#if defined(DRJ_HAVE_SIMD) && !DRJ_HAVE_SIMD
+#define BENCH_VARIANT "scalar"
+#else
+#define BENCH_VARIANT "default"
+#endif
+#define DRJSON_API static inline
+#include "drjson.c"
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#ifdef __clang__
+#pragma clang assume_nonnull begin
+#endif
+
+typedef struct BenchBuf BenchBuf;
+struct BenchBuf {
+    char* text;
+    size_t length;
+    size_t capacity;
+};
+
+static
+void
+bb_write(BenchBuf* b, const char* s, size_t len){
+    if(b->length + len + 1 > b->capacity){
+        size_t cap = b->capacity? b->capacity*2 : 4096;
+        while(cap < b->length + len + 1) cap *= 2;
+        char* p = realloc(b->text, cap);
+        if(!p) abort();
+        b->text = p;
+        b->capacity = cap;
+    }
+    memcpy(b->text+b->length, s, len);
+    b->length += len;
+    b->text[b->length] = 0;
+}
+
+static
+void
+bb_printf(BenchBuf* b, const char* fmt, ...){
+    char tmp[1024];
+    va_list va;
+    va_start(va, fmt);
+    int n = vsnprintf(tmp, sizeof tmp, fmt, va);
+    va_end(va);
+    if(n < 0 || (size_t)n >= sizeof tmp) abort();
+    bb_write(b, tmp, (size_t)n);
+}
+
+static
+double
+bench_now(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const char* bench_filter;
+
+static
+_Bool
+bench_enabled(const char* name){
+    return !bench_filter || strstr(name, bench_filter);
+}
+
+// Runs are reported as the fastest iteration, which is far more stable than
+// the mean on a noisy machine.
+static
+void
+bench_report(const char* name, size_t bytes, double best){
+    if(bytes)
+        printf("%-32s %9.1f MB/s %11.3f ms/iter\n", name, (double)bytes / best / 1e6, best * 1e3);
+    else
+        printf("%-32s %11.3f ms/iter\n", name, best * 1e3);
+    fflush(stdout);
+}
+
+// Counts what a parse asks of the allocator.
+typedef struct BenchCounts BenchCounts;
+struct BenchCounts {
+    size_t allocs;
+    size_t reallocs;
+    size_t frees;
+    size_t bytes; // live
+};
+
+static
+void*_Nullable
+bench_count_alloc(void*_Null_unspecified up, size_t size){
+    ((BenchCounts*)up)->allocs++;
+    ((BenchCounts*)up)->bytes += size;
+    return malloc(size);
+}
+
+static
+void*_Nullable
+bench_count_realloc(void*_Null_unspecified up, void*_Nullable p, size_t old_size, size_t new_size){
+    ((BenchCounts*)up)->reallocs++;
+    ((BenchCounts*)up)->bytes += new_size - old_size;
+    return realloc(p, new_size);
+}
+
+static
+void
+bench_count_free(void*_Null_unspecified up, const void*_Nullable p, size_t size){
+    ((BenchCounts*)up)->frees++;
+    ((BenchCounts*)up)->bytes -= size;
+    free((void*)p);
+}
+
+// Documents
+
+static
+void
+gen_records(BenchBuf* b, int n){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        bb_printf(b,
+            "%s{\"id\":%d,\"name\":\"user%d\",\"email\":\"user%d@example.com\","
+            "\"active\":%s,\"score\":%d.%d,\"balance\":-%d,"
+            "\"tags\":[\"alpha\",\"beta\",\"gamma\"],"
+            "\"address\":{\"street\":\"%d Main Street\",\"city\":\"Springfield\",\"zip\":\"%05d\"}}",
+            i?",":"", i, i, i, (i&1)?"true":"false", i%100, i%7, i*3, i, (i*7919)%100000);
+    }
+    bb_write(b, "]", 1);
+}
+
+static
+void
+gen_strings(BenchBuf* b, int n){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        bb_printf(b, "%s\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod %d tempor incididunt ut labore et dolore magna aliqua.\"", i?",":"", i);
+    }
+    bb_write(b, "]", 1);
+}
+
+// Strings full of escaped quotes and backslashes.
+static
+void
+gen_escaped(BenchBuf* b, int n){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        bb_printf(b, "%s\"He said \\\"hi\\\" to \\\"%d\\\", C:\\\\path\\\\to\\\\file \\\"quoted\\\" \\\"again\\\"\"", i?",":"", i);
+    }
+    bb_write(b, "]", 1);
+}
+
+// Column aligned numbers: mostly whitespace.
+static
+void
+gen_sparse(BenchBuf* b, int n){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        bb_printf(b, "%-8d%s", i, (i & 7) == 7? "\n" : "                                                        ");
+    }
+    bb_write(b, "]", 1);
+}
+
+// Many small values in one flat array.
+static
+void
+gen_wide(BenchBuf* b, int n){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++)
+        bb_printf(b, "%s%d", i?",":"", i);
+    bb_write(b, "]", 1);
+}
+
+// One object with many keys.
+static
+void
+gen_big_object(BenchBuf* b, int n){
+    bb_write(b, "{", 1);
+    for(int i = 0; i < n; i++)
+        bb_printf(b, "%s\"key%d\":%d", i?",":"", i, i);
+    bb_write(b, "}", 1);
+}
+
+// Integers and doubles of realistic sizes: ids, timestamps, coordinates.
+static
+void
+gen_ints(BenchBuf* b, int n){
+    uint64_t x = 88172645463325252u;
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int64_t v = (int64_t)(x >> (x & 63));
+        bb_printf(b, "%s%lld", i?",":"", (long long)(i & 1? -v : v) / 2);
+    }
+    bb_write(b, "]", 1);
+}
+
+static
+void
+gen_doubles(BenchBuf* b, int n){
+    uint64_t x = 88172645463325252u;
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        double d = (double)(x >> 11) / (double)(1ull << 53);
+        bb_printf(b, "%s%.*g", i?",":"", 1 + (int)(x % 17), (d - .5) * 1e6);
+    }
+    bb_write(b, "]", 1);
+}
+
+// Alternating objects and arrays nested `depth` deep, repeated.
+static
+void
+gen_deep(BenchBuf* b, int n, int depth){
+    bb_write(b, "[", 1);
+    for(int i = 0; i < n; i++){
+        if(i) bb_write(b, ",", 1);
+        for(int d = 0; d < depth; d++)
+            bb_write(b, d & 1? "[" : "{\"k\":", d & 1? 1 : 5);
+        bb_printf(b, "%d", i);
+        for(int d = depth; d-- > 0;)
+            bb_write(b, d & 1? "]" : "}", 1);
+    }
+    bb_write(b, "]", 1);
+}
+
+// Re-print a document with the library's pretty printer.
+static
+void
+pretty(const BenchBuf* src, BenchBuf* dst){
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    DrJsonValue v = drjson_parse_string(ctx, src->text, src->length, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    if(v.kind == DRJSON_ERROR) abort();
+    size_t cap = src->length * 4 + 4096;
+    dst->text = malloc(cap);
+    dst->capacity = cap;
+    size_t printed = 0;
+    if(drjson_print_value_mem(ctx, dst->text, cap, v, 0, DRJSON_PRETTY_PRINT, &printed))
+        abort();
+    dst->length = printed;
+    drjson_ctx_free_all(ctx);
+}
+
+// Widen indentation, like a document written with 8 space indents.
+static
+void
+reindent(const BenchBuf* src, BenchBuf* dst, int factor){
+    _Bool bol = 1;
+    for(size_t i = 0; i < src->length; i++){
+        char c = src->text[i];
+        if(bol && c == ' '){
+            for(int j = 0; j < factor; j++)
+                bb_write(dst, " ", 1);
+            continue;
+        }
+        bol = c == '\n';
+        bb_write(dst, &c, 1);
+    }
+}
+
+// Benchmarks
+
+static
+void
+bench_parse(const char* name, const BenchBuf* doc, unsigned flags){
+    if(!bench_enabled(name)) return;
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+        double t0 = bench_now();
+        DrJsonValue v = drjson_parse_string(ctx, doc->text, doc->length, flags);
+        double t = bench_now() - t0;
+        if(v.kind == DRJSON_ERROR) abort();
+        drjson_ctx_free_all(ctx);
+        if(t < best) best = t;
+    }
+    bench_report(name, doc->length, best);
+}
+
+// Parse and print back out, as a filter that passes data through would.
+static
+void
+bench_roundtrip(const char* name, const BenchBuf* doc, unsigned flags){
+    if(!bench_enabled(name)) return;
+    size_t size = doc->length * 2 + 64;
+    char* out = malloc(size);
+    if(!out) abort();
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+        double t0 = bench_now();
+        DrJsonValue v = drjson_parse_string(ctx, doc->text, doc->length, flags);
+        size_t printed;
+        int err = v.kind == DRJSON_ERROR || drjson_print_value_mem(ctx, out, size, v, 0, 0, &printed);
+        double t = bench_now() - t0;
+        if(err) abort();
+        drjson_ctx_free_all(ctx);
+        if(t < best) best = t;
+    }
+    free(out);
+    bench_report(name, doc->length, best);
+}
+
+// Collects a context holding the document and as much garbage. With a
+// budget, reports the longest drjson_gc_step instead of the whole drjson_gc.
+// With more than 1 thread, the whole drjson_gc_parallel.
+static
+void
+bench_gc(const char* name, const BenchBuf* doc, size_t budget, size_t threads){
+    if(!bench_enabled(name)) return;
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+        DrJsonValue garbage = drjson_parse_string(ctx, doc->text, doc->length, 0);
+        DrJsonValue root = drjson_parse_string(ctx, doc->text, doc->length, 0);
+        if(garbage.kind == DRJSON_ERROR || root.kind == DRJSON_ERROR) abort();
+        double worst = 0;
+        if(!budget){
+            double t0 = bench_now();
+            drjson_gc_parallel(ctx, &root, 1, threads);
+            worst = bench_now() - t0;
+        }
+        else {
+            for(int done = 0; !done;){
+                double t0 = bench_now();
+                done = drjson_gc_step(ctx, &root, 1, budget);
+                double t = bench_now() - t0;
+                if(t > worst) worst = t;
+            }
+        }
+        drjson_ctx_free_all(ctx);
+        if(worst < best) best = worst;
+    }
+    bench_report(name, 0, best);
+}
+
+static
+size_t
+bench_walk(const DrJsonContext* ctx, DrJsonValue v){
+    if(v.kind == DRJSON_OBJECT)
+        v = drjson_object_values(v);
+    else if(v.kind != DRJSON_ARRAY)
+        return 1;
+    size_t n = 1;
+    int64_t len = drjson_len(ctx, v);
+    for(int64_t i = 0; i < len; i++)
+        n += bench_walk(ctx, drjson_get_by_index(ctx, v, i));
+    return n;
+}
+
+// Keeps every 8th record of the document, so the survivors of a collection
+// are spread through the tables, then compacts. Reports the memory still
+// allocated and how long walking the survivors takes, before and after.
+static
+void
+bench_compact(const char* name, const BenchBuf* doc){
+    if(!bench_enabled(name)) return;
+    BenchCounts counts = {0};
+    DrJsonAllocator allocator = {
+        .user_pointer = &counts,
+        .alloc = bench_count_alloc,
+        .realloc = bench_count_realloc,
+        .free = bench_count_free,
+    };
+    DrJsonContext* ctx = drjson_create_ctx(allocator);
+    if(!ctx) abort();
+    DrJsonValue all = drjson_parse_string(ctx, doc->text, doc->length, 0);
+    if(all.kind == DRJSON_ERROR) abort();
+    DrJsonValue keep = drjson_make_array(ctx);
+    for(int64_t i = 0; i < drjson_len(ctx, all); i += 8)
+        if(drjson_array_push_item(ctx, keep, drjson_get_by_index(ctx, all, i))) abort();
+    drjson_gc(ctx, &keep, 1);
+    size_t expected = bench_walk(ctx, keep);
+    for(int compacted = 0; compacted < 2; compacted++){
+        if(compacted && drjson_gc_compact(ctx, &keep, 1, NULL)) abort();
+        double best = 1e9;
+        size_t iterations = 0;
+        for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+            double t0 = bench_now();
+            size_t n = bench_walk(ctx, keep);
+            double t = bench_now() - t0;
+            if(n != expected) abort();
+            if(t < best) best = t;
+        }
+        char sub[64];
+        snprintf(sub, sizeof sub, "%s-%s", name, compacted? "after" : "before");
+        printf("%-32s %9zu KB %11.3f ms/walk\n", sub, counts.bytes/1024, best * 1e3);
+        fflush(stdout);
+    }
+    drjson_ctx_free_all(ctx);
+}
+
+// Parses documents with keys and values never seen before into one
+// context, the way a long running process would, collecting after each.
+// Reports what is still allocated at the end, with and without collecting
+// atoms, and the time the slowest collection took.
+static
+void
+bench_atom_gc(const char* name, int rounds){
+    if(!bench_enabled(name)) return;
+    BenchBuf doc = {0};
+    for(int atoms = 0; atoms < 2; atoms++){
+        BenchCounts counts = {0};
+        DrJsonAllocator allocator = {
+            .user_pointer = &counts,
+            .alloc = bench_count_alloc,
+            .realloc = bench_count_realloc,
+            .free = bench_count_free,
+        };
+        DrJsonContext* ctx = drjson_create_ctx(allocator);
+        if(!ctx) abort();
+        double worst = 0;
+        for(int r = 0; r < rounds; r++){
+            doc.length = 0;
+            bb_write(&doc, "[", 1);
+            for(int i = 0; i < 1000; i++)
+                bb_printf(&doc, "%s{\"id\": %d, \"key_%d_%d\": \"value_%d_%d\"}", i? "," : "", i, r, i, r, i);
+            bb_write(&doc, "]", 1);
+            DrJsonValue v = drjson_parse_string(ctx, doc.text, doc.length, 0);
+            if(v.kind == DRJSON_ERROR) abort();
+            double t0 = bench_now();
+            if(atoms){
+                if(drjson_gc_atoms(ctx, &v, 1)) abort();
+            }
+            else
+                drjson_gc(ctx, &v, 1);
+            double t = bench_now() - t0;
+            if(t > worst) worst = t;
+        }
+        char sub[64];
+        snprintf(sub, sizeof sub, "%s-%s", name, atoms? "atoms" : "plain");
+        printf("%-32s %9zu KB %11.3f ms/gc (worst)\n", sub, counts.bytes/1024, worst * 1e3);
+        fflush(stdout);
+        drjson_ctx_free_all(ctx);
+    }
+    free(doc.text);
+}
+
+// n small documents, each parsed into a fresh context as a request handler
+// would, or into one context that is reset between them.
+static
+void
+bench_requests(const char* name, int n, _Bool reset){
+    if(!bench_enabled(name)) return;
+    static const char doc[] = "{\"user\": \"u1234\", \"action\": \"update\", \"ids\": [1, 2, 3], "
+        "\"opts\": {\"force\": false, \"retries\": 3, \"tag\": \"nightly\"}}";
+    BenchCounts counts = {0};
+    DrJsonAllocator allocator = {
+        .user_pointer = &counts,
+        .alloc = bench_count_alloc,
+        .realloc = bench_count_realloc,
+        .free = bench_count_free,
+    };
+    DrJsonContext* ctx = reset? drjson_create_ctx(allocator) : NULL;
+    double t0 = bench_now();
+    for(int i = 0; i < n; i++){
+        if(!reset) ctx = drjson_create_ctx(allocator);
+        if(!ctx) abort();
+        DrJsonValue v = drjson_parse_string(ctx, doc, sizeof doc - 1, 0);
+        if(v.kind != DRJSON_OBJECT) abort();
+        if(drjson_query(ctx, v, "opts.retries", 12).kind != DRJSON_UINTEGER) abort();
+        if(reset) drjson_ctx_reset(ctx);
+        else drjson_ctx_free_all(ctx);
+    }
+    double t = bench_now() - t0;
+    if(reset) drjson_ctx_free_all(ctx);
+    printf("%-32s %9.1f ns/parse %6.2f allocs/parse %6.2f reallocs/parse\n", name, t * 1e9 / n, (double)counts.allocs / n, (double)counts.reallocs / n);
+    fflush(stdout);
+}
+
+// Allocator calls made by one parse, and what's still allocated after it.
+static
+void
+bench_allocs(const char* name, const BenchBuf* doc, unsigned flags){
+    if(!bench_enabled(name)) return;
+    BenchCounts counts = {0};
+    DrJsonAllocator allocator = {
+        .user_pointer = &counts,
+        .alloc = bench_count_alloc,
+        .realloc = bench_count_realloc,
+        .free = bench_count_free,
+    };
+    DrJsonContext* ctx = drjson_create_ctx(allocator);
+    if(!ctx) abort();
+    DrJsonValue v = drjson_parse_string(ctx, doc->text, doc->length, flags);
+    if(v.kind == DRJSON_ERROR) abort();
+    BenchCounts parsed = counts;
+    drjson_ctx_free_all(ctx);
+    printf("%-32s %9zu allocs %9zu reallocs %9zu frees %9zu KB\n", name, parsed.allocs, parsed.reallocs, counts.frees, parsed.bytes/1024);
+    fflush(stdout);
+}
+
+// Atomizes n distinct keys, then looks each of them up (hits) and then
+// that many that aren't there (misses).
+static
+void
+bench_atoms(const char* name, int n){
+    // Keys are generated up front: "key0", "key1"... then "nokey0"...
+    BenchBuf keys = {0};
+    size_t* offsets = malloc((2*(size_t)n+1) * sizeof *offsets);
+    if(!offsets) abort();
+    for(int i = 0; i < 2*n; i++){
+        offsets[i] = keys.length;
+        bb_printf(&keys, i < n? "key%d" : "nokey%d", i < n? i : i - n);
+    }
+    offsets[2*n] = keys.length;
+    if(bench_enabled(name)){
+        double best = 1e9;
+        size_t iterations = 0;
+        for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+            DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+            double t0 = bench_now();
+            for(int i = 0; i < n; i++){
+                DrJsonAtom a;
+                if(drjson_atomize(ctx, keys.text + offsets[i], offsets[i+1] - offsets[i], &a)) abort();
+            }
+            double t = bench_now() - t0;
+            drjson_ctx_free_all(ctx);
+            if(t < best) best = t;
+        }
+        bench_report(name, 0, best);
+    }
+    // The slowest single insert, which is when the table grows.
+    char worst_name[64];
+    snprintf(worst_name, sizeof worst_name, "%s-worst", name);
+    if(bench_enabled(worst_name)){
+        double best = 1e9;
+        for(int iter = 0; iter < 3; iter++){
+            DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+            double worst = 0;
+            for(int i = 0; i < n; i++){
+                DrJsonAtom a;
+                double t0 = bench_now();
+                if(drjson_atomize(ctx, keys.text + offsets[i], offsets[i+1] - offsets[i], &a)) abort();
+                double t = bench_now() - t0;
+                if(t > worst) worst = t;
+            }
+            drjson_ctx_free_all(ctx);
+            if(worst < best) best = worst;
+        }
+        bench_report(worst_name, 0, best);
+    }
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    for(int i = 0; i < n; i++){
+        DrJsonAtom a;
+        if(drjson_atomize(ctx, keys.text + offsets[i], offsets[i+1] - offsets[i], &a)) abort();
+    }
+    for(int miss = 0; miss < 2; miss++){
+        char sub[64];
+        snprintf(sub, sizeof sub, "%s-%s", name, miss? "miss" : "hit");
+        if(!bench_enabled(sub)) continue;
+        double best = 1e9;
+        size_t iterations = 0;
+        for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+            double t0 = bench_now();
+            for(int i = miss? n : 0; i < (miss? 2*n : n); i++){
+                DrJsonAtom a;
+                if(drjson_get_atom_no_intern(ctx, keys.text + offsets[i], offsets[i+1] - offsets[i], &a) != miss) abort();
+            }
+            double t = bench_now() - t0;
+            if(t < best) best = t;
+        }
+        bench_report(sub, 0, best);
+    }
+    drjson_ctx_free_all(ctx);
+    free(offsets);
+    free(keys.text);
+}
+
+// Looks up every key of an n key object in a scrambled order (hits), then as
+// many keys that are atoms but aren't in the object (misses).
+static
+void
+bench_lookup(const char* name, int n){
+    char hit_name[64], miss_name[64];
+    snprintf(hit_name, sizeof hit_name, "%s-hit", name);
+    snprintf(miss_name, sizeof miss_name, "%s-miss", name);
+    if(!bench_enabled(hit_name) && !bench_enabled(miss_name)) return;
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    DrJsonAtom* atoms = malloc(2*(size_t)n * sizeof *atoms);
+    if(!atoms) abort();
+    DrJsonValue o = drjson_make_object(ctx);
+    for(int i = 0; i < 2*n; i++){
+        char buff[32];
+        int len = snprintf(buff, sizeof buff, i < n? "key%d" : "nokey%d", i < n? i : i - n);
+        if(drjson_atomize(ctx, buff, (size_t)len, &atoms[i])) abort();
+        if(i < n && drjson_object_set_item_atom(ctx, o, atoms[i], drjson_make_int(i))) abort();
+    }
+    uint64_t x = 88172645463325252u;
+    for(int i = n-1; i > 0; i--){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int j = (int)(x % (uint64_t)(i+1));
+        DrJsonAtom t = atoms[i]; atoms[i] = atoms[j]; atoms[j] = t;
+        t = atoms[n+i]; atoms[n+i] = atoms[n+j]; atoms[n+j] = t;
+    }
+    for(int miss = 0; miss < 2; miss++){
+        const char* sub = miss? miss_name : hit_name;
+        if(!bench_enabled(sub)) continue;
+        double best = 1e9;
+        size_t iterations = 0;
+        for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+            double t0 = bench_now();
+            for(int i = miss? n : 0; i < (miss? 2*n : n); i++){
+                DrJsonValue v = drjson_object_get_item_atom(ctx, o, atoms[i]);
+                if((v.kind == DRJSON_ERROR) != miss) abort();
+            }
+            double t = bench_now() - t0;
+            if(t < best) best = t;
+        }
+        bench_report(sub, 0, best);
+    }
+    drjson_ctx_free_all(ctx);
+    free(atoms);
+}
+
+// Deletes every other key of an n key object in a scrambled order, then reads
+// the last key by position, which is where deletes that were put off catch up.
+static
+void
+bench_delete(const char* name, int n){
+    if(!bench_enabled(name)) return;
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    DrJsonAtom* atoms = malloc((size_t)n * sizeof *atoms);
+    if(!atoms) abort();
+    for(int i = 0; i < n; i++){
+        char buff[32];
+        int len = snprintf(buff, sizeof buff, "key%d", i);
+        if(drjson_atomize(ctx, buff, (size_t)len, &atoms[i])) abort();
+    }
+    DrJsonAtom* doomed = malloc((size_t)(n/2) * sizeof *doomed);
+    if(!doomed) abort();
+    for(int i = 0; i < n/2; i++)
+        doomed[i] = atoms[2*i];
+    uint64_t x = 88172645463325252u;
+    for(int i = n/2-1; i > 0; i--){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int j = (int)(x % (uint64_t)(i+1));
+        DrJsonAtom t = doomed[i]; doomed[i] = doomed[j]; doomed[j] = t;
+    }
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonValue o = drjson_make_object(ctx);
+        for(int i = 0; i < n; i++)
+            if(drjson_object_set_item_atom(ctx, o, atoms[i], drjson_make_int(i))) abort();
+        double t0 = bench_now();
+        for(int i = 0; i < n/2; i++)
+            if(drjson_object_delete_item_atom(ctx, o, doomed[i])) abort();
+        DrJsonValue last = drjson_get_by_index(ctx, drjson_object_keys(o), -1);
+        double t = bench_now() - t0;
+        if(last.atom.bits != atoms[n-1].bits) abort();
+        if(t < best) best = t;
+        drjson_gc(ctx, NULL, 0);
+    }
+    bench_report(name, 0, best);
+    drjson_ctx_free_all(ctx);
+    free(doomed);
+    free(atoms);
+}
+
+// Looks up every key of every record in an array of records, plus one
+// that isn't there.
+static
+void
+bench_lookup_records(const char* name, const BenchBuf* doc){
+    if(!bench_enabled(name)) return;
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    DrJsonValue v = drjson_parse_string(ctx, doc->text, doc->length, DRJSON_PARSE_FLAG_NONE);
+    if(v.kind != DRJSON_ARRAY) abort();
+    DrJsonValue keys = drjson_object_keys(drjson_get_by_index(ctx, v, 0));
+    int64_t nkeys = drjson_len(ctx, keys);
+    DrJsonAtom atoms[32];
+    if(nkeys >= 32) abort();
+    for(int64_t k = 0; k < nkeys; k++)
+        atoms[k] = drjson_get_by_index(ctx, keys, k).atom;
+    if(drjson_atomize(ctx, "missing", 7, &atoms[nkeys])) abort();
+    int64_t n = drjson_len(ctx, v);
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        size_t found = 0;
+        double t0 = bench_now();
+        for(int64_t i = 0; i < n; i++){
+            DrJsonValue o = drjson_get_by_index(ctx, v, i);
+            for(int64_t k = 0; k <= nkeys; k++)
+                found += drjson_object_get_item_atom(ctx, o, atoms[k]).kind != DRJSON_ERROR;
+        }
+        double t = bench_now() - t0;
+        if(found != (size_t)(n * nkeys)) abort();
+        if(t < best) best = t;
+    }
+    bench_report(name, 0, best);
+    drjson_ctx_free_all(ctx);
+}
+
+// Checks the document without building it.
+static
+void
+bench_validate(const char* name, const BenchBuf* doc, unsigned flags){
+    if(!bench_enabled(name)) return;
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        double t0 = bench_now();
+        DrJsonErrorCode err = drjson_validate(doc->text, doc->length, flags, NULL, NULL);
+        double t = bench_now() - t0;
+        if(err) abort();
+        if(t < best) best = t;
+    }
+    bench_report(name, doc->length, best);
+}
+
+// Pulls a few fields out of the document, the way a service would.
+static
+void
+bench_project(const char* name, const BenchBuf* doc, const char*const* queries, size_t nqueries){
+    if(!bench_enabled(name)) return;
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+        DrJsonPath paths[8];
+        if(nqueries > 8) abort();
+        for(size_t i = 0; i < nqueries; i++)
+            if(drjson_path_parse_intern(ctx, queries[i], strlen(queries[i]), &paths[i])) abort();
+        double t0 = bench_now();
+        DrJsonParseContext pctx = {
+            .ctx = ctx,
+            .begin = doc->text,
+            .cursor = doc->text,
+            .end = doc->text + doc->length,
+        };
+        DrJsonValue v = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_NONE, paths, nqueries);
+        for(size_t i = 0; i < nqueries; i++)
+            if(drjson_evaluate_path(ctx, v, &paths[i]).kind == DRJSON_ERROR) abort();
+        double t = bench_now() - t0;
+        drjson_ctx_free_all(ctx);
+        if(t < best) best = t;
+    }
+    bench_report(name, doc->length, best);
+}
+
+// Same as bench_parse, but fed to the push parser in fixed size chunks.
+static
+void
+bench_push(const char* name, const BenchBuf* doc, unsigned flags, size_t chunk){
+    if(!bench_enabled(name)) return;
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+        double t0 = bench_now();
+        DrJsonPushParser* p = drjson_push_parser_create(ctx, flags);
+        if(!p) abort();
+        for(size_t offset = 0; offset < doc->length; offset += chunk){
+            size_t n = doc->length - offset < chunk? doc->length - offset : chunk;
+            if(drjson_parse_feed(p, doc->text + offset, n)) abort();
+        }
+        DrJsonValue v = drjson_parse_finish(p);
+        drjson_push_parser_free(p);
+        double t = bench_now() - t0;
+        if(v.kind == DRJSON_ERROR) abort();
+        drjson_ctx_free_all(ctx);
+        if(t < best) best = t;
+    }
+    bench_report(name, doc->length, best);
+}
+
+// Unescapes every string of an array of strings.
+static
+void
+bench_unescape(const char* name, const BenchBuf* doc){
+    if(!bench_enabled(name)) return;
+    DrJsonContext* ctx = drjson_create_ctx(drjson_stdc_allocator());
+    DrJsonValue v = drjson_parse_string(ctx, doc->text, doc->length, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    if(v.kind != DRJSON_ARRAY) abort();
+    int64_t n = drjson_len(ctx, v);
+    char buff[4096];
+    double best = 1e9;
+    size_t iterations = 0;
+    for(double start = bench_now(); iterations < 3 || bench_now() - start < 1.0; iterations++){
+        double t0 = bench_now();
+        for(int64_t i = 0; i < n; i++){
+            size_t len;
+            if(drjson_unescape_string_value(ctx, drjson_get_by_index(ctx, v, i), buff, sizeof buff, &len)) abort();
+        }
+        double t = bench_now() - t0;
+        if(t < best) best = t;
+    }
+    drjson_ctx_free_all(ctx);
+    bench_report(name, doc->length, best);
+}
+
+int
+main(int argc, char** argv){
+    if(argc > 1) bench_filter = argv[1];
+    printf("drjson v%s (%s)\n", DRJSON_VERSION, BENCH_VARIANT);
+    BenchBuf records = {0}, records_pretty = {0}, records_indented = {0}, strings = {0}, strings_pretty = {0};
+    gen_records(&records, 50000);
+    pretty(&records, &records_pretty);
+    reindent(&records_pretty, &records_indented, 8);
+    BenchBuf sparse = {0};
+    gen_sparse(&sparse, 500000);
+    gen_strings(&strings, 50000);
+    pretty(&strings, &strings_pretty);
+    BenchBuf escaped = {0};
+    gen_escaped(&escaped, 50000);
+    BenchBuf wide = {0}, deep = {0};
+    gen_wide(&wide, 1000000);
+    gen_deep(&deep, 20000, 90);
+    BenchBuf big_object = {0};
+    gen_big_object(&big_object, 1000000);
+    BenchBuf ints = {0}, doubles = {0};
+    gen_ints(&ints, 2000000);
+    gen_doubles(&doubles, 2000000);
+
+    bench_parse("parse/records", &records, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/records-pretty", &records_pretty, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/records-indented", &records_indented, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/sparse", &sparse, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/strings", &strings, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/strings-pretty", &strings_pretty, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/records-nocopy", &records, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    bench_parse("parse/strings-escaped", &escaped, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/wide", &wide, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/deep", &deep, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/big-object", &big_object, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/ints", &ints, DRJSON_PARSE_FLAG_NONE);
+    bench_parse("parse/doubles", &doubles, DRJSON_PARSE_FLAG_NONE);
+    // Same documents with the extensions turned off.
+    bench_parse("strict/records", &records, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/records-pretty", &records_pretty, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/records-indented", &records_indented, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/strings", &strings, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/wide", &wide, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/ints", &ints, DRJSON_PARSE_FLAG_STRICT);
+    bench_parse("strict/records-nocopy", &records, DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    bench_roundtrip("roundtrip/doubles", &doubles, DRJSON_PARSE_FLAG_NONE);
+    bench_roundtrip("roundtrip/doubles-lazy", &doubles, DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+    bench_roundtrip("roundtrip/records", &records, DRJSON_PARSE_FLAG_NONE);
+    bench_roundtrip("roundtrip/records-lazy", &records, DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+    bench_gc("gc/records-full", &records, 0, 1);
+    bench_gc("gc/records-step-10k", &records, 10000, 1);
+    bench_gc("gc/records-parallel-2", &records, 0, 2);
+    bench_gc("gc/records-parallel-4", &records, 0, 4);
+    bench_gc("gc/records-parallel-8", &records, 0, 8);
+    bench_compact("compact/records", &records);
+    bench_atom_gc("gc-atoms/1000-rounds", 1000);
+    bench_requests("requests/1M-fresh-ctx", 1000000, 0);
+    bench_requests("requests/1M-reset-ctx", 1000000, 1);
+    bench_atoms("atoms/1M", 1000000);
+    bench_lookup("lookup/1M", 1000000);
+    bench_lookup_records("lookup/records", &records);
+    bench_lookup("lookup/64k", 65536);
+    bench_delete("delete/1M-half", 1000000);
+    bench_delete("delete/64k-half", 65536);
+    bench_allocs("allocs/records", &records, DRJSON_PARSE_FLAG_NONE);
+    bench_allocs("allocs/records-nocopy", &records, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    bench_allocs("allocs/strings", &strings, DRJSON_PARSE_FLAG_NONE);
+    bench_allocs("allocs/big-object", &big_object, DRJSON_PARSE_FLAG_NONE);
+    bench_allocs("allocs/ints", &ints, DRJSON_PARSE_FLAG_NONE);
+    bench_allocs("allocs/doubles", &doubles, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/records", &records, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/records-pretty", &records_pretty, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/strings", &strings, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/wide", &wide, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/big-object", &big_object, DRJSON_PARSE_FLAG_NONE);
+    bench_validate("validate/strict-records", &records, DRJSON_PARSE_FLAG_STRICT);
+    bench_validate("validate/strict-strings", &strings, DRJSON_PARSE_FLAG_STRICT);
+    const char* record_fields[] = {"[0].name", "[25000].address.city", "[49999].tags[1]"};
+    bench_project("project/records", &records, record_fields, sizeof record_fields / sizeof record_fields[0]);
+    bench_project("project/records-pretty", &records_pretty, record_fields, sizeof record_fields / sizeof record_fields[0]);
+    const char* object_fields[] = {"key10", "key500000", "key999999"};
+    bench_project("project/big-object", &big_object, object_fields, sizeof object_fields / sizeof object_fields[0]);
+    bench_unescape("unescape/strings", &strings);
+    bench_unescape("unescape/strings-escaped", &escaped);
+    bench_push("push/records-64k", &records, DRJSON_PARSE_FLAG_NONE, 64*1024);
+    bench_push("push/records-4k", &records, DRJSON_PARSE_FLAG_NONE, 4*1024);
+    bench_push("push/strings-4k", &strings, DRJSON_PARSE_FLAG_NONE, 4*1024);
+
+    free(records.text);
+    free(records_pretty.text);
+    free(records_indented.text);
+    free(sparse.text);
+    free(strings.text);
+    free(strings_pretty.text);
+    free(escaped.text);
+    free(wide.text);
+    free(deep.text);
+    free(big_object.text);
+    free(ints.text);
+    free(doubles.text);
+    return 0;
+}
+
+#ifdef __clang__
+#pragma clang assume_nonnull end
+#endif
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifdef _WIN32
 typedef long long ssize_t;
@@ -21,6 +22,15 @@ typedef long long ssize_t;
 #include <windows.h>
 #endif
 
+#ifndef DRJSON_NO_IO
+#include <errno.h>
+#endif
+#if !defined(DRJSON_NO_IO) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifndef DRJ_HAVE_SIMD
     #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
         #define DRJ_HAVE_SIMD 1
@@ -39,6 +49,19 @@ typedef long long ssize_t;
     #endif
 #endif
 
+// drjson_gc_parallel needs threads. Without them it is drjson_gc.
+#ifndef DRJ_HAVE_THREADS
+    #if defined(_WIN32) || ((defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__) && !defined(__wasm__))
+        #define DRJ_HAVE_THREADS 1
+    #else
+        #define DRJ_HAVE_THREADS 0
+    #endif
+#endif
+#if DRJ_HAVE_THREADS && !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "../compiler_warnings.h"
 #ifndef DRJSON_API
 
@@ -146,18 +169,42 @@ struct DrJsonObjectPair {
 
 typedef struct DrJsonHashIndex DrJsonHashIndex;
 struct DrJsonHashIndex {
-    uint32_t index;
+    uint32_t index; // UINT32_MAX if empty
+    // The key's hash, so probes can skip slots for other keys without
+    // looking at their pairs.
+    uint32_t hash;
 };
 
 // #define DRJ_DEBUG
 
 
+// Parsed objects with the same keys in the same order (records, log lines)
+// share one DrjShape holding the keys and their hash index, so each object
+// only has to store its values. Shapes are deduplicated in the context and
+// live as long as it does.
+typedef struct DrjShape DrjShape;
+struct DrjShape {
+    uint32_t count;
+    uint32_t hash; // of the keys
+    DrJsonAtom keys[]; // then the hash index, if the count needs one
+};
+
+// What a shaped object's object_items points to.
+typedef struct DrjShapedItems DrjShapedItems;
+struct DrjShapedItems {
+    const DrjShape* shape;
+    DrJsonValue values[];
+};
+
 typedef struct DrJsonObject DrJsonObject;
 struct DrJsonObject {
+    // DrJsonObjectPairs followed by their hash index, or DrjShapedItems if
+    // shaped.
     void*_Nullable object_items;
     uint32_t count:31;
     uint32_t marked:1;
-    uint32_t capacity:31;
+    uint32_t capacity:30;
+    uint32_t shaped:1;
     uint32_t read_only:1;
 #ifdef DRJ_DEBUG
     _Bool freed:1;
@@ -166,16 +213,90 @@ struct DrJsonObject {
 
 typedef struct DrJsonArray DrJsonArray;
 struct DrJsonArray {
-    DrJsonValue*_Nullable array_items;
+    // Arrays whose items are all numbers of one kind can store just the
+    // numbers. Then `packed` is that kind (DRJSON_NUMBER, DRJSON_INTEGER or
+    // DRJSON_UINTEGER) and the items are in `numbers`, `integers` or
+    // `uintegers`. Otherwise `packed` is 0 and they are in `array_items`.
+    // The parser makes integers DRJSON_UINTEGER unless they're negative, so
+    // packed integers are the negative DRJSON_INTEGERs and the
+    // DRJSON_UINTEGERs that fit in an int64_t, told apart by their sign.
+    union {
+        DrJsonValue*_Nullable array_items;
+        double*_Nullable numbers;
+        int64_t*_Nullable integers;
+        uint64_t*_Nullable uintegers;
+    };
     uint32_t count:31;
     uint32_t marked:1;
-    uint32_t capacity:31;
+    uint32_t capacity:29;
+    uint32_t packed:2;
     uint32_t read_only:1;
 #ifdef DRJ_DEBUG
     _Bool freed:1;
 #endif
 };
 
+force_inline
+size_t
+drj_array_item_size(const DrJsonArray* array){
+    return array->packed? sizeof(uint64_t) : sizeof(DrJsonValue);
+}
+
+force_inline
+DrJsonValue
+drj_array_get(const DrJsonArray* array, size_t i){
+    switch(array->packed){
+        case DRJSON_NUMBER:   return (DrJsonValue){.kind=DRJSON_NUMBER, .number=array->numbers[i]};
+        case DRJSON_INTEGER:{
+            int64_t integer = array->integers[i];
+            return (DrJsonValue){.kind=integer < 0? DRJSON_INTEGER : DRJSON_UINTEGER, .integer=integer};
+        }
+        case DRJSON_UINTEGER: return (DrJsonValue){.kind=DRJSON_UINTEGER, .uinteger=array->uintegers[i]};
+        default:              return array->array_items[i];
+    }
+}
+
+// Whether a packed array can hold item.
+force_inline
+_Bool
+drj_array_fits(unsigned packed, DrJsonValue item){
+    switch(packed){
+        case DRJSON_NUMBER:   return item.kind == DRJSON_NUMBER;
+        case DRJSON_UINTEGER: return item.kind == DRJSON_UINTEGER;
+        // Negative if and only if DRJSON_INTEGER, without branching on the
+        // sign: mixed signs are as common as not.
+        case DRJSON_INTEGER:  return ((item.kind | 1) == DRJSON_UINTEGER) & ((item.kind == DRJSON_INTEGER) == (item.uinteger >> 63));
+        default:              return 1;
+    }
+}
+
+// Only give a packed array items that fit.
+force_inline
+void
+drj_array_put(DrJsonArray* array, size_t i, DrJsonValue item){
+    switch(array->packed){
+        case DRJSON_NUMBER:   array->numbers[i] = item.number; break;
+        case DRJSON_INTEGER:  array->integers[i] = item.integer; break;
+        case DRJSON_UINTEGER: array->uintegers[i] = item.uinteger; break;
+        default:              array->array_items[i] = item; break;
+    }
+}
+
+// What a packed array of these items would be, or 0 if they can't be.
+static inline
+unsigned
+drj_array_packable(const DrJsonValue* items, size_t count){
+    if(!count) return 0;
+    static const unsigned kinds[] = {DRJSON_NUMBER, DRJSON_UINTEGER, DRJSON_INTEGER};
+    for(size_t k = 0; k < sizeof kinds / sizeof kinds[0]; k++){
+        size_t i = 0;
+        while(i < count && drj_array_fits(kinds[k], items[i]))
+            i++;
+        if(i == count) return kinds[k];
+    }
+    return 0;
+}
+
 force_inline
 uint32_t
 drj_atom_get_hash(DrJsonAtom a){
@@ -197,38 +318,97 @@ drj_make_atom(uint32_t idx, uint32_t hash){
     return (DrJsonAtom){result};
 }
 
-#define ATOM_MAX_LEN (UINT32_MAX/2)
+#define ATOM_MAX_LEN (UINT32_MAX/4)
 
 typedef struct DrjAtomStr DrjAtomStr;
 struct DrjAtomStr {
     uint32_t hash;
-    uint32_t length:31;
-    uint32_t allocated: 1;
+    uint32_t length:30;
+    uint32_t allocated: 1; // copied into the table's string chunks
+    uint32_t escapes: 1; // contains a '\\', so unescaping is not just a copy
     const char* pointer;
 };
 
+// Copied atom strings are bump allocated out of a list of these, and are
+// only freed all at once with the context.
+typedef struct DrjStringChunk DrjStringChunk;
+struct DrjStringChunk {
+    DrjStringChunk*_Nullable next;
+    size_t size; // including this header
+};
+
+enum {
+    DRJ_STRING_CHUNK_MIN = 4096,
+    DRJ_STRING_CHUNK_MAX = 1024*1024,
+};
+
+enum {
+    DRJ_ATOM_GROUP = 16,
+    DRJ_ATOM_EMPTY = 0x80,
+    // Smaller tables are rehashed all at once when they grow.
+    DRJ_ATOM_INCREMENTAL_MIN = 8192,
+};
+
+// The index is probed a group at a time. Each slot's control byte is
+// DRJ_ATOM_EMPTY or 7 bits of its atom's hash, so the DrjAtomStrs are only
+// looked at when those bits match. The control bytes are next to the
+// indexes they guard, so a hit usually costs one cache miss in the index
+// instead of two.
+typedef struct DrjAtomGroup DrjAtomGroup;
+struct DrjAtomGroup {
+    uint8_t ctrl[DRJ_ATOM_GROUP];
+    uint32_t idx[DRJ_ATOM_GROUP];
+};
+
 typedef struct DrjAtomTable DrjAtomTable;
+enum {
+    // Atomizing a string this short first checks a small direct mapped
+    // cache of recent short atoms. Keys and enum-like values ("ok", "US")
+    // repeat a lot, and a hit skips hashing and probing the table. Only
+    // strings the table owns are cached: the bytes behind a no-copy atom
+    // are the caller's, and the cache would go on matching what they were.
+    DRJ_SHORT_ATOM_MAX = 16,
+    DRJ_SHORT_ATOM_CACHE = 256,
+};
+
+typedef struct DrjShortAtom DrjShortAtom;
+struct DrjShortAtom {
+    uint64_t lo, hi; // see drj_short_atom_key
+    DrJsonAtom atom;
+    uint32_t length; // 0 if unused
+};
+
 struct DrjAtomTable {
-    // layout:
-    //      cap x [DrjAtomStr]
-    //      2*cap x [uint32_t idx]
-    void* data;
+    void*_Nullable data; // cap x [DrjAtomStr]
+    DrjAtomGroup*_Nullable groups; // 2*cap/DRJ_ATOM_GROUP
     uint32_t capacity; // in items
     uint32_t count; // in items
+    // Big tables grow incrementally: the previous index is kept until its
+    // groups have all been moved into `groups`, a few per atomize. Lookups
+    // that miss in `groups` check it too. It still points at the same
+    // DrjAtomStrs, so its entries stay valid whether moved yet or not.
+    DrjAtomGroup*_Nullable old_groups;
+    uint32_t old_ngroups;
+    uint32_t migrated; // old groups moved so far
+    // While growing, which of `groups` have had their control bytes set.
+    // Other groups are empty. This way growing doesn't have to touch the
+    // whole new index at once.
+    uint64_t*_Nullable ready;
+    uint32_t init_cursor; // groups before this are all ready
+    DrjStringChunk*_Nullable chunks; // newest first
+    char*_Nullable string_cursor; // free space in chunks
+    size_t string_remaining;
+    // Chunks emptied by drjson_ctx_reset, used again before new ones are
+    // allocated.
+    DrjStringChunk*_Nullable spare_chunks;
+    DrjShortAtom short_atoms[DRJ_SHORT_ATOM_CACHE];
 };
 
-static inline
-void
-drj_atom_table_get_ptrs(void* p, size_t capacity, DrjAtomStr*_Nullable*_Nonnull atomstrs, uint32_t*_Nullable*_Nonnull idxes){
-    *atomstrs = p;
-    *idxes = (uint32_t*)(((char*)p) + capacity * sizeof(DrjAtomStr));
-}
-
+// Bytes used, for reporting.
 static inline
 size_t
 drj_atom_table_size_for(size_t cap){
-    // XXX: alignment
-    return cap * sizeof(DrjAtomStr)+ 2 * cap*sizeof(uint32_t);
+    return cap * sizeof(DrjAtomStr) + 2*cap/DRJ_ATOM_GROUP * sizeof(DrjAtomGroup);
 }
 
 static inline
@@ -238,7 +418,6 @@ drj_get_atom_str(const DrjAtomTable* table, DrJsonAtom a){
     return strs[drj_atom_get_idx(a)];
 }
 
-
 force_inline
 uint32_t
 drj_hash_str(const char* key, size_t keylen){
@@ -247,112 +426,440 @@ drj_hash_str(const char* key, size_t keylen){
     return h;
 }
 
+force_inline
+unsigned
+drj_ctz64(uint64_t x){
+    #if defined(__GNUC__) || defined(__clang__)
+        return (unsigned)__builtin_ctzll(x);
+    #elif defined(_MSC_VER) && defined(_WIN64)
+        unsigned long idx;
+        _BitScanForward64(&idx, x);
+        return (unsigned)idx;
+    #else
+        unsigned n = 0;
+        while(!(x & 1)){
+            x >>= 1;
+            n++;
+        }
+        return n;
+    #endif
+}
+
+force_inline
+uint8_t
+drj_atom_tag(uint32_t hash){
+    return hash & 0x7f;
+}
+
+// Bit i is set if byte i of the group is b.
+force_inline
+uint32_t
+drj_atom_group_match(const uint8_t* group, uint8_t b){
+    #if DRJ_HAVE_SIMD && (defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__)))
+        __m128i g = _mm_loadu_si128((const __m128i*)group);
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+    #elif DRJ_HAVE_SIMD && defined(__aarch64__)
+        const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(group), vdupq_n_u8(b)), bits);
+        return vaddv_u8(vget_low_u8(m)) | (uint32_t)vaddv_u8(vget_high_u8(m)) << 8;
+    #elif DRJ_HAVE_SIMD && defined(__wasm_simd128__)
+        return wasm_i8x16_bitmask(wasm_i8x16_eq(wasm_v128_load(group), wasm_i8x16_splat((int8_t)b)));
+    #else
+        uint32_t m = 0;
+        for(int i = 0; i < DRJ_ATOM_GROUP; i++)
+            m |= (uint32_t)(group[i] == b) << i;
+        return m;
+    #endif
+}
+
+force_inline
+_Bool
+drj_atom_group_ready(const uint64_t*_Nullable ready, uint32_t g){
+    return !ready || (ready[g/64] >> (g%64) & 1);
+}
+
+static inline
+void
+drj_atom_group_init(DrjAtomTable* table, uint32_t g){
+    drj_memset(table->groups[g].ctrl, DRJ_ATOM_EMPTY, DRJ_ATOM_GROUP);
+    table->ready[g/64] |= (uint64_t)1 << (g%64);
+}
+
+// Probes one index for str. If it isn't there, returns UINT32_MAX and sets
+// *slot to where it would go. `ready` is as in DrjAtomTable.
+force_inline
+uint32_t
+drj_atom_probe(const DrjAtomStr* strs, const DrjAtomGroup* groups, uint32_t ngroups, const uint64_t*_Nullable ready, const char* str, uint32_t len, uint32_t hash, uint32_t* slot){
+    uint8_t tag = drj_atom_tag(hash);
+    uint32_t g = fast_reduce32(hash, ngroups);
+    for(;;){
+        if(unlikely(!drj_atom_group_ready(ready, g))){
+            *slot = g*DRJ_ATOM_GROUP;
+            return UINT32_MAX;
+        }
+        const DrjAtomGroup* group = &groups[g];
+        for(uint32_t m = drj_atom_group_match(group->ctrl, tag); m; m &= m - 1){
+            uint32_t i = group->idx[drj_ctz64(m)];
+            const DrjAtomStr* a = &strs[i];
+            if(a->hash == hash && a->length == len && memcmp(str, a->pointer, len) == 0)
+                return i;
+        }
+        // Nothing is ever removed, so an empty slot ends the probe.
+        uint32_t empty = drj_atom_group_match(group->ctrl, DRJ_ATOM_EMPTY);
+        if(empty){
+            *slot = g*DRJ_ATOM_GROUP + (uint32_t)drj_ctz64(empty);
+            return UINT32_MAX;
+        }
+        g++;
+        if(g == ngroups) g = 0;
+    }
+}
+
+// Finds the atom for str. If there isn't one, returns UINT32_MAX and sets
+// *slot to where it would go.
+force_inline
+uint32_t
+drj_atom_find(const DrjAtomTable* table, const char* str, uint32_t len, uint32_t hash, uint32_t* slot){
+    const DrjAtomStr* strs = table->data;
+    uint32_t i = drj_atom_probe(strs, table->groups, 2*table->capacity/DRJ_ATOM_GROUP, table->ready, str, len, hash, slot);
+    if(i == UINT32_MAX && unlikely(table->old_groups != NULL)){
+        uint32_t old_slot;
+        i = drj_atom_probe(strs, table->old_groups, table->old_ngroups, NULL, str, len, hash, &old_slot);
+    }
+    return i;
+}
+
+// Puts atom i in the first empty slot of its probe sequence.
+static inline
+void
+drj_atom_table_place(DrjAtomTable* table, uint32_t slot, uint32_t hash, uint32_t i){
+    DrjAtomGroup* group = &table->groups[slot / DRJ_ATOM_GROUP];
+    if(!drj_atom_group_ready(table->ready, slot / DRJ_ATOM_GROUP))
+        drj_atom_group_init(table, slot / DRJ_ATOM_GROUP);
+    group->ctrl[slot % DRJ_ATOM_GROUP] = drj_atom_tag(hash);
+    group->idx[slot % DRJ_ATOM_GROUP] = i;
+}
+
+static inline
+void
+drj_atom_table_reinsert(DrjAtomTable* table, uint32_t hash, uint32_t i){
+    uint32_t ngroups = 2*table->capacity/DRJ_ATOM_GROUP;
+    uint32_t g = fast_reduce32(hash, ngroups);
+    for(;;){
+        if(!drj_atom_group_ready(table->ready, g)){
+            drj_atom_table_place(table, g*DRJ_ATOM_GROUP, hash, i);
+            return;
+        }
+        uint32_t empty = drj_atom_group_match(table->groups[g].ctrl, DRJ_ATOM_EMPTY);
+        if(empty){
+            drj_atom_table_place(table, g*DRJ_ATOM_GROUP + (uint32_t)drj_ctz64(empty), hash, i);
+            return;
+        }
+        g++;
+        if(g == ngroups) g = 0;
+    }
+}
+
+// Moves `steps` groups of the old index into the new one. The new index
+// has twice as many groups, so two of those get their control bytes set
+// per step as well and both finish together.
+static
+void
+drj_atom_table_migrate(DrjAtomTable* table, const DrJsonAllocator* allocator, uint32_t steps){
+    const DrjAtomStr* strs = table->data;
+    uint32_t ngroups = 2*table->capacity/DRJ_ATOM_GROUP;
+    for(; steps; steps--){
+        if(table->migrated < table->old_ngroups){
+            const DrjAtomGroup* old = &table->old_groups[table->migrated++];
+            for(uint32_t m = ~drj_atom_group_match(old->ctrl, DRJ_ATOM_EMPTY) & 0xffffu; m; m &= m - 1){
+                uint32_t i = old->idx[drj_ctz64(m)];
+                drj_atom_table_reinsert(table, strs[i].hash, i);
+            }
+        }
+        for(int k = 0; k < 2 && table->init_cursor < ngroups; k++, table->init_cursor++)
+            if(!drj_atom_group_ready(table->ready, table->init_cursor))
+                drj_atom_group_init(table, table->init_cursor);
+        if(table->migrated == table->old_ngroups && table->init_cursor == ngroups){
+            allocator->free(allocator->user_pointer, table->old_groups, table->old_ngroups * sizeof(DrjAtomGroup));
+            allocator->free(allocator->user_pointer, table->ready, (ngroups+63)/64 * sizeof(uint64_t));
+            table->old_groups = NULL;
+            table->ready = NULL;
+            table->old_ngroups = 0;
+            return;
+        }
+    }
+}
+
 static inline
 int
 drj_grow_atom_table(DrjAtomTable* table, const DrJsonAllocator* allocator){
+    if(table->old_groups)
+        drj_atom_table_migrate(table, allocator, UINT32_MAX);
     size_t old_cap = table->capacity;
     uint32_t count = table->count;
-    size_t new_cap = old_cap * 2;
-    void* p = allocator->realloc(allocator->user_pointer, table->data, drj_atom_table_size_for(old_cap), drj_atom_table_size_for(new_cap));
-    if(!p) return 1;
-    DrjAtomStr* strs; uint32_t* idxes;
-    drj_atom_table_get_ptrs(p, new_cap, &strs, &idxes);
-    drj_memset(idxes, 0xff, 2*new_cap * sizeof *idxes);
-    for(uint32_t i = 0; i < count; i++){
-        const DrjAtomStr* s = &strs[i];
-        uint32_t hash = s->hash;
-        uint32_t idx = fast_reduce32(hash, (uint32_t)(2*new_cap));
-        while(idxes[idx] != UINT32_MAX){
-            idx++;
-            if(idx >= 2*new_cap) idx = 0;
+    // The first table has 4 groups.
+    size_t new_cap = old_cap? old_cap * 2 : 32;
+    uint32_t old_ngroups = (uint32_t)(2*old_cap / DRJ_ATOM_GROUP);
+    uint32_t ngroups = (uint32_t)(2*new_cap / DRJ_ATOM_GROUP);
+    _Bool incremental = new_cap > DRJ_ATOM_INCREMENTAL_MIN;
+    DrjAtomGroup* groups = allocator->alloc(allocator->user_pointer, ngroups * sizeof *groups);
+    if(!groups) return 1;
+    uint64_t* ready = NULL;
+    if(incremental){
+        ready = allocator->alloc(allocator->user_pointer, (ngroups+63)/64 * sizeof *ready);
+        if(!ready){
+            allocator->free(allocator->user_pointer, groups, ngroups * sizeof *groups);
+            return 1;
         }
-        idxes[idx] = i;
+        drj_memset(ready, 0, (ngroups+63)/64 * sizeof *ready);
+    }
+    // The atoms themselves still move at once, but that's a realloc, which
+    // for big tables is usually remapping pages rather than copying.
+    void* p = old_cap
+        ? allocator->realloc(allocator->user_pointer, table->data, old_cap * sizeof(DrjAtomStr), new_cap * sizeof(DrjAtomStr))
+        : allocator->alloc(allocator->user_pointer, new_cap * sizeof(DrjAtomStr));
+    if(!p){
+        if(ready) allocator->free(allocator->user_pointer, ready, (ngroups+63)/64 * sizeof *ready);
+        allocator->free(allocator->user_pointer, groups, ngroups * sizeof *groups);
+        return 1;
     }
     table->data = p;
+    DrjAtomGroup* old_groups = table->groups;
+    table->groups = groups;
     table->capacity = (uint32_t)new_cap;
+    if(incremental){
+        table->ready = ready;
+        table->init_cursor = 0;
+        table->old_groups = old_groups;
+        table->old_ngroups = old_ngroups;
+        table->migrated = 0;
+        return 0;
+    }
+    for(uint32_t g = 0; g < ngroups; g++)
+        drj_memset(groups[g].ctrl, DRJ_ATOM_EMPTY, sizeof groups[g].ctrl);
+    const DrjAtomStr* strs = p;
+    for(uint32_t i = 0; i < count; i++)
+        drj_atom_table_reinsert(table, strs[i].hash, i);
+    if(old_groups)
+        allocator->free(allocator->user_pointer, old_groups, old_ngroups * sizeof *old_groups);
     return 0;
 }
 
+// Copies an atom's string into the table's chunks.
+static inline
+const char*_Nullable
+drj_atom_copy_str(DrjAtomTable* table, const DrJsonAllocator* allocator, const char* str, size_t len){
+    DrjStringChunk* spare = table->spare_chunks;
+    if(unlikely(len > table->string_remaining) && spare && len <= spare->size - sizeof *spare){
+        table->spare_chunks = spare->next;
+        spare->next = table->chunks;
+        table->chunks = spare;
+        table->string_cursor = (char*)(spare + 1);
+        table->string_remaining = spare->size - sizeof *spare;
+    }
+    if(unlikely(len > table->string_remaining)){
+        size_t size = table->chunks? table->chunks->size * 2 : DRJ_STRING_CHUNK_MIN;
+        if(size > DRJ_STRING_CHUNK_MAX) size = DRJ_STRING_CHUNK_MAX;
+        // Big strings get a chunk of their own, which goes behind the
+        // current one so its free space isn't wasted.
+        _Bool alone = len > size / 4;
+        if(alone) size = sizeof(DrjStringChunk) + len;
+        DrjStringChunk* chunk = allocator->alloc(allocator->user_pointer, size);
+        if(!chunk) return NULL;
+        chunk->size = size;
+        char* data = (char*)(chunk + 1);
+        if(alone && table->chunks){
+            chunk->next = table->chunks->next;
+            table->chunks->next = chunk;
+            drj_memcpy(data, str, len);
+            return data;
+        }
+        chunk->next = table->chunks;
+        table->chunks = chunk;
+        table->string_cursor = data;
+        table->string_remaining = size - sizeof *chunk;
+    }
+    char* p = table->string_cursor;
+    drj_memcpy(p, str, len);
+    table->string_cursor = p + len;
+    table->string_remaining -= len;
+    return p;
+}
+
+static inline
+void
+drj_atom_table_free(DrjAtomTable* table, const DrJsonAllocator* allocator){
+    for(DrjStringChunk* chunk = table->chunks; chunk;){
+        DrjStringChunk* next = chunk->next;
+        allocator->free(allocator->user_pointer, chunk, chunk->size);
+        chunk = next;
+    }
+    for(DrjStringChunk* chunk = table->spare_chunks; chunk;){
+        DrjStringChunk* next = chunk->next;
+        allocator->free(allocator->user_pointer, chunk, chunk->size);
+        chunk = next;
+    }
+    uint32_t ngroups = 2*table->capacity/DRJ_ATOM_GROUP;
+    if(table->old_groups){
+        allocator->free(allocator->user_pointer, table->old_groups, table->old_ngroups * sizeof(DrjAtomGroup));
+        allocator->free(allocator->user_pointer, table->ready, (ngroups+63)/64 * sizeof(uint64_t));
+    }
+    if(table->capacity){
+        allocator->free(allocator->user_pointer, table->groups, ngroups * sizeof(DrjAtomGroup));
+        allocator->free(allocator->user_pointer, table->data, table->capacity * sizeof(DrjAtomStr));
+    }
+    *table = (DrjAtomTable){0};
+}
+
+// Packs a string of 1 to DRJ_SHORT_ATOM_MAX bytes into two words. Together
+// with the length, they are the whole string: longer strings overlap their
+// first and last 8 (or 4) bytes, strings under 4 bytes take 3 of them.
+force_inline
+DrjShortAtom*
+drj_short_atom_key(DrjAtomTable* table, const char* str, uint32_t len, uint64_t* lo, uint64_t* hi){
+    if(len >= 8){
+        drj_memcpy(lo, str, 8);
+        drj_memcpy(hi, str+len-8, 8);
+    }
+    else if(len >= 4){
+        uint32_t a, b;
+        drj_memcpy(&a, str, 4);
+        drj_memcpy(&b, str+len-4, 4);
+        *lo = a | (uint64_t)b << 32;
+        *hi = 0;
+    }
+    else {
+        *lo = (uint64_t)(unsigned char)str[0] | (uint64_t)(unsigned char)str[len/2] << 8 | (uint64_t)(unsigned char)str[len-1] << 16;
+        *hi = 0;
+    }
+    uint64_t h = (*lo ^ (*hi + len) * 0x9e3779b97f4a7c15u) * 0x9e3779b97f4a7c15u;
+    return &table->short_atoms[h >> 56];
+}
+
+// Forgets every atom from `keep` on, but keeps the index and the string
+// chunks. The atoms kept mustn't have been copied into the chunks. When
+// there were only a few atoms, just their slots in the index and the short
+// atom cache are emptied, so resetting a context that was used for
+// something small costs little even if its table is big.
+static inline
+void
+drj_atom_table_reset(DrjAtomTable* table, const DrJsonAllocator* allocator, uint32_t keep){
+    uint32_t ngroups = 2*table->capacity/DRJ_ATOM_GROUP;
+    const DrjAtomStr* strs = table->data;
+    uint32_t count = table->count;
+    if(table->old_groups || count - keep > ngroups/4){
+        if(table->old_groups){
+            allocator->free(allocator->user_pointer, table->old_groups, table->old_ngroups * sizeof(DrjAtomGroup));
+            allocator->free(allocator->user_pointer, table->ready, (ngroups+63)/64 * sizeof(uint64_t));
+            table->old_groups = NULL;
+            table->ready = NULL;
+            table->old_ngroups = 0;
+        }
+        for(uint32_t g = 0; g < ngroups; g++)
+            drj_memset(table->groups[g].ctrl, DRJ_ATOM_EMPTY, sizeof table->groups[g].ctrl);
+        for(uint32_t i = 0; i < keep; i++)
+            drj_atom_table_reinsert(table, strs[i].hash, i);
+    }
+    else {
+        // The atoms kept were there first, so they come before the ones
+        // going in any probe sequence and removing those leaves no holes
+        // in theirs.
+        for(uint32_t i = keep; i < count; i++){
+            for(uint32_t g = fast_reduce32(strs[i].hash, ngroups);; g = g + 1 == ngroups? 0 : g + 1){
+                DrjAtomGroup* group = &table->groups[g];
+                uint32_t m = drj_atom_group_match(group->ctrl, drj_atom_tag(strs[i].hash));
+                for(; m; m &= m - 1)
+                    if(group->idx[drj_ctz64(m)] == i)
+                        break;
+                if(m){
+                    group->ctrl[drj_ctz64(m)] = DRJ_ATOM_EMPTY;
+                    break;
+                }
+            }
+        }
+    }
+    if(count - keep > DRJ_SHORT_ATOM_CACHE/4)
+        drj_memset(table->short_atoms, 0, sizeof table->short_atoms);
+    else {
+        for(uint32_t i = keep; i < count; i++){
+            uint32_t len = strs[i].length;
+            if(!strs[i].allocated || len > DRJ_SHORT_ATOM_MAX) continue;
+            uint64_t lo, hi;
+            DrjShortAtom* short_atom = drj_short_atom_key(table, strs[i].pointer, len, &lo, &hi);
+            if(short_atom->length && drj_atom_get_idx(short_atom->atom) == i)
+                short_atom->length = 0;
+        }
+    }
+    table->count = keep;
+    if(table->chunks){
+        DrjStringChunk* last = table->chunks;
+        while(last->next) last = last->next;
+        last->next = table->spare_chunks;
+        table->spare_chunks = table->chunks;
+        table->chunks = NULL;
+    }
+    table->string_cursor = NULL;
+    table->string_remaining = 0;
+}
+
+// `escapes` is whether str contains a backslash, or -1 if the caller
+// doesn't know. It is only looked at (or worked out) for new atoms.
 static inline
 int
-drj_atomize_str(DrjAtomTable* table, const DrJsonAllocator* allocator, const char* str, uint32_t len, _Bool copy, DrJsonAtom* outatom){
+drj_atomize_str_escapes(DrjAtomTable* table, const DrJsonAllocator* allocator, const char* str, uint32_t len, _Bool copy, int escapes, DrJsonAtom* outatom){
     if(unlikely(!len)) str = "";
-    uint32_t hash = drj_hash_str(str, len);
-    if(unlikely(!table->count)){
-        assert(!table->capacity);
-        assert(!table->data);
-        enum {capacity = 32};
-        void* p = allocator->alloc(allocator->user_pointer, drj_atom_table_size_for(capacity));
-        if(!p) return 1;
-        DrjAtomStr* strs; uint32_t* idxes;
-        drj_atom_table_get_ptrs(p, capacity, &strs, &idxes);
-        drj_memset(idxes, 0xff, 2*capacity * sizeof*idxes);
-        table->data = p;
-        table->capacity = capacity;
-        uint32_t idx = fast_reduce32(hash, 2*capacity);
-        _Bool copied = 0;
-        if(copy && len){
-            // XXX: use a string arena
-            char* p = allocator->alloc(allocator->user_pointer, len);
-            if(!p){
-                allocator->free(allocator->user_pointer, p,drj_atom_table_size_for(capacity) );
-                table->data = NULL;
-                table->capacity = 0;
-                return 1;
-            }
-            drj_memcpy(p, str, len);
-            str = p;
-            copied = 1;
-        }
-        strs[table->count] = (DrjAtomStr){
-            .hash = hash,
-            .length = len,
-            .allocated = copied,
-            .pointer = str,
-        };
-        *outatom = drj_make_atom(table->count, hash);
-        idxes[idx] = table->count++;
-        return 0;
+    uint64_t lo = 0, hi = 0;
+    DrjShortAtom* short_atom = NULL;
+    if(len - 1u < DRJ_SHORT_ATOM_MAX){
+        short_atom = drj_short_atom_key(table, str, len, &lo, &hi);
+        if(short_atom->lo == lo && short_atom->hi == hi && short_atom->length == len){
+            *outatom = short_atom->atom;
+            return 0;
+        }
     }
+    uint32_t hash = drj_hash_str(str, len);
     if(unlikely(table->count >= table->capacity)){
         int err = drj_grow_atom_table(table, allocator);
         if(unlikely(err)) return err;
     }
-    uint32_t capacity = table->capacity;
-    uint32_t bounds = 2*capacity;
-    uint32_t idx = fast_reduce32(hash, bounds);
-    DrjAtomStr* strs; uint32_t* idxes;
-    drj_atom_table_get_ptrs(table->data, capacity, &strs, &idxes);
-    for(;;){
-        uint32_t i = idxes[idx];
-        if(i == UINT32_MAX){ // unset
-            _Bool copied = 0;
-            if(copy && len){
-                // XXX: use a string arena
-                char* p = allocator->alloc(allocator->user_pointer, len);
-                if(!p) return 1;
-                drj_memcpy(p, str, len);
-                str = p;
-                copied = 1;
-            }
-            strs[table->count] = (DrjAtomStr){
-                .hash = hash,
-                .length = len,
-                .pointer = str,
-                .allocated = copied,
-            };
-            *outatom = drj_make_atom(table->count, hash);
-            idxes[idx] = table->count++;
-            return 0;
-        }
-        DrjAtomStr a = strs[i];
-        if(a.hash == hash && a.length == len && memcmp(str, a.pointer, len) == 0){
-            *outatom = drj_make_atom(i, hash);
-            return 0;
-        }
-        idx++;
-        if(idx >= bounds) idx = 0;
+    else if(unlikely(table->old_groups != NULL))
+        drj_atom_table_migrate(table, allocator, 1);
+    uint32_t slot = 0;
+    uint32_t i = drj_atom_find(table, str, len, hash, &slot);
+    if(i != UINT32_MAX){
+        *outatom = drj_make_atom(i, hash);
+        if(short_atom && ((const DrjAtomStr*)table->data)[i].allocated)
+            *short_atom = (DrjShortAtom){lo, hi, *outatom, len};
+        return 0;
     }
+    _Bool copied = 0;
+    if(copy && len){
+        const char* dup = drj_atom_copy_str(table, allocator, str, len);
+        if(!dup) return 1;
+        str = dup;
+        copied = 1;
+    }
+    if(escapes < 0)
+        escapes = len && memchr(str, '\\', len);
+    DrjAtomStr* strs = table->data;
+    strs[table->count] = (DrjAtomStr){
+        .hash = hash,
+        .length = len,
+        .pointer = str,
+        .allocated = copied,
+        .escapes = escapes,
+    };
+    drj_atom_table_place(table, slot, hash, table->count);
+    *outatom = drj_make_atom(table->count++, hash);
+    if(short_atom && copied)
+        *short_atom = (DrjShortAtom){lo, hi, *outatom, len};
+    return 0;
+}
+
+static inline
+int
+drj_atomize_str(DrjAtomTable* table, const DrJsonAllocator* allocator, const char* str, uint32_t len, _Bool copy, DrJsonAtom* outatom){
+    return drj_atomize_str_escapes(table, allocator, str, len, copy, -1, outatom);
 }
 
 static inline
@@ -361,25 +868,12 @@ drj_get_atom_no_alloc(const DrjAtomTable* table, const char* str, uint32_t len,
     if(!table->count)
         return 1;
     uint32_t hash = drj_hash_str(str, len);
-    uint32_t capacity = table->capacity;
-    uint32_t idx = fast_reduce32(hash, 2*capacity);
-    DrjAtomStr* strs; uint32_t* idxes;
-    drj_atom_table_get_ptrs(table->data, capacity, &strs, &idxes);
-    for(;;idx++){
-        if(idx >= 2*capacity) idx = 0;
-        uint32_t i = idxes[idx];
-        if(i == UINT32_MAX) // unset
-            return 1;
-        DrjAtomStr a = strs[i];
-        if(a.hash != hash)
-            continue;
-        if(a.length != len)
-            continue;
-        if(memcmp(str, a.pointer, len) == 0){
-            *outatom = drj_make_atom(i, hash);
-            return 0;
-        }
-    }
+    uint32_t slot;
+    uint32_t i = drj_atom_find(table, str, len, hash, &slot);
+    if(i == UINT32_MAX)
+        return 1;
+    *outatom = drj_make_atom(i, hash);
+    return 0;
 }
 
 typedef struct DrjHashIdx DrjHashIdx;
@@ -388,6 +882,20 @@ struct DrjHashIdx {
     uint32_t idx;
 };
 
+// A file loaded by drjson_ctx_map_file.
+typedef struct DrjFileData DrjFileData;
+struct DrjFileData {
+    void* data;
+    size_t size;
+    _Bool mapped; // otherwise read into memory from the allocator
+};
+
+enum {
+    DRJ_GC_IDLE,
+    DRJ_GC_MARK,
+    DRJ_GC_SWEEP,
+};
+
 struct DrJsonContext {
     DrJsonAllocator allocator;
     DrjAtomTable atoms;
@@ -420,6 +928,30 @@ struct DrJsonContext {
         DrJsonAtom values;
         DrJsonAtom items;
     } magic_keys;
+    // Files the parsed strings may point into.
+    struct {
+        DrjFileData* data;
+        size_t count;
+        size_t capacity;
+    } files;
+    // Open addressed by the hash of the keys, NULL if empty.
+    struct {
+        DrjShape*_Nullable*_Nullable data;
+        size_t count;
+        size_t capacity;
+    } shapes;
+    // The collection drjson_gc_step is part way through. Marked containers
+    // are either gray (in `gray`, children not scanned yet) or black.
+    struct {
+        size_t*_Nullable gray; // index << 1 | is_array
+        size_t count;
+        size_t capacity;
+        size_t sweep_objects; // sweeping counts these down to 0
+        size_t sweep_arrays;
+        size_t allocated; // containers made since the last step, while marking
+        int phase;
+        _Bool overflowed; // gray didn't grow, so marking must be redone
+    } gc;
 };
 
 static inline
@@ -498,17 +1030,11 @@ drjson_atomize_no_copy(DrJsonContext* ctx, const char* str, size_t len, DrJsonAt
     return drj_atomize_str(&ctx->atoms, &ctx->allocator, str, (uint32_t)len, 0, outatom);
 }
 
-DRJSON_API
-DRJSON_WARN_UNUSED
-DrJsonContext*_Nullable
-drjson_create_ctx(DrJsonAllocator allocator){
-    DrJsonContext* ctx = allocator.alloc(allocator.user_pointer, sizeof *ctx);
-    if(!ctx) return NULL;
-    drj_memset(ctx, 0, sizeof *ctx);
-    ctx->allocator = allocator;
-
-    // Pre-atomize magic keys for allocation-free queries
-    // However, it's ok if they fail.
+// Pre-atomize magic keys for allocation-free queries
+// However, it's ok if they fail.
+static
+void
+drj_atomize_magic_keys(DrJsonContext* ctx){
     int err;
     err = DRJSON_ATOMIZE(ctx, "length", &ctx->magic_keys.length);
     (void)err;
@@ -518,14 +1044,41 @@ drjson_create_ctx(DrJsonAllocator allocator){
     (void)err;
     err = DRJSON_ATOMIZE(ctx, "items", &ctx->magic_keys.items);
     (void)err;
+}
 
+DRJSON_API
+DRJSON_WARN_UNUSED
+DrJsonContext*_Nullable
+drjson_create_ctx(DrJsonAllocator allocator){
+    DrJsonContext* ctx = allocator.alloc(allocator.user_pointer, sizeof *ctx);
+    if(!ctx) return NULL;
+    drj_memset(ctx, 0, sizeof *ctx);
+    ctx->allocator = allocator;
+    drj_atomize_magic_keys(ctx);
     return ctx;
 }
 
+enum {
+    // Objects with at most this capacity have no hash index after their
+    // pairs; their keys are just scanned. Most objects are records with a
+    // handful of keys, where the scan is as fast as hashing and the index
+    // would be a third of the allocation.
+    DRJ_OBJECT_LINEAR_MAX = 8,
+};
+
+force_inline
+_Bool
+drj_obj_has_index(size_t cap){
+    return cap > DRJ_OBJECT_LINEAR_MAX;
+}
+
 static inline
 size_t
 drjson_size_for_object_of_length(size_t len){
-    return len * sizeof(DrJsonObjectPair) + 2*len*sizeof(DrJsonHashIndex);
+    if(!drj_obj_has_index(len))
+        return len * sizeof(DrJsonObjectPair);
+    // The word after the index counts the pairs' tombstones.
+    return len * sizeof(DrJsonObjectPair) + 2*len*sizeof(DrJsonHashIndex) + sizeof(uint32_t);
 }
 
 force_inline
@@ -548,6 +1101,280 @@ drj_obj_get_idxes(void* p, size_t cap){
     return (DrJsonHashIndex*)(((char*)p)+cap*sizeof(DrJsonObjectPair));
 }
 
+// Deleting a key from an object with a hash index overwrites its pair with a
+// tombstone instead of shifting down every later pair and renumbering the
+// index. Readers skip tombstones, as they may be sharing the context with
+// other readers; they are squeezed out once they are most of the pairs, or
+// before anything else changes the object.
+#define DRJ_TOMBSTONE UINT64_MAX
+
+force_inline
+uint32_t*
+drj_obj_get_tombstones(void* p, size_t cap){
+    return (uint32_t*)(((char*)p)+cap*sizeof(DrJsonObjectPair)+2*cap*sizeof(DrJsonHashIndex));
+}
+
+force_inline
+uint32_t
+drj_obj_tombstone_count(const DrJsonObject* object){
+    if(object->shaped || !drj_obj_has_index(object->capacity))
+        return 0;
+    return *drj_obj_get_tombstones(object->object_items, object->capacity);
+}
+
+// The number of keys, as opposed to the number of pairs.
+force_inline
+uint32_t
+drj_obj_len(const DrJsonObject* object){
+    return object->count - drj_obj_tombstone_count(object);
+}
+
+// For objects without a hash index.
+force_inline
+uint32_t
+drj_obj_find_linear(const DrJsonObjectPair* pairs, uint32_t count, DrJsonAtom atom){
+    for(uint32_t i = 0; i < count; i++)
+        if(pairs[i].atom.bits == atom.bits)
+            return i;
+    return UINT32_MAX;
+}
+
+static inline
+void
+drj_obj_rebuild_index(DrJsonHashIndex* idxes, const DrJsonObjectPair* pairs, uint32_t count, uint32_t cap){
+    drj_memset(idxes, 0xff, 2*cap * sizeof *idxes);
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t hash = drj_atom_get_hash(pairs[i].atom);
+        uint32_t idx = fast_reduce32(hash, 2*cap);
+        while(idxes[idx].index != UINT32_MAX){
+            idx++;
+            if(idx >= 2*cap) idx = 0;
+        }
+        idxes[idx] = (DrJsonHashIndex){i, hash};
+    }
+    *(uint32_t*)(idxes + 2*cap) = 0;
+}
+
+static
+void
+drj_obj_compact(DrJsonObject* object){
+    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < object->count; i++){
+        if(pairs[i].atom.bits == DRJ_TOMBSTONE) continue;
+        if(n != i) pairs[n] = pairs[i];
+        n++;
+    }
+    object->count = n;
+    drj_obj_rebuild_index(idxes, pairs, n, object->capacity);
+}
+
+enum {
+    // Objects with more keys than this are rarely repeated, so they aren't
+    // worth looking up a shape for.
+    DRJ_SHAPE_MAX_KEYS = 64,
+};
+
+static inline
+size_t
+drj_shape_size(size_t count){
+    size_t size = sizeof(DrjShape) + count * sizeof(DrJsonAtom);
+    if(drj_obj_has_index(count))
+        size += 2*count * sizeof(DrJsonHashIndex);
+    return size;
+}
+
+force_inline
+DrJsonHashIndex*
+drj_shape_idxes(const DrjShape* shape){
+    return (DrJsonHashIndex*)(shape->keys + shape->count);
+}
+
+// Returns the key's position, or UINT32_MAX.
+force_inline
+uint32_t
+drj_shape_find(const DrjShape* shape, DrJsonAtom atom){
+    uint32_t count = shape->count;
+    if(!drj_obj_has_index(count)){
+        for(uint32_t i = 0; i < count; i++)
+            if(shape->keys[i].bits == atom.bits)
+                return i;
+        return UINT32_MAX;
+    }
+    const DrJsonHashIndex* idxes = drj_shape_idxes(shape);
+    uint32_t hash = drj_atom_get_hash(atom);
+    for(uint32_t idx = fast_reduce32(hash, 2*count);;){
+        DrJsonHashIndex hi = idxes[idx];
+        if(hi.index == UINT32_MAX) return UINT32_MAX;
+        if(hi.hash == hash && shape->keys[hi.index].bits == atom.bits)
+            return hi.index;
+        idx++;
+        if(idx >= 2*count) idx = 0;
+    }
+}
+
+force_inline
+size_t
+drj_obj_items_size(const DrJsonObject* object){
+    if(object->shaped)
+        return sizeof(DrjShapedItems) + object->count * sizeof(DrJsonValue);
+    return drjson_size_for_object_of_length(object->capacity);
+}
+
+// Finds or makes the shape for these keys. Returns NULL if a key is repeated
+// (those objects can't be shaped) or on allocation failure.
+static
+const DrjShape*_Nullable
+drj_get_shape(DrJsonContext* ctx, const DrJsonAtom* keys, uint32_t count){
+    uint32_t hash = hash_align8(keys, count * sizeof *keys);
+    uint32_t cap = (uint32_t)ctx->shapes.capacity;
+    uint32_t idx = 0;
+    if(cap){
+        for(idx = fast_reduce32(hash, cap);; idx = idx + 1 == cap? 0 : idx + 1){
+            const DrjShape* shape = ctx->shapes.data[idx];
+            if(!shape) break;
+            if(shape->hash == hash && shape->count == count && memcmp(shape->keys, keys, count * sizeof *keys) == 0)
+                return shape;
+        }
+    }
+    DrjShape* shape = drj_alloc(ctx, drj_shape_size(count));
+    if(!shape) return NULL;
+    shape->count = count;
+    shape->hash = hash;
+    drj_memcpy(shape->keys, keys, count * sizeof *keys);
+    _Bool repeated = 0;
+    if(!drj_obj_has_index(count)){
+        for(uint32_t i = 1; i < count && !repeated; i++)
+            for(uint32_t j = 0; j < i && !repeated; j++)
+                repeated = keys[i].bits == keys[j].bits;
+    }
+    else {
+        DrJsonHashIndex* idxes = drj_shape_idxes(shape);
+        drj_memset(idxes, 0xff, 2*count * sizeof *idxes);
+        for(uint32_t i = 0; i < count && !repeated; i++){
+            uint32_t h = drj_atom_get_hash(keys[i]);
+            uint32_t k = fast_reduce32(h, 2*count);
+            for(; idxes[k].index != UINT32_MAX; k = k + 1 == 2*count? 0 : k + 1){
+                if(keys[idxes[k].index].bits == keys[i].bits){
+                    repeated = 1;
+                    break;
+                }
+            }
+            idxes[k] = (DrJsonHashIndex){i, h};
+        }
+    }
+    if(repeated){
+        drj_free(ctx, shape, drj_shape_size(count));
+        return NULL;
+    }
+    // Keep the table at most half full.
+    if(2*(ctx->shapes.count + 1) > cap){
+        uint32_t new_cap = cap? 2*cap : 64;
+        DrjShape** data = drj_alloc(ctx, new_cap * sizeof *data);
+        if(!data){
+            drj_free(ctx, shape, drj_shape_size(count));
+            return NULL;
+        }
+        drj_memset(data, 0, new_cap * sizeof *data);
+        for(uint32_t i = 0; i < cap; i++){
+            DrjShape* s = ctx->shapes.data[i];
+            if(!s) continue;
+            uint32_t k = fast_reduce32(s->hash, new_cap);
+            while(data[k]) k = k + 1 == new_cap? 0 : k + 1;
+            data[k] = s;
+        }
+        if(cap)
+            drj_free(ctx, ctx->shapes.data, cap * sizeof *data);
+        ctx->shapes.data = data;
+        ctx->shapes.capacity = cap = new_cap;
+        idx = fast_reduce32(hash, cap);
+        while(data[idx]) idx = idx + 1 == cap? 0 : idx + 1;
+    }
+    ctx->shapes.data[idx] = shape;
+    ctx->shapes.count++;
+    return shape;
+}
+
+// Gives a shaped object its own keys, so it can be changed.
+static
+int
+drj_obj_unshare(const DrJsonContext* ctx, DrJsonObject* object){
+    DrjShapedItems* items = object->object_items;
+    const DrjShape* shape = items->shape;
+    uint32_t count = object->count;
+    void* p = drj_alloc(ctx, drjson_size_for_object_of_length(count));
+    if(!p) return 1;
+    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(p, count, &idxes, &pairs);
+    for(uint32_t i = 0; i < count; i++)
+        pairs[i] = (DrJsonObjectPair){.atom = shape->keys[i], .value = items->values[i]};
+    if(drj_obj_has_index(count)){
+        drj_memcpy(idxes, drj_shape_idxes(shape), 2*count * sizeof *idxes);
+        *drj_obj_get_tombstones(p, count) = 0;
+    }
+    drj_free(ctx, items, drj_obj_items_size(object));
+    object->object_items = p;
+    object->capacity = count;
+    object->shaped = 0;
+    return 0;
+}
+
+// Where an object's keys and values are, for code that only reads them.
+typedef struct DrjObjSlots DrjObjSlots;
+struct DrjObjSlots {
+    const char*_Nullable keys;
+    const char*_Nullable values;
+    size_t key_stride;
+    size_t value_stride;
+};
+
+force_inline
+DrjObjSlots
+drj_obj_slots(const DrJsonObject* object){
+    if(!object->object_items)
+        return (DrjObjSlots){0};
+    if(object->shaped){
+        const DrjShapedItems* items = object->object_items;
+        return (DrjObjSlots){
+            .keys = (const char*)items->shape->keys,
+            .values = (const char*)items->values,
+            .key_stride = sizeof(DrJsonAtom),
+            .value_stride = sizeof(DrJsonValue),
+        };
+    }
+    const char* p = object->object_items;
+    return (DrjObjSlots){
+        .keys = p + offsetof(DrJsonObjectPair, atom),
+        .values = p + offsetof(DrJsonObjectPair, value),
+        .key_stride = sizeof(DrJsonObjectPair),
+        .value_stride = sizeof(DrJsonObjectPair),
+    };
+}
+
+force_inline
+DrJsonObjectPair
+drj_obj_pair(DrjObjSlots slots, size_t i){
+    return (DrJsonObjectPair){
+        .atom = *(const DrJsonAtom*)(slots.keys + i * slots.key_stride),
+        .value = *(const DrJsonValue*)(slots.values + i * slots.value_stride),
+    };
+}
+
+// The pair of the nth key, counting around any tombstones.
+static inline
+DrJsonObjectPair
+drj_obj_nth_pair(const DrJsonObject* object, size_t n){
+    DrjObjSlots slots = drj_obj_slots(object);
+    if(likely(!drj_obj_tombstone_count(object)))
+        return drj_obj_pair(slots, n);
+    for(size_t i = 0;; i++){
+        DrJsonObjectPair pair = drj_obj_pair(slots, i);
+        if(pair.atom.bits == DRJ_TOMBSTONE) continue;
+        if(!n--) return pair;
+    }
+}
+
 
 
 
@@ -555,10 +1382,91 @@ force_inline
 int
 drjson_object_set_item(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom, DrJsonValue item);
 
+static
+void
+drj_gc_push(DrJsonContext* ctx, size_t tagged){
+    if(unlikely(ctx->gc.count == ctx->gc.capacity)){
+        size_t new_cap = ctx->gc.capacity? ctx->gc.capacity*2 : 64;
+        size_t* p = drj_realloc(ctx, ctx->gc.gray, ctx->gc.capacity*sizeof *p, new_cap*sizeof *p);
+        if(!p){
+            ctx->gc.overflowed = 1;
+            return;
+        }
+        ctx->gc.gray = p;
+        ctx->gc.capacity = new_cap;
+    }
+    ctx->gc.gray[ctx->gc.count++] = tagged;
+}
+
+// Makes a white container gray.
+static
+void
+drj_gc_shade(DrJsonContext* ctx, DrJsonValue v){
+    switch(v.kind){
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
+        case DRJSON_OBJECT_ITEMS:
+        case DRJSON_OBJECT_VALUES:{
+            DrJsonObject* object = &ctx->objects.data[v.object_idx];
+            if(object->marked) return;
+            // Empty containers are marked too, as they might not be by
+            // the time they are swept.
+            object->marked = 1;
+            if(object->capacity)
+                drj_gc_push(ctx, v.object_idx << 1);
+        }return;
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:{
+            DrJsonArray* array = &ctx->arrays.data[v.array_idx];
+            if(array->marked) return;
+            array->marked = 1;
+            if(array->capacity && !array->packed)
+                drj_gc_push(ctx, v.array_idx << 1 | 1);
+        }return;
+        default:
+            return;
+    }
+}
+
+// Called with every value stored into a container. While marking, a
+// black container must not end up pointing to a white one, so the value
+// is shaded (a Dijkstra style barrier).
+static inline
+void
+drj_gc_barrier(const DrJsonContext* ctx, DrJsonValue v){
+    if(unlikely(ctx->gc.phase == DRJ_GC_MARK))
+        drj_gc_shade((DrJsonContext*)ctx, v);
+}
+
+enum {
+    // How much more marking drjson_gc_step does for each container made
+    // since the last step, so that a mutator that keeps allocating can't
+    // outrun the collection.
+    DRJ_GC_ALLOC_WORK = 4,
+};
+
+// Containers made while marking are gray, as their items are usually
+// filled in directly rather than through the barrier. They are marked
+// too, so storing them somewhere doesn't push them a second time.
+static inline
+void
+drj_gc_allocated(DrJsonContext* ctx, size_t tagged){
+    if(likely(ctx->gc.phase != DRJ_GC_MARK))
+        return;
+    if(tagged & 1)
+        ctx->arrays.data[tagged >> 1].marked = 1;
+    else
+        ctx->objects.data[tagged >> 1].marked = 1;
+    ctx->gc.allocated++;
+    drj_gc_push(ctx, tagged);
+}
+
 static inline
 ssize_t
 alloc_obj(DrJsonContext* ctx){
-    if(ctx->objects.free_object){
+    // While sweeping, free slots may not have been swept yet, so new
+    // containers go at the end.
+    if(ctx->objects.free_object && ctx->gc.phase != DRJ_GC_SWEEP){
         ssize_t result = ctx->objects.free_object;
         DrJsonObject* p = &ctx->objects.data[result];
         ctx->objects.free_object = p->count;
@@ -566,6 +1474,7 @@ alloc_obj(DrJsonContext* ctx){
         #ifdef DRJ_DEBUG
         fprintf(stderr, "Recycling object %p (%zu)\n", (void*)p, (size_t)result);
         #endif
+        drj_gc_allocated(ctx, (size_t)result << 1);
         return result;
     }
     if(ctx->objects.capacity <= ctx->objects.count){
@@ -585,13 +1494,14 @@ alloc_obj(DrJsonContext* ctx){
     #ifdef DRJ_DEBUG
     fprintf(stderr, "allocated object %p (%zu)\n", (void*)&odata[result], (size_t)result);
     #endif
+    drj_gc_allocated(ctx, (size_t)result << 1);
     return result;
 }
 
 static inline
 ssize_t
 alloc_array(DrJsonContext* ctx){
-    if(ctx->arrays.free_array){
+    if(ctx->arrays.free_array && ctx->gc.phase != DRJ_GC_SWEEP){
         ssize_t result = ctx->arrays.free_array;
         DrJsonArray* p = &ctx->arrays.data[result];
         ctx->arrays.free_array = p->count;
@@ -599,6 +1509,7 @@ alloc_array(DrJsonContext* ctx){
         #ifdef DRJ_DEBUG
         fprintf(stderr, "Recycling array %p (%zu)\n", (void*)p, (size_t)result);
         #endif
+        drj_gc_allocated(ctx, (size_t)result << 1 | 1);
         return result;
     }
     if(ctx->arrays.capacity <= ctx->arrays.count){
@@ -612,6 +1523,7 @@ alloc_array(DrJsonContext* ctx){
     ssize_t result = ctx->arrays.count++;
     DrJsonArray* adata = ctx->arrays.data;
     adata[result] = (DrJsonArray){0};
+    drj_gc_allocated(ctx, (size_t)result << 1 | 1);
     return result;
 }
 
@@ -676,27 +1588,158 @@ drjson_stdc_allocator(void){
     };
 }
 
+#if DRJ_HAVE_SIMD
+//
+// Stage 1: classify 64 bytes of input at a time into bitmasks (bit i is
+// byte i of the block). The parser consults these instead of re-scanning
+// byte by byte where it would otherwise loop: runs of whitespace and the
+// body of strings.
+//
+// This is a block classifier and not a flattened structural index as the
+// liberal syntax (comments, single quoted strings) means quote parity can't
+// be determined up front without the parser's state.
+//
+#define DRJ_BLOCK_SIZE 64
+typedef struct DrjBlockMasks DrjBlockMasks;
+struct DrjBlockMasks {
+    uint64_t space; // bytes drj_skip_whitespace skips, including ',', ':' and '='
+    uint64_t quote; // '"'
+    uint64_t backslash;
+};
+
+#if defined(__aarch64__) && !(defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__)))
+force_inline
+uint64_t
+drj_neon_mask64(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d){
+    const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t s0 = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    uint8x16_t s1 = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+#endif
+
+// Caller guarantees DRJ_BLOCK_SIZE bytes are readable at p.
+force_inline
+DrjBlockMasks
+drj_classify_block(const char* p){
+    DrjBlockMasks m = {0};
+    #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
+        for(int i = 0; i < 4; i++){
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + 16*i));
+            __m128i sp;
+            // Mirror the scalar `*cursor <= 0x20`, which depends on the
+            // signedness of char.
+            if(CHAR_MIN < 0)
+                sp = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+            else
+                sp = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x20)), v);
+            sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+            sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+            sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+            m.space |= (uint64_t)(unsigned)_mm_movemask_epi8(sp) << (16*i);
+            m.quote |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << (16*i);
+            m.backslash |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << (16*i);
+        }
+    #elif defined(__aarch64__)
+        uint8x16_t v[4], sp[4], q[4], bs[4];
+        for(int i = 0; i < 4; i++){
+            v[i] = vld1q_u8((const uint8_t*)p + 16*i);
+            if(CHAR_MIN < 0)
+                sp[i] = vcltq_s8(vreinterpretq_s8_u8(v[i]), vdupq_n_s8(0x21));
+            else
+                sp[i] = vcleq_u8(v[i], vdupq_n_u8(0x20));
+            sp[i] = vorrq_u8(sp[i], vceqq_u8(v[i], vdupq_n_u8(',')));
+            sp[i] = vorrq_u8(sp[i], vceqq_u8(v[i], vdupq_n_u8(':')));
+            sp[i] = vorrq_u8(sp[i], vceqq_u8(v[i], vdupq_n_u8('=')));
+            q[i] = vceqq_u8(v[i], vdupq_n_u8('"'));
+            bs[i] = vceqq_u8(v[i], vdupq_n_u8('\\'));
+        }
+        m.space = drj_neon_mask64(sp[0], sp[1], sp[2], sp[3]);
+        m.quote = drj_neon_mask64(q[0], q[1], q[2], q[3]);
+        m.backslash = drj_neon_mask64(bs[0], bs[1], bs[2], bs[3]);
+    #elif defined(__wasm_simd128__)
+        for(int i = 0; i < 4; i++){
+            v128_t v = wasm_v128_load(p + 16*i);
+            v128_t sp;
+            if(CHAR_MIN < 0)
+                sp = wasm_i8x16_lt(v, wasm_i8x16_splat(0x21));
+            else
+                sp = wasm_u8x16_le(v, wasm_u8x16_splat(0x20));
+            sp = wasm_v128_or(sp, wasm_i8x16_eq(v, wasm_i8x16_splat(',')));
+            sp = wasm_v128_or(sp, wasm_i8x16_eq(v, wasm_i8x16_splat(':')));
+            sp = wasm_v128_or(sp, wasm_i8x16_eq(v, wasm_i8x16_splat('=')));
+            m.space |= (uint64_t)wasm_i8x16_bitmask(sp) << (16*i);
+            m.quote |= (uint64_t)wasm_i8x16_bitmask(wasm_i8x16_eq(v, wasm_i8x16_splat('"'))) << (16*i);
+            m.backslash |= (uint64_t)wasm_i8x16_bitmask(wasm_i8x16_eq(v, wasm_i8x16_splat('\\'))) << (16*i);
+        }
+    #else
+        // 32 bit neon lacks the pairwise adds, just do it bytewise.
+        for(int i = 0; i < DRJ_BLOCK_SIZE; i++){
+            uint64_t bit = (uint64_t)1 << i;
+            switch(p[i]){
+                case ',': case ':': case '=':
+                    m.space |= bit;
+                    break;
+                case '"':
+                    m.quote |= bit;
+                    break;
+                case '\\':
+                    m.backslash |= bit;
+                    break;
+                default:
+                    if(p[i] <= 0x20)
+                        m.space |= bit;
+                    break;
+            }
+        }
+    #endif
+    return m;
+}
+#endif
+
 // NOTE: we consider commas and colons to be whitespace ;)
 static inline
 void
 drj_skip_whitespace(DrJsonParseContext* ctx){
     const char* cursor = ctx->cursor;
     const char* end = ctx->end;
-    strip:
+    strip:;
+    #if DRJ_HAVE_SIMD
+    const char* run = cursor;
+    #endif
     for(;cursor != end; cursor++){
-        if(*cursor <= 0x20) continue;
+        if(*cursor <= 0x20) goto space;
         switch(*cursor){
-            case ' ': case '\r':
-            case '\t': case '\n':
             case ',': case ':':
             case '=':
-                continue;
+                goto space;
             case '/':
                 cursor++;
                 goto comment;
             default:
                 goto end;
         }
+        space:;
+        #if DRJ_HAVE_SIMD
+        // Short runs (a separator, a newline and some indentation) are
+        // cheaper bytewise. Once a run is long, skip a block at a time.
+        if(cursor - run >= 16 && end - cursor > DRJ_BLOCK_SIZE){
+            cursor++;
+            do {
+                uint64_t nonspace = ~drj_classify_block(cursor).space;
+                if(nonspace){
+                    cursor += drj_ctz64(nonspace);
+                    break;
+                }
+                cursor += DRJ_BLOCK_SIZE;
+            }while(end - cursor >= DRJ_BLOCK_SIZE);
+            // Let the loop look at the non-whitespace byte.
+            cursor--;
+            run = cursor;
+        }
+        #endif
     }
     end:
     ctx->cursor = cursor;
@@ -748,160 +1791,169 @@ drj_match(DrJsonParseContext* ctx, char c){
 
 static inline
 DrJsonValue
-drj_make_atom_val(DrJsonParseContext* ctx, const char* str, size_t len){
+drj_make_atom_val(DrJsonParseContext* ctx, const char* str, size_t len, _Bool escapes){
     DrJsonAtom atom;
-    int err = drj_atomize_str(&ctx->ctx->atoms, &ctx->ctx->allocator, str, (uint32_t)len, ctx->_copy_strings, &atom);
+    int err = drj_atomize_str_escapes(&ctx->ctx->atoms, &ctx->ctx->allocator, str, (uint32_t)len, ctx->_copy_strings, escapes, &atom);
     if(err) return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "failed to make atom");
     return (DrJsonValue){.kind = DRJSON_STRING, .atom=atom};
 }
 
-static inline
+#if DRJ_HAVE_SIMD
+// Which bytes of a block are escaped: those right after an odd length run
+// of backslashes. *carry is whether the first byte of the next block is
+// escaped. Runs are split on parity by adding their starts to them, so
+// this is a handful of integer ops per block no matter how many escapes
+// there are.
+force_inline
+uint64_t
+drj_escaped_mask(uint64_t backslash, uint64_t* carry){
+    const uint64_t even_bits = 0x5555555555555555u;
+    backslash &= ~*carry;
+    uint64_t follows_escape = backslash << 1 | *carry;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t sequences_on_even = odd_starts + backslash;
+    *carry = sequences_on_even < odd_starts;
+    uint64_t invert = sequences_on_even << 1;
+    return (even_bits ^ invert) & follows_escape;
+}
+#endif
+
+// Finds the closing quote of a string, given the cursor just after the
+// opening one, in a single forward pass. Returns NULL if there isn't one.
+// Sets *escapes if the string contains a backslash.
+force_inline
+const char*_Nullable
+drj_scan_string(const char* cursor, const char* end, char quote, _Bool* escapes){
+    #if DRJ_HAVE_SIMD
+    if(quote == '"' && end - cursor >= DRJ_BLOCK_SIZE){
+        DrjBlockMasks m = drj_classify_block(cursor);
+        if(!m.backslash){
+            // Most strings are short and close within the first block.
+            if(m.quote)
+                return cursor + drj_ctz64(m.quote);
+            // Long strings without escapes are memchr's best case.
+            cursor += DRJ_BLOCK_SIZE;
+        }
+        else
+            goto blocks;
+    }
+    #endif
+    // Both searches only ever move forward, so this stays linear however
+    // many escapes there are.
+    for(const char* q = NULL;;){
+        if(!q || q < cursor){
+            q = memchr(cursor, quote, end - cursor);
+            if(!q) return NULL;
+        }
+        const char* bs = memchr(cursor, '\\', q - cursor);
+        if(!bs) return q;
+        *escapes = 1;
+        #if DRJ_HAVE_SIMD
+        // Strings with one escape often have more, resolve them a block
+        // at a time from here.
+        if(quote == '"'){
+            cursor = bs;
+            goto blocks;
+        }
+        #endif
+        // Skip whatever is escaped, which might be q.
+        cursor = bs + 2;
+    }
+    #if DRJ_HAVE_SIMD
+    blocks:;
+    // cursor is not preceded by an unconsumed backslash.
+    uint64_t carry = 0;
+    uint64_t backslashes = 0;
+    for(;;){
+        DrjBlockMasks m;
+        if(likely(end - cursor >= DRJ_BLOCK_SIZE))
+            m = drj_classify_block(cursor);
+        else {
+            if(cursor == end) return NULL;
+            // Pad the tail, zeros are neither quotes nor backslashes.
+            char tail[DRJ_BLOCK_SIZE] = {0};
+            drj_memcpy(tail, cursor, end - cursor);
+            m = drj_classify_block(tail);
+        }
+        uint64_t quotes = m.quote & ~drj_escaped_mask(m.backslash, &carry);
+        if(quotes){
+            backslashes |= m.backslash & ((quotes & -quotes) - 1);
+            if(backslashes) *escapes = 1;
+            return cursor + drj_ctz64(quotes);
+        }
+        backslashes |= m.backslash;
+        if(end - cursor <= DRJ_BLOCK_SIZE) return NULL;
+        cursor += DRJ_BLOCK_SIZE;
+    }
+    #endif
+}
+
+// Finds the end of a bare (unquoted) string.
+force_inline
+const char*
+drj_scan_bare_string(const char* cursor, const char* end){
+    for(;cursor != end; cursor++){
+        switch(*cursor){
+            case CASE_a_z:
+            case CASE_A_Z:
+            case CASE_0_9:
+            case '_':
+            case '-':
+            case '.':
+            case '/':
+            case '+':
+            case '*':
+                continue;
+            default:
+                return cursor;
+        }
+    }
+    return cursor;
+}
+
+// With `validate`, the string is only checked, not atomized, and null is
+// returned instead. The cursor must already be past any whitespace: when
+// push parsing, a '/' at the end of the buffer may start a comment in the
+// next chunk, so it can't be skipped here.
+force_inline
 DrJsonValue
-parse_string(DrJsonParseContext* ctx){
-    drj_skip_whitespace(ctx);
+drj_parse_string_impl(DrJsonParseContext* ctx, const _Bool validate){
     if(ctx->cursor == ctx->end)
         return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "eof when beginning parsing string");
     const char* string_start;
     const char* string_end;
     const char* cursor = ctx->cursor;
     const char* end = ctx->end;
-    if(likely(drj_match(ctx, '"'))){
-        cursor = ctx->cursor;
+    if(likely(*cursor == '"' || *cursor == '\'')){
+        char quote = *cursor++;
         string_start = cursor;
-        for(;;){
-            const char* close = memchr(cursor, '"', end-cursor);
-            if(unlikely(!close)) return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "No closing '\"' for a string");
-            cursor = close+1;
-            int nbackslashes = 0;
-            int negidx = -1;
-            while(close[negidx--] == '\\')
-                nbackslashes++;
-            if(nbackslashes & 1) continue;
-            string_end = close;
-            break;
-        }
-        ctx->cursor = cursor;
-        return drj_make_atom_val(ctx, string_start, string_end-string_start);
-    }
-    else if(drj_match(ctx, '\'')){
-        cursor = ctx->cursor;
-        string_start = cursor;
-        for(;;){
-            const char* close = memchr(cursor, '\'', end-cursor);
-            if(unlikely(!close)) return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "No closing \"'\" for a string");
-            cursor = close+1;
-            int nbackslashes = 0;
-            int negidx = -1;
-            while(close[negidx--] == '\\')
-                nbackslashes++;
-            if(nbackslashes & 1) continue;
-            string_end = close;
-            break;
+        _Bool escapes = 0;
+        string_end = drj_scan_string(cursor, end, quote, &escapes);
+        if(unlikely(!string_end)){
+            ctx->cursor = string_start;
+            return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, quote == '"'? "No closing '\"' for a string" : "No closing \"'\" for a string");
         }
-        ctx->cursor = cursor;
-        return drj_make_atom_val(ctx, string_start, string_end-string_start);
+        ctx->cursor = string_end + 1;
+        if(validate) return drjson_make_null();
+        return drj_make_atom_val(ctx, string_start, string_end-string_start, escapes);
     }
     else {
         string_start = cursor;
-        // allow bare identifiers
-        for(;cursor != end; cursor++){
-            switch(*cursor){
-                default:
-                    if(cursor == string_start) return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "zero length when expecting a string");
-                    else goto after2;
-                case CASE_a_z:
-                case CASE_A_Z:
-                case CASE_0_9:
-                case '_':
-                case '-':
-                case '.':
-                case '/':
-                case '+':
-                case '*':
-                    continue;
-            }
-        }
-        after2:
-        ctx->cursor = cursor;
-        string_end = cursor;
-        return drj_make_atom_val(ctx, string_start, string_end-string_start);
+        string_end = drj_scan_bare_string(cursor, end);
+        if(string_end == string_start)
+            return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "zero length when expecting a string");
+        ctx->cursor = string_end;
+        if(validate) return drjson_make_null();
+        return drj_make_atom_val(ctx, string_start, string_end-string_start, 0);
     }
 }
 
-
-static
-DrJsonValue
-drj_parse(DrJsonParseContext* ctx);
-
 static inline
 DrJsonValue
-parse_object(DrJsonParseContext* ctx){
-    if(unlikely(!drj_match(ctx, '{'))){
-        return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Expected a '{' to begin an object");
-    }
-    DrJsonValue result = drjson_make_object(ctx->ctx);
-    DrJsonValue error = {0};
-    drj_skip_whitespace(ctx);
-    while(!drj_match(ctx, '}')){
-        if(unlikely(ctx->cursor == ctx->end)){
-            error = drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before closing '}'");
-            goto cleanup;
-        }
-        drj_skip_whitespace(ctx);
-        DrJsonValue key = parse_string(ctx);
-        if(unlikely(key.kind == DRJSON_ERROR)){
-            error = key;
-            goto cleanup;
-        }
-        DrJsonValue item = drj_parse(ctx);
-        if(unlikely(item.kind == DRJSON_ERROR)){
-            error = item;
-            goto cleanup;
-        }
-        int err = drjson_object_set_item_atom(ctx->ctx, result, key.atom, item);
-        if(unlikely(err)){
-            error = drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate space for an item while setting member of an object");
-            goto cleanup;
-        }
-        drj_skip_whitespace(ctx);
-    }
-    if(ctx->_read_only_objects)
-        result = drj_intern_object(ctx->ctx, result, 1);
-    return result;
-    cleanup:
-    return error;
+parse_string(DrJsonParseContext* ctx){
+    return drj_parse_string_impl(ctx, 0);
 }
 
-static inline
-DrJsonValue
-parse_array(DrJsonParseContext* ctx){
-    if(!drj_match(ctx, '[')) return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Expected a '[' to begin an array");
-    DrJsonValue result = drjson_make_array(ctx->ctx);
-    DrJsonValue error = {0};
-    drj_skip_whitespace(ctx);
-    while(!drj_match(ctx, ']')){
-        if(unlikely(ctx->cursor == ctx->end)){
-            error = drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before closing ']'");
-            goto cleanup;
-        }
-        DrJsonValue item = drj_parse(ctx);
-        if(unlikely(item.kind == DRJSON_ERROR)){
-            error = item;
-            goto cleanup;
-        }
-        int err = drjson_array_push_item(ctx->ctx, result, item);
-        if(unlikely(err)){
-            error = drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to push an item onto an array");
-            goto cleanup;
-        }
-        drj_skip_whitespace(ctx);
-    }
-    if(ctx->_read_only_objects)
-        result = drj_intern_array(ctx->ctx, result, 1);
-    return result;
-    cleanup:
-    return error;
-}
 
 static inline
 DrJsonValue
@@ -921,10 +1973,72 @@ parse_bool_null(DrJsonParseContext* ctx){
     }
     return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Invalid literal");
 }
-static inline
+// Converts a span that has already been classified.
+static
 DrJsonValue
-parse_number(DrJsonParseContext* ctx){
-    const char* num_begin = ctx->cursor;
+drj_convert_number(const char* num_begin, size_t length, _Bool fractional, _Bool has_minus){
+    if(fractional){
+        DoubleResult pr = parse_double(num_begin, length);
+        if(pr.errored){
+            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+        }
+        return drjson_make_number(pr.result);
+    }
+    else if(has_minus){
+        Int64Result pr = parse_int64(num_begin, length);
+        if(pr.errored){
+            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+        }
+        return drjson_make_int(pr.result);
+    }
+    else {
+        Uint64Result pr = parse_uint64(num_begin, length);
+        if(pr.errored){
+            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+        }
+        return drjson_make_uint(pr.result);
+    }
+}
+
+// Whether the span is a number as json spells it. Only those are kept as
+// text, so printing them back is still json.
+static inline
+_Bool
+drj_is_json_number(const char* p, const char* end){
+    if(p != end && *p == '-')
+        p++;
+    if(p == end) return 0;
+    if(*p == '0')
+        p++;
+    else if((unsigned)(unsigned char)*p - '0' <= 9u)
+        while(p != end && (unsigned)(unsigned char)*p - '0' <= 9u)
+            p++;
+    else
+        return 0;
+    if(p != end && *p == '.'){
+        p++;
+        if(p == end || (unsigned)(unsigned char)*p - '0' > 9u) return 0;
+        while(p != end && (unsigned)(unsigned char)*p - '0' <= 9u)
+            p++;
+    }
+    if(p != end && (*p == 'e' || *p == 'E')){
+        p++;
+        if(p != end && (*p == '+' || *p == '-'))
+            p++;
+        if(p == end || (unsigned)(unsigned char)*p - '0' > 9u) return 0;
+        while(p != end && (unsigned)(unsigned char)*p - '0' <= 9u)
+            p++;
+    }
+    return p == end;
+}
+
+// Classifies the whole span first and hands it to the matching parser.
+// Handles everything parse_number's fused loop doesn't: fractions,
+// exponents, values that might overflow and malformed spans.
+static
+DrJsonValue
+drj_parse_number_span(DrJsonParseContext* ctx){
+    const char* num_begin = ctx->cursor;
     const char* cursor = ctx->cursor;
     const char* end = ctx->end;
     _Bool has_exponent = 0;
@@ -951,30 +2065,92 @@ parse_number(DrJsonParseContext* ctx){
     after:;
     ptrdiff_t length = cursor - num_begin;
     if(!length) return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Zero length number");
+    _Bool fractional = has_exponent || has_decimal;
     DrJsonValue result;
-    if(has_exponent || has_decimal){
-        DoubleResult pr = parse_double(num_begin, length);
-        if(pr.errored){
+    if(ctx->_lazy_numbers && length <= UINT32_MAX && drj_is_json_number(num_begin, cursor)){
+        // Integers are cheap, so they are still converted to check they fit.
+        if(!fractional && drj_convert_number(num_begin, length, 0, has_minus).kind == DRJSON_ERROR)
             return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+        const char* text = num_begin;
+        if(ctx->_copy_strings){
+            text = drj_atom_copy_str(&ctx->ctx->atoms, &ctx->ctx->allocator, num_begin, length);
+            if(!text) return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate number");
         }
-        result = drjson_make_number(pr.result);
+        result = (DrJsonValue){._lkind = DRJSON_LAZY_NUMBER, ._lowned = ctx->_copy_strings, .number_len = (uint32_t)length, .number_text = text};
     }
-    else if(has_minus){
-        Int64Result pr = parse_int64(num_begin, length);
-        if(pr.errored){
-            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+    else {
+        result = drj_convert_number(num_begin, length, fractional, has_minus);
+        if(result.kind == DRJSON_ERROR)
+            return result;
+    }
+    ctx->cursor = cursor;
+    return result;
+}
+
+DRJSON_API
+DrJsonValue
+drjson_resolve_number(DrJsonValue v){
+    if(v.kind != DRJSON_LAZY_NUMBER) return v;
+    _Bool fractional = 0, has_minus = 0;
+    for(uint32_t i = 0; i < v.number_len; i++){
+        switch(v.number_text[i]){
+            case 'e': case 'E': case '.':
+                fractional = 1;
+                break;
+            case '-':
+                has_minus = 1;
+                break;
+            default:
+                break;
         }
-        result =  drjson_make_int(pr.result);
     }
-    else {
-        Uint64Result pr = parse_uint64(num_begin, length);
-        if(pr.errored){
-            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Failed to parse number");
+    return drj_convert_number(v.number_text, v.number_len, fractional, has_minus);
+}
+
+// Integers are by far the most common numbers, so they are converted as
+// they are scanned, 8 digits at a time where possible. Anything else falls
+// back to drj_parse_number_span.
+static inline
+DrJsonValue
+parse_number(DrJsonParseContext* ctx){
+    const char* cursor = ctx->cursor;
+    const char* end = ctx->end;
+    _Bool negative = 0;
+    if(*cursor == '-'){
+        negative = 1;
+        cursor++;
+    }
+    const char* digits = cursor;
+    uint64_t value = 0;
+    while(end - cursor >= 8 && fast_float_is_made_of_eight_digits_fast(cursor)){
+        value = value * 100000000 + fast_float_parse_eight_digits_unrolled(cursor);
+        cursor += 8;
+    }
+    for(;cursor != end; cursor++){
+        unsigned d = (unsigned char)*cursor - '0';
+        if(d > 9) break;
+        value = value * 10 + d;
+    }
+    if(cursor != end){
+        switch(*cursor){
+            case '.': case 'e': case 'E':
+            case '+': case '-':
+                return drj_parse_number_span(ctx);
+            default:
+                break;
         }
-        result =  drjson_make_uint(pr.result);
     }
+    // 19 digits always fit in a uint64_t, but maybe not an int64_t.
+    size_t ndigits = cursor - digits;
+    if(unlikely(!ndigits || ndigits > 18))
+        return drj_parse_number_span(ctx);
+    // -0 would print back as 0.
+    if(unlikely(negative && !value) && ctx->_lazy_numbers)
+        return drj_parse_number_span(ctx);
     ctx->cursor = cursor;
-    return result;
+    if(negative)
+        return drjson_make_int(-(int64_t)value);
+    return drjson_make_uint(value);
 }
 
 force_inline
@@ -1075,103 +2251,23 @@ drj_parse_hex(DrJsonParseContext* ctx){
     return drjson_make_uint(value);
 }
 
-static
-DrJsonValue
-drjson_parse_braceless_object(DrJsonParseContext* ctx);
-
-
-DRJSON_API
-DrJsonValue
-drjson_parse(DrJsonParseContext* ctx, unsigned flags){
-    if(!(flags & DRJSON_PARSE_FLAG_NO_COPY_STRINGS))
-        ctx->_copy_strings = 1;
-    if(flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS)
-        ctx->_read_only_objects = 1;
-
-    // NDJSON mode: parse multiple top-level values into an array
-    if(flags & DRJSON_PARSE_FLAG_NDJSON){
-        DrJsonValue array = drjson_make_array(ctx->ctx);
-        for(;;){
-            drj_skip_whitespace(ctx);
-            if(ctx->cursor >= ctx->end)
-                break;
-
-            DrJsonValue value;
-            if(flags & DRJSON_PARSE_FLAG_BRACELESS_OBJECT){
-                // For braceless objects in NDJSON, parse line-by-line
-                // Find the next newline
-                size_t remaining = ctx->end - ctx->cursor;
-                const char* line_end = memchr(ctx->cursor, '\n', remaining);
-                if(!line_end)
-                    line_end = ctx->end;
-
-                // Temporarily limit the context to this line
-                const char* saved_end = ctx->end;
-                ctx->end = line_end;
-
-                value = drjson_parse_braceless_object(ctx);
-
-                // Restore the original end
-                ctx->end = saved_end;
-
-                // Skip the newline character
-                if(ctx->cursor < ctx->end && *ctx->cursor == '\n')
-                    ctx->cursor++;
-            }
-            else
-                value = drj_parse(ctx);
-
-            if(value.kind == DRJSON_ERROR)
-                return value;
-
-            drjson_array_push_item(ctx->ctx, array, value);
-        }
-        return array;
-    }
-
-    DrJsonValue result;
-    if(flags & DRJSON_PARSE_FLAG_BRACELESS_OBJECT)
-        result = drjson_parse_braceless_object(ctx);
-    else
-        result = drj_parse(ctx);
-
-    // Check for trailing content if requested
-    if((flags & DRJSON_PARSE_FLAG_ERROR_ON_TRAILING) && result.kind != DRJSON_ERROR){
-        drj_skip_whitespace(ctx);
-        if(ctx->cursor != ctx->end){
-            return drjson_make_error(DRJSON_ERROR_TRAILING_CONTENT, "Unexpected content after JSON value");
-        }
-    }
-    return result;
-}
-
-static
+// Parses any value that isn't an object or array. Cursor must not be at
+// the end. With `validate`, strings aren't atomized.
+force_inline
 DrJsonValue
-drj_parse(DrJsonParseContext* ctx){
-    ctx->depth++;
-    if(unlikely(ctx->depth > 100))
-        return drjson_make_error(DRJSON_ERROR_TOO_DEEP, "Too many levels of nesting.");
-    drj_skip_whitespace(ctx);
+drj_parse_scalar_impl(DrJsonParseContext* ctx, const _Bool validate){
     DrJsonValue result;
-    if(ctx->cursor == ctx->end)
-        return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before any values");
     switch(ctx->cursor[0]){
-        case '{':
-            result = parse_object(ctx);
-            break;
-        case '[':
-            result = parse_array(ctx);
-            break;
         case '\'':
         case '"':
-            result = parse_string(ctx);
+            result = drj_parse_string_impl(ctx, validate);
             break;
         case 't':
         case 'f':
         case 'n':
             result = parse_bool_null(ctx);
             if(result.kind == DRJSON_ERROR)
-                result = parse_string(ctx);
+                result = drj_parse_string_impl(ctx, validate);
             break;
         case '#':
             ctx->cursor++;
@@ -1183,7 +2279,7 @@ drj_parse(DrJsonParseContext* ctx){
         case '4': case '5': case '6': case '7': case '8': case '9':
             result = parse_number(ctx);
             if(result.kind == DRJSON_ERROR)
-                result = parse_string(ctx);
+                result = drj_parse_string_impl(ctx, validate);
             break;
         case '0':
             if(ctx->cursor + 1 != ctx->end){
@@ -1195,2890 +2291,5775 @@ drj_parse(DrJsonParseContext* ctx){
             }
             result = parse_number(ctx);
             if(result.kind == DRJSON_ERROR)
-                result = parse_string(ctx);
+                result = drj_parse_string_impl(ctx, validate);
             break;
 
         default:
-            result = parse_string(ctx);
+            result = drj_parse_string_impl(ctx, validate);
             if(result.kind != DRJSON_ERROR) break;
             result = drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Character is not a valid starting character for json");
             break;
     }
-    ctx->depth--;
     return result;
 }
 
-DRJSON_API
+static inline
 DrJsonValue
-drjson_parse_string(DrJsonContext* jctx, const char* text, size_t length, unsigned flags){
-    DrJsonParseContext ctx = {
-        .ctx = jctx,
-        .begin = text,
-        .cursor = text,
-        .end = text+length,
-        .depth = 0,
-    };
-    return drjson_parse(&ctx, flags);
+drj_parse_scalar(DrJsonParseContext* ctx){
+    return drj_parse_scalar_impl(ctx, 0);
 }
 
+//
+// Parser
+//
+// Open containers are kept on an explicit stack instead of the C stack, so
+// nesting is only limited by max_depth and the parse can stop at the end
+// of any chunk and pick up again with the next one (push parsing).
+// drjson_parse runs the same machine over the whole input at once. A token
+// is only handed to the scalar parsers once all of it is in one buffer.
+//
+enum {
+    DRJ_FRAME_ARRAY,
+    DRJ_FRAME_OBJECT,
+    DRJ_FRAME_BRACELESS, // object without braces, ends at eof (or at the end of the line for ndjson)
+    DRJ_FRAME_NDJSON,    // array without brackets, ends at eof
+};
 
-static
-DrJsonValue
-drjson_parse_braceless_object(DrJsonParseContext* ctx){
-    DrJsonValue result = drjson_make_object(ctx->ctx);
-    DrJsonValue error = {0};
-    ctx->depth++;
-    drj_skip_whitespace(ctx);
-    for(drj_skip_whitespace(ctx); ctx->cursor != ctx->end; drj_skip_whitespace(ctx)){
-        DrJsonValue key = parse_string(ctx);
-        if(unlikely(key.kind == DRJSON_ERROR)){
-            error = key;
-            goto cleanup;
-        }
-        DrJsonValue item = drj_parse(ctx);
-        if(unlikely(item.kind == DRJSON_ERROR)){
-            error = item;
-            goto cleanup;
-        }
-        int err = drjson_object_set_item_atom(ctx->ctx, result, key.atom, item);
-        if(unlikely(err)){
-            error = drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate space for an item while setting member of an object");
-            goto cleanup;
-        }
-    }
-    ctx->depth--;
-    return result;
-    cleanup:
-    return error;
-}
+// What DRJSON_PARSE_FLAG_STRICT allows next in a container.
+enum {
+    DRJ_EXPECT_FIRST,     // just opened: first item or close
+    DRJ_EXPECT_ITEM,      // after ','
+    DRJ_EXPECT_COLON,     // after a key
+    DRJ_EXPECT_VALUE,     // after ':'
+    DRJ_EXPECT_SEPARATOR, // after an item: ',' or close
+};
 
-DRJSON_API
-int // 0 on success
-drjson_array_push_item(const DrJsonContext* ctx, DrJsonValue a, DrJsonValue item){
-    if(a.kind != DRJSON_ARRAY) return 1;
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only) return 1;
-    if(array->capacity < array->count+1u){
-        size_t old_cap = array->capacity;
-        enum {ARRAY_MAX = 0x1fffffff};
-        size_t new_cap = old_cap?old_cap*2:4;
-        if(new_cap > ARRAY_MAX) return 1;
-        DrJsonValue* new_items = drj_realloc(ctx, array->array_items, old_cap*sizeof(*new_items), new_cap*sizeof(*new_items));
-        if(!new_items) return 1;
-        array->array_items = new_items;
-        array->capacity = (uint32_t)new_cap;
-    }
-    array->array_items[array->count++] = item;
-    return 0;
+typedef struct DrjParseFrame DrjParseFrame;
+struct DrjParseFrame {
+    DrJsonValue container;
+    DrJsonAtom key;
+    uint16_t kind;
+    uint16_t expect; // only tracked for strict parses
+    uint32_t has_key;
+    // Where this container's children start on the scratch stacks.
+    size_t values_base;
+    size_t keys_base;
+};
+
+enum {
+    DRJ_COMMENT_NONE,
+    DRJ_COMMENT_LINE,
+    DRJ_COMMENT_BLOCK,
+    DRJ_COMMENT_BLOCK_STAR, // in a block comment and the last byte was '*'
+};
+
+// How to treat the end of the buffer being parsed.
+enum {
+    DRJ_INPUT_EOF,      // end of the document
+    DRJ_INPUT_MORE,     // more follows, a token touching the end is incomplete
+    DRJ_INPUT_BOUNDARY, // more follows, but the last token is complete
+};
+
+enum {
+    DRJ_RUN_NEED_MORE,
+    DRJ_RUN_DONE,
+    DRJ_RUN_ERROR,
+};
+
+struct DrJsonPushParser {
+    DrJsonContext* ctx;
+    unsigned flags;
+    int depth; // open containers, not counting an ndjson root
+    int comment;
+    _Bool done; // the top level value is complete
+    _Bool failed;
+    _Bool finished;
+    _Bool validate; // only check the grammar: no containers, atoms or scratch
+    int max_depth;
+    DrJsonValue result; // document or error
+    DrjParseFrame* frames; // inline_frames until that is outgrown
+    size_t frame_count;
+    size_t frame_capacity;
+    DrjParseFrame inline_frames[8];
+    // Children of the open containers. They are only moved into the
+    // container when it closes, so it can be allocated once at its final
+    // size (and an object's hash index built once).
+    DrJsonValue*_Nullable values;
+    size_t value_count;
+    size_t value_capacity;
+    DrJsonAtom*_Nullable keys;
+    size_t key_count;
+    size_t key_capacity;
+    // A token that straddles chunks.
+    char*_Nullable carry;
+    size_t carry_length;
+    size_t carry_capacity;
+    // Position of the start of the buffer being parsed, or of the error.
+    size_t line, column;
+};
+
+static inline
+void
+drj_advance_line_column(size_t* line, size_t* column, const char* p, const char* end){
+    for(;;){
+        const char* nl = memchr(p, '\n', end - p);
+        if(!nl) break;
+        ++*line;
+        *column = 0;
+        p = nl + 1;
+    }
+    *column += end - p;
 }
 
-DRJSON_API
-int // 0 on success
-drjson_array_insert_item(const DrJsonContext* ctx, DrJsonValue a, size_t idx, DrJsonValue item){
-    if(a.kind != DRJSON_ARRAY) return 1;
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(idx == array->count) return drjson_array_push_item(ctx, a, item);
-    if(array->read_only) return 1;
-    if(idx >= array->count) return 1;
-    if(array->capacity < array->count+1u){
-        size_t old_cap = array->capacity;
-        enum {ARRAY_MAX = 0x1fffffff};
-        size_t new_cap = old_cap?old_cap*2:4;
-        if(new_cap > ARRAY_MAX) return 1;
-        DrJsonValue* new_items = drj_realloc(ctx, array->array_items, old_cap*sizeof(*new_items), new_cap*sizeof(*new_items));
-        if(!new_items) return 1;
-        array->array_items = new_items;
-        array->capacity = (uint32_t)new_cap;
+// Characters that can continue a bare token (identifier, number, literal,
+// color, hex). A superset of what any of those parses accept.
+force_inline
+_Bool
+drj_is_bare_char(char c){
+    switch(c){
+        case CASE_a_z:
+        case CASE_A_Z:
+        case CASE_0_9:
+        case '_': case '-': case '.':
+        case '/': case '+': case '*':
+        case '#':
+            return 1;
+        default:
+            return 0;
     }
-    size_t nmove = array->count - idx;
-    drj_memmove(array->array_items+idx+1, array->array_items+idx, nmove * sizeof(*array->array_items));
-    array->array_items[idx] = item;
-    array->count++;
-    return 0;
 }
 
-DRJSON_API
-DrJsonValue
-drjson_array_pop_item(const DrJsonContext* ctx, DrJsonValue a){
-    if(a.kind != DRJSON_ARRAY) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is not an array");
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only)
-        return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is read only");
-    if(!array->count)
-        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Array is empty");
-    return array->array_items[--array->count];
+static inline
+int
+drj_push_parser_fail(DrJsonPushParser* p, DrJsonValue error){
+    p->result = error;
+    p->failed = 1;
+    return DRJ_RUN_ERROR;
 }
 
-DRJSON_API
+static inline
 int
-drjson_clear(const DrJsonContext* ctx, DrJsonValue v){
-    switch(v.kind){
-        case DRJSON_ARRAY:{
-            DrJsonArray* adata = ctx->arrays.data;
-            DrJsonArray* array = &adata[v.array_idx];
-            if(array->read_only) return 1;
-            array->count = 0;
-            return 0;
+drj_push_parser_push_frame(DrJsonPushParser* p, uint32_t kind, DrJsonValue container){
+    if(container.kind == DRJSON_ERROR)
+        return drj_push_parser_fail(p, container);
+    if(unlikely(p->frame_count == p->frame_capacity)){
+        size_t new_cap = p->frame_capacity*2;
+        DrjParseFrame* frames;
+        if(p->frames == p->inline_frames){
+            frames = drj_alloc(p->ctx, new_cap*sizeof *frames);
+            if(frames) memcpy(frames, p->frames, p->frame_count*sizeof *frames);
         }
-        case DRJSON_OBJECT:{
-            DrJsonObject* odata = ctx->objects.data;
-            DrJsonObject* object = &odata[v.object_idx];
-            if(object->read_only) return 1;
-            if(object->capacity){
-                DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
-                drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
-                (void)pairs;
-                drj_memset(idxes, 0xff, 2 * sizeof *idxes * object->capacity);
-            }
-            object->count = 0;
-            return 0;
-        }
-        default:
-            return 1;
+        else
+            frames = drj_realloc(p->ctx, p->frames, p->frame_capacity*sizeof *frames, new_cap*sizeof *frames);
+        if(!frames)
+            return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate parser stack"));
+        p->frames = frames;
+        p->frame_capacity = new_cap;
     }
+    p->frames[p->frame_count++] = (DrjParseFrame){
+        .container = container,
+        .kind = kind,
+        .values_base = p->value_count,
+        .keys_base = p->key_count,
+    };
+    if(kind != DRJ_FRAME_NDJSON)
+        p->depth++;
+    return DRJ_RUN_DONE;
 }
 
-DRJSON_API
-DrJsonValue
-drjson_array_del_item(const DrJsonContext* ctx, DrJsonValue a, size_t idx){
-    if(a.kind != DRJSON_ARRAY) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is not an array");
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is read only");
-    if(!array->count)
-        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Array is empty");
-    if(idx >= array->count){
-        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Index out of bounds.");
-    }
-    if(idx == array->count-1u)
-        return drjson_array_pop_item(ctx, a);
-    size_t nmove = array->count - idx-1;
-    DrJsonValue result= array->array_items[idx];
-    drj_memmove(array->array_items+idx, array->array_items+idx+1, nmove*sizeof(*array->array_items));
-    array->count--;
-    return result;
+static
+int
+drj_push_parser_grow(DrJsonPushParser* p, void*_Nullable*_Nonnull data, size_t* capacity, size_t size){
+    size_t old_cap = *capacity;
+    size_t new_cap = old_cap? old_cap*2 : 64;
+    void* grown = drj_realloc(p->ctx, *data, old_cap*size, new_cap*size);
+    if(!grown)
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate parser stack"));
+    *data = grown;
+    *capacity = new_cap;
+    return DRJ_RUN_DONE;
 }
 
-DRJSON_API
+// Adds a completed value to the innermost open container.
+static inline
 int
-drjson_array_swap_items(const DrJsonContext* ctx, DrJsonValue a, size_t idx1, size_t idx2){
-    if(a.kind != DRJSON_ARRAY) return 1;
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only) return 1;
-    if(idx1 >= array->count || idx2 >= array->count) return 1;
-    if(idx1 == idx2) return 0; // Nothing to do
-
-    DrJsonValue temp = array->array_items[idx1];
-    array->array_items[idx1] = array->array_items[idx2];
-    array->array_items[idx2] = temp;
-    return 0;
+drj_push_parser_add(DrJsonPushParser* p, DrJsonValue v){
+    if(!p->frame_count){
+        p->result = v;
+        p->done = 1;
+        return DRJ_RUN_DONE;
+    }
+    DrjParseFrame* f = &p->frames[p->frame_count-1];
+    f->expect = DRJ_EXPECT_SEPARATOR;
+    _Bool keyed = f->kind == DRJ_FRAME_OBJECT || f->kind == DRJ_FRAME_BRACELESS;
+    if(keyed)
+        f->has_key = 0;
+    if(p->validate)
+        return DRJ_RUN_DONE;
+    if(keyed){
+        if(unlikely(p->key_count == p->key_capacity))
+            if(drj_push_parser_grow(p, (void**)&p->keys, &p->key_capacity, sizeof *p->keys) == DRJ_RUN_ERROR)
+                return DRJ_RUN_ERROR;
+        p->keys[p->key_count++] = f->key;
+    }
+    if(unlikely(p->value_count == p->value_capacity))
+        if(drj_push_parser_grow(p, (void**)&p->values, &p->value_capacity, sizeof *p->values) == DRJ_RUN_ERROR)
+            return DRJ_RUN_ERROR;
+    p->values[p->value_count++] = v;
+    return DRJ_RUN_DONE;
 }
 
-DRJSON_API
+// Moves a closing container's children off the scratch stacks and into
+// the container.
+static
 int
-drjson_array_move_item(const DrJsonContext* ctx, DrJsonValue a, size_t from_idx, size_t to_idx){
-    if(a.kind != DRJSON_ARRAY) return 1;
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only) return 1;
-    if(from_idx >= array->count || to_idx >= array->count) return 1;
-    if(from_idx == to_idx) return 0; // Nothing to do
-
-    // Save the item to move
-    DrJsonValue item = array->array_items[from_idx];
-
-    // Shift items to close the gap
-    if(from_idx < to_idx){
-        // Moving forward: shift items left
-        drj_memmove(array->array_items + from_idx,
-                   array->array_items + from_idx + 1,
-                   (to_idx - from_idx) * sizeof(*array->array_items));
+drj_push_parser_build(DrJsonPushParser* p, const DrjParseFrame* f){
+    enum {CONTAINER_MAX = 0x1fffffff};
+    DrJsonContext* ctx = p->ctx;
+    size_t n = p->value_count - f->values_base;
+    const DrJsonValue* values = p->values + f->values_base;
+    p->value_count = f->values_base;
+    p->key_count = f->keys_base;
+    if(!n) return DRJ_RUN_DONE;
+    if(f->kind == DRJ_FRAME_ARRAY || f->kind == DRJ_FRAME_NDJSON){
+        unsigned packed = n <= CONTAINER_MAX? drj_array_packable(values, n) : 0;
+        if(packed){
+            DrJsonArray* array = &ctx->arrays.data[f->container.array_idx];
+            void* numbers;
+            // Taking the stack works here too: each number is written over
+            // the front half of a value that has already been read.
+            if(!f->values_base){
+                array->uintegers = (uint64_t*)p->values;
+                array->packed = packed;
+                for(size_t i = 0; i < n; i++)
+                    drj_array_put(array, i, values[i]);
+                numbers = drj_realloc(ctx, p->values, p->value_capacity * sizeof *p->values, n * sizeof(uint64_t));
+                if(numbers){
+                    p->values = NULL;
+                    p->value_capacity = 0;
+                }
+            }
+            else {
+                numbers = drj_alloc(ctx, n * sizeof(uint64_t));
+                if(numbers){
+                    array->uintegers = numbers;
+                    array->packed = packed;
+                    for(size_t i = 0; i < n; i++)
+                        drj_array_put(array, i, values[i]);
+                }
+            }
+            if(unlikely(!numbers)){
+                array->uintegers = NULL;
+                array->packed = 0;
+                return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to push an item onto an array"));
+            }
+            array->uintegers = numbers;
+            array->count = (uint32_t)n;
+            array->capacity = (uint32_t)n;
+            return DRJ_RUN_DONE;
+        }
+        DrJsonValue* items;
+        if(n > CONTAINER_MAX)
+            items = NULL;
+        // With nothing below it on the stack (usually the outermost and
+        // largest array) it's cheaper to take the stack than to copy it.
+        else if(!f->values_base){
+            items = drj_realloc(ctx, p->values, p->value_capacity * sizeof *items, n * sizeof *items);
+            if(items){
+                p->values = NULL;
+                p->value_capacity = 0;
+            }
+        }
+        else {
+            items = drj_alloc(ctx, n * sizeof *items);
+            if(items) drj_memcpy(items, values, n * sizeof *items);
+        }
+        if(unlikely(!items))
+            return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to push an item onto an array"));
+        DrJsonArray* array = &ctx->arrays.data[f->container.array_idx];
+        array->array_items = items;
+        array->count = (uint32_t)n;
+        array->capacity = (uint32_t)n;
+        return DRJ_RUN_DONE;
+    }
+    const DrJsonAtom* keys = p->keys + f->keys_base;
+    // Interned objects get compared byte for byte, so they keep their keys.
+    if(n <= DRJ_SHAPE_MAX_KEYS && !(p->flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS)){
+        const DrjShape* shape = drj_get_shape(ctx, keys, (uint32_t)n);
+        // No shape means repeated keys, which the general path sorts out.
+        if(shape){
+            DrjShapedItems* items = drj_alloc(ctx, sizeof *items + n * sizeof *values);
+            if(unlikely(!items))
+                return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate space for an item while setting member of an object"));
+            items->shape = shape;
+            drj_memcpy(items->values, values, n * sizeof *values);
+            DrJsonObject* object = &ctx->objects.data[f->container.object_idx];
+            object->object_items = items;
+            object->count = (uint32_t)n;
+            object->capacity = (uint32_t)n;
+            object->shaped = 1;
+            return DRJ_RUN_DONE;
+        }
+    }
+    void* items = n > CONTAINER_MAX? NULL : drj_alloc(ctx, drjson_size_for_object_of_length(n));
+    if(unlikely(!items))
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate space for an item while setting member of an object"));
+    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(items, n, &idxes, &pairs);
+    uint32_t count = 0;
+    if(!drj_obj_has_index(n)){
+        for(size_t i = 0; i < n; i++){
+            // A repeated key keeps its first position and its last value.
+            uint32_t pidx = drj_obj_find_linear(pairs, count, keys[i]);
+            if(pidx == UINT32_MAX)
+                pairs[count++] = (DrJsonObjectPair){.atom = keys[i], .value = values[i]};
+            else
+                pairs[pidx].value = values[i];
+        }
     }
     else {
-        // Moving backward: shift items right
-        drj_memmove(array->array_items + to_idx + 1,
-                   array->array_items + to_idx,
-                   (from_idx - to_idx) * sizeof(*array->array_items));
+        drj_memset(idxes, 0xff, 2*n*sizeof *idxes);
+        for(size_t i = 0; i < n; i++){
+            uint32_t hash = drj_atom_get_hash(keys[i]);
+            uint32_t idx = fast_reduce32(hash, (uint32_t)(2*n));
+            for(;;){
+                uint32_t pidx = idxes[idx].index;
+                if(pidx == UINT32_MAX){
+                    pairs[count] = (DrJsonObjectPair){.atom = keys[i], .value = values[i]};
+                    idxes[idx] = (DrJsonHashIndex){count++, hash};
+                    break;
+                }
+                // A repeated key keeps its first position and its last value.
+                if(idxes[idx].hash == hash && pairs[pidx].atom.bits == keys[i].bits){
+                    pairs[pidx].value = values[i];
+                    break;
+                }
+                idx++;
+                if(idx >= 2*n) idx = 0;
+            }
+        }
+        *drj_obj_get_tombstones(items, n) = 0;
     }
-
-    // Place item at new position
-    array->array_items[to_idx] = item;
-    return 0;
+    DrJsonObject* object = &ctx->objects.data[f->container.object_idx];
+    object->object_items = items;
+    object->count = count;
+    object->capacity = (uint32_t)n;
+    return DRJ_RUN_DONE;
 }
 
-DRJSON_API
+static inline
 int
-drjson_object_move_item(const DrJsonContext* ctx, DrJsonValue o, size_t from_idx, size_t to_idx){
-    if(o.kind != DRJSON_OBJECT) return 1;
-    DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(object->read_only) return 1;
-    if(from_idx >= object->count || to_idx >= object->count) return 1;
-    if(from_idx == to_idx) return 0; // Nothing to do
-
-    // Get pointers to object data
-    DrJsonHashIndex* idxes;
-    DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
-
-    // Save the pair to move
-    DrJsonObjectPair temp_pair = pairs[from_idx];
-
-    // Shift items to close the gap and make space
-    if(from_idx < to_idx){
-        // Moving forward: shift pairs left
-        drj_memmove(pairs + from_idx,
-                   pairs + from_idx + 1,
-                   (to_idx - from_idx) * sizeof(*pairs));
-    }
-    else {
-        // Moving backward: shift pairs right
-        drj_memmove(pairs + to_idx + 1,
-                   pairs + to_idx,
-                   (from_idx - to_idx) * sizeof(*pairs));
+drj_push_parser_close(DrJsonPushParser* p){
+    DrjParseFrame f = p->frames[--p->frame_count];
+    DrJsonValue v = f.container;
+    if(f.kind != DRJ_FRAME_NDJSON)
+        p->depth--;
+    if(p->validate)
+        return drj_push_parser_add(p, v);
+    if(drj_push_parser_build(p, &f) == DRJ_RUN_ERROR)
+        return DRJ_RUN_ERROR;
+    if(p->flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS){
+        if(f.kind == DRJ_FRAME_OBJECT)
+            v = drj_intern_object(p->ctx, v, 1);
+        else if(f.kind == DRJ_FRAME_ARRAY)
+            v = drj_intern_array(p->ctx, v, 1);
     }
+    return drj_push_parser_add(p, v);
+}
 
-    // Place pair at new position
-    pairs[to_idx] = temp_pair;
+// The error for running out of input with the innermost container open.
+static inline
+int
+drj_push_parser_fail_eof(DrJsonPushParser* p){
+    DrjParseFrame* f = &p->frames[p->frame_count-1];
+    if(f->kind == DRJ_FRAME_ARRAY)
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before closing ']'"));
+    if(f->has_key)
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before any values"));
+    if(f->kind == DRJ_FRAME_BRACELESS)
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof after ','"));
+    return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before closing '}'"));
+}
 
-    // Rebuild hash table since indices changed
-    drj_memset(idxes, 0xff, 2 * sizeof(*idxes) * object->capacity);
-    for(size_t i = 0; i < object->count; i++){
-        const DrJsonObjectPair* p = &pairs[i];
-        uint32_t hash = drj_atom_get_hash(p->atom);
-        uint32_t idx = fast_reduce32(hash, (uint32_t)(2*object->capacity));
-        while(idxes[idx].index != UINT32_MAX){
-            idx++;
-            if(idx >= 2*object->capacity) idx = 0;
+static inline
+int
+drj_push_parser_eof(DrJsonPushParser* p){
+    while(p->frame_count){
+        DrjParseFrame* f = &p->frames[p->frame_count-1];
+        switch(f->kind){
+            case DRJ_FRAME_ARRAY:
+            case DRJ_FRAME_OBJECT:
+                return drj_push_parser_fail_eof(p);
+            case DRJ_FRAME_BRACELESS:
+                if(f->has_key || f->expect == DRJ_EXPECT_ITEM)
+                    return drj_push_parser_fail_eof(p);
+                break;
+            default:
+                break;
         }
-        idxes[idx].index = (uint32_t)i;
+        if(drj_push_parser_close(p) == DRJ_RUN_ERROR)
+            return DRJ_RUN_ERROR;
     }
-
-    return 0;
+    if(!p->done)
+        return drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before any values"));
+    return DRJ_RUN_DONE;
 }
 
-force_inline
-int
-drjson_object_set_item(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom, DrJsonValue item){
-    if(o.kind != DRJSON_OBJECT) return 1;
-    DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(object->read_only) return 1;
-    enum {OBJECT_MAX = 0x1fffffff};
-    if(unlikely(object->count >= object->capacity)){
-        if(!object->capacity){
-            size_t new_cap = 4;
-            size_t size = drjson_size_for_object_of_length(new_cap);
-            void* p = drj_alloc(ctx, size);
-            if(!p) return 1;
-            drj_memset(drj_obj_get_idxes(p, new_cap), 0xff, 2*new_cap*sizeof(DrJsonHashIndex));
-            object->object_items = p;
-            object->capacity = (uint32_t)new_cap;
-        }
-        else {
-            size_t old_cap = object->capacity;
-            size_t new_cap = old_cap * 2;
-            if(new_cap > OBJECT_MAX) return 1;
-            void* p = drj_realloc(ctx, object->object_items, drjson_size_for_object_of_length(old_cap), drjson_size_for_object_of_length(new_cap));
-            if(!p) return 1;
-            DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
-            drj_get_obj_ptrs(p, new_cap, &idxes, &pairs);
-            drj_memset(idxes, 0xff, 2*new_cap * sizeof *idxes);
-            for(size_t i = 0; i < object->count; i++){
-                const DrJsonObjectPair* p = &pairs[i];
-                uint32_t hash = drj_atom_get_hash(p->atom);
-                uint32_t idx = fast_reduce32(hash, (uint32_t)(2*new_cap));
-                while(idxes[idx].index != UINT32_MAX){
-                    idx++;
-                    if(idx >= 2*new_cap) idx = 0;
+// Like drj_skip_whitespace, but a comment can continue into the next
+// buffer.
+static inline
+void
+drj_push_skip_whitespace(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    const char* cursor = ctx->cursor;
+    const char* end = ctx->end;
+    switch(p->comment){
+        case DRJ_COMMENT_LINE:
+            goto line;
+        case DRJ_COMMENT_BLOCK:
+            goto block;
+        case DRJ_COMMENT_BLOCK_STAR:
+            goto block_star;
+        default:
+            break;
+    }
+    strip:
+    p->comment = DRJ_COMMENT_NONE;
+    for(;cursor != end; cursor++){
+        if(*cursor <= 0x20) continue;
+        switch(*cursor){
+            case ',': case ':':
+            case '=':
+                continue;
+            case '/':
+                if(cursor + 1 == end){
+                    // Might be a comment, let the token logic hold onto
+                    // it until we see the next byte.
+                    if(input == DRJ_INPUT_EOF)
+                        cursor = end;
+                    goto done;
                 }
-                idxes[idx].index = (uint32_t)i;
-            }
-            object->object_items = p;
-            object->capacity = (uint32_t)new_cap;
-        }
-        #if 0
-        if(object->capacity <= 32){
-            DrJsonHashIndex* idxes = drj_obj_get_idxes(object->object_items, object->capacity);
-            uint64_t seent = 0;
-            for(size_t i = 0; i < object->capacity*2; i++){
-                if(idxes[i].index == UINT32_MAX) continue;
-                uint64_t mask = 1llu << idxes[i].index;
-                if(mask & seent){
-                    __builtin_debugtrap();
+                if(cursor[1] == '/'){
+                    cursor += 2;
+                    goto line;
                 }
-                seent |= mask;
-            }
+                if(cursor[1] == '*'){
+                    cursor += 2;
+                    goto block;
+                }
+                goto done; // let parses take it as an invalid character
+            default:
+                goto done;
         }
-        #endif
     }
-
-    #if 0
-    if(object->capacity <= 32){
-        DrJsonHashIndex* idxes = drj_obj_get_idxes(object->object_items, object->capacity);
-        uint64_t seent = 0;
-        for(size_t i = 0; i < object->capacity*2; i++){
-            if(idxes[i].index == UINT32_MAX) continue;
-            uint64_t mask = 1llu << idxes[i].index;
-            if(mask & seent){
-                __builtin_debugtrap();
-            }
-            seent |= mask;
+    goto done;
+    line:{
+        const char* nl = memchr(cursor, '\n', end - cursor);
+        if(!nl){
+            cursor = end;
+            p->comment = DRJ_COMMENT_LINE;
+            goto done;
         }
+        cursor = nl + 1;
+        goto strip;
     }
-    #endif
-    uint32_t capacity = object->capacity;
-    uint32_t hash = drj_atom_get_hash(atom);
-    uint32_t idx = fast_reduce32(hash, 2*capacity);
-    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
+    block:
     for(;;){
-        DrJsonHashIndex hi = idxes[idx];
-        if(hi.index == UINT32_MAX){
-            size_t pidx = object->count++;
-            DrJsonObjectPair* o = &pairs[pidx];
-            *o = (DrJsonObjectPair){
-                .atom=atom,
-                .value=item,
-            };
-            idxes[idx].index = (uint32_t)pidx;
-            return 0;
+        const char* star = memchr(cursor, '*', end - cursor);
+        if(!star){
+            cursor = end;
+            p->comment = DRJ_COMMENT_BLOCK;
+            goto done;
         }
-        DrJsonObjectPair* o = &pairs[hi.index];
-        if(o->atom.bits == atom.bits){
-            o->value = item;
-            return 0;
+        cursor = star + 1;
+        block_star:
+        if(cursor == end){
+            p->comment = DRJ_COMMENT_BLOCK_STAR;
+            goto done;
+        }
+        if(*cursor == '/'){
+            cursor++;
+            goto strip;
         }
-        idx++;
-        if(idx >= 2*capacity)
-            idx = 0;
     }
+    done:
+    ctx->cursor = cursor;
 }
 
-DRJSON_API
-int // 0 on success
-drjson_object_set_item_no_copy_key(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen, DrJsonValue item){
-    DrJsonAtom atom;
-    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, key, (uint32_t)keylen, 1, &atom);
-    if(err) return err;
-    return drjson_object_set_item(ctx, object, atom, item);
+// RFC 8259 whitespace only.
+force_inline
+void
+drj_skip_whitespace_strict(DrJsonParseContext* ctx){
+    const char* cursor = ctx->cursor;
+    const char* end = ctx->end;
+    while(cursor != end){
+        switch(*cursor){
+            case ' ':
+                // Indentation, 8 at a time.
+                if(end - cursor >= 8 && memcmp(cursor, "        ", 8) == 0){
+                    cursor += 8;
+                    continue;
+                }
+                cursor++;
+                continue;
+            case '\t':
+            case '\n': case '\r':
+                cursor++;
+                continue;
+            default:
+                goto done;
+        }
+    }
+    done:
+    ctx->cursor = cursor;
 }
 
-DRJSON_API
-int // 0 on success
-drjson_object_set_item_copy_key(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen, DrJsonValue item){
-    DrJsonAtom atom;
-    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, key, (uint32_t)keylen, 1, &atom);
-    if(err) return err;
-    return drjson_object_set_item(ctx, object, atom, item);
+// Finds the first character of a string's contents that RFC 8259 doesn't
+// allow: a raw control character or an escape json doesn't have. Returns
+// NULL if there is none.
+static inline
+const char*_Nullable
+drj_json_string_error(const char* p, const char* end){
+    for(;;){
+        // Skip 8 bytes at a time while none of them is below 0x20 or a
+        // backslash.
+        while(end - p >= 8){
+            uint64_t x;
+            drj_memcpy(&x, p, 8);
+            uint64_t bs = x ^ 0x5c5c5c5c5c5c5c5cULL;
+            if(((x - 0x2020202020202020ULL) & ~x & 0x8080808080808080ULL)
+            | ((bs - 0x0101010101010101ULL) & ~bs & 0x8080808080808080ULL))
+                break;
+            p += 8;
+        }
+        if(p == end) return NULL;
+        unsigned char c = (unsigned char)*p;
+        if(c < 0x20) return p;
+        p++;
+        if(c != '\\') continue;
+        // drj_scan_string never ends a string on an escaped quote, so the
+        // escaped character is always there.
+        switch(*p){
+            case '"': case '\\': case '/':
+            case 'b': case 'f': case 'n': case 'r': case 't':
+                p++;
+                continue;
+            case 'u':
+                p++;
+                for(int i = 0; i < 4; i++, p++){
+                    if(p == end) return p - 2 - i;
+                    switch(*p){
+                        case CASE_0_9:
+                        case CASE_a_f:
+                        case CASE_A_F:
+                            continue;
+                        default:
+                            return p - 2 - i;
+                    }
+                }
+                continue;
+            default:
+                return p - 1;
+        }
+    }
 }
 
-DRJSON_API
-int // 0 on success
-drjson_object_set_item_atom(DrJsonContext* ctx, DrJsonValue object, DrJsonAtom atom, DrJsonValue item){
-    return drjson_object_set_item(ctx, object, atom, item);
+// drj_parse_scalar without the extensions: only double quoted strings,
+// true/false/null and json numbers, with no falling back to bare strings.
+force_inline
+DrJsonValue
+drj_parse_scalar_strict(DrJsonParseContext* ctx, const _Bool validate){
+    const char* begin = ctx->cursor;
+    switch(*begin){
+        case '"':{
+            DrJsonValue v = drj_parse_string_impl(ctx, validate);
+            if(v.kind == DRJSON_ERROR) return v;
+            const char* bad = drj_json_string_error(begin+1, ctx->cursor-1);
+            if(unlikely(bad)){
+                ctx->cursor = bad;
+                if(*bad == '\\')
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Invalid escape in a string");
+                return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Unescaped control character in a string");
+            }
+            return v;
+        }
+        case 't':
+        case 'f':
+        case 'n':
+            return parse_bool_null(ctx);
+        case '-':
+        case CASE_0_9:{
+            // parse_number also takes leading zeros, "1." and "1e". It
+            // always takes the whole span of number characters, so checking
+            // that span is enough.
+            DrJsonValue v = parse_number(ctx);
+            if(v.kind == DRJSON_ERROR) return v;
+            if(unlikely(!drj_is_json_number(begin, ctx->cursor))){
+                ctx->cursor = begin;
+                return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Invalid json number");
+            }
+            return v;
+        }
+        default:
+            return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Character is not a valid starting character for json");
+    }
 }
 
-DRJSON_API
-int // 0 on success
-drjson_object_set_item_escape_key(DrJsonContext* ctx, DrJsonValue object, const char* restrict key, size_t keylen, DrJsonValue item){
-    DrJsonAtom atom;
-    int err = drjson_escape_string(ctx, key, keylen, &atom);
-    if(err) return err;
-    return drjson_object_set_item(ctx, object, atom, item);
+// Braceless ndjson: the line object is done. Anything nested in it is
+// unterminated, as tokens can't cross lines.
+static inline
+int
+drj_push_parser_end_line(DrJsonPushParser* p){
+    DrjParseFrame* f = &p->frames[p->frame_count-1];
+    if(p->frame_count > 2 || f->has_key || f->expect == DRJ_EXPECT_ITEM)
+        return drj_push_parser_fail_eof(p);
+    return drj_push_parser_close(p);
 }
-DRJSON_API
-int // 0 on success, 1 if key not found or error
-drjson_object_delete_item_atom(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom){
-    if(o.kind != DRJSON_OBJECT) return 1;
-    DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(object->read_only) return 1;
-    if(object->count == 0) return 1;
-    if(!object->capacity) return 1;
 
-    uint32_t capacity = object->capacity;
-    uint32_t hash = drj_atom_get_hash(atom);
-    uint32_t hash_idx = fast_reduce32(hash, 2*capacity);
-    DrJsonHashIndex* idxes;
-    DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
-
-    // Find the key in the hash table
-    uint32_t found_hash_slot = UINT32_MAX;
-    uint32_t found_pair_idx = UINT32_MAX;
+// Parses as much of the buffer as possible. When more input is needed,
+// ctx->cursor is left at the start of an incomplete token (or at the end).
+//
+// `strict` and `validate` are always constants: this is instantiated for
+// the liberal syntax and for DRJSON_PARSE_FLAG_STRICT, each both building
+// values and only validating, so none pays for the others' checks.
+force_inline
+int
+drj_push_parser_run_impl(DrJsonPushParser* p, DrJsonParseContext* ctx, int input, const _Bool strict, const _Bool validate){
+    const _Bool ndjson_lines = (p->flags & (DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT)) == (DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT);
+    const char* const end = ctx->end;
+    // Braceless ndjson objects end at the end of their line. `lim` is that
+    // newline if it is in this buffer.
+    const char* lim = end;
+    if(ndjson_lines && p->frame_count > 1){
+        const char* nl = memchr(ctx->cursor, '\n', end - ctx->cursor);
+        if(nl) lim = nl;
+    }
+    for(;;){
+        ctx->end = lim;
+        int here = lim == end? input : DRJ_INPUT_EOF;
+        if(strict)
+            drj_skip_whitespace_strict(ctx);
+        else if(here == DRJ_INPUT_EOF && p->comment == DRJ_COMMENT_NONE)
+            drj_skip_whitespace(ctx);
+        else
+            drj_push_skip_whitespace(p, ctx, here);
+        if(ctx->cursor == lim){
+            if(lim != end){
+                p->comment = DRJ_COMMENT_NONE;
+                if(drj_push_parser_end_line(p) == DRJ_RUN_ERROR)
+                    goto fail;
+                ctx->cursor = lim + 1;
+                lim = end;
+                continue;
+            }
+            if(input != DRJ_INPUT_EOF)
+                return DRJ_RUN_NEED_MORE;
+            return drj_push_parser_eof(p);
+        }
+        // Could be the start of a comment.
+        if(!strict && here == DRJ_INPUT_MORE && ctx->cursor + 1 == lim && *ctx->cursor == '/')
+            return DRJ_RUN_NEED_MORE;
+        if(p->done){
+            if(!(p->flags & DRJSON_PARSE_FLAG_ERROR_ON_TRAILING)){
+                ctx->cursor = end;
+                return DRJ_RUN_DONE;
+            }
+            drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_TRAILING_CONTENT, "Unexpected content after JSON value"));
+            goto fail;
+        }
+        char c = *ctx->cursor;
+        _Bool is_key = 0;
+        if(p->frame_count){
+            DrjParseFrame* f = &p->frames[p->frame_count-1];
+            if(strict && f->kind != DRJ_FRAME_NDJSON){
+                // The separators are whitespace in the liberal syntax.
+                switch(f->expect){
+                    case DRJ_EXPECT_SEPARATOR:
+                        if(c == ','){
+                            ctx->cursor++;
+                            f->expect = DRJ_EXPECT_ITEM;
+                            continue;
+                        }
+                        if(c == (f->kind == DRJ_FRAME_ARRAY? ']' : '}') && f->kind != DRJ_FRAME_BRACELESS)
+                            break;
+                        drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_INVALID_CHAR, f->kind == DRJ_FRAME_ARRAY? "Expected ',' or ']' after an array item" : "Expected ',' or '}' after an object member"));
+                        goto fail;
+                    case DRJ_EXPECT_COLON:
+                        if(c != ':'){
+                            drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Expected ':' after an object key"));
+                            goto fail;
+                        }
+                        ctx->cursor++;
+                        f->expect = DRJ_EXPECT_VALUE;
+                        continue;
+                    case DRJ_EXPECT_ITEM:
+                        if(c == ']' || c == '}'){
+                            drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Trailing ','"));
+                            goto fail;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            switch(f->kind){
+                case DRJ_FRAME_ARRAY:
+                    if(c == ']'){
+                        ctx->cursor++;
+                        if(drj_push_parser_close(p) == DRJ_RUN_ERROR)
+                            goto fail;
+                        goto added;
+                    }
+                    break;
+                case DRJ_FRAME_OBJECT:
+                    if(f->has_key) break;
+                    if(c == '}'){
+                        ctx->cursor++;
+                        if(drj_push_parser_close(p) == DRJ_RUN_ERROR)
+                            goto fail;
+                        goto added;
+                    }
+                    is_key = 1;
+                    break;
+                case DRJ_FRAME_BRACELESS:
+                    if(!f->has_key)
+                        is_key = 1;
+                    break;
+                case DRJ_FRAME_NDJSON:
+                    if(!ndjson_lines) break;
+                    // Each line is a braceless object.
+                    if(drj_push_parser_push_frame(p, DRJ_FRAME_BRACELESS, validate? drjson_make_null() : drjson_make_object(p->ctx)) == DRJ_RUN_ERROR)
+                        goto fail;
+                    const char* nl = memchr(ctx->cursor, '\n', end - ctx->cursor);
+                    if(nl) lim = nl;
+                    continue;
+            }
+        }
+        if(!is_key){
+            if(unlikely(p->depth >= p->max_depth)){
+                drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_TOO_DEEP, "Too many levels of nesting."));
+                goto fail;
+            }
+            if(c == '{' || c == '['){
+                DrJsonValue container = validate? drjson_make_null()
+                                      : c == '{'? drjson_make_object(p->ctx)
+                                      : drjson_make_array(p->ctx);
+                if(drj_push_parser_push_frame(p, c == '{'? DRJ_FRAME_OBJECT : DRJ_FRAME_ARRAY, container) == DRJ_RUN_ERROR)
+                    goto fail;
+                ctx->cursor++;
+                continue;
+            }
+        }
+        const char* start = ctx->cursor;
+        _Bool quoted = strict? c == '"' : c == '"' || c == '\'';
+        if(here == DRJ_INPUT_MORE && !quoted){
+            const char* e = start + 1;
+            while(e != lim && drj_is_bare_char(*e))
+                e++;
+            if(e == lim)
+                return DRJ_RUN_NEED_MORE;
+        }
+        DrJsonValue v;
+        if(strict){
+            if(is_key && !quoted)
+                v = drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Expected a '\"' to begin an object key");
+            else
+                v = drj_parse_scalar_strict(ctx, validate);
+        }
+        else
+            v = is_key? drj_parse_string_impl(ctx, validate) : drj_parse_scalar_impl(ctx, validate);
+        if(v.kind == DRJSON_ERROR){
+            // No closing quote yet.
+            _Bool dummy;
+            if(quoted && here == DRJ_INPUT_MORE && v.error_code == DRJSON_ERROR_INVALID_CHAR && !drj_scan_string(start+1, lim, c, &dummy)){
+                ctx->cursor = start;
+                return DRJ_RUN_NEED_MORE;
+            }
+            drj_push_parser_fail(p, v);
+            goto fail;
+        }
+        if(is_key){
+            DrjParseFrame* f = &p->frames[p->frame_count-1];
+            f->key = v.atom;
+            f->has_key = 1;
+            f->expect = DRJ_EXPECT_COLON;
+            continue;
+        }
+        if(drj_push_parser_add(p, v) == DRJ_RUN_ERROR)
+            goto fail;
+        added:
+        // Like drjson_parse always has, leave the cursor just after the
+        // value.
+        if(p->done && input == DRJ_INPUT_EOF && !(p->flags & DRJSON_PARSE_FLAG_ERROR_ON_TRAILING)){
+            ctx->end = end;
+            return DRJ_RUN_DONE;
+        }
+    }
+    fail:
+    ctx->end = end;
+    return DRJ_RUN_ERROR;
+}
 
-    for(uint32_t idx = hash_idx;;){
-        DrJsonHashIndex hi = idxes[idx];
-        if(hi.index == UINT32_MAX) return 1; // Not found
+static
+int
+drj_push_parser_run_liberal(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    return drj_push_parser_run_impl(p, ctx, input, 0, 0);
+}
 
-        if(pairs[hi.index].atom.bits == atom.bits){
-            found_hash_slot = idx;
-            found_pair_idx = hi.index;
-            break;
-        }
+static
+int
+drj_push_parser_run_strict(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    return drj_push_parser_run_impl(p, ctx, input, 1, 0);
+}
 
-        idx++;
-        if(idx >= 2*capacity) idx = 0;
-    }
+static
+int
+drj_push_parser_run_validate_liberal(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    return drj_push_parser_run_impl(p, ctx, input, 0, 1);
+}
 
-    // Step 1: Shift pairs array to remove the deleted pair
-    // This preserves insertion order
-    if(found_pair_idx < object->count - 1u)
-        memmove(&pairs[found_pair_idx], &pairs[found_pair_idx + 1], (object->count - found_pair_idx - 1) * sizeof * pairs);
-    object->count--;
+static
+int
+drj_push_parser_run_validate_strict(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    return drj_push_parser_run_impl(p, ctx, input, 1, 1);
+}
 
-    // Step 2: Decrement all hash indices > found_pair_idx
-    // (they now point to shifted pairs)
-    for(uint32_t i = 0; i < 2*capacity; i++){
-        if(idxes[i].index != UINT32_MAX && idxes[i].index > found_pair_idx)
-            idxes[i].index--;
+static inline
+int
+drj_push_parser_run(DrJsonPushParser* p, DrJsonParseContext* ctx, int input){
+    if(p->validate){
+        if(p->flags & DRJSON_PARSE_FLAG_STRICT)
+            return drj_push_parser_run_validate_strict(p, ctx, input);
+        return drj_push_parser_run_validate_liberal(p, ctx, input);
     }
+    if(p->flags & DRJSON_PARSE_FLAG_STRICT)
+        return drj_push_parser_run_strict(p, ctx, input);
+    return drj_push_parser_run_liberal(p, ctx, input);
+}
 
-    // Step 3: Fix the probe chain using backward shift deletion
-    // This maintains the linear probing invariant
-    uint32_t i = found_hash_slot;
-    for(;;){
-        uint32_t j = i;
+// Sets up the implicit top level container, if any.
+static inline
+int
+drj_push_parser_open_root(DrJsonPushParser* p){
+    int r = DRJ_RUN_DONE;
+    if(p->flags & DRJSON_PARSE_FLAG_NDJSON)
+        r = drj_push_parser_push_frame(p, DRJ_FRAME_NDJSON, p->validate? drjson_make_null() : drjson_make_array(p->ctx));
+    else if(p->flags & DRJSON_PARSE_FLAG_BRACELESS_OBJECT)
+        r = drj_push_parser_push_frame(p, DRJ_FRAME_BRACELESS, p->validate? drjson_make_null() : drjson_make_object(p->ctx));
+    return r == DRJ_RUN_ERROR;
+}
 
-        // Look ahead in the probe sequence
-        for(;;){
-            j++;
-            if(j >= 2*capacity) j = 0;
+static inline
+int
+drj_push_parser_init(DrJsonPushParser* p, DrJsonContext* ctx, unsigned flags){
+    *p = (DrJsonPushParser){
+        .ctx = ctx,
+        .flags = flags,
+        .max_depth = DRJSON_DEFAULT_MAX_DEPTH,
+        .frame_capacity = sizeof p->inline_frames / sizeof p->inline_frames[0],
+    };
+    p->frames = p->inline_frames;
+    return drj_push_parser_open_root(p);
+}
 
-            // If we hit an empty slot, we're done
-            if(idxes[j].index == UINT32_MAX){
-                idxes[i].index = UINT32_MAX;
-                return 0;
-            }
+static inline
+void
+drj_push_parser_release(DrJsonPushParser* p){
+    if(p->frames != p->inline_frames)
+        drj_free(p->ctx, p->frames, p->frame_capacity * sizeof *p->frames);
+    if(p->values)
+        drj_free(p->ctx, p->values, p->value_capacity * sizeof *p->values);
+    if(p->keys)
+        drj_free(p->ctx, p->keys, p->key_capacity * sizeof *p->keys);
+}
 
-            // Check if element at j can move to slot i
-            // It can move if its ideal position is NOT in the range (i, j]
-            uint32_t pair_hash = drj_atom_get_hash(pairs[idxes[j].index].atom);
-            uint32_t k = fast_reduce32(pair_hash, 2*capacity);
+DRJSON_API
+DrJsonValue
+drjson_parse(DrJsonParseContext* ctx, unsigned flags){
+    if(!(flags & DRJSON_PARSE_FLAG_NO_COPY_STRINGS))
+        ctx->_copy_strings = 1;
+    if(flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS)
+        ctx->_read_only_objects = 1;
+    if(flags & DRJSON_PARSE_FLAG_LAZY_NUMBERS)
+        ctx->_lazy_numbers = 1;
+    DrJsonPushParser p;
+    if(drj_push_parser_init(&p, ctx->ctx, flags))
+        return p.result;
+    if(ctx->max_depth)
+        p.max_depth = ctx->max_depth;
+    p.depth += ctx->depth;
+    drj_push_parser_run(&p, ctx, DRJ_INPUT_EOF);
+    drj_push_parser_release(&p);
+    return p.result;
+}
 
-            // Check if k is in range (i, j] (with wrapping)
-            _Bool k_in_range;
-            if(i < j)
-                k_in_range = (k > i && k <= j);
-            else // Wrapped range
-                k_in_range = (k > i || k <= j);
+DRJSON_API
+DrJsonValue
+drjson_parse_string(DrJsonContext* jctx, const char* text, size_t length, unsigned flags){
+    DrJsonParseContext ctx = {
+        .ctx = jctx,
+        .begin = text,
+        .cursor = text,
+        .end = text+length,
+        .depth = 0,
+    };
+    return drjson_parse(&ctx, flags);
+}
 
-            if(!k_in_range)
-                break; // Element at j wants to be at k, which is not in (i,j]
-                       // So it was probing through i, and we can move it back
-        }
+DRJSON_API
+DrJsonErrorCode
+drjson_validate(const char* text, size_t length, unsigned flags, size_t*_Nullable line, size_t*_Nullable column){
+    // Deep enough that the frame stack never grows, so there's no
+    // context to allocate from.
+    DrjParseFrame frames[DRJSON_DEFAULT_MAX_DEPTH+2];
+    DrJsonPushParser p = {
+        .flags = flags,
+        .validate = 1,
+        .max_depth = DRJSON_DEFAULT_MAX_DEPTH,
+        .frames = frames,
+        .frame_capacity = sizeof frames / sizeof frames[0],
+    };
+    DrJsonParseContext ctx = {
+        .begin = text,
+        .cursor = text,
+        .end = text+length,
+    };
+    if(!drj_push_parser_open_root(&p))
+        drj_push_parser_run(&p, &ctx, DRJ_INPUT_EOF);
+    if(!p.failed)
+        return DRJSON_ERROR_NONE;
+    size_t l, c;
+    drjson_get_line_column(&ctx, &l, &c);
+    if(line) *line = l;
+    if(column) *column = c;
+    return p.result.error_code;
+}
 
-        // Move element from j to i
-        idxes[i] = idxes[j];
-        i = j;
+DRJSON_API
+DrJsonPushParser*_Nullable
+drjson_push_parser_create(DrJsonContext* ctx, unsigned flags){
+    DrJsonPushParser* p = drj_alloc(ctx, sizeof *p);
+    if(!p) return NULL;
+    if(drj_push_parser_init(p, ctx, flags)){
+        drjson_push_parser_free(p);
+        return NULL;
     }
+    return p;
 }
 
 DRJSON_API
-int // 0 on success, 1 if key not found or error
-drjson_object_delete_item(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen){
-    DrJsonAtom atom;
-    int err = drj_get_atom_no_alloc(&ctx->atoms, key, (uint32_t)keylen, &atom);
-    if(err) return 1; // Key not in atom table means it's not in the object
-    return drjson_object_delete_item_atom(ctx, object, atom);
+void
+drjson_push_parser_set_max_depth(DrJsonPushParser* p, int max_depth){
+    p->max_depth = max_depth;
 }
 
 DRJSON_API
-int // 0 on success, 1 if key not found or error
-drjson_object_replace_key_atom(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom old_key, DrJsonAtom new_key){
-    if(o.kind != DRJSON_OBJECT) return 1;
-    DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(object->read_only) return 1;
-    if(object->count == 0) return 1;
-    if(!object->capacity) return 1;
-
-    uint32_t capacity = object->capacity;
-    DrJsonHashIndex* idxes;
-    DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
+void
+drjson_push_parser_free(DrJsonPushParser* p){
+    drj_push_parser_release(p);
+    if(p->carry)
+        drj_free(p->ctx, p->carry, p->carry_capacity);
+    drj_free(p->ctx, p, sizeof *p);
+}
 
-    // Find the old key in the pairs array
-    uint32_t found_pair_idx = UINT32_MAX;
-    for(uint32_t i = 0; i < object->count; i++){
-        if(pairs[i].atom.bits == old_key.bits){
-            found_pair_idx = i;
-            break;
+// How much of `chunk` continues the token held in the carry buffer.
+static inline
+size_t
+drj_push_parser_token_extent(const DrJsonPushParser* p, const char* chunk, size_t length, _Bool* complete){
+    char first = p->carry[0];
+    *complete = 1;
+    if(first == '"' || first == '\''){
+        const unsigned line_flags = DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
+        _Bool lines = (p->flags & line_flags) == line_flags && p->frame_count > 1;
+        _Bool escaped = 0;
+        for(size_t i = p->carry_length; i > 1 && p->carry[i-1] == '\\'; i--)
+            escaped = !escaped;
+        for(size_t i = 0; i < length; i++){
+            char c = chunk[i];
+            if(escaped)
+                escaped = 0;
+            else if(c == '\\')
+                escaped = 1;
+            else if(c == first)
+                return i + 1;
+            else if(c == '\n' && lines)
+                return i;
         }
+        *complete = 0;
+        return length;
     }
+    size_t i = 0;
+    while(i < length && drj_is_bare_char(chunk[i]))
+        i++;
+    *complete = i < length;
+    return i;
+}
 
-    if(found_pair_idx == UINT32_MAX) return 1; // Key not found
-
-    // Check if new_key already exists (and is not the same as old_key)
-    if(new_key.bits != old_key.bits){
-        uint32_t new_key_hash = drj_atom_get_hash(new_key);
-        uint32_t idx = fast_reduce32(new_key_hash, 2*capacity);
-        for(;;){
-            DrJsonHashIndex hi = idxes[idx];
-            if(hi.index == UINT32_MAX) break; // New key doesn't exist, safe to proceed
-            if(pairs[hi.index].atom.bits == new_key.bits){
-                // New key already exists in the object
-                return 1; // Would create duplicate
-            }
-            idx++;
-            if(idx >= 2*capacity) idx = 0;
+static inline
+int
+drj_push_parser_carry(DrJsonPushParser* p, const char* data, size_t length){
+    if(p->carry_length + length > p->carry_capacity){
+        size_t new_cap = p->carry_capacity? p->carry_capacity : 64;
+        while(new_cap < p->carry_length + length)
+            new_cap *= 2;
+        char* carry = drj_realloc(p->ctx, p->carry, p->carry_capacity, new_cap);
+        if(!carry){
+            drj_push_parser_fail(p, drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to buffer a token"));
+            return 1;
         }
+        p->carry = carry;
+        p->carry_capacity = new_cap;
     }
+    memcpy(p->carry + p->carry_length, data, length);
+    p->carry_length += length;
+    return 0;
+}
 
-    // Replace the key in the pair
-    pairs[found_pair_idx].atom = new_key;
+// Parses the buffered token. On success it is fully consumed, apart from
+// `*left` bytes at its end when `input` is DRJ_INPUT_MORE.
+static inline
+int
+drj_push_parser_run_carry(DrJsonPushParser* p, int input, size_t*_Nullable left){
+    DrJsonParseContext pctx = {
+        .cursor = p->carry,
+        .end = p->carry + p->carry_length,
+        .begin = p->carry,
+        .ctx = p->ctx,
+        ._copy_strings = 1,
+        ._read_only_objects = !!(p->flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS),
+        ._lazy_numbers = !!(p->flags & DRJSON_PARSE_FLAG_LAZY_NUMBERS),
+    };
+    int r = drj_push_parser_run(p, &pctx, input);
+    drj_advance_line_column(&p->line, &p->column, pctx.begin, pctx.cursor);
+    if(left) *left = pctx.end - pctx.cursor;
+    p->carry_length = 0;
+    return r;
+}
 
-    // Rebuild the hash table
-    drj_memset(idxes, 0xff, 2*capacity * sizeof *idxes);
-    for(uint32_t i = 0; i < object->count; i++){
-        const DrJsonObjectPair* p = &pairs[i];
-        uint32_t hash = drj_atom_get_hash(p->atom);
-        uint32_t idx = fast_reduce32(hash, 2*capacity);
-        while(idxes[idx].index != UINT32_MAX){
-            idx++;
-            if(idx >= 2*capacity) idx = 0;
+DRJSON_API
+int
+drjson_parse_feed(DrJsonPushParser* p, const char* chunk, size_t length){
+    if(p->failed) return 1;
+    if(p->finished) return 0;
+    if(p->done && !(p->flags & DRJSON_PARSE_FLAG_ERROR_ON_TRAILING)) return 0;
+    if(!length) return 0;
+    if(p->carry_length){
+        _Bool complete;
+        size_t take = drj_push_parser_token_extent(p, chunk, length, &complete);
+        if(drj_push_parser_carry(p, chunk, take))
+            return 1;
+        if(!complete)
+            return 0;
+        // Whether a '/' ending the token starts a bare string or is skipped
+        // (before the end of a braceless ndjson line) depends on the byte
+        // after it, so hold off until that byte is parsed with it.
+        int input = DRJ_INPUT_BOUNDARY;
+        if(p->carry[p->carry_length-1] == '/' && take < length){
+            if(drj_push_parser_carry(p, chunk+take, 1))
+                return 1;
+            take++;
+            input = DRJ_INPUT_MORE;
         }
-        idxes[idx].index = i;
+        size_t left = 0;
+        if(drj_push_parser_run_carry(p, input, &left) == DRJ_RUN_ERROR)
+            return 1;
+        // Only the extra byte can be left over: it wasn't a bare character.
+        assert(left <= 1);
+        take -= left;
+        chunk += take;
+        length -= take;
+    }
+    DrJsonParseContext pctx = {
+        .cursor = chunk,
+        .end = chunk + length,
+        .begin = chunk,
+        .ctx = p->ctx,
+        ._copy_strings = 1,
+        ._read_only_objects = !!(p->flags & DRJSON_PARSE_FLAG_INTERN_OBJECTS),
+        ._lazy_numbers = !!(p->flags & DRJSON_PARSE_FLAG_LAZY_NUMBERS),
+    };
+    int r = drj_push_parser_run(p, &pctx, DRJ_INPUT_MORE);
+    drj_advance_line_column(&p->line, &p->column, pctx.begin, pctx.cursor);
+    if(r == DRJ_RUN_ERROR)
+        return 1;
+    if(pctx.cursor != pctx.end){
+        if(drj_push_parser_carry(p, pctx.cursor, pctx.end - pctx.cursor))
+            return 1;
     }
-
     return 0;
 }
 
 DRJSON_API
-int // 0 on success, 1 if key already exists, index out of bounds, or error
-drjson_object_insert_item_at_index(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom key, DrJsonValue item, size_t index){
-    if(o.kind != DRJSON_OBJECT) return 1;
-    DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(object->read_only) return 1;
-
-    // Check if index is valid (can be 0 to count inclusive, where count means append)
-    if(index > object->count) return 1;
+DrJsonValue
+drjson_parse_finish(DrJsonPushParser* p){
+    if(p->failed || p->finished) return p->result;
+    p->finished = 1;
+    if(p->carry_length){
+        drj_push_parser_run_carry(p, DRJ_INPUT_EOF, NULL);
+        return p->result;
+    }
+    DrJsonParseContext pctx = {
+        .cursor = "",
+        .end = "",
+        .begin = "",
+        .ctx = p->ctx,
+        ._lazy_numbers = !!(p->flags & DRJSON_PARSE_FLAG_LAZY_NUMBERS),
+    };
+    drj_push_parser_run(p, &pctx, DRJ_INPUT_EOF);
+    return p->result;
+}
 
-    enum {OBJECT_MAX = 0x1fffffff};
+DRJSON_API
+void
+drjson_push_parser_get_line_column(const DrJsonPushParser* p, size_t* line, size_t* column){
+    *line = p->line;
+    *column = p->column;
+}
 
-    // Check if key already exists
-    if(object->count > 0 && object->capacity > 0){
-        uint32_t capacity = object->capacity;
-        uint32_t hash = drj_atom_get_hash(key);
-        uint32_t hash_idx = fast_reduce32(hash, 2*capacity);
-        DrJsonHashIndex* idxes;
-        DrJsonObjectPair* pairs;
-        drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
+// Turns a packed array back into DrJsonValues, for when it's given an item
+// of another kind.
+static
+int
+drj_array_unpack(const DrJsonContext* ctx, DrJsonArray* array){
+    size_t cap = array->capacity;
+    DrJsonValue* items = drj_alloc(ctx, cap * sizeof *items);
+    if(!items) return 1;
+    for(size_t i = 0; i < array->count; i++)
+        items[i] = drj_array_get(array, i);
+    drj_free(ctx, array->uintegers, cap * sizeof(uint64_t));
+    array->array_items = items;
+    array->packed = 0;
+    return 0;
+}
 
-        for(uint32_t idx = hash_idx;;){
-            DrJsonHashIndex hi = idxes[idx];
-            if(hi.index == UINT32_MAX) break; // Key doesn't exist, safe to proceed
+// Packs an array of DrJsonValues if it can be.
+static
+int
+drj_array_pack(const DrJsonContext* ctx, DrJsonArray* array){
+    unsigned packed = drj_array_packable(array->array_items, array->count);
+    if(!packed) return 0;
+    size_t cap = array->capacity;
+    void* numbers = drj_alloc(ctx, cap * sizeof(uint64_t));
+    if(!numbers) return 1;
+    DrJsonValue* items = array->array_items;
+    array->uintegers = numbers;
+    array->packed = packed;
+    for(size_t i = 0; i < array->count; i++)
+        drj_array_put(array, i, items[i]);
+    drj_free(ctx, items, cap * sizeof *items);
+    return 0;
+}
 
-            if(pairs[hi.index].atom.bits == key.bits){
-                // Key already exists
-                return 1;
-            }
+DRJSON_API
+const double*_Nullable
+drjson_array_numbers(const DrJsonContext* ctx, DrJsonValue a, size_t* count){
+    if(a.kind != DRJSON_ARRAY) return NULL;
+    const DrJsonArray* array = &ctx->arrays.data[a.array_idx];
+    if(array->packed != DRJSON_NUMBER) return NULL;
+    *count = array->count;
+    return array->numbers;
+}
 
-            idx++;
-            if(idx >= 2*capacity) idx = 0;
-        }
-    }
-
-    // Ensure capacity (same logic as drjson_object_set_item)
-    if(unlikely(object->count >= object->capacity)){
-        if(!object->capacity){
-            size_t new_cap = 4;
-            size_t size = drjson_size_for_object_of_length(new_cap);
-            void* p = drj_alloc(ctx, size);
-            if(!p) return 1;
-            drj_memset(drj_obj_get_idxes(p, new_cap), 0xff, 2*new_cap*sizeof(DrJsonHashIndex));
-            object->object_items = p;
-            object->capacity = (uint32_t)new_cap;
-        }
-        else {
-            size_t old_cap = object->capacity;
-            size_t new_cap = old_cap * 2;
-            if(new_cap > OBJECT_MAX) return 1;
-            void* p = drj_realloc(ctx, object->object_items, drjson_size_for_object_of_length(old_cap), drjson_size_for_object_of_length(new_cap));
-            if(!p) return 1;
-            object->object_items = p;
-            object->capacity = (uint32_t)new_cap;
-            // Hash table will be rebuilt below
-        }
-    }
-
-    uint32_t capacity = object->capacity;
-    DrJsonHashIndex* idxes;
-    DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
-
-    // Shift pairs from index onwards to make room
-    if(index < object->count){
-        memmove(&pairs[index + 1], &pairs[index], (object->count - index) * sizeof(*pairs));
-    }
-
-    // Insert the new pair at the specified index
-    pairs[index] = (DrJsonObjectPair){
-        .atom = key,
-        .value = item,
-    };
-    object->count++;
+DRJSON_API
+const int64_t*_Nullable
+drjson_array_integers(const DrJsonContext* ctx, DrJsonValue a, size_t* count){
+    if(a.kind != DRJSON_ARRAY) return NULL;
+    const DrJsonArray* array = &ctx->arrays.data[a.array_idx];
+    if(array->packed != DRJSON_INTEGER) return NULL;
+    *count = array->count;
+    return array->integers;
+}
 
-    // Rebuild the hash table to point to all pairs in their new positions
-    drj_memset(idxes, 0xff, 2*capacity * sizeof(*idxes));
-    for(uint32_t i = 0; i < object->count; i++){
-        const DrJsonObjectPair* p = &pairs[i];
-        uint32_t hash = drj_atom_get_hash(p->atom);
-        uint32_t idx = fast_reduce32(hash, 2*capacity);
-        while(idxes[idx].index != UINT32_MAX){
-            idx++;
-            if(idx >= 2*capacity) idx = 0;
-        }
-        idxes[idx].index = i;
-    }
+DRJSON_API
+const uint64_t*_Nullable
+drjson_array_uintegers(const DrJsonContext* ctx, DrJsonValue a, size_t* count){
+    if(a.kind != DRJSON_ARRAY) return NULL;
+    const DrJsonArray* array = &ctx->arrays.data[a.array_idx];
+    if(array->packed != DRJSON_UINTEGER) return NULL;
+    *count = array->count;
+    return array->uintegers;
+}
 
+static inline
+int
+drj_array_grow(const DrJsonContext* ctx, DrJsonArray* array){
+    size_t old_cap = array->capacity;
+    enum {ARRAY_MAX = 0x1fffffff};
+    size_t new_cap = old_cap?old_cap*2:4;
+    if(new_cap > ARRAY_MAX) return 1;
+    size_t size = drj_array_item_size(array);
+    void* new_items = drj_realloc(ctx, array->array_items, old_cap*size, new_cap*size);
+    if(!new_items) return 1;
+    array->array_items = new_items;
+    array->capacity = (uint32_t)new_cap;
     return 0;
 }
 
 DRJSON_API
-DrJsonValue
-drjson_object_get_item_atom(const DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom){
-    if(o.kind != DRJSON_OBJECT) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "not an object");
-    uint32_t hash = drj_atom_get_hash(atom);
-    const DrJsonObject* object = &ctx->objects.data[o.object_idx];
-    if(!object->capacity)
-        return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
-    uint32_t capacity = object->capacity;
-    uint32_t idx = fast_reduce32(hash, 2*capacity);
-    DrJsonHashIndex* his; DrJsonObjectPair* pairs;
-    drj_get_obj_ptrs(object->object_items, object->capacity, &his, &pairs);
-    for(;;){
-        DrJsonHashIndex hi = his[idx];
-        if(hi.index == UINT32_MAX) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
-        const DrJsonObjectPair* o = &pairs[hi.index];
-        if(o->atom.bits == atom.bits)
-            return o->value;
-        idx++;
-        if(idx >= 2*capacity)
-            idx = 0;
-    }
+int // 0 on success
+drjson_array_push_item(const DrJsonContext* ctx, DrJsonValue a, DrJsonValue item){
+    if(a.kind != DRJSON_ARRAY) return 1;
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only) return 1;
+    drj_gc_barrier(ctx, item);
+    if(array->packed && !drj_array_fits(array->packed, item) && drj_array_unpack(ctx, array)) return 1;
+    if(array->capacity < array->count+1u && drj_array_grow(ctx, array)) return 1;
+    drj_array_put(array, array->count++, item);
+    return 0;
 }
 
 DRJSON_API
-DrJsonValue
-drjson_object_get_item(const DrJsonContext* ctx, DrJsonValue o, const char* key, size_t keylen){
-    DrJsonAtom atom;
-    int err = drj_get_atom_no_alloc(&ctx->atoms, key, (uint32_t)keylen, &atom);
-    if(err) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
-    return drjson_object_get_item_atom(ctx, o, atom);
+int // 0 on success
+drjson_array_insert_item(const DrJsonContext* ctx, DrJsonValue a, size_t idx, DrJsonValue item){
+    if(a.kind != DRJSON_ARRAY) return 1;
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(idx == array->count) return drjson_array_push_item(ctx, a, item);
+    if(array->read_only) return 1;
+    if(idx >= array->count) return 1;
+    drj_gc_barrier(ctx, item);
+    if(array->packed && !drj_array_fits(array->packed, item) && drj_array_unpack(ctx, array)) return 1;
+    if(array->capacity < array->count+1u && drj_array_grow(ctx, array)) return 1;
+    size_t nmove = array->count - idx;
+    size_t size = drj_array_item_size(array);
+    char* items = (char*)array->array_items;
+    drj_memmove(items+(idx+1)*size, items+idx*size, nmove * size);
+    drj_array_put(array, idx, item);
+    array->count++;
+    return 0;
 }
 
 DRJSON_API
 DrJsonValue
-drjson_checked_query(const DrJsonContext* ctx, DrJsonValue v, int type, const char* query, size_t query_length){
-    DrJsonValue o = drjson_query(ctx, v, query, query_length);
-    if(o.kind == DRJSON_ERROR) return o;
-    if(o.kind != type)
-        return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Wrong type");
-    return o;
+drjson_array_pop_item(const DrJsonContext* ctx, DrJsonValue a){
+    if(a.kind != DRJSON_ARRAY) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is not an array");
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only)
+        return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is read only");
+    if(!array->count)
+        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Array is empty");
+    return drj_array_get(array, --array->count);
 }
 
 DRJSON_API
 int
-drjson_deep_eq(const DrJsonContext* ctx, DrJsonValue a, DrJsonValue b){
-    // Different types are not equal, except for numeric types
-    if(a.kind != b.kind){
-        // Allow comparison between different numeric types
-        if((a.kind == DRJSON_INTEGER || a.kind == DRJSON_UINTEGER || a.kind == DRJSON_NUMBER) &&
-           (b.kind == DRJSON_INTEGER || b.kind == DRJSON_UINTEGER || b.kind == DRJSON_NUMBER)){
-
-            // INTEGER vs UINTEGER
-            if(a.kind == DRJSON_INTEGER && b.kind == DRJSON_UINTEGER){
-                if(a.integer < 0) return 0;
-                return (uint64_t)a.integer == b.uinteger;
-            }
-            if(a.kind == DRJSON_UINTEGER && b.kind == DRJSON_INTEGER){
-                if(b.integer < 0) return 0;
-                return a.uinteger == (uint64_t)b.integer;
-            }
-
-            // INTEGER vs NUMBER
-            if(a.kind == DRJSON_INTEGER && b.kind == DRJSON_NUMBER){
-                // Check if b is an integer value
-                if(b.number != (double)(int64_t)b.number) return 0;
-                return a.integer == (int64_t)b.number;
-            }
-            if(a.kind == DRJSON_NUMBER && b.kind == DRJSON_INTEGER){
-                if(a.number != (double)(int64_t)a.number) return 0;
-                return (int64_t)a.number == b.integer;
-            }
-
-            // UINTEGER vs NUMBER
-            if(a.kind == DRJSON_UINTEGER && b.kind == DRJSON_NUMBER){
-                if(b.number < 0) return 0;
-                if(b.number != (double)(uint64_t)b.number) return 0;
-                return a.uinteger == (uint64_t)b.number;
-            }
-            if(a.kind == DRJSON_NUMBER && b.kind == DRJSON_UINTEGER){
-                if(a.number < 0) return 0;
-                if(a.number != (double)(uint64_t)a.number) return 0;
-                return (uint64_t)a.number == b.uinteger;
-            }
-        }
-        return 0;
-    }
-
-    switch(a.kind){
-        case DRJSON_NULL:
-            return 1;
-        case DRJSON_BOOL:
-            return a.boolean == b.boolean;
-        case DRJSON_INTEGER:
-            return a.integer == b.integer;
-        case DRJSON_UINTEGER:
-            return a.uinteger == b.uinteger;
-        case DRJSON_NUMBER:
-            return a.number == b.number;
-        case DRJSON_STRING:{
-            const char *a_str, *b_str;
-            size_t a_len, b_len;
-            int a_err = drj_get_str_and_len(ctx, a, &a_str, &a_len);
-            int b_err = drj_get_str_and_len(ctx, b, &b_str, &b_len);
-            if(a_err) return b_err == a_err;
-            if(b_err) return 0;
-            if(a_len != b_len) return 0;
-            return memcmp(a_str, b_str, a_len) == 0;
+drjson_clear(const DrJsonContext* ctx, DrJsonValue v){
+    switch(v.kind){
+        case DRJSON_ARRAY:{
+            DrJsonArray* adata = ctx->arrays.data;
+            DrJsonArray* array = &adata[v.array_idx];
+            if(array->read_only) return 1;
+            array->count = 0;
+            return 0;
         }
-        case DRJSON_ARRAY:
-        case DRJSON_ARRAY_VIEW:{
-            const DrJsonArray* adata = ctx->arrays.data;
-            const DrJsonArray* a_arr = &adata[a.array_idx];
-            const DrJsonArray* b_arr = &adata[b.array_idx];
-            if(a_arr->count != b_arr->count) return 0;
-            for(size_t i = 0; i < a_arr->count; i++){
-                if(!drjson_deep_eq(ctx, a_arr->array_items[i], b_arr->array_items[i]))
-                    return 0;
+        case DRJSON_OBJECT:{
+            DrJsonObject* odata = ctx->objects.data;
+            DrJsonObject* object = &odata[v.object_idx];
+            if(object->read_only) return 1;
+            if(object->shaped){
+                drj_free(ctx, object->object_items, drj_obj_items_size(object));
+                object->object_items = NULL;
+                object->capacity = 0;
+                object->shaped = 0;
             }
-            return 1;
-        }
-        case DRJSON_OBJECT:
-        case DRJSON_OBJECT_KEYS:
-        case DRJSON_OBJECT_VALUES:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* a_obj = &odata[a.object_idx];
-            const DrJsonObject* b_obj = &odata[b.object_idx];
-            if(a_obj->count != b_obj->count) return 0;
-
-            // Check that all keys in a exist in b with equal values
-            DrJsonObjectPair* a_pairs = drj_obj_get_pairs(a_obj->object_items, a_obj->capacity);
-            for(size_t i = 0; i < a_obj->count; i++){
-                DrJsonAtom key = a_pairs[i].atom;
-                DrJsonValue a_val = a_pairs[i].value;
-                DrJsonValue b_val = drjson_object_get_item_atom(ctx, b, key);
-                if(b_val.kind == DRJSON_ERROR) return 0; // Key not found in b
-                if(!drjson_deep_eq(ctx, a_val, b_val)) return 0;
+            if(drj_obj_has_index(object->capacity)){
+                DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+                drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
+                (void)pairs;
+                drj_memset(idxes, 0xff, 2 * sizeof *idxes * object->capacity);
+                *drj_obj_get_tombstones(object->object_items, object->capacity) = 0;
             }
-            return 1;
+            object->count = 0;
+            return 0;
         }
-        case DRJSON_OBJECT_ITEMS:
-        case DRJSON_ERROR:
         default:
-            return 0;
+            return 1;
     }
 }
 
-
 DRJSON_API
-int
-drjson_path_add_key(DrJsonPath* path, DrJsonAtom key){
-    if(path->count >= DRJSON_PATH_MAX_DEPTH) return 1;
-    path->segments[path->count++] = (DrJsonPathSegment){ .kind = DRJSON_PATH_KEY, .key = key };
-    return 0;
+DrJsonValue
+drjson_array_del_item(const DrJsonContext* ctx, DrJsonValue a, size_t idx){
+    if(a.kind != DRJSON_ARRAY) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is not an array");
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "Argument is read only");
+    if(!array->count)
+        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Array is empty");
+    if(idx >= array->count){
+        return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "Index out of bounds.");
+    }
+    if(idx == array->count-1u)
+        return drjson_array_pop_item(ctx, a);
+    size_t nmove = array->count - idx-1;
+    DrJsonValue result = drj_array_get(array, idx);
+    size_t size = drj_array_item_size(array);
+    char* items = (char*)array->array_items;
+    drj_memmove(items+idx*size, items+(idx+1)*size, nmove*size);
+    array->count--;
+    return result;
 }
 
 DRJSON_API
 int
-drjson_path_add_index(DrJsonPath* path, int64_t index){
-    if(path->count >= DRJSON_PATH_MAX_DEPTH) return 1;
-    path->segments[path->count++] = (DrJsonPathSegment){ .kind = DRJSON_PATH_INDEX, .index = index };
+drjson_array_swap_items(const DrJsonContext* ctx, DrJsonValue a, size_t idx1, size_t idx2){
+    if(a.kind != DRJSON_ARRAY) return 1;
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only) return 1;
+    if(idx1 >= array->count || idx2 >= array->count) return 1;
+    if(idx1 == idx2) return 0; // Nothing to do
+
+    DrJsonValue temp = drj_array_get(array, idx1);
+    drj_array_put(array, idx1, drj_array_get(array, idx2));
+    drj_array_put(array, idx2, temp);
     return 0;
 }
 
 DRJSON_API
-DRJSON_WARN_UNUSED
 int
-drjson_path_parse(const DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path){
-    const char* remainder = NULL;
-    int err = drjson_path_parse_greedy(ctx, path_str, path_len, path, &remainder);
-    if(err) return err;
-    if(remainder != path_str + path_len) return 1; // Did not consume whole string
+drjson_array_move_item(const DrJsonContext* ctx, DrJsonValue a, size_t from_idx, size_t to_idx){
+    if(a.kind != DRJSON_ARRAY) return 1;
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only) return 1;
+    if(from_idx >= array->count || to_idx >= array->count) return 1;
+    if(from_idx == to_idx) return 0; // Nothing to do
+
+    // Save the item to move
+    DrJsonValue item = drj_array_get(array, from_idx);
+    size_t size = drj_array_item_size(array);
+    char* items = (char*)array->array_items;
+
+    // Shift items to close the gap
+    if(from_idx < to_idx){
+        // Moving forward: shift items left
+        drj_memmove(items + from_idx*size,
+                   items + (from_idx + 1)*size,
+                   (to_idx - from_idx) * size);
+    }
+    else {
+        // Moving backward: shift items right
+        drj_memmove(items + (to_idx + 1)*size,
+                   items + to_idx*size,
+                   (from_idx - to_idx) * size);
+    }
+
+    // Place item at new position
+    drj_array_put(array, to_idx, item);
     return 0;
 }
 
 DRJSON_API
-DRJSON_WARN_UNUSED
 int
-drjson_path_parse_greedy(const DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path, const char* _Nullable * _Nonnull remainder){
-    size_t i = 0;
-    size_t begin = 0;
-    if(!path_str) return 1;
-    if(!path) return 1;
-    path->count = 0;
-    if(path_len && path_str[0] == '$'){
-        i = 1;
-    }
+drjson_object_move_item(const DrJsonContext* ctx, DrJsonValue o, size_t from_idx, size_t to_idx){
+    if(o.kind != DRJSON_OBJECT) return 1;
+    DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(object->read_only) return 1;
+    if(drj_obj_tombstone_count(object)) drj_obj_compact(object);
+    if(from_idx >= object->count || to_idx >= object->count) return 1;
+    if(from_idx == to_idx) return 0; // Nothing to do
+    if(object->shaped && drj_obj_unshare(ctx, object)) return 1;
 
-    Ldispatch:
-    if(i >= path_len) goto Ldone;
+    // Get pointers to object data
+    DrJsonHashIndex* idxes;
+    DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
 
-    switch(path_str[i]){
-        case '.':
-            i++;
-            begin = i;
-            if(i == path_len) return 1; // unexpected eof
-            if(path_str[i] == '\"'){
-                i++;
-                begin=i;
-                goto Lquoted_getitem;
-            }
-            goto Lgetitem;
-        case '[':
-            i++;
-            begin = i;
-            goto Lsubscript;
-        case CASE_a_z:
-        case CASE_A_Z:
-        case '_':
-            // Allow bare identifier at start of path
-            if(i == 0 || (i == 1 && path_str[0] == '$')){
-                begin = i;
-                goto Lgetitem;
-            }
-            goto Ldone;
-        default:
-            if(i == 0 || (i == 1 && path_str[0] == '$')) return 1;
-            goto Ldone;
+    // Save the pair to move
+    DrJsonObjectPair temp_pair = pairs[from_idx];
+
+    // Shift items to close the gap and make space
+    if(from_idx < to_idx){
+        // Moving forward: shift pairs left
+        drj_memmove(pairs + from_idx,
+                   pairs + from_idx + 1,
+                   (to_idx - from_idx) * sizeof(*pairs));
+    }
+    else {
+        // Moving backward: shift pairs right
+        drj_memmove(pairs + to_idx + 1,
+                   pairs + to_idx,
+                   (from_idx - to_idx) * sizeof(*pairs));
     }
 
-    Lgetitem:
-    for(;i<path_len;i++){
-        switch(path_str[i]){
-            case '.':
-            case '[':
-                goto Ldo_getitem;
-            case CASE_a_z:
-            case CASE_A_Z:
-            case CASE_0_9:
-            case '/':
-            case '_':
-            case '-':
-            case '+':
-            case '*':
-                continue;
-            default:
-                goto Ldo_getitem;
+    // Place pair at new position
+    pairs[to_idx] = temp_pair;
+
+    // Rebuild hash table since indices changed
+    if(drj_obj_has_index(object->capacity))
+        drj_obj_rebuild_index(idxes, pairs, object->count, object->capacity);
+
+    return 0;
+}
+
+force_inline
+int
+drjson_object_set_item(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom, DrJsonValue item){
+    if(o.kind != DRJSON_OBJECT) return 1;
+    DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(object->read_only) return 1;
+    drj_gc_barrier(ctx, item);
+    if(object->shaped){
+        // Replacing a value keeps the shape, a new key doesn't.
+        DrjShapedItems* items = object->object_items;
+        uint32_t i = drj_shape_find(items->shape, atom);
+        if(i != UINT32_MAX){
+            items->values[i] = item;
+            return 0;
         }
+        if(drj_obj_unshare(ctx, object)) return 1;
     }
-    Ldo_getitem:
-    if(i == begin) return 1;
-    {
-        DrJsonAtom atom;
-        // Use get_atom_no_intern for allocation-free queries
-        int err = drjson_get_atom_no_intern(ctx, path_str + begin, i - begin, &atom);
-        if(err){
-            // Key not in atom table - won't be found in any object
-            // Store sentinel value (bits = 0)
-            atom = (DrJsonAtom){.bits = 0};
+    enum {OBJECT_MAX = 0x1fffffff};
+    if(unlikely(object->count >= object->capacity)){
+        if(drj_obj_tombstone_count(object)){
+            drj_obj_compact(object);
         }
-        err = drjson_path_add_key(path, atom);
-        if(err) return 1;
-    }
-    goto Ldispatch;
-
-    Lsubscript:
-    for(;i<path_len;i++){
-        switch(path_str[i]){
-            case '-':
-            case CASE_0_9:
-                continue;
-            case ']':
-                goto Ldo_subscript;
-            default:
-                return 1;
+        else if(!object->capacity){
+            size_t new_cap = 4;
+            size_t size = drjson_size_for_object_of_length(new_cap);
+            void* p = drj_alloc(ctx, size);
+            if(!p) return 1;
+            object->object_items = p;
+            object->capacity = (uint32_t)new_cap;
+        }
+        else {
+            size_t old_cap = object->capacity;
+            size_t new_cap = old_cap * 2;
+            if(new_cap > OBJECT_MAX) return 1;
+            void* p = drj_realloc(ctx, object->object_items, drjson_size_for_object_of_length(old_cap), drjson_size_for_object_of_length(new_cap));
+            if(!p) return 1;
+            if(drj_obj_has_index(new_cap)){
+                DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+                drj_get_obj_ptrs(p, new_cap, &idxes, &pairs);
+                drj_obj_rebuild_index(idxes, pairs, object->count, (uint32_t)new_cap);
+            }
+            object->object_items = p;
+            object->capacity = (uint32_t)new_cap;
+        }
+        #if 0
+        if(object->capacity <= 32){
+            DrJsonHashIndex* idxes = drj_obj_get_idxes(object->object_items, object->capacity);
+            uint64_t seent = 0;
+            for(size_t i = 0; i < object->capacity*2; i++){
+                if(idxes[i].index == UINT32_MAX) continue;
+                uint64_t mask = 1llu << idxes[i].index;
+                if(mask & seent){
+                    __builtin_debugtrap();
+                }
+                seent |= mask;
+            }
         }
+        #endif
     }
-    return 1;
-    Ldo_subscript:;
-    Int64Result pr = parse_int64(path_str+begin, i-begin);
-    if(pr.errored) return 1;
-    int err = drjson_path_add_index(path, pr.result);
-    if(err) return 1;
-    i++;
-    goto Ldispatch;
 
-    Lquoted_getitem:
-    for(;i<path_len;i++){
-        if(path_str[i] == '\"'){
-            size_t nbackslash = 0;
-            for(size_t back = i-1; back != begin; back--){
-                if(path_str[back] != '\\') break;
-                nbackslash++;
+    #if 0
+    if(object->capacity <= 32){
+        DrJsonHashIndex* idxes = drj_obj_get_idxes(object->object_items, object->capacity);
+        uint64_t seent = 0;
+        for(size_t i = 0; i < object->capacity*2; i++){
+            if(idxes[i].index == UINT32_MAX) continue;
+            uint64_t mask = 1llu << idxes[i].index;
+            if(mask & seent){
+                __builtin_debugtrap();
             }
-            if(nbackslash & 1) continue;
-            {
-                DrJsonAtom atom;
-                // Use get_atom_no_intern for allocation-free queries
-                int err = drjson_get_atom_no_intern(ctx, path_str + begin, i - begin, &atom);
-                if(err){
-                    // Key not in atom table - won't be found in any object
-                    // Store sentinel value (bits = 0)
-                    atom = (DrJsonAtom){.bits = 0};
-                }
-                err = drjson_path_add_key(path, atom);
-                if(err) return 1;
+            seent |= mask;
+        }
+    }
+    #endif
+    uint32_t capacity = object->capacity;
+    uint32_t hash = drj_atom_get_hash(atom);
+    uint32_t idx = fast_reduce32(hash, 2*capacity);
+    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, object->capacity, &idxes, &pairs);
+    if(!drj_obj_has_index(capacity)){
+        uint32_t pidx = drj_obj_find_linear(pairs, object->count, atom);
+        if(pidx == UINT32_MAX)
+            pairs[object->count++] = (DrJsonObjectPair){.atom = atom, .value = item};
+        else
+            pairs[pidx].value = item;
+        return 0;
+    }
+    for(;;){
+        DrJsonHashIndex hi = idxes[idx];
+        if(hi.index == UINT32_MAX){
+            size_t pidx = object->count++;
+            DrJsonObjectPair* o = &pairs[pidx];
+            *o = (DrJsonObjectPair){
+                .atom=atom,
+                .value=item,
+            };
+            idxes[idx] = (DrJsonHashIndex){(uint32_t)pidx, hash};
+            return 0;
+        }
+        if(hi.hash == hash){
+            DrJsonObjectPair* o = &pairs[hi.index];
+            if(o->atom.bits == atom.bits){
+                o->value = item;
+                return 0;
             }
-            i++;
-            goto Ldispatch;
         }
+        idx++;
+        if(idx >= 2*capacity)
+            idx = 0;
     }
-    return 1;
+}
 
-Ldone:
-    *remainder = path_str + i;
-    return 0;
+DRJSON_API
+int // 0 on success
+drjson_object_set_item_no_copy_key(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen, DrJsonValue item){
+    DrJsonAtom atom;
+    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, key, (uint32_t)keylen, 1, &atom);
+    if(err) return err;
+    return drjson_object_set_item(ctx, object, atom, item);
 }
 
 DRJSON_API
-DrJsonValue
-drjson_query(const DrJsonContext* ctx, DrJsonValue v, const char* query, size_t length){
-    DrJsonPath path;
-    int err = drjson_path_parse(ctx, query, length, &path);
-    if(err) return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Invalid query path");
-    return drjson_evaluate_path(ctx, v, &path);
+int // 0 on success
+drjson_object_set_item_copy_key(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen, DrJsonValue item){
+    DrJsonAtom atom;
+    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, key, (uint32_t)keylen, 1, &atom);
+    if(err) return err;
+    return drjson_object_set_item(ctx, object, atom, item);
 }
 
-// Helper function to check if a key is a magic property and handle it
-static
-DrJsonValue
-drjson_try_magic_key(const DrJsonContext* ctx, DrJsonValue current, DrJsonAtom key){
-    // Check for magic properties using pre-atomized keys
-    if(key.bits == ctx->magic_keys.length.bits){
-        int64_t len = drjson_len(ctx, current);
-        if(len < 0)
-            return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "length on non-container");
-        return drjson_make_int(len);
+DRJSON_API
+int // 0 on success
+drjson_object_set_item_atom(DrJsonContext* ctx, DrJsonValue object, DrJsonAtom atom, DrJsonValue item){
+    return drjson_object_set_item(ctx, object, atom, item);
+}
+
+DRJSON_API
+int // 0 on success
+drjson_object_set_item_escape_key(DrJsonContext* ctx, DrJsonValue object, const char* restrict key, size_t keylen, DrJsonValue item){
+    DrJsonAtom atom;
+    int err = drjson_escape_string(ctx, key, keylen, &atom);
+    if(err) return err;
+    return drjson_object_set_item(ctx, object, atom, item);
+}
+DRJSON_API
+int // 0 on success, 1 if key not found or error
+drjson_object_delete_item_atom(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom){
+    if(o.kind != DRJSON_OBJECT) return 1;
+    DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(object->read_only) return 1;
+    if(object->count == 0) return 1;
+    if(!object->capacity) return 1;
+    if(object->shaped){
+        const DrjShapedItems* items = object->object_items;
+        if(drj_shape_find(items->shape, atom) == UINT32_MAX) return 1;
+        if(drj_obj_unshare(ctx, object)) return 1;
     }
-    if(key.bits == ctx->magic_keys.keys.bits){
-        return drjson_object_keys(current);
+
+    uint32_t capacity = object->capacity;
+    uint32_t hash = drj_atom_get_hash(atom);
+    uint32_t hash_idx = fast_reduce32(hash, 2*capacity);
+    DrJsonHashIndex* idxes;
+    DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
+
+    if(!drj_obj_has_index(capacity)){
+        uint32_t pidx = drj_obj_find_linear(pairs, object->count, atom);
+        if(pidx == UINT32_MAX) return 1;
+        memmove(&pairs[pidx], &pairs[pidx + 1], (object->count - pidx - 1) * sizeof *pairs);
+        object->count--;
+        return 0;
     }
-    if(key.bits == ctx->magic_keys.values.bits){
-        return drjson_object_values(current);
+
+    // Find the key in the hash table
+    uint32_t found_hash_slot = UINT32_MAX;
+    uint32_t found_pair_idx = UINT32_MAX;
+
+    for(uint32_t idx = hash_idx;;){
+        DrJsonHashIndex hi = idxes[idx];
+        if(hi.index == UINT32_MAX) return 1; // Not found
+
+        if(hi.hash == hash && pairs[hi.index].atom.bits == atom.bits){
+            found_hash_slot = idx;
+            found_pair_idx = hi.index;
+            break;
+        }
+
+        idx++;
+        if(idx >= 2*capacity) idx = 0;
     }
-    if(key.bits == ctx->magic_keys.items.bits){
-        return drjson_object_items(current);
+
+    // Leave a tombstone in the pair so that nothing after it moves and the
+    // index keeps pointing at the right pairs. The last pair can just go.
+    if(found_pair_idx == object->count - 1u)
+        object->count--;
+    else {
+        // Null the value too so the collector doesn't keep it alive.
+        pairs[found_pair_idx].atom.bits = DRJ_TOMBSTONE;
+        pairs[found_pair_idx].value = drjson_make_null();
+        uint32_t* tombstones = drj_obj_get_tombstones(object->object_items, capacity);
+        ++*tombstones;
+        // Compacting costs about as much as the deletes since the last one.
+        if(2 * *tombstones > object->count){
+            drj_obj_compact(object);
+            return 0;
+        }
     }
 
-    // Not a magic key
-    return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "Key not found");
-}
+    // Fix the probe chain using backward shift deletion
+    // This maintains the linear probing invariant
+    uint32_t i = found_hash_slot;
+    for(;;){
+        uint32_t j = i;
 
-DRJSON_API
-DrJsonValue
-drjson_evaluate_path(const DrJsonContext* ctx, DrJsonValue v, const DrJsonPath* path){
-    DrJsonValue current_value = v;
-    for(size_t i = 0; i < path->count; i++){
-        const DrJsonPathSegment* seg = &path->segments[i];
-        if(seg->kind == DRJSON_PATH_KEY){
-            // Check for sentinel (key not in atom table)
-            if(seg->key.bits == 0){
-                // Key doesn't exist in atom table, check if it's a magic key
-                // (This shouldn't happen since we pre-atomize magic keys, but handle it anyway)
-                return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "Key not found");
+        // Look ahead in the probe sequence
+        for(;;){
+            j++;
+            if(j >= 2*capacity) j = 0;
+
+            // If we hit an empty slot, we're done
+            if(idxes[j].index == UINT32_MAX){
+                idxes[i].index = UINT32_MAX;
+                return 0;
             }
 
-            // Save the value before lookup
-            DrJsonValue pre_lookup_value = current_value;
+            // Check if element at j can move to slot i
+            // It can move if its ideal position is NOT in the range (i, j]
+            uint32_t k = fast_reduce32(idxes[j].hash, 2*capacity);
 
-            // Try normal key lookup first
-            current_value = drjson_object_get_item_atom(ctx, current_value, seg->key);
+            // Check if k is in range (i, j] (with wrapping)
+            _Bool k_in_range;
+            if(i < j)
+                k_in_range = (k > i && k <= j);
+            else // Wrapped range
+                k_in_range = (k > i || k <= j);
 
-            // If that failed, try magic keys on the original value
-            if(current_value.kind == DRJSON_ERROR){
-                DrJsonValue magic_result = drjson_try_magic_key(ctx, pre_lookup_value, seg->key);
-                // Only use magic result if it's not a "key not found" error
-                if(magic_result.kind != DRJSON_ERROR || magic_result.error_code != DRJSON_ERROR_MISSING_KEY){
-                    current_value = magic_result;
-                }
-            }
-        } else { // DRJSON_PATH_INDEX
-            current_value = drjson_get_by_index(ctx, current_value, seg->index);
+            if(!k_in_range)
+                break; // Element at j wants to be at k, which is not in (i,j]
+                       // So it was probing through i, and we can move it back
         }
-        if(current_value.kind == DRJSON_ERROR) return current_value;
+
+        // Move element from j to i
+        idxes[i] = idxes[j];
+        i = j;
     }
-    return current_value;
 }
 
 DRJSON_API
-int64_t
-drjson_len(const DrJsonContext* ctx, DrJsonValue v){
-    switch(v.kind){
-        case DRJSON_ARRAY:
-        case DRJSON_ARRAY_VIEW:{
-            const DrJsonArray* adata = ctx->arrays.data;
-            const DrJsonArray* array = &adata[v.array_idx];
-            return array->count;
-        }
-        case DRJSON_OBJECT:
-        case DRJSON_OBJECT_KEYS:
-        case DRJSON_OBJECT_VALUES:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            return object->count;
-        }
-        case DRJSON_OBJECT_ITEMS:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            return 2*object->count;
-        }
-        case DRJSON_STRING:{
-            DrjAtomStr s = drj_get_atom_str(&ctx->atoms, v.atom);
-            return s.length;
-        }
-        default:
-            return -1;
-    }
+int // 0 on success, 1 if key not found or error
+drjson_object_delete_item(DrJsonContext* ctx, DrJsonValue object, const char* key, size_t keylen){
+    DrJsonAtom atom;
+    int err = drj_get_atom_no_alloc(&ctx->atoms, key, (uint32_t)keylen, &atom);
+    if(err) return 1; // Key not in atom table means it's not in the object
+    return drjson_object_delete_item_atom(ctx, object, atom);
 }
+
 DRJSON_API
-DrJsonValue
-drjson_get_by_index(const DrJsonContext* ctx, DrJsonValue v, int64_t idx){
-    int64_t len = drjson_len(ctx, v);
-    if(idx < 0) idx += len;
-    size_t index  = idx < 0? (size_t)(idx + len) : (size_t)idx;
-    switch(v.kind){
-        case DRJSON_ARRAY:
-        case DRJSON_ARRAY_VIEW:{
-            const DrJsonArray* adata = ctx->arrays.data;
-            const DrJsonArray* array = &adata[v.array_idx];
-            if(array->count <= index)
-                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
-            return array->array_items[index];
-        }
-        case DRJSON_OBJECT_KEYS:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            if(object->count <= index)
-                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
-            size_t capacity = object->capacity;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, capacity);
-            return drjson_atom_to_value(pairs[index].atom);
-        }
-        case DRJSON_OBJECT_VALUES:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            if(object->count <= index)
-                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
-            size_t capacity = object->capacity;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, capacity);
-            return pairs[index].value;
+int // 0 on success, 1 if key not found or error
+drjson_object_replace_key_atom(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom old_key, DrJsonAtom new_key){
+    if(o.kind != DRJSON_OBJECT) return 1;
+    DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(object->read_only) return 1;
+    if(object->count == 0) return 1;
+    if(!object->capacity) return 1;
+    if(object->shaped && drj_obj_unshare(ctx, object)) return 1;
+    if(drj_obj_tombstone_count(object)) drj_obj_compact(object);
+
+    uint32_t capacity = object->capacity;
+    DrJsonHashIndex* idxes;
+    DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
+
+    // Find the old key in the pairs array
+    uint32_t found_pair_idx = UINT32_MAX;
+    for(uint32_t i = 0; i < object->count; i++){
+        if(pairs[i].atom.bits == old_key.bits){
+            found_pair_idx = i;
+            break;
         }
-        case DRJSON_OBJECT_ITEMS:{
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            size_t pidx = index/2;
-            if(object->count <= pidx)
-                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
-            size_t capacity = object->capacity;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, capacity);
-            if(index & 1)
-                return pairs[pidx].value;
-            else
-                return drjson_atom_to_value(pairs[pidx].atom);
+    }
+
+    if(found_pair_idx == UINT32_MAX) return 1; // Key not found
+
+    // Check if new_key already exists (and is not the same as old_key)
+    if(new_key.bits != old_key.bits && !drj_obj_has_index(capacity)){
+        if(drj_obj_find_linear(pairs, object->count, new_key) != UINT32_MAX)
+            return 1; // Would create duplicate
+    }
+    else if(new_key.bits != old_key.bits){
+        uint32_t new_key_hash = drj_atom_get_hash(new_key);
+        uint32_t idx = fast_reduce32(new_key_hash, 2*capacity);
+        for(;;){
+            DrJsonHashIndex hi = idxes[idx];
+            if(hi.index == UINT32_MAX) break; // New key doesn't exist, safe to proceed
+            if(hi.hash == new_key_hash && pairs[hi.index].atom.bits == new_key.bits){
+                // New key already exists in the object
+                return 1; // Would create duplicate
+            }
+            idx++;
+            if(idx >= 2*capacity) idx = 0;
         }
-        default:
-            return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "object does not support indexing by integer");
     }
-}
 
-DRJSON_API
-int
-drjson_array_set_by_index(const DrJsonContext* ctx, DrJsonValue a, int64_t idx, DrJsonValue value){
-    if(a.kind != DRJSON_ARRAY) return 1;
-    DrJsonArray* adata = ctx->arrays.data;
-    DrJsonArray* array = &adata[a.array_idx];
-    if(array->read_only) return 1;
-    if(idx < 0) idx += array->count;
-    if(idx < 0) return 1;
-    if(idx >= array->count) return 1;
-    array->array_items[idx] = value;
-    return 0;
-}
+    // Replace the key in the pair
+    pairs[found_pair_idx].atom = new_key;
 
-typedef struct DrJsonMemBuff DrJsonMemBuff;
-struct DrJsonMemBuff {
-    char* begin;
-    char* end;
-};
+    // Rebuild the hash table
+    if(drj_obj_has_index(capacity))
+        drj_obj_rebuild_index(idxes, pairs, object->count, capacity);
 
-static
-int mem_buff_write(void* p, const void* data, size_t len){
-    DrJsonMemBuff* buff = p;
-    if(buff->begin + len >= buff->end)
-        return 1;
-    drj_memcpy(buff->begin, data, len);
-    buff->begin += len;
     return 0;
 }
 
 DRJSON_API
-int
-drjson_print_value_mem(const DrJsonContext* ctx, void* buff, size_t bufflen, DrJsonValue v, int indent, unsigned flags, size_t*_Nullable printed){
-    DrJsonMemBuff membuff = {.begin = buff, .end = bufflen+(char*)buff};
-    DrJsonTextWriter writer = {
-        .up = &membuff,
-        .write = mem_buff_write,
-    };
-    int result = drjson_print_value(ctx, &writer, v, indent, flags);
-    if(!result && printed){
-        *printed = membuff.begin - (char*)buff;
+int // 0 on success, 1 if key already exists, index out of bounds, or error
+drjson_object_insert_item_at_index(DrJsonContext* ctx, DrJsonValue o, DrJsonAtom key, DrJsonValue item, size_t index){
+    if(o.kind != DRJSON_OBJECT) return 1;
+    DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(object->read_only) return 1;
+    drj_gc_barrier(ctx, item);
+    if(drj_obj_tombstone_count(object)) drj_obj_compact(object);
+
+    // Check if index is valid (can be 0 to count inclusive, where count means append)
+    if(index > object->count) return 1;
+    if(object->shaped && drj_obj_unshare(ctx, object)) return 1;
+
+    enum {OBJECT_MAX = 0x1fffffff};
+
+    // Check if key already exists
+    if(!drj_obj_has_index(object->capacity)){
+        if(drj_obj_find_linear(drj_obj_get_pairs(object->object_items, object->capacity), object->count, key) != UINT32_MAX)
+            return 1;
     }
-    return result;
-}
+    else if(object->count > 0){
+        uint32_t capacity = object->capacity;
+        uint32_t hash = drj_atom_get_hash(key);
+        uint32_t hash_idx = fast_reduce32(hash, 2*capacity);
+        DrJsonHashIndex* idxes;
+        DrJsonObjectPair* pairs;
+        drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
 
-DRJSON_API
-int
-drjson_print_error_mem(void* buff, size_t bufflen, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
-    DrJsonMemBuff membuff = {.begin = buff, .end = bufflen+(char*)buff};
-    DrJsonTextWriter writer = {
-        .up = &membuff,
-        .write = mem_buff_write,
-    };
-    return drjson_print_error(&writer, filename, filename_len, line, column, v);
-}
+        for(uint32_t idx = hash_idx;;){
+            DrJsonHashIndex hi = idxes[idx];
+            if(hi.index == UINT32_MAX) break; // Key doesn't exist, safe to proceed
 
-#ifndef DRJSON_NO_STDIO
-static
-int wrapped_fwrite(void* ud, const void* data, size_t length){
-    return fwrite(data, 1, length, ud) != length;
-}
+            if(hi.hash == hash && pairs[hi.index].atom.bits == key.bits){
+                // Key already exists
+                return 1;
+            }
 
-DRJSON_API
-#ifdef __clang__
-__attribute__((__noinline__)) // clang is generating invalid code on windows without this
-#endif
-int
-drjson_print_value_fp(const DrJsonContext* ctx, FILE* fp, DrJsonValue v, int indent, unsigned flags){
-    DrJsonTextWriter writer = {
-        .up = fp,
-        .write = wrapped_fwrite,
-    };
-    return drjson_print_value(ctx, &writer, v, indent, flags);
-}
-DRJSON_API
-#ifdef __clang__
-__attribute__((__noinline__)) // probably ditto
-#endif
-int
-drjson_print_error_fp(FILE* fp, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
-    DrJsonTextWriter writer = {
-        .up = fp,
-        .write = wrapped_fwrite,
-    };
-    return drjson_print_error(&writer, filename, filename_len, line, column, v);
-}
-#endif
+            idx++;
+            if(idx >= 2*capacity) idx = 0;
+        }
+    }
 
-#ifndef DRJSON_NO_IO
-#ifndef _WIN32
-static
-int
-wrapped_write(void* restrict ud, const void* restrict data, size_t length){
-    int fd = (int)(intptr_t)ud;
-    return write(fd, data, length) != (ssize_t)length;
-}
-DRJSON_API
-int
-drjson_print_value_fd(const DrJsonContext* ctx, int fd, DrJsonValue v, int indent, unsigned flags){
-    DrJsonTextWriter writer = {
-        .up = (void*)(intptr_t)fd,
-        .write = wrapped_write,
-    };
-    return drjson_print_value(ctx, &writer, v, indent, flags);
-}
-DRJSON_API
-int
-drjson_print_error_fd(int fd, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
-    DrJsonTextWriter writer = {
-        .up = (void*)(intptr_t)fd,
-        .write = wrapped_write,
-    };
-    return drjson_print_error(&writer, filename, filename_len, line, column, v);
-}
-#else
-static int
-wrapped_write_file(void* restrict ud, const void* restrict data, size_t length){
-    HANDLE hnd = ud;
-    DWORD nwrit = 0;
-    return WriteFile(hnd, data, length, &nwrit, NULL) != TRUE;
-}
-DRJSON_API
-int
-drjson_print_value_HANDLE(const DrJsonContext* ctx, void* hnd, DrJsonValue v, int indent, unsigned flags){
-    DrJsonTextWriter writer = {
-        .up = (void*)hnd,
-        .write = wrapped_write_file,
-    };
-    return drjson_print_value(ctx, &writer, v, indent, flags);
-}
-DRJSON_API
-int
-drjson_print_error_HANDLE(void* hnd, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
-    DrJsonTextWriter writer = {
-        .up = (void*)hnd,
-        .write = wrapped_write_file,
-    };
-    return drjson_print_error(&writer, filename, filename_len, line, column, v);
-}
-#endif
-#endif
+    // Ensure capacity (same logic as drjson_object_set_item)
+    if(unlikely(object->count >= object->capacity)){
+        if(!object->capacity){
+            size_t new_cap = 4;
+            size_t size = drjson_size_for_object_of_length(new_cap);
+            void* p = drj_alloc(ctx, size);
+            if(!p) return 1;
+            object->object_items = p;
+            object->capacity = (uint32_t)new_cap;
+        }
+        else {
+            size_t old_cap = object->capacity;
+            size_t new_cap = old_cap * 2;
+            if(new_cap > OBJECT_MAX) return 1;
+            void* p = drj_realloc(ctx, object->object_items, drjson_size_for_object_of_length(old_cap), drjson_size_for_object_of_length(new_cap));
+            if(!p) return 1;
+            object->object_items = p;
+            object->capacity = (uint32_t)new_cap;
+            // Hash table will be rebuilt below
+        }
+    }
 
-enum {DRJSON_BUFF_SIZE = 1024*512};
-typedef struct DrJsonBuffered DrJsonBuffered;
-struct DrJsonBuffered {
-    const DrJsonTextWriter* writer;
-    size_t cursor;
-    int errored;
-    char buff[DRJSON_BUFF_SIZE];
-};
+    uint32_t capacity = object->capacity;
+    DrJsonHashIndex* idxes;
+    DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, capacity, &idxes, &pairs);
 
+    // Shift pairs from index onwards to make room
+    if(index < object->count){
+        memmove(&pairs[index + 1], &pairs[index], (object->count - index) * sizeof(*pairs));
+    }
 
-static inline
-void
-drjson_print_value_inner(const DrJsonContext* ctx, DrJsonBuffered* restrict buffer, DrJsonValue v);
+    // Insert the new pair at the specified index
+    pairs[index] = (DrJsonObjectPair){
+        .atom = key,
+        .value = item,
+    };
+    object->count++;
 
-static inline
-void
-drjson_pretty_print_value_inner(const DrJsonContext*_Nullable ctx, DrJsonBuffered* restrict buffer, DrJsonValue v, int indent);
+    // Rebuild the hash table to point to all pairs in their new positions
+    if(drj_obj_has_index(capacity))
+        drj_obj_rebuild_index(idxes, pairs, object->count, capacity);
 
-static inline
-void
-drjson_buff_flush(DrJsonBuffered* restrict buffer){
-    if(!buffer->errored)
-        buffer->errored = buffer->writer->write(buffer->writer->up, buffer->buff, buffer->cursor);
-    buffer->cursor = 0;
+    return 0;
 }
 
-static inline
-void
-drjson_buff_ensure_n(DrJsonBuffered* restrict buffer, size_t length){
-    if(buffer->cursor + length > DRJSON_BUFF_SIZE){
-        drjson_buff_flush(buffer);
+DRJSON_API
+DrJsonValue
+drjson_object_get_item_atom(const DrJsonContext* ctx, DrJsonValue o, DrJsonAtom atom){
+    if(o.kind != DRJSON_OBJECT) return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "not an object");
+    uint32_t hash = drj_atom_get_hash(atom);
+    const DrJsonObject* object = &ctx->objects.data[o.object_idx];
+    if(!object->capacity)
+        return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
+    if(object->shaped){
+        const DrjShapedItems* items = object->object_items;
+        uint32_t i = drj_shape_find(items->shape, atom);
+        if(i == UINT32_MAX) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
+        return items->values[i];
+    }
+    uint32_t capacity = object->capacity;
+    uint32_t idx = fast_reduce32(hash, 2*capacity);
+    DrJsonHashIndex* his; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(object->object_items, object->capacity, &his, &pairs);
+    if(!drj_obj_has_index(capacity)){
+        uint32_t pidx = drj_obj_find_linear(pairs, object->count, atom);
+        if(pidx == UINT32_MAX) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
+        return pairs[pidx].value;
+    }
+    for(;;){
+        DrJsonHashIndex hi = his[idx];
+        if(hi.index == UINT32_MAX) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
+        if(hi.hash == hash){
+            const DrJsonObjectPair* o = &pairs[hi.index];
+            if(o->atom.bits == atom.bits)
+                return o->value;
+        }
+        idx++;
+        if(idx >= 2*capacity)
+            idx = 0;
     }
 }
 
-static inline
-void
-drjson_buff_write(DrJsonBuffered* restrict buffer, const char* restrict data, size_t length){
-    drjson_buff_ensure_n(buffer, length);
-    if(length >= DRJSON_BUFF_SIZE){
-        if(!buffer->errored)
-            buffer->errored = buffer->writer->write(buffer->writer->up, data, length);
-        return;
-    }
-    drj_memcpy(buffer->buff+buffer->cursor, data, length);
-    buffer->cursor += length;
+DRJSON_API
+DrJsonValue
+drjson_object_get_item(const DrJsonContext* ctx, DrJsonValue o, const char* key, size_t keylen){
+    DrJsonAtom atom;
+    int err = drj_get_atom_no_alloc(&ctx->atoms, key, (uint32_t)keylen, &atom);
+    if(err) return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "key is not valid for object");
+    return drjson_object_get_item_atom(ctx, o, atom);
 }
 
-#define drjson_buff_write_lit(b, lit) drjson_buff_write(b, "" lit, sizeof(lit)-1)
-static inline
-void
-drjson_buff_putc(DrJsonBuffered* restrict buffer, char c){
-    drjson_buff_ensure_n(buffer, 1);
-    buffer->buff[buffer->cursor++] = c;
+DRJSON_API
+DrJsonValue
+drjson_checked_query(const DrJsonContext* ctx, DrJsonValue v, int type, const char* query, size_t query_length){
+    DrJsonValue o = drjson_query(ctx, v, query, query_length);
+    if(o.kind == DRJSON_ERROR) return o;
+    if(o.kind != type)
+        return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Wrong type");
+    return o;
 }
 
 DRJSON_API
 int
-drjson_print_value(const DrJsonContext* ctx, const DrJsonTextWriter* restrict writer, DrJsonValue v, int indent, unsigned flags){
-    DrJsonBuffered buffer;
-    buffer.cursor = 0;
-    buffer.writer = writer;
-    buffer.errored = 0;
+drjson_deep_eq(const DrJsonContext* ctx, DrJsonValue a, DrJsonValue b){
+    if(a.kind == DRJSON_LAZY_NUMBER) a = drjson_resolve_number(a);
+    if(b.kind == DRJSON_LAZY_NUMBER) b = drjson_resolve_number(b);
+    // Different types are not equal, except for numeric types
+    if(a.kind != b.kind){
+        // Allow comparison between different numeric types
+        if((a.kind == DRJSON_INTEGER || a.kind == DRJSON_UINTEGER || a.kind == DRJSON_NUMBER) &&
+           (b.kind == DRJSON_INTEGER || b.kind == DRJSON_UINTEGER || b.kind == DRJSON_NUMBER)){
 
-    // Handle DRJSON_PRINT_NDJSON for arrays
-    if((flags & DRJSON_PRINT_NDJSON) && v.kind == DRJSON_ARRAY){
-        const DrJsonArray* adata = ctx->arrays.data;
-        const DrJsonArray* array = &adata[v.array_idx];
-        _Bool braceless = flags & DRJSON_PRINT_BRACELESS;
-        _Bool pretty = flags & DRJSON_PRETTY_PRINT;
-
-        for(size_t i = 0; i < array->count; i++){
-            if(i != 0)
-                drjson_buff_putc(&buffer, '\n');
-
-            DrJsonValue item = array->array_items[i];
+            // INTEGER vs UINTEGER
+            if(a.kind == DRJSON_INTEGER && b.kind == DRJSON_UINTEGER){
+                if(a.integer < 0) return 0;
+                return (uint64_t)a.integer == b.uinteger;
+            }
+            if(a.kind == DRJSON_UINTEGER && b.kind == DRJSON_INTEGER){
+                if(b.integer < 0) return 0;
+                return a.uinteger == (uint64_t)b.integer;
+            }
 
-            // Handle braceless objects in NDJSON
-            if(braceless && item.kind == DRJSON_OBJECT){
-                const DrJsonObject* odata = ctx->objects.data;
-                const DrJsonObject* object = &odata[item.object_idx];
-                DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
+            // INTEGER vs NUMBER
+            if(a.kind == DRJSON_INTEGER && b.kind == DRJSON_NUMBER){
+                // Check if b is an integer value
+                if(b.number != (double)(int64_t)b.number) return 0;
+                return a.integer == (int64_t)b.number;
+            }
+            if(a.kind == DRJSON_NUMBER && b.kind == DRJSON_INTEGER){
+                if(a.number != (double)(int64_t)a.number) return 0;
+                return (int64_t)a.number == b.integer;
+            }
 
-                // In NDJSON mode, always print compactly (no pretty printing within lines)
-                // even if PRETTY flag is set, to maintain one value per line
-                for(size_t j = 0; j < object->count; j++){
-                    DrJsonObjectPair* o = &pairs[j];
-                    if(j != 0){
-                        drjson_buff_putc(&buffer, ',');
-                        if(pretty)
-                            drjson_buff_putc(&buffer, ' ');
-                    }
-                    DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                    drjson_buff_putc(&buffer, '"');
-                    drjson_buff_write(&buffer, s.pointer, s.length);
-                    drjson_buff_putc(&buffer, '"');
-                    drjson_buff_putc(&buffer, ':');
-                    if(pretty)
-                        drjson_buff_putc(&buffer, ' ');
-                    drjson_print_value_inner(ctx, &buffer, o->value);
-                }
+            // UINTEGER vs NUMBER
+            if(a.kind == DRJSON_UINTEGER && b.kind == DRJSON_NUMBER){
+                if(b.number < 0) return 0;
+                if(b.number != (double)(uint64_t)b.number) return 0;
+                return a.uinteger == (uint64_t)b.number;
             }
-            else {
-                // Regular printing for non-object items or when not braceless
-                if(pretty){
-                    for(int ind = 0; ind < indent; ind++)
-                        drjson_buff_putc(&buffer, ' ');
-                    drjson_pretty_print_value_inner(ctx, &buffer, item, indent);
-                }
-                else
-                    drjson_print_value_inner(ctx, &buffer, item);
+            if(a.kind == DRJSON_NUMBER && b.kind == DRJSON_UINTEGER){
+                if(a.number < 0) return 0;
+                if(a.number != (double)(uint64_t)a.number) return 0;
+                return (uint64_t)a.number == b.uinteger;
             }
         }
+        return 0;
     }
-    // Handle DRJSON_PRINT_BRACELESS for objects
-    else if((flags & DRJSON_PRINT_BRACELESS) && v.kind == DRJSON_OBJECT){
-        const DrJsonObject* odata = ctx->objects.data;
-        const DrJsonObject* object = &odata[v.object_idx];
-        DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-
-        if(flags & DRJSON_PRETTY_PRINT){
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(i != 0){
-                    drjson_buff_putc(&buffer, ',');
-                    drjson_buff_putc(&buffer, '\n');
-                }
-                for(int ind = 0; ind < indent; ind++)
-                    drjson_buff_putc(&buffer, ' ');
 
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(&buffer, '"');
-                drjson_buff_write(&buffer, s.pointer, s.length);
-                drjson_buff_putc(&buffer, '"');
-                drjson_buff_putc(&buffer, ':');
-                drjson_buff_putc(&buffer, ' ');
-                drjson_pretty_print_value_inner(ctx, &buffer, o->value, indent);
-            }
+    switch(a.kind){
+        case DRJSON_NULL:
+            return 1;
+        case DRJSON_BOOL:
+            return a.boolean == b.boolean;
+        case DRJSON_INTEGER:
+            return a.integer == b.integer;
+        case DRJSON_UINTEGER:
+            return a.uinteger == b.uinteger;
+        case DRJSON_NUMBER:
+            return a.number == b.number;
+        case DRJSON_STRING:{
+            const char *a_str, *b_str;
+            size_t a_len, b_len;
+            int a_err = drj_get_str_and_len(ctx, a, &a_str, &a_len);
+            int b_err = drj_get_str_and_len(ctx, b, &b_str, &b_len);
+            if(a_err) return b_err == a_err;
+            if(b_err) return 0;
+            if(a_len != b_len) return 0;
+            return memcmp(a_str, b_str, a_len) == 0;
         }
-        else {
-            int newlined = 0;
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(&buffer, ',');
-                newlined = 1;
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(&buffer, '"');
-                drjson_buff_write(&buffer, s.pointer, s.length);
-                drjson_buff_putc(&buffer, '"');
-                drjson_buff_putc(&buffer, ':');
-                drjson_print_value_inner(ctx, &buffer, o->value);
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:{
+            const DrJsonArray* adata = ctx->arrays.data;
+            const DrJsonArray* a_arr = &adata[a.array_idx];
+            const DrJsonArray* b_arr = &adata[b.array_idx];
+            if(a_arr->count != b_arr->count) return 0;
+            for(size_t i = 0; i < a_arr->count; i++){
+                if(!drjson_deep_eq(ctx, drj_array_get(a_arr, i), drj_array_get(b_arr, i)))
+                    return 0;
             }
+            return 1;
         }
-    }
-    else {
-        if(flags & DRJSON_PRETTY_PRINT){
-            for(int i = 0; i < indent; i++)
-                drjson_buff_putc(&buffer, ' ');
-            drjson_pretty_print_value_inner(ctx, &buffer, v, indent);
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
+        case DRJSON_OBJECT_VALUES:{
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* a_obj = &odata[a.object_idx];
+            const DrJsonObject* b_obj = &odata[b.object_idx];
+            if(drj_obj_len(a_obj) != drj_obj_len(b_obj)) return 0;
+
+            // Check that all keys in a exist in b with equal values
+            DrjObjSlots a_slots = drj_obj_slots(a_obj);
+            for(size_t i = 0; i < a_obj->count; i++){
+                DrJsonObjectPair a_pair = drj_obj_pair(a_slots, i);
+                if(a_pair.atom.bits == DRJ_TOMBSTONE) continue;
+                DrJsonAtom key = a_pair.atom;
+                DrJsonValue a_val = a_pair.value;
+                DrJsonValue b_val = drjson_object_get_item_atom(ctx, b, key);
+                if(b_val.kind == DRJSON_ERROR) return 0; // Key not found in b
+                if(!drjson_deep_eq(ctx, a_val, b_val)) return 0;
+            }
+            return 1;
         }
-        else
-            drjson_print_value_inner(ctx, &buffer, v);
+        case DRJSON_OBJECT_ITEMS:
+        case DRJSON_ERROR:
+        default:
+            return 0;
     }
+}
 
-    if(flags & DRJSON_APPEND_NEWLINE)
-        drjson_buff_putc(&buffer, '\n');
-    if(flags & DRJSON_APPEND_ZERO)
-        drjson_buff_putc(&buffer, '\0');
-    if(buffer.cursor)
-        drjson_buff_flush(&buffer);
-    return buffer.errored;
+
+DRJSON_API
+int
+drjson_path_add_key(DrJsonPath* path, DrJsonAtom key){
+    if(path->count >= DRJSON_PATH_MAX_DEPTH) return 1;
+    path->segments[path->count++] = (DrJsonPathSegment){ .kind = DRJSON_PATH_KEY, .key = key };
+    return 0;
 }
 
 DRJSON_API
 int
-drjson_print_error(const DrJsonTextWriter* restrict writer, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
-#if 0
-    size_t line = 0;
-    size_t column = 0;
-    // just do it the slow way, whatever.
-    for(const char* c = ctx->begin; c != ctx->cursor; c++){
-        switch(*c){
-            case '\n':
-                line++;
-                column = 0;
-                break;
-            default:
-                column++;
-                break;
-        }
+drjson_path_add_index(DrJsonPath* path, int64_t index){
+    if(path->count >= DRJSON_PATH_MAX_DEPTH) return 1;
+    path->segments[path->count++] = (DrJsonPathSegment){ .kind = DRJSON_PATH_INDEX, .index = index };
+    return 0;
+}
+
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_path_parse(const DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path){
+    const char* remainder = NULL;
+    int err = drjson_path_parse_greedy(ctx, path_str, path_len, path, &remainder);
+    if(err) return err;
+    if(remainder != path_str + path_len) return 1; // Did not consume whole string
+    return 0;
+}
+
+// Keys not in the atom table become a key that matches nothing, unless
+// `intern` is given, in which case they are atomized with it.
+static
+int
+drj_path_key(const DrJsonContext* ctx, DrJsonContext*_Nullable intern, const char* key, size_t length, DrJsonPath* path){
+    DrJsonAtom atom;
+    if(intern){
+        int err = drjson_atomize(intern, key, length, &atom);
+        if(err) return 1;
     }
-#endif
-    DrJsonBuffered buffer;
-    buffer.cursor = 0;
-    buffer.writer = writer;
-    buffer.errored = 0;
-    if(filename_len){
-        drjson_buff_write(&buffer, filename, filename_len);
-        drjson_buff_putc(&buffer, ':');
+    else {
+        // Use get_atom_no_intern for allocation-free queries
+        int err = drjson_get_atom_no_intern(ctx, key, length, &atom);
+        if(err){
+            // Key not in atom table - won't be found in any object
+            // Store sentinel value (bits = 0)
+            atom = (DrJsonAtom){.bits = 0};
+        }
     }
-
-    drjson_buff_ensure_n(&buffer, 20);
-    buffer.cursor += drjson_uint64_to_ascii(buffer.buff+buffer.cursor, line+1);
-    drjson_buff_putc(&buffer, ':');
-    buffer.cursor += drjson_uint64_to_ascii(buffer.buff+buffer.cursor, column+1);
-    drjson_buff_putc(&buffer, ':');
-    drjson_buff_putc(&buffer, ' ');
-    drjson_pretty_print_value_inner(NULL, &buffer, v, 0);
-    drjson_buff_putc(&buffer, '\n');
-    if(buffer.cursor)
-        drjson_buff_flush(&buffer);
-    return buffer.errored;
+    return drjson_path_add_key(path, atom);
 }
-static inline
-const char*
-drjson_get_error_name(DrJsonValue);
 
-static inline
-size_t
-drjson_get_error_name_length(DrJsonValue);
+static
+int
+drj_path_parse_greedy(const DrJsonContext* ctx, DrJsonContext*_Nullable intern, const char* path_str, size_t path_len, DrJsonPath* path, const char* _Nullable * _Nonnull remainder){
+    size_t i = 0;
+    size_t begin = 0;
+    if(!path_str) return 1;
+    if(!path) return 1;
+    path->count = 0;
+    if(path_len && path_str[0] == '$'){
+        i = 1;
+    }
 
-static inline
-void
-drjson_print_value_inner(const DrJsonContext* ctx, DrJsonBuffered* restrict buffer, DrJsonValue v){
-    if(buffer->errored) return;
-    switch(v.kind){
-        case DRJSON_NUMBER:{
-            drjson_buff_ensure_n(buffer, 24);
-            int len = fpconv_dtoa(v.number, buffer->buff+buffer->cursor);
-            buffer->cursor += len;
-        }break;
-        case DRJSON_INTEGER:
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.integer);
-            break;
-        case DRJSON_UINTEGER:
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_uint64_to_ascii(buffer->buff+buffer->cursor, v.uinteger);
-            break;
-        case DRJSON_STRING:{
-            drjson_buff_putc(buffer, '"');
-            const char* string = ""; size_t slen = 0;
-            int err = drj_get_str_and_len(ctx, v, &string, &slen);
-            (void)err;
-            drjson_buff_write(buffer, string, slen);
-            drjson_buff_putc(buffer, '"');
-        }break;
-        case DRJSON_ARRAY_VIEW:
-        case DRJSON_ARRAY:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonArray* adata = ctx->arrays.data;
-            const DrJsonArray* array = &adata[v.array_idx];
-            for(size_t i = 0; i < array->count; i++){
-                drjson_print_value_inner(ctx, buffer, array->array_items[i]);
-                if(i != array->count-1u)
-                    drjson_buff_putc(buffer, ',');
-            }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_OBJECT:{
-            drjson_buff_putc(buffer, '{');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                newlined = 1;
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_putc(buffer, ':');
-                drjson_print_value_inner(ctx, buffer, o->value);
-            }
-            drjson_buff_putc(buffer, '}');
-        }break;
-        case DRJSON_OBJECT_KEYS:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                newlined = 1;
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
+    Ldispatch:
+    if(i >= path_len) goto Ldone;
+
+    switch(path_str[i]){
+        case '.':
+            i++;
+            begin = i;
+            if(i == path_len) return 1; // unexpected eof
+            if(path_str[i] == '\"'){
+                i++;
+                begin=i;
+                goto Lquoted_getitem;
             }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_OBJECT_VALUES:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                newlined = 1;
-                drjson_print_value_inner(ctx, buffer, o->value);
+            goto Lgetitem;
+        case '[':
+            i++;
+            begin = i;
+            goto Lsubscript;
+        case CASE_a_z:
+        case CASE_A_Z:
+        case '_':
+            // Allow bare identifier at start of path
+            if(i == 0 || (i == 1 && path_str[0] == '$')){
+                begin = i;
+                goto Lgetitem;
             }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_OBJECT_ITEMS:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                newlined = 1;
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_putc(buffer, ',');
-                drjson_print_value_inner(ctx, buffer, o->value);
+            goto Ldone;
+        default:
+            if(i == 0 || (i == 1 && path_str[0] == '$')) return 1;
+            goto Ldone;
+    }
+
+    Lgetitem:
+    for(;i<path_len;i++){
+        switch(path_str[i]){
+            case '.':
+            case '[':
+                goto Ldo_getitem;
+            case CASE_a_z:
+            case CASE_A_Z:
+            case CASE_0_9:
+            case '/':
+            case '_':
+            case '-':
+            case '+':
+            case '*':
+                continue;
+            default:
+                goto Ldo_getitem;
+        }
+    }
+    Ldo_getitem:
+    if(i == begin) return 1;
+    if(drj_path_key(ctx, intern, path_str + begin, i - begin, path))
+        return 1;
+    goto Ldispatch;
+
+    Lsubscript:
+    for(;i<path_len;i++){
+        switch(path_str[i]){
+            case '-':
+            case CASE_0_9:
+                continue;
+            case ']':
+                goto Ldo_subscript;
+            default:
+                return 1;
+        }
+    }
+    return 1;
+    Ldo_subscript:;
+    Int64Result pr = parse_int64(path_str+begin, i-begin);
+    if(pr.errored) return 1;
+    int err = drjson_path_add_index(path, pr.result);
+    if(err) return 1;
+    i++;
+    goto Ldispatch;
+
+    Lquoted_getitem:
+    for(;i<path_len;i++){
+        if(path_str[i] == '\"'){
+            size_t nbackslash = 0;
+            for(size_t back = i-1; back != begin; back--){
+                if(path_str[back] != '\\') break;
+                nbackslash++;
             }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_NULL:
-            drjson_buff_write_lit(buffer, "null");
-            break;
-        case DRJSON_BOOL:
-            if(v.boolean)
-                drjson_buff_write_lit(buffer, "true");
-            else
-                drjson_buff_write_lit(buffer, "false");
-            break;
-        case DRJSON_ERROR:
-            drjson_buff_write_lit(buffer, "Error: ");
-            drjson_buff_write(buffer, drjson_get_error_name(v), drjson_get_error_name_length(v));
-            drjson_buff_write_lit(buffer, "(Code ");
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.error_code);
-            drjson_buff_write_lit(buffer, "): ");
-            drjson_buff_write(buffer, v.err_mess, v.err_len);
-            break;
+            if(nbackslash & 1) continue;
+            if(drj_path_key(ctx, intern, path_str + begin, i - begin, path))
+                return 1;
+            i++;
+            goto Ldispatch;
+        }
     }
+    return 1;
+
+Ldone:
+    *remainder = path_str + i;
+    return 0;
 }
 
-static inline
-void
-drjson_pretty_print_value_inner(const DrJsonContext*_Nullable ctx, DrJsonBuffered* restrict buffer, DrJsonValue v, int indent){
-    if(buffer->errored) return;
-    switch(v.kind){
-        case DRJSON_NUMBER:{
-            drjson_buff_ensure_n(buffer, 24);
-            int len = fpconv_dtoa(v.number, buffer->buff+buffer->cursor);
-            buffer->cursor += len;
-        }break;
-        case DRJSON_INTEGER:
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.integer);
-            break;
-        case DRJSON_UINTEGER:
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_uint64_to_ascii(buffer->buff+buffer->cursor, v.uinteger);
-            break;
-        case DRJSON_STRING:{
-            drjson_buff_putc(buffer, '"');
-            const char* string = ""; size_t slen = 0;
-            int err = drj_get_str_and_len(ctx, v, &string, &slen);
-            (void)err;
-            drjson_buff_write(buffer, string, slen);
-            drjson_buff_putc(buffer, '"');
-        }break;
-        case DRJSON_ARRAY_VIEW:
-        case DRJSON_ARRAY:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonArray* adata = ctx->arrays.data;
-            const DrJsonArray* array = &adata[v.array_idx];
-            int newlined = 0;
-            if(array->count && !drjson_is_numeric(array->array_items[0])){
-                drjson_buff_putc(buffer, '\n');
-                newlined = 1;
-            }
-            for(size_t i = 0; i < array->count; i++){
-                if(newlined)
-                    for(int i = 0; i < indent+2; i++)
-                        drjson_buff_putc(buffer, ' ');
-                drjson_pretty_print_value_inner(ctx, buffer, array->array_items[i], indent+2);
-                if(i != array->count-1u)
-                    drjson_buff_putc(buffer, ',');
-                if(newlined)
-                    drjson_buff_putc(buffer, '\n');
-            }
-            if(newlined){
-                for(int i = 0; i < indent; i++)
-                    drjson_buff_putc(buffer, ' ');
-            }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_OBJECT:{
-            drjson_buff_putc(buffer, '{');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                drjson_buff_putc(buffer, '\n');
-                newlined = 1;
-                for(int ind = 0; ind < indent+2; ind++)
-                    drjson_buff_putc(buffer, ' ');
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_path_parse_greedy(const DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path, const char* _Nullable * _Nonnull remainder){
+    return drj_path_parse_greedy(ctx, NULL, path_str, path_len, path, remainder);
+}
 
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_putc(buffer, ':');
-                drjson_buff_putc(buffer, ' ');
-                drjson_pretty_print_value_inner(ctx, buffer, o->value, indent+2);
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_path_parse_intern(DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path){
+    const char* remainder = NULL;
+    int err = drj_path_parse_greedy(ctx, ctx, path_str, path_len, path, &remainder);
+    if(err) return err;
+    if(remainder != path_str + path_len) return 1; // Did not consume whole string
+    return 0;
+}
+
+//
+// Projection parsing
+//
+// Only the values the paths lead to are built. Everything else is skipped
+// by matching brackets and quotes, without atomizing or allocating.
+//
+
+// Skips one value or, if `closer` is given, the rest of the container it
+// closes (which counts as the first level). Strings are only scanned for their closing quote and other
+// tokens for their end, so skipped text is checked for little more than
+// being balanced.
+static
+DrJsonValue // an error or null
+drj_skip_value(DrJsonParseContext* ctx, char closer, int max_depth){
+    // A bit per level: whether it is an object.
+    enum {SKIP_MAX_DEPTH=1024};
+    uint64_t objects[SKIP_MAX_DEPTH/64] = {0};
+    int depth = 0;
+    if(closer){
+        objects[0] = closer == '}';
+        depth = 1;
+    }
+    do {
+        drj_skip_whitespace(ctx);
+        const char* cursor = ctx->cursor;
+        const char* end = ctx->end;
+        if(cursor == end)
+            return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before the end of a value");
+        char c = *cursor;
+        switch(c){
+            case '{': case '[':
+                if(unlikely(depth >= SKIP_MAX_DEPTH || depth >= max_depth))
+                    return drjson_make_error(DRJSON_ERROR_TOO_DEEP, "Too many levels of nesting.");
+                if(c == '{')
+                    objects[depth/64] |= 1llu << (depth & 63);
+                else
+                    objects[depth/64] &= ~(1llu << (depth & 63));
+                depth++;
+                ctx->cursor = cursor + 1;
+                continue;
+            case '}': case ']':{
+                if(!depth)
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Character is not a valid starting character for json");
+                depth--;
+                _Bool object = (objects[depth/64] >> (depth & 63)) & 1;
+                if(object != (c == '}'))
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, object? "Expected '}' to close an object" : "Expected ']' to close an array");
+                ctx->cursor = cursor + 1;
+            }break;
+            case '"': case '\'':{
+                _Bool escapes;
+                const char* close = drj_scan_string(cursor+1, end, c, &escapes);
+                if(!close){
+                    ctx->cursor = cursor + 1;
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, c == '"'? "No closing '\"' for a string" : "No closing \"'\" for a string");
+                }
+                ctx->cursor = close + 1;
+            }break;
+            default:
+                if(!drj_is_bare_char(c))
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Character is not a valid starting character for json");
+                do cursor++; while(cursor != end && drj_is_bare_char(*cursor));
+                ctx->cursor = cursor;
+                break;
+        }
+    }while(depth);
+    return drjson_make_null();
+}
+
+typedef struct DrjProjection DrjProjection;
+struct DrjProjection {
+    const DrJsonPath* paths;
+    unsigned flags; // for values that are built whole
+    int depth; // nesting outside of the document (-1 for an ndjson root)
+    int max_depth;
+};
+
+force_inline
+_Bool
+drj_is_magic_key(const DrJsonContext* ctx, DrJsonAtom key){
+    return key.bits == ctx->magic_keys.length.bits
+        || key.bits == ctx->magic_keys.keys.bits
+        || key.bits == ctx->magic_keys.values.bits
+        || key.bits == ctx->magic_keys.items.bits;
+}
+
+static
+DrJsonValue
+drj_parse_projected_container(DrJsonParseContext* ctx, const DrjProjection* proj, uint64_t active, int depth, _Bool object, char closer);
+
+// Whether a container at `depth` has to be built whole: a path ends at it
+// or needs all of it (negative indexes, length, keys, ...).
+static inline
+_Bool
+drj_projection_needs_whole(const DrJsonContext* ctx, const DrjProjection* proj, uint64_t active, int depth){
+    for(uint64_t a = active; a; a &= a - 1){
+        const DrJsonPath* path = &proj->paths[drj_ctz64(a)];
+        if(path->count == (size_t)depth)
+            return 1;
+        const DrJsonPathSegment* seg = &path->segments[depth];
+        if(seg->kind == DRJSON_PATH_INDEX? seg->index < 0 : drj_is_magic_key(ctx, seg->key))
+            return 1;
+    }
+    return 0;
+}
+
+// Builds the value at the cursor if one of the `active` paths ends at it,
+// otherwise only the parts of it that they lead into. Recurses at most
+// DRJSON_PATH_MAX_DEPTH deep.
+static
+DrJsonValue
+drj_parse_projected_value(DrJsonParseContext* ctx, const DrjProjection* proj, uint64_t active, int depth){
+    drj_skip_whitespace(ctx);
+    if(ctx->cursor == ctx->end)
+        return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, "Eof before any values");
+    char c = *ctx->cursor;
+    // Scalars are just parsed.
+    if((c != '{' && c != '[') || drj_projection_needs_whole(ctx->ctx, proj, active, depth)){
+        int outer = ctx->depth;
+        ctx->depth = proj->depth + depth;
+        DrJsonValue v = drjson_parse(ctx, proj->flags);
+        ctx->depth = outer;
+        return v;
+    }
+    if(proj->depth + depth >= proj->max_depth)
+        return drjson_make_error(DRJSON_ERROR_TOO_DEEP, "Too many levels of nesting.");
+    ctx->cursor++;
+    return drj_parse_projected_container(ctx, proj, active, depth, c == '{', c == '{'? '}' : ']');
+}
+
+// `closer` is 0 for the implicit container of a braceless or ndjson
+// document.
+static
+DrJsonValue
+drj_parse_projected_container(DrJsonParseContext* ctx, const DrjProjection* proj, uint64_t active, int depth, _Bool object, char closer){
+    DrJsonContext* jctx = ctx->ctx;
+    DrJsonValue result = object? drjson_make_object(jctx) : drjson_make_array(jctx);
+    if(result.kind == DRJSON_ERROR) return result;
+    // Later items of an array aren't needed.
+    int64_t last = -1;
+    if(!object){
+        for(uint64_t a = active; a; a &= a - 1){
+            const DrJsonPathSegment* seg = &proj->paths[drj_ctz64(a)].segments[depth];
+            if(seg->kind == DRJSON_PATH_INDEX && seg->index > last)
+                last = seg->index;
+        }
+    }
+    for(int64_t index = 0;; index++){
+        drj_skip_whitespace(ctx);
+        if(ctx->cursor == ctx->end){
+            if(!closer) return result;
+            return drjson_make_error(DRJSON_ERROR_UNEXPECTED_EOF, object? "Eof before closing '}'" : "Eof before closing ']'");
+        }
+        if(closer && *ctx->cursor == closer){
+            ctx->cursor++;
+            return result;
+        }
+        if(closer && index > last && !object){
+            DrJsonValue err = drj_skip_value(ctx, closer, proj->max_depth - proj->depth - depth);
+            if(err.kind == DRJSON_ERROR) return err;
+            return result;
+        }
+        uint64_t next = 0;
+        DrJsonAtom key = {0};
+        if(object){
+            const char* k = ctx->cursor;
+            const char* kend;
+            if(*k == '"' || *k == '\''){
+                _Bool escapes;
+                kend = drj_scan_string(k+1, ctx->end, *k, &escapes);
+                if(!kend){
+                    ctx->cursor = k + 1;
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, *k == '"'? "No closing '\"' for a string" : "No closing \"'\" for a string");
+                }
+                ctx->cursor = kend + 1;
+                k++;
             }
-            if(newlined){
-                drjson_buff_putc(buffer, '\n');
-                for(int i = 0; i < indent; i++)
-                    drjson_buff_putc(buffer, ' ');
+            else {
+                kend = drj_scan_bare_string(k, ctx->end);
+                if(kend == k)
+                    return drjson_make_error(DRJSON_ERROR_INVALID_CHAR, "Character is not a valid starting character for json");
+                ctx->cursor = kend;
             }
-            drjson_buff_putc(buffer, '}');
-        }break;
-        case DRJSON_OBJECT_KEYS:{
-            drjson_buff_putc(buffer, '[');
-            const DrJsonObject* odata = ctx->objects.data;
-            const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                drjson_buff_putc(buffer, '\n');
-                newlined = 1;
-                for(int ind = 0; ind < indent+2; ind++)
-                    drjson_buff_putc(buffer, ' ');
+            // Compare against the paths' keys instead of looking the key
+            // up, which would have to hash it.
+            size_t klen = kend - k;
+            for(uint64_t a = active; a; a &= a - 1){
+                unsigned i = drj_ctz64(a);
+                const DrJsonPathSegment* seg = &proj->paths[i].segments[depth];
+                if(seg->kind != DRJSON_PATH_KEY || !seg->key.bits)
+                    continue;
+                DrjAtomStr str = drj_get_atom_str(&jctx->atoms, seg->key);
+                if(str.length == klen && memcmp(str.pointer, k, klen) == 0){
+                    next |= 1llu << i;
+                    key = seg->key;
+                }
+            }
+        }
+        else {
+            for(uint64_t a = active; a; a &= a - 1){
+                unsigned i = drj_ctz64(a);
+                const DrJsonPathSegment* seg = &proj->paths[i].segments[depth];
+                if(seg->kind == DRJSON_PATH_INDEX && seg->index == index)
+                    next |= 1llu << i;
+            }
+        }
+        if(!next){
+            DrJsonValue err = drj_skip_value(ctx, 0, proj->max_depth - proj->depth - depth - 1);
+            if(err.kind == DRJSON_ERROR) return err;
+            continue;
+        }
+        DrJsonValue v = drj_parse_projected_value(ctx, proj, next, depth + 1);
+        if(v.kind == DRJSON_ERROR) return v;
+        if(object){
+            if(drjson_object_set_item_atom(jctx, result, key, v))
+                return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to allocate space for an item while setting member of an object");
+            continue;
+        }
+        // Skipped items are null so the indexes still line up.
+        while(drjson_len(jctx, result) < index)
+            if(drjson_array_push_item(jctx, result, drjson_make_null()))
+                return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to push an item onto an array");
+        if(drjson_array_push_item(jctx, result, v))
+            return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "Failed to push an item onto an array");
+    }
+}
 
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
+DRJSON_API
+DrJsonValue
+drjson_parse_projected(DrJsonParseContext* ctx, unsigned flags, const DrJsonPath* paths, size_t npaths){
+    const unsigned lines = DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
+    // Paths are tracked in a 64 bit set. Neither that nor braceless ndjson
+    // is worth the complexity; a full parse is a valid projection too.
+    if(npaths > 64 || (flags & lines) == lines)
+        return drjson_parse(ctx, flags);
+    for(size_t i = 0; i < npaths; i++)
+        if(paths[i].count > DRJSON_PATH_MAX_DEPTH)
+            return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Invalid path");
+    if(!(flags & DRJSON_PARSE_FLAG_NO_COPY_STRINGS))
+        ctx->_copy_strings = 1;
+    if(flags & DRJSON_PARSE_FLAG_LAZY_NUMBERS)
+        ctx->_lazy_numbers = 1;
+    DrjProjection proj = {
+        .paths = paths,
+        .flags = flags & ~(lines|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING),
+        .depth = ctx->depth,
+        .max_depth = ctx->max_depth? ctx->max_depth : DRJSON_DEFAULT_MAX_DEPTH,
+    };
+    uint64_t active = npaths == 64? UINT64_MAX : (1llu << npaths) - 1;
+    DrJsonValue result;
+    // The implicit container of a braceless or ndjson document has nothing
+    // to parse it whole, so that is just a full parse.
+    if((flags & lines) && drj_projection_needs_whole(ctx->ctx, &proj, active, 0))
+        return drjson_parse(ctx, flags);
+    if(flags & DRJSON_PARSE_FLAG_NDJSON){
+        proj.depth--;
+        result = drj_parse_projected_container(ctx, &proj, active, 0, 0, 0);
+    }
+    else if(flags & DRJSON_PARSE_FLAG_BRACELESS_OBJECT)
+        result = drj_parse_projected_container(ctx, &proj, active, 0, 1, 0);
+    else
+        result = drj_parse_projected_value(ctx, &proj, active, 0);
+    if(result.kind == DRJSON_ERROR)
+        return result;
+    if(flags & DRJSON_PARSE_FLAG_ERROR_ON_TRAILING){
+        drj_skip_whitespace(ctx);
+        if(ctx->cursor != ctx->end)
+            return drjson_make_error(DRJSON_ERROR_TRAILING_CONTENT, "Unexpected content after JSON value");
+    }
+    return result;
+}
+
+DRJSON_API
+DrJsonValue
+drjson_query(const DrJsonContext* ctx, DrJsonValue v, const char* query, size_t length){
+    DrJsonPath path;
+    int err = drjson_path_parse(ctx, query, length, &path);
+    if(err) return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Invalid query path");
+    return drjson_evaluate_path(ctx, v, &path);
+}
+
+// Helper function to check if a key is a magic property and handle it
+static
+DrJsonValue
+drjson_try_magic_key(const DrJsonContext* ctx, DrJsonValue current, DrJsonAtom key){
+    // Check for magic properties using pre-atomized keys
+    if(key.bits == ctx->magic_keys.length.bits){
+        int64_t len = drjson_len(ctx, current);
+        if(len < 0)
+            return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "length on non-container");
+        return drjson_make_int(len);
+    }
+    if(key.bits == ctx->magic_keys.keys.bits){
+        return drjson_object_keys(current);
+    }
+    if(key.bits == ctx->magic_keys.values.bits){
+        return drjson_object_values(current);
+    }
+    if(key.bits == ctx->magic_keys.items.bits){
+        return drjson_object_items(current);
+    }
+
+    // Not a magic key
+    return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "Key not found");
+}
+
+DRJSON_API
+DrJsonValue
+drjson_evaluate_path(const DrJsonContext* ctx, DrJsonValue v, const DrJsonPath* path){
+    DrJsonValue current_value = v;
+    for(size_t i = 0; i < path->count; i++){
+        const DrJsonPathSegment* seg = &path->segments[i];
+        if(seg->kind == DRJSON_PATH_KEY){
+            // Check for sentinel (key not in atom table)
+            if(seg->key.bits == 0){
+                // Key doesn't exist in atom table, check if it's a magic key
+                // (This shouldn't happen since we pre-atomize magic keys, but handle it anyway)
+                return drjson_make_error(DRJSON_ERROR_MISSING_KEY, "Key not found");
             }
-            if(newlined){
-                drjson_buff_putc(buffer, '\n');
-                for(int i = 0; i < indent; i++)
-                    drjson_buff_putc(buffer, ' ');
+
+            // Save the value before lookup
+            DrJsonValue pre_lookup_value = current_value;
+
+            // Try normal key lookup first
+            current_value = drjson_object_get_item_atom(ctx, current_value, seg->key);
+
+            // If that failed, try magic keys on the original value
+            if(current_value.kind == DRJSON_ERROR){
+                DrJsonValue magic_result = drjson_try_magic_key(ctx, pre_lookup_value, seg->key);
+                // Only use magic result if it's not a "key not found" error
+                if(magic_result.kind != DRJSON_ERROR || magic_result.error_code != DRJSON_ERROR_MISSING_KEY){
+                    current_value = magic_result;
+                }
             }
-            drjson_buff_putc(buffer, ']');
-        }break;
+        } else { // DRJSON_PATH_INDEX
+            current_value = drjson_get_by_index(ctx, current_value, seg->index);
+        }
+        if(current_value.kind == DRJSON_ERROR) return current_value;
+    }
+    return current_value;
+}
+
+DRJSON_API
+int64_t
+drjson_len(const DrJsonContext* ctx, DrJsonValue v){
+    switch(v.kind){
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:{
+            const DrJsonArray* adata = ctx->arrays.data;
+            const DrJsonArray* array = &adata[v.array_idx];
+            return array->count;
+        }
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
         case DRJSON_OBJECT_VALUES:{
-            drjson_buff_putc(buffer, '[');
             const DrJsonObject* odata = ctx->objects.data;
             const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                drjson_buff_putc(buffer, '\n');
-                newlined = 1;
-                for(int ind = 0; ind < indent+2; ind++)
-                    drjson_buff_putc(buffer, ' ');
-                drjson_pretty_print_value_inner(ctx, buffer, o->value, indent+2);
-            }
-            if(newlined){
-                drjson_buff_putc(buffer, '\n');
-                for(int i = 0; i < indent; i++)
-                    drjson_buff_putc(buffer, ' ');
-            }
-            drjson_buff_putc(buffer, ']');
-        }break;
+            return drj_obj_len(object);
+        }
         case DRJSON_OBJECT_ITEMS:{
-            drjson_buff_putc(buffer, '[');
             const DrJsonObject* odata = ctx->objects.data;
             const DrJsonObject* object = &odata[v.object_idx];
-            int newlined = 0;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++){
-                DrJsonObjectPair* o = &pairs[i];
-                if(newlined)
-                    drjson_buff_putc(buffer, ',');
-                drjson_buff_putc(buffer, '\n');
-                newlined = 1;
-                for(int ind = 0; ind < indent+2; ind++)
-                    drjson_buff_putc(buffer, ' ');
-
-                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o->atom);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_write(buffer, s.pointer, s.length);
-                drjson_buff_putc(buffer, '"');
-                drjson_buff_putc(buffer, ',');
-                drjson_buff_putc(buffer, ' ');
-                drjson_pretty_print_value_inner(ctx, buffer, o->value, indent+2);
-            }
-            if(newlined){
-                drjson_buff_putc(buffer, '\n');
-                for(int i = 0; i < indent; i++)
-                    drjson_buff_putc(buffer, ' ');
+            return 2*drj_obj_len(object);
+        }
+        case DRJSON_STRING:{
+            DrjAtomStr s = drj_get_atom_str(&ctx->atoms, v.atom);
+            return s.length;
+        }
+        default:
+            return -1;
+    }
+}
+DRJSON_API
+DrJsonValue
+drjson_get_by_index(const DrJsonContext* ctx, DrJsonValue v, int64_t idx){
+    int64_t len = drjson_len(ctx, v);
+    if(idx < 0) idx += len;
+    size_t index  = idx < 0? (size_t)(idx + len) : (size_t)idx;
+    switch(v.kind){
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:{
+            const DrJsonArray* adata = ctx->arrays.data;
+            const DrJsonArray* array = &adata[v.array_idx];
+            if(array->count <= index)
+                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
+            return drj_array_get(array, index);
+        }
+        case DRJSON_OBJECT_KEYS:{
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            if(drj_obj_len(object) <= index)
+                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
+            return drjson_atom_to_value(drj_obj_nth_pair(object, index).atom);
+        }
+        case DRJSON_OBJECT_VALUES:{
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            if(drj_obj_len(object) <= index)
+                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
+            return drj_obj_nth_pair(object, index).value;
+        }
+        case DRJSON_OBJECT_ITEMS:{
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            size_t pidx = index/2;
+            if(drj_obj_len(object) <= pidx)
+                return drjson_make_error(DRJSON_ERROR_INDEX_ERROR, "out of bounds indexing");
+            DrJsonObjectPair pair = drj_obj_nth_pair(object, pidx);
+            if(index & 1)
+                return pair.value;
+            else
+                return drjson_atom_to_value(pair.atom);
+        }
+        default:
+            return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "object does not support indexing by integer");
+    }
+}
+
+DRJSON_API
+int
+drjson_array_set_by_index(const DrJsonContext* ctx, DrJsonValue a, int64_t idx, DrJsonValue value){
+    if(a.kind != DRJSON_ARRAY) return 1;
+    DrJsonArray* adata = ctx->arrays.data;
+    DrJsonArray* array = &adata[a.array_idx];
+    if(array->read_only) return 1;
+    if(idx < 0) idx += array->count;
+    if(idx < 0) return 1;
+    if(idx >= array->count) return 1;
+    drj_gc_barrier(ctx, value);
+    if(array->packed && !drj_array_fits(array->packed, value) && drj_array_unpack(ctx, array)) return 1;
+    drj_array_put(array, idx, value);
+    return 0;
+}
+
+typedef struct DrJsonMemBuff DrJsonMemBuff;
+struct DrJsonMemBuff {
+    char* begin;
+    char* end;
+};
+
+static
+int mem_buff_write(void* p, const void* data, size_t len){
+    DrJsonMemBuff* buff = p;
+    if(buff->begin + len >= buff->end)
+        return 1;
+    drj_memcpy(buff->begin, data, len);
+    buff->begin += len;
+    return 0;
+}
+
+DRJSON_API
+int
+drjson_print_value_mem(const DrJsonContext* ctx, void* buff, size_t bufflen, DrJsonValue v, int indent, unsigned flags, size_t*_Nullable printed){
+    DrJsonMemBuff membuff = {.begin = buff, .end = bufflen+(char*)buff};
+    DrJsonTextWriter writer = {
+        .up = &membuff,
+        .write = mem_buff_write,
+    };
+    int result = drjson_print_value(ctx, &writer, v, indent, flags);
+    if(!result && printed){
+        *printed = membuff.begin - (char*)buff;
+    }
+    return result;
+}
+
+DRJSON_API
+int
+drjson_print_error_mem(void* buff, size_t bufflen, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
+    DrJsonMemBuff membuff = {.begin = buff, .end = bufflen+(char*)buff};
+    DrJsonTextWriter writer = {
+        .up = &membuff,
+        .write = mem_buff_write,
+    };
+    return drjson_print_error(&writer, filename, filename_len, line, column, v);
+}
+
+#ifndef DRJSON_NO_STDIO
+static
+int wrapped_fwrite(void* ud, const void* data, size_t length){
+    return fwrite(data, 1, length, ud) != length;
+}
+
+DRJSON_API
+#ifdef __clang__
+__attribute__((__noinline__)) // clang is generating invalid code on windows without this
+#endif
+int
+drjson_print_value_fp(const DrJsonContext* ctx, FILE* fp, DrJsonValue v, int indent, unsigned flags){
+    DrJsonTextWriter writer = {
+        .up = fp,
+        .write = wrapped_fwrite,
+    };
+    return drjson_print_value(ctx, &writer, v, indent, flags);
+}
+DRJSON_API
+#ifdef __clang__
+__attribute__((__noinline__)) // probably ditto
+#endif
+int
+drjson_print_error_fp(FILE* fp, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
+    DrJsonTextWriter writer = {
+        .up = fp,
+        .write = wrapped_fwrite,
+    };
+    return drjson_print_error(&writer, filename, filename_len, line, column, v);
+}
+#endif
+
+#ifndef DRJSON_NO_IO
+#ifndef _WIN32
+static
+int
+wrapped_write(void* restrict ud, const void* restrict data, size_t length){
+    int fd = (int)(intptr_t)ud;
+    return write(fd, data, length) != (ssize_t)length;
+}
+DRJSON_API
+int
+drjson_print_value_fd(const DrJsonContext* ctx, int fd, DrJsonValue v, int indent, unsigned flags){
+    DrJsonTextWriter writer = {
+        .up = (void*)(intptr_t)fd,
+        .write = wrapped_write,
+    };
+    return drjson_print_value(ctx, &writer, v, indent, flags);
+}
+DRJSON_API
+int
+drjson_print_error_fd(int fd, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
+    DrJsonTextWriter writer = {
+        .up = (void*)(intptr_t)fd,
+        .write = wrapped_write,
+    };
+    return drjson_print_error(&writer, filename, filename_len, line, column, v);
+}
+#else
+static int
+wrapped_write_file(void* restrict ud, const void* restrict data, size_t length){
+    HANDLE hnd = ud;
+    DWORD nwrit = 0;
+    return WriteFile(hnd, data, length, &nwrit, NULL) != TRUE;
+}
+DRJSON_API
+int
+drjson_print_value_HANDLE(const DrJsonContext* ctx, void* hnd, DrJsonValue v, int indent, unsigned flags){
+    DrJsonTextWriter writer = {
+        .up = (void*)hnd,
+        .write = wrapped_write_file,
+    };
+    return drjson_print_value(ctx, &writer, v, indent, flags);
+}
+DRJSON_API
+int
+drjson_print_error_HANDLE(void* hnd, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
+    DrJsonTextWriter writer = {
+        .up = (void*)hnd,
+        .write = wrapped_write_file,
+    };
+    return drjson_print_error(&writer, filename, filename_len, line, column, v);
+}
+#endif
+
+static
+int
+drj_ctx_add_file(DrJsonContext* ctx, void* data, size_t size, _Bool mapped){
+    if(ctx->files.count == ctx->files.capacity){
+        size_t new_cap = ctx->files.capacity? ctx->files.capacity*2 : 4;
+        DrjFileData* files = drj_realloc(ctx, ctx->files.data, ctx->files.capacity*sizeof *files, new_cap*sizeof *files);
+        if(!files) return 1;
+        ctx->files.data = files;
+        ctx->files.capacity = new_cap;
+    }
+    ctx->files.data[ctx->files.count++] = (DrjFileData){data, size, mapped};
+    return 0;
+}
+
+#ifndef _WIN32
+DRJSON_API
+int
+drjson_ctx_map_file(DrJsonContext* ctx, const char* path, const char*_Nullable*_Nonnull text, size_t* length){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 1;
+    int result = 1;
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+        goto finally;
+    if(S_ISREG(st.st_mode)){
+        size_t size = (size_t)st.st_size;
+        // Can't map nothing.
+        if(!size){
+            *text = "";
+            *length = 0;
+            result = 0;
+            goto finally;
+        }
+        void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+            goto finally;
+        if(drj_ctx_add_file(ctx, data, size, 1)){
+            munmap(data, size);
+            errno = ENOMEM;
+            goto finally;
+        }
+        *text = data;
+        *length = size;
+        result = 0;
+        goto finally;
+    }
+    size_t capacity = 64*1024, used = 0;
+    char* buff = drj_alloc(ctx, capacity);
+    if(!buff){
+        errno = ENOMEM;
+        goto finally;
+    }
+    for(;;){
+        if(used == capacity){
+            char* grown = drj_realloc(ctx, buff, capacity, capacity*2);
+            if(!grown){
+                drj_free(ctx, buff, capacity);
+                errno = ENOMEM;
+                goto finally;
+            }
+            buff = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, buff+used, capacity-used);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            drj_free(ctx, buff, capacity);
+            goto finally;
+        }
+        if(!n) break;
+        used += (size_t)n;
+    }
+    if(drj_ctx_add_file(ctx, buff, capacity, 0)){
+        drj_free(ctx, buff, capacity);
+        errno = ENOMEM;
+        goto finally;
+    }
+    *text = buff;
+    *length = used;
+    result = 0;
+
+    finally:;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return result;
+}
+
+// Hints whether a file is about to be read front to back.
+static inline
+void
+drj_advise_file(const DrjFileData* f, _Bool sequential){
+    // Hidden by strict -std=c11 without a feature test macro.
+    #ifdef POSIX_MADV_SEQUENTIAL
+    if(f->mapped)
+        posix_madvise(f->data, f->size, sequential? POSIX_MADV_SEQUENTIAL : POSIX_MADV_NORMAL);
+    #else
+    (void)f; (void)sequential;
+    #endif
+}
+
+static inline
+void
+drj_unmap_file(const DrjFileData* f){
+    munmap(f->data, f->size);
+}
+#else
+// drjson_ctx_map_file reports failures in errno, like it does elsewhere.
+static inline
+int
+drj_errno_from_win32(DWORD err){
+    switch(err){
+        case ERROR_FILE_NOT_FOUND:
+        case ERROR_PATH_NOT_FOUND:
+        case ERROR_INVALID_NAME:
+            return ENOENT;
+        case ERROR_ACCESS_DENIED:
+        case ERROR_SHARING_VIOLATION:
+        case ERROR_LOCK_VIOLATION:
+            return EACCES;
+        case ERROR_NOT_ENOUGH_MEMORY:
+        case ERROR_OUTOFMEMORY:
+            return ENOMEM;
+        default:
+            return EIO;
+    }
+}
+
+DRJSON_API
+int
+drjson_ctx_map_file(DrJsonContext* ctx, const char* path, const char*_Nullable*_Nonnull text, size_t* length){
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        errno = drj_errno_from_win32(GetLastError());
+        return 1;
+    }
+    int result = 1;
+    int err = 0;
+    LARGE_INTEGER size;
+    if(GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size)){
+        if(!size.QuadPart){
+            *text = "";
+            *length = 0;
+            result = 0;
+            goto finally;
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(!mapping){
+            err = drj_errno_from_win32(GetLastError());
+            goto finally;
+        }
+        // The view keeps the mapping alive.
+        void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(!data) err = drj_errno_from_win32(GetLastError());
+        CloseHandle(mapping);
+        if(!data) goto finally;
+        if(drj_ctx_add_file(ctx, data, (size_t)size.QuadPart, 1)){
+            UnmapViewOfFile(data);
+            err = ENOMEM;
+            goto finally;
+        }
+        *text = data;
+        *length = (size_t)size.QuadPart;
+        result = 0;
+        goto finally;
+    }
+    size_t capacity = 64*1024, used = 0;
+    char* buff = drj_alloc(ctx, capacity);
+    if(!buff){
+        err = ENOMEM;
+        goto finally;
+    }
+    for(;;){
+        if(used == capacity){
+            char* grown = drj_realloc(ctx, buff, capacity, capacity*2);
+            if(!grown){
+                drj_free(ctx, buff, capacity);
+                err = ENOMEM;
+                goto finally;
+            }
+            buff = grown;
+            capacity *= 2;
+        }
+        size_t want = capacity - used;
+        if(want > 0x40000000) want = 0x40000000;
+        DWORD n = 0;
+        if(!ReadFile(file, buff+used, (DWORD)want, &n, NULL)){
+            DWORD e = GetLastError();
+            if(e == ERROR_BROKEN_PIPE) break;
+            drj_free(ctx, buff, capacity);
+            err = drj_errno_from_win32(e);
+            goto finally;
+        }
+        if(!n) break;
+        used += n;
+    }
+    if(drj_ctx_add_file(ctx, buff, capacity, 0)){
+        drj_free(ctx, buff, capacity);
+        err = ENOMEM;
+        goto finally;
+    }
+    *text = buff;
+    *length = used;
+    result = 0;
+
+    finally:
+    CloseHandle(file);
+    if(result) errno = err;
+    return result;
+}
+
+// The mapping's reads are covered by FILE_FLAG_SEQUENTIAL_SCAN.
+static inline
+void
+drj_advise_file(const DrjFileData* f, _Bool sequential){
+    (void)f; (void)sequential;
+}
+
+static inline
+void
+drj_unmap_file(const DrjFileData* f){
+    UnmapViewOfFile(f->data);
+}
+#endif
+
+static inline
+void
+drj_unmap_files(DrJsonContext* ctx){
+    for(size_t i = 0; i < ctx->files.count; i++){
+        DrjFileData* f = &ctx->files.data[i];
+        if(f->mapped)
+            drj_unmap_file(f);
+    }
+}
+
+// Copies a lazy number's text out of [begin, end).
+static inline
+int
+drj_unmap_move_value(DrJsonContext* ctx, uintptr_t begin, uintptr_t end, DrJsonValue* v){
+    if(v->kind != DRJSON_LAZY_NUMBER || v->_lowned) return 0;
+    uintptr_t p = (uintptr_t)v->number_text;
+    if(p < begin || p >= end) return 0;
+    const char* text = drj_atom_copy_str(&ctx->atoms, &ctx->allocator, v->number_text, v->number_len);
+    if(!text) return 1;
+    v->number_text = text;
+    v->_lowned = 1;
+    return 0;
+}
+
+DRJSON_API
+int
+drjson_ctx_unmap_file(DrJsonContext* ctx, const char* text){
+    size_t idx = 0;
+    for(;idx < ctx->files.count; idx++)
+        if(ctx->files.data[idx].data == text)
+            break;
+    if(idx == ctx->files.count) return 1;
+    DrjFileData file = ctx->files.data[idx];
+    uintptr_t begin = (uintptr_t)file.data, end = begin + file.size;
+    DrjAtomTable* table = &ctx->atoms;
+    DrjAtomStr* strs = table->data;
+    for(uint32_t i = 0; i < table->count; i++){
+        DrjAtomStr* str = &strs[i];
+        uintptr_t p = (uintptr_t)str->pointer;
+        if(str->allocated || p < begin || p >= end) continue;
+        const char* copy = drj_atom_copy_str(table, &ctx->allocator, str->pointer, str->length);
+        if(!copy) return 1;
+        str->pointer = copy;
+        str->allocated = 1;
+    }
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        const DrJsonObject* o = &ctx->objects.data[i];
+        if(!o->capacity) continue;
+        DrjObjSlots slots = drj_obj_slots(o);
+        for(size_t j = 0; j < o->count; j++)
+            if(drj_unmap_move_value(ctx, begin, end, (DrJsonValue*)(slots.values + j * slots.value_stride)))
+                return 1;
+    }
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(!a->capacity || a->packed) continue;
+        for(size_t j = 0; j < a->count; j++)
+            if(drj_unmap_move_value(ctx, begin, end, &a->array_items[j]))
+                return 1;
+    }
+    if(file.mapped)
+        drj_unmap_file(&file);
+    else
+        drj_free(ctx, file.data, file.size);
+    ctx->files.data[idx] = ctx->files.data[--ctx->files.count];
+    return 0;
+}
+
+DRJSON_API
+DrJsonValue
+drjson_parse_file(DrJsonContext* ctx, const char* path, unsigned flags, size_t*_Nullable line, size_t*_Nullable column){
+    const char* text;
+    size_t length;
+    if(line) *line = 0;
+    if(column) *column = 0;
+    size_t nfiles = ctx->files.count;
+    if(drjson_ctx_map_file(ctx, path, &text, &length))
+        return drjson_make_error(DRJSON_ERROR_IO, "Unable to read file");
+    // Empty files aren't kept.
+    const DrjFileData* file = ctx->files.count != nfiles? &ctx->files.data[nfiles] : NULL;
+    DrJsonParseContext pctx = {
+        .ctx = ctx,
+        .begin = text,
+        .cursor = text,
+        .end = text + length,
+    };
+    // Read ahead aggressively while parsing. Afterwards, the strings that
+    // point into the file are looked at in no particular order.
+    if(file) drj_advise_file(file, 1);
+    DrJsonValue result = drjson_parse(&pctx, flags | DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    if(file) drj_advise_file(file, 0);
+    if(result.kind == DRJSON_ERROR){
+        if(line || column){
+            size_t l, c;
+            drjson_get_line_column(&pctx, &l, &c);
+            if(line) *line = l;
+            if(column) *column = c;
+        }
+        // Nothing can get at the partial result, so don't keep the file
+        // around for it. If the atoms made from it can't be copied, it
+        // stays until the ctx is freed.
+        if(file) (void)drjson_ctx_unmap_file(ctx, text);
+    }
+    return result;
+}
+#else
+static inline
+void
+drj_unmap_files(DrJsonContext* ctx){
+    (void)ctx;
+}
+#endif
+
+enum {DRJSON_BUFF_SIZE = 1024*512};
+typedef struct DrJsonBuffered DrJsonBuffered;
+struct DrJsonBuffered {
+    const DrJsonTextWriter* writer;
+    size_t cursor;
+    int errored;
+    char buff[DRJSON_BUFF_SIZE];
+};
+
+
+static inline
+void
+drjson_print_value_inner(const DrJsonContext* ctx, DrJsonBuffered* restrict buffer, DrJsonValue v);
+
+static inline
+void
+drjson_pretty_print_value_inner(const DrJsonContext*_Nullable ctx, DrJsonBuffered* restrict buffer, DrJsonValue v, int indent);
+
+static inline
+void
+drjson_buff_flush(DrJsonBuffered* restrict buffer){
+    if(!buffer->errored)
+        buffer->errored = buffer->writer->write(buffer->writer->up, buffer->buff, buffer->cursor);
+    buffer->cursor = 0;
+}
+
+static inline
+void
+drjson_buff_ensure_n(DrJsonBuffered* restrict buffer, size_t length){
+    if(buffer->cursor + length > DRJSON_BUFF_SIZE){
+        drjson_buff_flush(buffer);
+    }
+}
+
+static inline
+void
+drjson_buff_write(DrJsonBuffered* restrict buffer, const char* restrict data, size_t length){
+    drjson_buff_ensure_n(buffer, length);
+    if(length >= DRJSON_BUFF_SIZE){
+        if(!buffer->errored)
+            buffer->errored = buffer->writer->write(buffer->writer->up, data, length);
+        return;
+    }
+    drj_memcpy(buffer->buff+buffer->cursor, data, length);
+    buffer->cursor += length;
+}
+
+#define drjson_buff_write_lit(b, lit) drjson_buff_write(b, "" lit, sizeof(lit)-1)
+static inline
+void
+drjson_buff_putc(DrJsonBuffered* restrict buffer, char c){
+    drjson_buff_ensure_n(buffer, 1);
+    buffer->buff[buffer->cursor++] = c;
+}
+
+DRJSON_API
+int
+drjson_print_value(const DrJsonContext* ctx, const DrJsonTextWriter* restrict writer, DrJsonValue v, int indent, unsigned flags){
+    DrJsonBuffered buffer;
+    buffer.cursor = 0;
+    buffer.writer = writer;
+    buffer.errored = 0;
+
+    // Handle DRJSON_PRINT_NDJSON for arrays
+    if((flags & DRJSON_PRINT_NDJSON) && v.kind == DRJSON_ARRAY){
+        const DrJsonArray* adata = ctx->arrays.data;
+        const DrJsonArray* array = &adata[v.array_idx];
+        _Bool braceless = flags & DRJSON_PRINT_BRACELESS;
+        _Bool pretty = flags & DRJSON_PRETTY_PRINT;
+
+        for(size_t i = 0; i < array->count; i++){
+            if(i != 0)
+                drjson_buff_putc(&buffer, '\n');
+
+            DrJsonValue item = drj_array_get(array, i);
+
+            // Handle braceless objects in NDJSON
+            if(braceless && item.kind == DRJSON_OBJECT){
+                const DrJsonObject* odata = ctx->objects.data;
+                const DrJsonObject* object = &odata[item.object_idx];
+                DrjObjSlots slots = drj_obj_slots(object);
+
+                // In NDJSON mode, always print compactly (no pretty printing within lines)
+                // even if PRETTY flag is set, to maintain one value per line
+                int first = 1;
+                for(size_t j = 0; j < object->count; j++){
+                    DrJsonObjectPair o = drj_obj_pair(slots, j);
+                    if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                    if(!first){
+                        drjson_buff_putc(&buffer, ',');
+                        if(pretty)
+                            drjson_buff_putc(&buffer, ' ');
+                    }
+                    first = 0;
+                    DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                    drjson_buff_putc(&buffer, '"');
+                    drjson_buff_write(&buffer, s.pointer, s.length);
+                    drjson_buff_putc(&buffer, '"');
+                    drjson_buff_putc(&buffer, ':');
+                    if(pretty)
+                        drjson_buff_putc(&buffer, ' ');
+                    drjson_print_value_inner(ctx, &buffer, o.value);
+                }
+            }
+            else {
+                // Regular printing for non-object items or when not braceless
+                if(pretty){
+                    for(int ind = 0; ind < indent; ind++)
+                        drjson_buff_putc(&buffer, ' ');
+                    drjson_pretty_print_value_inner(ctx, &buffer, item, indent);
+                }
+                else
+                    drjson_print_value_inner(ctx, &buffer, item);
+            }
+        }
+    }
+    // Handle DRJSON_PRINT_BRACELESS for objects
+    else if((flags & DRJSON_PRINT_BRACELESS) && v.kind == DRJSON_OBJECT){
+        const DrJsonObject* odata = ctx->objects.data;
+        const DrJsonObject* object = &odata[v.object_idx];
+        DrjObjSlots slots = drj_obj_slots(object);
+
+        if(flags & DRJSON_PRETTY_PRINT){
+            int newlined = 0;
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined){
+                    drjson_buff_putc(&buffer, ',');
+                    drjson_buff_putc(&buffer, '\n');
+                }
+                newlined = 1;
+                for(int ind = 0; ind < indent; ind++)
+                    drjson_buff_putc(&buffer, ' ');
+
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(&buffer, '"');
+                drjson_buff_write(&buffer, s.pointer, s.length);
+                drjson_buff_putc(&buffer, '"');
+                drjson_buff_putc(&buffer, ':');
+                drjson_buff_putc(&buffer, ' ');
+                drjson_pretty_print_value_inner(ctx, &buffer, o.value, indent);
+            }
+        }
+        else {
+            int newlined = 0;
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(&buffer, ',');
+                newlined = 1;
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(&buffer, '"');
+                drjson_buff_write(&buffer, s.pointer, s.length);
+                drjson_buff_putc(&buffer, '"');
+                drjson_buff_putc(&buffer, ':');
+                drjson_print_value_inner(ctx, &buffer, o.value);
+            }
+        }
+    }
+    else {
+        if(flags & DRJSON_PRETTY_PRINT){
+            for(int i = 0; i < indent; i++)
+                drjson_buff_putc(&buffer, ' ');
+            drjson_pretty_print_value_inner(ctx, &buffer, v, indent);
+        }
+        else
+            drjson_print_value_inner(ctx, &buffer, v);
+    }
+
+    if(flags & DRJSON_APPEND_NEWLINE)
+        drjson_buff_putc(&buffer, '\n');
+    if(flags & DRJSON_APPEND_ZERO)
+        drjson_buff_putc(&buffer, '\0');
+    if(buffer.cursor)
+        drjson_buff_flush(&buffer);
+    return buffer.errored;
+}
+
+DRJSON_API
+int
+drjson_print_error(const DrJsonTextWriter* restrict writer, const char* filename, size_t filename_len, size_t line, size_t column, DrJsonValue v){
+#if 0
+    size_t line = 0;
+    size_t column = 0;
+    // just do it the slow way, whatever.
+    for(const char* c = ctx->begin; c != ctx->cursor; c++){
+        switch(*c){
+            case '\n':
+                line++;
+                column = 0;
+                break;
+            default:
+                column++;
+                break;
+        }
+    }
+#endif
+    // Zeroed so gcc can see buff is initialized if the filename flushes it
+    // before anything was written.
+    DrJsonBuffered buffer = {.writer = writer};
+    if(filename_len){
+        drjson_buff_write(&buffer, filename, filename_len);
+        drjson_buff_putc(&buffer, ':');
+    }
+
+    drjson_buff_ensure_n(&buffer, 20);
+    buffer.cursor += drjson_uint64_to_ascii(buffer.buff+buffer.cursor, line+1);
+    drjson_buff_putc(&buffer, ':');
+    buffer.cursor += drjson_uint64_to_ascii(buffer.buff+buffer.cursor, column+1);
+    drjson_buff_putc(&buffer, ':');
+    drjson_buff_putc(&buffer, ' ');
+    drjson_pretty_print_value_inner(NULL, &buffer, v, 0);
+    drjson_buff_putc(&buffer, '\n');
+    if(buffer.cursor)
+        drjson_buff_flush(&buffer);
+    return buffer.errored;
+}
+static inline
+const char*
+drjson_get_error_name(DrJsonValue);
+
+static inline
+size_t
+drjson_get_error_name_length(DrJsonValue);
+
+static inline
+void
+drjson_print_value_inner(const DrJsonContext* ctx, DrJsonBuffered* restrict buffer, DrJsonValue v){
+    if(buffer->errored) return;
+    switch(v.kind){
+        case DRJSON_NUMBER:{
+            drjson_buff_ensure_n(buffer, 24);
+            int len = fpconv_dtoa(v.number, buffer->buff+buffer->cursor);
+            buffer->cursor += len;
+        }break;
+        case DRJSON_LAZY_NUMBER:
+            drjson_buff_write(buffer, v.number_text, v.number_len);
+            break;
+        case DRJSON_INTEGER:
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.integer);
+            break;
+        case DRJSON_UINTEGER:
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_uint64_to_ascii(buffer->buff+buffer->cursor, v.uinteger);
+            break;
+        case DRJSON_STRING:{
+            drjson_buff_putc(buffer, '"');
+            const char* string = ""; size_t slen = 0;
+            int err = drj_get_str_and_len(ctx, v, &string, &slen);
+            (void)err;
+            drjson_buff_write(buffer, string, slen);
+            drjson_buff_putc(buffer, '"');
+        }break;
+        case DRJSON_ARRAY_VIEW:
+        case DRJSON_ARRAY:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonArray* adata = ctx->arrays.data;
+            const DrJsonArray* array = &adata[v.array_idx];
+            for(size_t i = 0; i < array->count; i++){
+                drjson_print_value_inner(ctx, buffer, drj_array_get(array, i));
+                if(i != array->count-1u)
+                    drjson_buff_putc(buffer, ',');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT:{
+            drjson_buff_putc(buffer, '{');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                newlined = 1;
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_putc(buffer, ':');
+                drjson_print_value_inner(ctx, buffer, o.value);
+            }
+            drjson_buff_putc(buffer, '}');
+        }break;
+        case DRJSON_OBJECT_KEYS:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                newlined = 1;
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT_VALUES:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                newlined = 1;
+                drjson_print_value_inner(ctx, buffer, o.value);
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT_ITEMS:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                newlined = 1;
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_putc(buffer, ',');
+                drjson_print_value_inner(ctx, buffer, o.value);
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_NULL:
+            drjson_buff_write_lit(buffer, "null");
+            break;
+        case DRJSON_BOOL:
+            if(v.boolean)
+                drjson_buff_write_lit(buffer, "true");
+            else
+                drjson_buff_write_lit(buffer, "false");
+            break;
+        case DRJSON_ERROR:
+            drjson_buff_write_lit(buffer, "Error: ");
+            drjson_buff_write(buffer, drjson_get_error_name(v), drjson_get_error_name_length(v));
+            drjson_buff_write_lit(buffer, "(Code ");
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.error_code);
+            drjson_buff_write_lit(buffer, "): ");
+            drjson_buff_write(buffer, v.err_mess, v.err_len);
+            break;
+    }
+}
+
+static inline
+void
+drjson_pretty_print_value_inner(const DrJsonContext*_Nullable ctx, DrJsonBuffered* restrict buffer, DrJsonValue v, int indent){
+    if(buffer->errored) return;
+    switch(v.kind){
+        case DRJSON_NUMBER:{
+            drjson_buff_ensure_n(buffer, 24);
+            int len = fpconv_dtoa(v.number, buffer->buff+buffer->cursor);
+            buffer->cursor += len;
+        }break;
+        case DRJSON_LAZY_NUMBER:
+            drjson_buff_write(buffer, v.number_text, v.number_len);
+            break;
+        case DRJSON_INTEGER:
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.integer);
+            break;
+        case DRJSON_UINTEGER:
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_uint64_to_ascii(buffer->buff+buffer->cursor, v.uinteger);
+            break;
+        case DRJSON_STRING:{
+            drjson_buff_putc(buffer, '"');
+            const char* string = ""; size_t slen = 0;
+            int err = drj_get_str_and_len(ctx, v, &string, &slen);
+            (void)err;
+            drjson_buff_write(buffer, string, slen);
+            drjson_buff_putc(buffer, '"');
+        }break;
+        case DRJSON_ARRAY_VIEW:
+        case DRJSON_ARRAY:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonArray* adata = ctx->arrays.data;
+            const DrJsonArray* array = &adata[v.array_idx];
+            int newlined = 0;
+            if(array->count && !drjson_is_numeric(drj_array_get(array, 0))){
+                drjson_buff_putc(buffer, '\n');
+                newlined = 1;
+            }
+            for(size_t i = 0; i < array->count; i++){
+                if(newlined)
+                    for(int i = 0; i < indent+2; i++)
+                        drjson_buff_putc(buffer, ' ');
+                drjson_pretty_print_value_inner(ctx, buffer, drj_array_get(array, i), indent+2);
+                if(i != array->count-1u)
+                    drjson_buff_putc(buffer, ',');
+                if(newlined)
+                    drjson_buff_putc(buffer, '\n');
+            }
+            if(newlined){
+                for(int i = 0; i < indent; i++)
+                    drjson_buff_putc(buffer, ' ');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT:{
+            drjson_buff_putc(buffer, '{');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                drjson_buff_putc(buffer, '\n');
+                newlined = 1;
+                for(int ind = 0; ind < indent+2; ind++)
+                    drjson_buff_putc(buffer, ' ');
+
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_putc(buffer, ':');
+                drjson_buff_putc(buffer, ' ');
+                drjson_pretty_print_value_inner(ctx, buffer, o.value, indent+2);
+            }
+            if(newlined){
+                drjson_buff_putc(buffer, '\n');
+                for(int i = 0; i < indent; i++)
+                    drjson_buff_putc(buffer, ' ');
+            }
+            drjson_buff_putc(buffer, '}');
+        }break;
+        case DRJSON_OBJECT_KEYS:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                drjson_buff_putc(buffer, '\n');
+                newlined = 1;
+                for(int ind = 0; ind < indent+2; ind++)
+                    drjson_buff_putc(buffer, ' ');
+
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+            }
+            if(newlined){
+                drjson_buff_putc(buffer, '\n');
+                for(int i = 0; i < indent; i++)
+                    drjson_buff_putc(buffer, ' ');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT_VALUES:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                drjson_buff_putc(buffer, '\n');
+                newlined = 1;
+                for(int ind = 0; ind < indent+2; ind++)
+                    drjson_buff_putc(buffer, ' ');
+                drjson_pretty_print_value_inner(ctx, buffer, o.value, indent+2);
+            }
+            if(newlined){
+                drjson_buff_putc(buffer, '\n');
+                for(int i = 0; i < indent; i++)
+                    drjson_buff_putc(buffer, ' ');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_OBJECT_ITEMS:{
+            drjson_buff_putc(buffer, '[');
+            const DrJsonObject* odata = ctx->objects.data;
+            const DrJsonObject* object = &odata[v.object_idx];
+            int newlined = 0;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++){
+                DrJsonObjectPair o = drj_obj_pair(slots, i);
+                if(o.atom.bits == DRJ_TOMBSTONE) continue;
+                if(newlined)
+                    drjson_buff_putc(buffer, ',');
+                drjson_buff_putc(buffer, '\n');
+                newlined = 1;
+                for(int ind = 0; ind < indent+2; ind++)
+                    drjson_buff_putc(buffer, ' ');
+
+                DrjAtomStr s = drj_get_atom_str(&ctx->atoms, o.atom);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_write(buffer, s.pointer, s.length);
+                drjson_buff_putc(buffer, '"');
+                drjson_buff_putc(buffer, ',');
+                drjson_buff_putc(buffer, ' ');
+                drjson_pretty_print_value_inner(ctx, buffer, o.value, indent+2);
+            }
+            if(newlined){
+                drjson_buff_putc(buffer, '\n');
+                for(int i = 0; i < indent; i++)
+                    drjson_buff_putc(buffer, ' ');
+            }
+            drjson_buff_putc(buffer, ']');
+        }break;
+        case DRJSON_NULL:
+            drjson_buff_write_lit(buffer, "null");
+            break;
+        case DRJSON_BOOL:
+            if(v.boolean)
+                drjson_buff_write_lit(buffer, "true");
+            else
+                drjson_buff_write_lit(buffer, "false");
+            break;
+        case DRJSON_ERROR:
+            drjson_buff_write_lit(buffer, "Error: ");
+            drjson_buff_write(buffer, drjson_get_error_name(v), drjson_get_error_name_length(v));
+            drjson_buff_write_lit(buffer, "(Code ");
+            drjson_buff_ensure_n(buffer, 20);
+            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.error_code);
+            drjson_buff_write_lit(buffer, "): ");
+            drjson_buff_write(buffer, v.err_mess, v.err_len);
+            break;
+    }
+}
+
+// return 1 - error
+// return 2 - no need to escape
+static
+int
+drjson_escape_string2(const DrJsonAllocator* restrict allocator, const char* restrict unescaped, size_t length, char *_Nullable restrict *_Nonnull restrict outstring, size_t* restrict outlength){
+    if(!length) return 1;
+    const char* const hex = "0123456789abcdef";
+    size_t i = 0;
+    for(; i < length; i++){
+        switch(unescaped[i]){
+            // 0x0 through 0x1f (0 through 31) have to all be
+            // escaped with the 6 character sequence of \u00xx
+            // Why on god's green earth did they force utf16 escapes?
+
+            // gnu case ranges are nicer, but nonstandard
+            // just spell them all out.
+            case  0: case  1: case  2: case  3: case  4:
+            // 8 is '\b', 9 is '\t'
+            case  5: case  6: case  7:
+            // 10 is '\n', 12 is '\f', 13 is '\r'
+                     case 11:                   case 14:
+            case 15: case 16: case 17: case 18: case 19:
+            case 20: case 21: case 22: case 23: case 24:
+            case 25: case 26: case 27: case 28: case 29:
+            case 30: case 31:
+            case '"':
+            case '\\':
+            case '\b':
+            case '\f':
+            case '\n':
+            case '\r':
+            case '\t':
+                goto needs_alloc;
+            // Other characters are allowed through as is
+            // (presumably utf-8).
+            default:
+                continue;
+        }
+    }
+    return 2; // no escape
+    needs_alloc:;
+
+    // reserve 2 characters of output for every 2 characters of input.
+    // This is enough space for all common json strings (the bytes that must
+    // be escaped are rare).
+    // We fix that up if we actually hit them.
+    size_t allocated_size = length * 2;
+    char* s = allocator->alloc(allocator->user_pointer, allocated_size);
+    if(!s) return 1;
+    if(i) drj_memcpy(s, unescaped, i);
+    size_t cursor = i;
+    for(; i < length; i++){
+        switch(unescaped[i]){
+            // 0x0 through 0x1f (0 through 31) have to all be
+            // escaped with the 6 character sequence of \u00xx
+            // Why on god's green earth did they force utf16 escapes?
+
+            // gnu case ranges are nicer, but nonstandard
+            // just spell them all out.
+            case  0: case  1: case  2: case  3: case  4:
+            // 8 is '\b', 9 is '\t'
+            case  5: case  6: case  7:
+            // 10 is '\n', 12 is '\f', 13 is '\r'
+                     case 11:                   case 14:
+            case 15: case 16: case 17: case 18: case 19:
+            case 20: case 21: case 22: case 23: case 24:
+            case 25: case 26: case 27: case 28: case 29:
+            case 30: case 31:
+                // These are rare, so only reserve more space when we actually hit them.
+                {
+                    size_t realloc_size = allocated_size+4;
+                    char* news = allocator->realloc(allocator->user_pointer, s, allocated_size, realloc_size);
+                    if(!news){
+                        allocator->free(allocator->user_pointer, s, allocated_size);
+                        return 1;
+                    }
+                    allocated_size = realloc_size;
+                    s = news;
+                }
+                s[cursor++] = '\\';
+                s[cursor++] = 'u';
+                s[cursor++] = '0';
+                s[cursor++] = '0';
+                s[cursor++] = hex[(unescaped[i] & 0xf0)>>4];
+                s[cursor++] = hex[(unescaped[i] & 0xf)];
+                break;
+            case '"':
+                s[cursor++] = '\\';
+                s[cursor++] = '"';
+                break;
+            case '\\':
+                s[cursor++] = '\\';
+                s[cursor++] = '\\';
+                break;
+            case '\b':
+                s[cursor++] = '\\';
+                s[cursor++] = 'b';
+                break;
+            case '\f':
+                s[cursor++] = '\\';
+                s[cursor++] = 'f';
+                break;
+            case '\n':
+                s[cursor++] = '\\';
+                s[cursor++] = 'n';
+                break;
+            case '\r':
+                s[cursor++] = '\\';
+                s[cursor++] = 'r';
+                break;
+            case '\t':
+                s[cursor++] = '\\';
+                s[cursor++] = 't';
+                break;
+            // Other characters are allowed through as is
+            // (presumably utf-8).
+            default:
+                s[cursor++] = unescaped[i];
+                break;
+        }
+    }
+    // shrink to the size we actually used
+    char* news = allocator->realloc(allocator->user_pointer, s, allocated_size, cursor);
+    if(!news){
+        allocator->free(allocator->user_pointer, s, allocated_size);
+        return 1;
+    }
+    *outstring = news;
+    *outlength = cursor;
+    return 0;
+}
+
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_escape_string(DrJsonContext* ctx, const char* restrict unescaped, size_t length, DrJsonAtom* outatom){
+    if(!outatom) return 1;
+    if(length >= ATOM_MAX_LEN)
+        return 1;
+    if(!length){
+        int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, "", 0, 0, outatom);
+        return err;
+    }
+    char* tmp;
+    size_t tmp_length;
+    int err = drjson_escape_string2(&ctx->allocator, unescaped, length, &tmp, &tmp_length);
+    if(err == 1) return err;
+    // String doesn't need to be escaped, make a copy in the atom table.
+    const _Bool copy = 1;
+    if(err == 2) return drj_atomize_str_escapes(&ctx->atoms, &ctx->allocator, unescaped, (uint32_t)length, copy, 0, outatom);
+    if(tmp_length >= ATOM_MAX_LEN)
+        err = 1;
+    else {
+        // Always copy as we'd otherwise have to add a function that tells if it was interned or not.
+        // so we know whether to free.
+        // We could do that.
+        err = drj_atomize_str(&ctx->atoms, &ctx->allocator, tmp, (uint32_t)tmp_length, copy, outatom);
+    }
+    drj_free(ctx, tmp, tmp_length);
+    return err;
+}
+
+// Unescape a JSON string (convert \n, \t, \", \\, etc to actual characters)
+// Returns: 0 on success, 1 on error
+// outstring must have at least 'length' bytes available
+// *outlength will be set to actual output length (always <= length)
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_unescape_string(const char* restrict escaped, size_t length, char* restrict outstring, size_t* restrict outlength){
+    if(!outlength) return 1;
+    if(!length){
+        *outlength = 0;
+        return 0;
+    }
+    if(!escaped || !outstring) return 1;
+
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+
+#if DRJ_HAVE_SIMD
+    // SIMD path: scan for backslashes in 16-byte chunks
+
+    // Process 16 bytes at a time looking for backslashes
+    while(in_pos + DRJ_SIMD_WIDTH <= length){
+        #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(escaped + in_pos));
+            __m128i backslash = _mm_set1_epi8('\\');
+            __m128i cmp = _mm_cmpeq_epi8(chunk, backslash);
+            int mask = _mm_movemask_epi8(cmp);
+        #elif defined(__ARM_NEON) || defined(__aarch64__)
+            uint8x16_t chunk = vld1q_u8((const uint8_t*)(escaped + in_pos));
+            uint8x16_t backslash = vdupq_n_u8('\\');
+            uint8x16_t cmp = vceqq_u8(chunk, backslash);
+            // Extract mask from comparison
+            uint64_t mask_parts[2];
+            vst1q_u8((uint8_t*)mask_parts, cmp);
+            int mask = 0;
+            for(int i = 0; i < 16; i++){
+                if(((uint8_t*)mask_parts)[i])
+                    mask |= (1 << i);
+            }
+        #elif defined(__wasm_simd128__)
+            v128_t chunk = wasm_v128_load((const v128_t*)(escaped + in_pos));
+            v128_t backslash = wasm_i8x16_splat('\\');
+            v128_t cmp = wasm_i8x16_eq(chunk, backslash);
+            int mask = wasm_i8x16_bitmask(cmp);
+        #endif
+
+        if(mask == 0){
+            // No backslashes in this chunk, copy directly
+            #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
+                _mm_storeu_si128((__m128i*)(outstring + out_pos), chunk);
+            #elif defined(__ARM_NEON) || defined(__aarch64__)
+                vst1q_u8((uint8_t*)(outstring + out_pos), chunk);
+            #elif defined(__wasm_simd128__)
+                wasm_v128_store((v128_t*)(outstring + out_pos), chunk);
+            #endif
+            in_pos += DRJ_SIMD_WIDTH;
+            out_pos += DRJ_SIMD_WIDTH;
+        }
+        else {
+            // Found backslash(es), process this chunk byte by byte
+            // Copy bytes up to and including escape sequences, then continue SIMD
+            size_t chunk_start = in_pos;
+            size_t chunk_end = chunk_start + DRJ_SIMD_WIDTH;
+
+            while(in_pos < chunk_end){
+                char c = escaped[in_pos++];
+
+                if(c != '\\'){
+                    outstring[out_pos++] = c;
+                    continue;
+                }
+
+                // Handle escape sequence
+                if(in_pos >= length) return 1; // Trailing backslash
+
+                char escape = escaped[in_pos++];
+                switch(escape){
+                    case '"':  outstring[out_pos++] = '"'; break;
+                    case '\\': outstring[out_pos++] = '\\'; break;
+                    case '/':  outstring[out_pos++] = '/'; break;
+                    case 'b':  outstring[out_pos++] = '\b'; break;
+                    case 'f':  outstring[out_pos++] = '\f'; break;
+                    case 'n':  outstring[out_pos++] = '\n'; break;
+                    case 'r':  outstring[out_pos++] = '\r'; break;
+                    case 't':  outstring[out_pos++] = '\t'; break;
+                    case 'u': {
+                        // Unicode escape: \uXXXX
+                        if(in_pos + 4 > length) return 1;
+
+                        // Parse 4 hex digits
+                        uint32_t codepoint = 0;
+                        for(int i = 0; i < 4; i++){
+                            char hex = escaped[in_pos++];
+                            uint32_t digit;
+                            if(hex >= '0' && hex <= '9')
+                                digit = hex - '0';
+                            else if(hex >= 'a' && hex <= 'f')
+                                digit = hex - 'a' + 10;
+                            else if(hex >= 'A' && hex <= 'F')
+                                digit = hex - 'A' + 10;
+                            else
+                                return 1; // Invalid hex digit
+                            codepoint = (codepoint << 4) | digit;
+                        }
+
+                        // Handle UTF-16 surrogate pairs
+                        if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
+                            // High surrogate, expect low surrogate
+                            if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
+                                return 1;
+                            in_pos += 2;
+
+                            uint32_t low_surrogate = 0;
+                            for(int i = 0; i < 4; i++){
+                                char hex = escaped[in_pos++];
+                                uint32_t digit;
+                                if(hex >= '0' && hex <= '9')
+                                    digit = hex - '0';
+                                else if(hex >= 'a' && hex <= 'f')
+                                    digit = hex - 'a' + 10;
+                                else if(hex >= 'A' && hex <= 'F')
+                                    digit = hex - 'A' + 10;
+                                else
+                                    return 1;
+                                low_surrogate = (low_surrogate << 4) | digit;
+                            }
+
+                            if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
+                                return 1; // Invalid low surrogate
+
+                            // Combine surrogates into codepoint
+                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                        }
+
+                        // Encode as UTF-8
+                        if(codepoint <= 0x7F){
+                            outstring[out_pos++] = (char)codepoint;
+                        }
+                        else if(codepoint <= 0x7FF){
+                            outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else if(codepoint <= 0xFFFF){
+                            outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else if(codepoint <= 0x10FFFF){
+                            outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else {
+                            return 1; // Invalid codepoint
+                        }
+                        break;
+                    }
+                    default:
+                        return 1; // Invalid escape sequence
+                }
+            }
+            // Continue with SIMD for next chunk
+        }
+    }
+#elif defined(__LP64__) || defined(_WIN64)
+    // SWAR path: scan for backslashes in 8-byte chunks using bit tricks
+    while(in_pos + 8 <= length){
+        uint64_t chunk;
+        drj_memcpy(&chunk, escaped + in_pos, 8);
+
+        // Find backslashes using "has zero byte" trick
+        // XOR with backslash pattern, then detect zeros
+        uint64_t backslash_pattern = 0x5C5C5C5C5C5C5C5CULL; // '\\' repeated
+        uint64_t xored = chunk ^ backslash_pattern;
+
+        // Detect if any byte is zero: (x - 0x01...) & ~x & 0x80...
+        uint64_t has_zero = (xored - 0x0101010101010101ULL) & ~xored & 0x8080808080808080ULL;
+
+        if(has_zero == 0){
+            // No backslashes, copy 8 bytes directly
+            drj_memcpy(outstring + out_pos, &chunk, 8);
+            in_pos += 8;
+            out_pos += 8;
+        }
+        else {
+            // Found backslash, process this chunk byte by byte then continue SWAR
+            size_t chunk_start = in_pos;
+            size_t chunk_end = chunk_start + 8;
+
+            while(in_pos < chunk_end){
+                char c = escaped[in_pos++];
+
+                if(c != '\\'){
+                    outstring[out_pos++] = c;
+                    continue;
+                }
+
+                // Handle escape sequence
+                if(in_pos >= length) return 1; // Trailing backslash
+
+                char escape = escaped[in_pos++];
+                switch(escape){
+                    case '"':  outstring[out_pos++] = '"'; break;
+                    case '\\': outstring[out_pos++] = '\\'; break;
+                    case '/':  outstring[out_pos++] = '/'; break;
+                    case 'b':  outstring[out_pos++] = '\b'; break;
+                    case 'f':  outstring[out_pos++] = '\f'; break;
+                    case 'n':  outstring[out_pos++] = '\n'; break;
+                    case 'r':  outstring[out_pos++] = '\r'; break;
+                    case 't':  outstring[out_pos++] = '\t'; break;
+                    case 'u': {
+                        // Unicode escape: \uXXXX
+                        if(in_pos + 4 > length) return 1;
+
+                        // Parse 4 hex digits
+                        uint32_t codepoint = 0;
+                        for(int i = 0; i < 4; i++){
+                            char hex = escaped[in_pos++];
+                            uint32_t digit;
+                            if(hex >= '0' && hex <= '9')
+                                digit = hex - '0';
+                            else if(hex >= 'a' && hex <= 'f')
+                                digit = hex - 'a' + 10;
+                            else if(hex >= 'A' && hex <= 'F')
+                                digit = hex - 'A' + 10;
+                            else
+                                return 1; // Invalid hex digit
+                            codepoint = (codepoint << 4) | digit;
+                        }
+
+                        // Handle UTF-16 surrogate pairs
+                        if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
+                            // High surrogate, expect low surrogate
+                            if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
+                                return 1;
+                            in_pos += 2;
+
+                            uint32_t low_surrogate = 0;
+                            for(int i = 0; i < 4; i++){
+                                char hex = escaped[in_pos++];
+                                uint32_t digit;
+                                if(hex >= '0' && hex <= '9')
+                                    digit = hex - '0';
+                                else if(hex >= 'a' && hex <= 'f')
+                                    digit = hex - 'a' + 10;
+                                else if(hex >= 'A' && hex <= 'F')
+                                    digit = hex - 'A' + 10;
+                                else
+                                    return 1;
+                                low_surrogate = (low_surrogate << 4) | digit;
+                            }
+
+                            if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
+                                return 1; // Invalid low surrogate
+
+                            // Combine surrogates into codepoint
+                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                        }
+
+                        // Encode as UTF-8
+                        if(codepoint <= 0x7F){
+                            outstring[out_pos++] = (char)codepoint;
+                        }
+                        else if(codepoint <= 0x7FF){
+                            outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else if(codepoint <= 0xFFFF){
+                            outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else if(codepoint <= 0x10FFFF){
+                            outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                        }
+                        else {
+                            return 1; // Invalid codepoint
+                        }
+                        break;
+                    }
+                    default:
+                        return 1; // Invalid escape sequence
+                }
             }
-            drjson_buff_putc(buffer, ']');
-        }break;
-        case DRJSON_NULL:
-            drjson_buff_write_lit(buffer, "null");
-            break;
-        case DRJSON_BOOL:
-            if(v.boolean)
-                drjson_buff_write_lit(buffer, "true");
-            else
-                drjson_buff_write_lit(buffer, "false");
-            break;
-        case DRJSON_ERROR:
-            drjson_buff_write_lit(buffer, "Error: ");
-            drjson_buff_write(buffer, drjson_get_error_name(v), drjson_get_error_name_length(v));
-            drjson_buff_write_lit(buffer, "(Code ");
-            drjson_buff_ensure_n(buffer, 20);
-            buffer->cursor += drjson_int64_to_ascii(buffer->buff+buffer->cursor, v.error_code);
-            drjson_buff_write_lit(buffer, "): ");
-            drjson_buff_write(buffer, v.err_mess, v.err_len);
-            break;
+            // Continue with SWAR for next chunk
+        }
     }
-}
+#endif
 
-// return 1 - error
-// return 2 - no need to escape
-static
-int
-drjson_escape_string2(const DrJsonAllocator* restrict allocator, const char* restrict unescaped, size_t length, char *_Nullable restrict *_Nonnull restrict outstring, size_t* restrict outlength){
-    if(!length) return 1;
-    const char* const hex = "0123456789abcdef";
-    size_t i = 0;
-    for(; i < length; i++){
-        switch(unescaped[i]){
-            // 0x0 through 0x1f (0 through 31) have to all be
-            // escaped with the 6 character sequence of \u00xx
-            // Why on god's green earth did they force utf16 escapes?
+    // Scalar path: process remaining bytes
+    while(in_pos < length){
+        char c = escaped[in_pos++];
 
-            // gnu case ranges are nicer, but nonstandard
-            // just spell them all out.
-            case  0: case  1: case  2: case  3: case  4:
-            // 8 is '\b', 9 is '\t'
-            case  5: case  6: case  7:
-            // 10 is '\n', 12 is '\f', 13 is '\r'
-                     case 11:                   case 14:
-            case 15: case 16: case 17: case 18: case 19:
-            case 20: case 21: case 22: case 23: case 24:
-            case 25: case 26: case 27: case 28: case 29:
-            case 30: case 31:
-            case '"':
-            case '\\':
-            case '\b':
-            case '\f':
-            case '\n':
-            case '\r':
-            case '\t':
-                goto needs_alloc;
-            // Other characters are allowed through as is
-            // (presumably utf-8).
-            default:
-                continue;
+        if(c != '\\'){
+            outstring[out_pos++] = c;
+            continue;
         }
-    }
-    return 2; // no escape
-    needs_alloc:;
 
-    // reserve 2 characters of output for every 2 characters of input.
-    // This is enough space for all common json strings (the bytes that must
-    // be escaped are rare).
-    // We fix that up if we actually hit them.
-    size_t allocated_size = length * 2;
-    char* s = allocator->alloc(allocator->user_pointer, allocated_size);
-    if(!s) return 1;
-    if(i) drj_memcpy(s, unescaped, i);
-    size_t cursor = i;
-    for(; i < length; i++){
-        switch(unescaped[i]){
-            // 0x0 through 0x1f (0 through 31) have to all be
-            // escaped with the 6 character sequence of \u00xx
-            // Why on god's green earth did they force utf16 escapes?
+        // Handle escape sequence
+        if(in_pos >= length) return 1; // Trailing backslash
 
-            // gnu case ranges are nicer, but nonstandard
-            // just spell them all out.
-            case  0: case  1: case  2: case  3: case  4:
-            // 8 is '\b', 9 is '\t'
-            case  5: case  6: case  7:
-            // 10 is '\n', 12 is '\f', 13 is '\r'
-                     case 11:                   case 14:
-            case 15: case 16: case 17: case 18: case 19:
-            case 20: case 21: case 22: case 23: case 24:
-            case 25: case 26: case 27: case 28: case 29:
-            case 30: case 31:
-                // These are rare, so only reserve more space when we actually hit them.
-                {
-                    size_t realloc_size = allocated_size+4;
-                    char* news = allocator->realloc(allocator->user_pointer, s, allocated_size, realloc_size);
-                    if(!news){
-                        allocator->free(allocator->user_pointer, s, allocated_size);
+        char escape = escaped[in_pos++];
+        switch(escape){
+            case '"':  outstring[out_pos++] = '"'; break;
+            case '\\': outstring[out_pos++] = '\\'; break;
+            case '/':  outstring[out_pos++] = '/'; break;
+            case 'b':  outstring[out_pos++] = '\b'; break;
+            case 'f':  outstring[out_pos++] = '\f'; break;
+            case 'n':  outstring[out_pos++] = '\n'; break;
+            case 'r':  outstring[out_pos++] = '\r'; break;
+            case 't':  outstring[out_pos++] = '\t'; break;
+            case 'u': {
+                // Unicode escape: \uXXXX
+                if(in_pos + 4 > length) return 1;
+
+                // Parse 4 hex digits
+                uint32_t codepoint = 0;
+                for(int i = 0; i < 4; i++){
+                    char hex = escaped[in_pos++];
+                    uint32_t digit;
+                    if(hex >= '0' && hex <= '9')
+                        digit = hex - '0';
+                    else if(hex >= 'a' && hex <= 'f')
+                        digit = hex - 'a' + 10;
+                    else if(hex >= 'A' && hex <= 'F')
+                        digit = hex - 'A' + 10;
+                    else
+                        return 1; // Invalid hex digit
+                    codepoint = (codepoint << 4) | digit;
+                }
+
+                // Handle UTF-16 surrogate pairs
+                if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
+                    // High surrogate, expect low surrogate
+                    if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
                         return 1;
+                    in_pos += 2;
+
+                    uint32_t low_surrogate = 0;
+                    for(int i = 0; i < 4; i++){
+                        char hex = escaped[in_pos++];
+                        uint32_t digit;
+                        if(hex >= '0' && hex <= '9')
+                            digit = hex - '0';
+                        else if(hex >= 'a' && hex <= 'f')
+                            digit = hex - 'a' + 10;
+                        else if(hex >= 'A' && hex <= 'F')
+                            digit = hex - 'A' + 10;
+                        else
+                            return 1;
+                        low_surrogate = (low_surrogate << 4) | digit;
                     }
-                    allocated_size = realloc_size;
-                    s = news;
+
+                    if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
+                        return 1; // Invalid low surrogate
+
+                    // Combine surrogates into codepoint
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                }
+
+                // Encode as UTF-8
+                if(codepoint <= 0x7F){
+                    outstring[out_pos++] = (char)codepoint;
+                }
+                else if(codepoint <= 0x7FF){
+                    outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
+                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                }
+                else if(codepoint <= 0xFFFF){
+                    outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
+                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                }
+                else if(codepoint <= 0x10FFFF){
+                    outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
+                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
+                }
+                else {
+                    return 1; // Invalid codepoint
                 }
-                s[cursor++] = '\\';
-                s[cursor++] = 'u';
-                s[cursor++] = '0';
-                s[cursor++] = '0';
-                s[cursor++] = hex[(unescaped[i] & 0xf0)>>4];
-                s[cursor++] = hex[(unescaped[i] & 0xf)];
-                break;
-            case '"':
-                s[cursor++] = '\\';
-                s[cursor++] = '"';
-                break;
-            case '\\':
-                s[cursor++] = '\\';
-                s[cursor++] = '\\';
-                break;
-            case '\b':
-                s[cursor++] = '\\';
-                s[cursor++] = 'b';
-                break;
-            case '\f':
-                s[cursor++] = '\\';
-                s[cursor++] = 'f';
-                break;
-            case '\n':
-                s[cursor++] = '\\';
-                s[cursor++] = 'n';
-                break;
-            case '\r':
-                s[cursor++] = '\\';
-                s[cursor++] = 'r';
-                break;
-            case '\t':
-                s[cursor++] = '\\';
-                s[cursor++] = 't';
                 break;
-            // Other characters are allowed through as is
-            // (presumably utf-8).
+            }
             default:
-                s[cursor++] = unescaped[i];
-                break;
+                return 1; // Invalid escape sequence
         }
     }
-    // shrink to the size we actually used
-    char* news = allocator->realloc(allocator->user_pointer, s, allocated_size, cursor);
-    if(!news){
-        allocator->free(allocator->user_pointer, s, allocated_size);
-        return 1;
-    }
-    *outstring = news;
-    *outlength = cursor;
+
+    *outlength = out_pos;
     return 0;
 }
 
 DRJSON_API
 DRJSON_WARN_UNUSED
 int
-drjson_escape_string(DrJsonContext* ctx, const char* restrict unescaped, size_t length, DrJsonAtom* outatom){
-    if(!outatom) return 1;
-    if(length >= ATOM_MAX_LEN)
-        return 1;
-    if(!length){
-        int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, "", 0, 0, outatom);
-        return err;
-    }
-    char* tmp;
-    size_t tmp_length;
-    int err = drjson_escape_string2(&ctx->allocator, unescaped, length, &tmp, &tmp_length);
-    if(err == 1) return err;
-    // String doesn't need to be escaped, make a copy in the atom table.
-    const _Bool copy = 1;
-    if(err == 2) return drj_atomize_str(&ctx->atoms, &ctx->allocator, unescaped, (uint32_t)length, copy, outatom);
-    if(tmp_length >= ATOM_MAX_LEN)
-        err = 1;
-    else {
-        // Always copy as we'd otherwise have to add a function that tells if it was interned or not.
-        // so we know whether to free.
-        // We could do that.
-        err = drj_atomize_str(&ctx->atoms, &ctx->allocator, tmp, (uint32_t)tmp_length, copy, outatom);
+drjson_unescape_string_value(DrJsonContext* ctx, DrJsonValue v, char* restrict buff, size_t buffsize, size_t* restrict outlength){
+    if(v.kind != DRJSON_STRING) return 1;
+    DrjAtomStr s = drj_get_atom_str(&ctx->atoms, v.atom);
+    if(buffsize < s.length) return 1;
+    // Most strings have no escapes, those are just a copy.
+    if(!s.escapes){
+        if(s.length) drj_memcpy(buff, s.pointer, s.length);
+        *outlength = s.length;
+        return 0;
     }
-    drj_free(ctx, tmp, tmp_length);
-    return err;
+    return drjson_unescape_string(s.pointer, s.length, buff, outlength);
 }
 
-// Unescape a JSON string (convert \n, \t, \", \\, etc to actual characters)
+// Normalize user input by doing liberal unescape + strict escape in single pass
+// This handles user input from TUI where:
+// - Valid escape sequences (\n, \t, etc.) should be preserved
+// - Invalid escape sequences (\x) should have backslash escaped
+// - Unescaped special chars (") should be escaped
 // Returns: 0 on success, 1 on error
-// outstring must have at least 'length' bytes available
-// *outlength will be set to actual output length (always <= length)
+// outstring must have at least 'length * 2' bytes available (worst case)
+// *outlength will be set to actual output length
 DRJSON_API
 DRJSON_WARN_UNUSED
 int
-drjson_unescape_string(const char* restrict escaped, size_t length, char* restrict outstring, size_t* restrict outlength){
+drjson_normalize_user_input(const char* restrict input, size_t length, char* restrict outstring, size_t* restrict outlength){
     if(!outlength) return 1;
     if(!length){
         *outlength = 0;
         return 0;
     }
-    if(!escaped || !outstring) return 1;
+    if(!input || !outstring) return 1;
 
     size_t in_pos = 0;
     size_t out_pos = 0;
 
-#if DRJ_HAVE_SIMD
-    // SIMD path: scan for backslashes in 16-byte chunks
+    while(in_pos < length){
+        char c = input[in_pos];
 
-    // Process 16 bytes at a time looking for backslashes
-    while(in_pos + DRJ_SIMD_WIDTH <= length){
-        #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
-            __m128i chunk = _mm_loadu_si128((const __m128i*)(escaped + in_pos));
-            __m128i backslash = _mm_set1_epi8('\\');
-            __m128i cmp = _mm_cmpeq_epi8(chunk, backslash);
-            int mask = _mm_movemask_epi8(cmp);
-        #elif defined(__ARM_NEON) || defined(__aarch64__)
-            uint8x16_t chunk = vld1q_u8((const uint8_t*)(escaped + in_pos));
-            uint8x16_t backslash = vdupq_n_u8('\\');
-            uint8x16_t cmp = vceqq_u8(chunk, backslash);
-            // Extract mask from comparison
-            uint64_t mask_parts[2];
-            vst1q_u8((uint8_t*)mask_parts, cmp);
-            int mask = 0;
-            for(int i = 0; i < 16; i++){
-                if(((uint8_t*)mask_parts)[i])
-                    mask |= (1 << i);
+        if(c == '\\'){
+            // Check if this is a valid escape sequence
+            if(in_pos + 1 < length){
+                char next = input[in_pos + 1];
+                // Check for valid JSON escape characters
+                if(next == '"' || next == '\\' || next == '/' ||
+                   next == 'b' || next == 'f' || next == 'n' ||
+                   next == 'r' || next == 't'){
+                    // Valid escape sequence - pass through as-is
+                    outstring[out_pos++] = c;
+                    outstring[out_pos++] = next;
+                    in_pos += 2;
+                    continue;
+                }
+                else if(next == 'u'){
+                    // Unicode escape sequence \uXXXX
+                    // Validate that we have 4 hex digits
+                    if(in_pos + 5 < length){
+                        int valid = 1;
+                        for(int i = 0; i < 4; i++){
+                            char hex = input[in_pos + 2 + i];
+                            if(!((hex >= '0' && hex <= '9') ||
+                                 (hex >= 'a' && hex <= 'f') ||
+                                 (hex >= 'A' && hex <= 'F'))){
+                                valid = 0;
+                                break;
+                            }
+                        }
+                        if(valid){
+                            // Valid unicode escape - pass through
+                            outstring[out_pos++] = '\\';
+                            outstring[out_pos++] = 'u';
+                            outstring[out_pos++] = input[in_pos + 2];
+                            outstring[out_pos++] = input[in_pos + 3];
+                            outstring[out_pos++] = input[in_pos + 4];
+                            outstring[out_pos++] = input[in_pos + 5];
+                            in_pos += 6;
+                            continue;
+                        }
+                    }
+                    // Invalid unicode escape - fall through to escape the backslash
+                }
+                // Invalid escape sequence - escape the backslash
+                outstring[out_pos++] = '\\';
+                outstring[out_pos++] = '\\';
+                in_pos++;
+                continue;
             }
-        #elif defined(__wasm_simd128__)
-            v128_t chunk = wasm_v128_load((const v128_t*)(escaped + in_pos));
-            v128_t backslash = wasm_i8x16_splat('\\');
-            v128_t cmp = wasm_i8x16_eq(chunk, backslash);
-            int mask = wasm_i8x16_bitmask(cmp);
-        #endif
-
-        if(mask == 0){
-            // No backslashes in this chunk, copy directly
-            #if defined(__SSE2__) || (defined(_M_X64) && !defined(__clang__))
-                _mm_storeu_si128((__m128i*)(outstring + out_pos), chunk);
-            #elif defined(__ARM_NEON) || defined(__aarch64__)
-                vst1q_u8((uint8_t*)(outstring + out_pos), chunk);
-            #elif defined(__wasm_simd128__)
-                wasm_v128_store((v128_t*)(outstring + out_pos), chunk);
-            #endif
-            in_pos += DRJ_SIMD_WIDTH;
-            out_pos += DRJ_SIMD_WIDTH;
+            else {
+                // Trailing backslash - escape it
+                outstring[out_pos++] = '\\';
+                outstring[out_pos++] = '\\';
+                in_pos++;
+                continue;
+            }
+        }
+        else if(c == '"'){
+            // Unescaped quote - needs escaping
+            outstring[out_pos++] = '\\';
+            outstring[out_pos++] = '"';
+            in_pos++;
+        }
+        else if((unsigned char)c < 32){
+            // Control character - escape it
+            switch(c){
+                case '\b':
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 'b';
+                    break;
+                case '\f':
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 'f';
+                    break;
+                case '\n':
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 'n';
+                    break;
+                case '\r':
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 'r';
+                    break;
+                case '\t':
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 't';
+                    break;
+                default:{
+                    // Other control chars - use \u00xx format
+                    const char* const hex = "0123456789abcdef";
+                    outstring[out_pos++] = '\\';
+                    outstring[out_pos++] = 'u';
+                    outstring[out_pos++] = '0';
+                    outstring[out_pos++] = '0';
+                    outstring[out_pos++] = hex[((unsigned char)c & 0xf0) >> 4];
+                    outstring[out_pos++] = hex[((unsigned char)c & 0xf)];
+                    break;
+                }
+            }
+            in_pos++;
         }
         else {
-            // Found backslash(es), process this chunk byte by byte
-            // Copy bytes up to and including escape sequences, then continue SIMD
-            size_t chunk_start = in_pos;
-            size_t chunk_end = chunk_start + DRJ_SIMD_WIDTH;
+            // Normal character - pass through
+            outstring[out_pos++] = c;
+            in_pos++;
+        }
+    }
 
-            while(in_pos < chunk_end){
-                char c = escaped[in_pos++];
+    *outlength = out_pos;
+    return 0;
+}
 
-                if(c != '\\'){
-                    outstring[out_pos++] = c;
-                    continue;
-                }
+// Normalize user input and atomize it in one operation
+// This is the common pattern: normalize user input from editor/UI, then intern it
+// Handles memory allocation internally for the normalization buffer
+// Returns: 0 on success, 1 on error
+DRJSON_API
+DRJSON_WARN_UNUSED
+int
+drjson_normalize_and_atomize(DrJsonContext* ctx, const char* restrict input, size_t length, DrJsonAtom* outatom){
+    if(!outatom) return 1;
+    if(!length){
+        return drjson_atomize(ctx, "", 0, outatom);
+    }
+    if(!input) return 1;
 
-                // Handle escape sequence
-                if(in_pos >= length) return 1; // Trailing backslash
+    // Allocate buffer for normalization (worst case: length * 2)
+    size_t buffer_size = length * 2;
+    char* normalized = drj_alloc(ctx, buffer_size);
+    if(!normalized) return 1;
+
+    size_t normalized_len;
+    int err = drjson_normalize_user_input(input, length, normalized, &normalized_len);
+    if(err){
+        drj_free(ctx, normalized, buffer_size);
+        return err;
+    }
+
+    // Atomize the normalized string
+    err = drjson_atomize(ctx, normalized, normalized_len, outatom);
+    drj_free(ctx, normalized, buffer_size);
+    return err;
+}
+
+DRJSON_API
+void
+drjson_get_line_column(const DrJsonParseContext* ctx, size_t* line, size_t* column){
+    size_t lin = 0;
+    size_t col = 0;
+    // just do it the slow way, whatever.
+    for(const char* c = ctx->begin; c != ctx->cursor; c++){
+        switch(*c){
+            case '\n':
+                lin++;
+                col = 0;
+                break;
+            default:
+                col++;
+                break;
+        }
+    }
+    *line = lin;
+    *column = col;
+}
+
+DRJSON_API
+void
+drjson_ctx_free_all(DrJsonContext* ctx){
+    drj_unmap_files(ctx);
+    if(ctx->allocator.free_all){
+        ctx->allocator.free_all(ctx->allocator.user_pointer);
+        return;
+    }
+    if(!ctx->allocator.free)
+        return;
+    drj_atom_table_free(&ctx->atoms, &ctx->allocator);
 
-                char escape = escaped[in_pos++];
-                switch(escape){
-                    case '"':  outstring[out_pos++] = '"'; break;
-                    case '\\': outstring[out_pos++] = '\\'; break;
-                    case '/':  outstring[out_pos++] = '/'; break;
-                    case 'b':  outstring[out_pos++] = '\b'; break;
-                    case 'f':  outstring[out_pos++] = '\f'; break;
-                    case 'n':  outstring[out_pos++] = '\n'; break;
-                    case 'r':  outstring[out_pos++] = '\r'; break;
-                    case 't':  outstring[out_pos++] = '\t'; break;
-                    case 'u': {
-                        // Unicode escape: \uXXXX
-                        if(in_pos + 4 > length) return 1;
+    // Free each object
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        DrJsonObject* odata = ctx->objects.data;
+        DrJsonObject* o = &odata[i];
+        if(o->capacity)
+            drj_free(ctx, o->object_items, drj_obj_items_size(o));
+    }
+    // Then the objects array
+    if(ctx->objects.data)
+        drj_free(ctx, ctx->objects.data, ctx->objects.capacity*sizeof (DrJsonObject));
+    // Free interned objects
+    if(ctx->interned_objects.capacity)
+        drj_free(ctx, ctx->interned_objects.data, ctx->interned_objects.capacity*sizeof(uint32_t)*4);
 
-                        // Parse 4 hex digits
-                        uint32_t codepoint = 0;
-                        for(int i = 0; i < 4; i++){
-                            char hex = escaped[in_pos++];
-                            uint32_t digit;
-                            if(hex >= '0' && hex <= '9')
-                                digit = hex - '0';
-                            else if(hex >= 'a' && hex <= 'f')
-                                digit = hex - 'a' + 10;
-                            else if(hex >= 'A' && hex <= 'F')
-                                digit = hex - 'A' + 10;
-                            else
-                                return 1; // Invalid hex digit
-                            codepoint = (codepoint << 4) | digit;
-                        }
+    // Free each array
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        DrJsonArray* adata = ctx->arrays.data;
+        DrJsonArray* a = &adata[i];
+        if(a->capacity)
+            drj_free(ctx, a->array_items, a->capacity*drj_array_item_size(a));
+    }
+    // Free arrays array
+    if(ctx->arrays.data)
+        drj_free(ctx, ctx->arrays.data, ctx->arrays.capacity*sizeof(DrJsonArray));
 
-                        // Handle UTF-16 surrogate pairs
-                        if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
-                            // High surrogate, expect low surrogate
-                            if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
-                                return 1;
-                            in_pos += 2;
+    // Free interned arrays
+    if(ctx->interned_arrays.capacity)
+        drj_free(ctx, ctx->interned_arrays.data, ctx->interned_arrays.capacity*sizeof(uint32_t)*4);
 
-                            uint32_t low_surrogate = 0;
-                            for(int i = 0; i < 4; i++){
-                                char hex = escaped[in_pos++];
-                                uint32_t digit;
-                                if(hex >= '0' && hex <= '9')
-                                    digit = hex - '0';
-                                else if(hex >= 'a' && hex <= 'f')
-                                    digit = hex - 'a' + 10;
-                                else if(hex >= 'A' && hex <= 'F')
-                                    digit = hex - 'A' + 10;
-                                else
-                                    return 1;
-                                low_surrogate = (low_surrogate << 4) | digit;
-                            }
+    // Files that were read instead of mapped
+    for(size_t i = 0; i < ctx->files.count; i++){
+        DrjFileData* f = &ctx->files.data[i];
+        if(!f->mapped)
+            drj_free(ctx, f->data, f->size);
+    }
+    if(ctx->files.data)
+        drj_free(ctx, ctx->files.data, ctx->files.capacity*sizeof(DrjFileData));
 
-                            if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
-                                return 1; // Invalid low surrogate
+    for(size_t i = 0; i < ctx->shapes.capacity; i++){
+        DrjShape* shape = ctx->shapes.data[i];
+        if(shape)
+            drj_free(ctx, shape, drj_shape_size(shape->count));
+    }
+    if(ctx->shapes.data)
+        drj_free(ctx, ctx->shapes.data, ctx->shapes.capacity*sizeof *ctx->shapes.data);
+    if(ctx->gc.gray)
+        drj_free(ctx, ctx->gc.gray, ctx->gc.capacity*sizeof *ctx->gc.gray);
 
-                            // Combine surrogates into codepoint
-                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
-                        }
+    #ifndef DRJ_DONT_FREE_CTX
+        drj_free(ctx, ctx, sizeof *ctx);
+    #endif
+}
 
-                        // Encode as UTF-8
-                        if(codepoint <= 0x7F){
-                            outstring[out_pos++] = (char)codepoint;
-                        }
-                        else if(codepoint <= 0x7FF){
-                            outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else if(codepoint <= 0xFFFF){
-                            outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else if(codepoint <= 0x10FFFF){
-                            outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else {
-                            return 1; // Invalid codepoint
-                        }
-                        break;
-                    }
-                    default:
-                        return 1; // Invalid escape sequence
-                }
-            }
-            // Continue with SIMD for next chunk
+DRJSON_API
+void
+drjson_ctx_reset(DrJsonContext* ctx){
+    drj_unmap_files(ctx);
+    for(size_t i = 0; i < ctx->files.count; i++){
+        DrjFileData* f = &ctx->files.data[i];
+        if(!f->mapped)
+            drj_free(ctx, f->data, f->size);
+    }
+    ctx->files.count = 0;
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        DrJsonObject* o = &ctx->objects.data[i];
+        if(o->capacity)
+            drj_free(ctx, o->object_items, drj_obj_items_size(o));
+    }
+    ctx->objects.count = 0;
+    ctx->objects.free_object = 0;
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(a->capacity)
+            drj_free(ctx, a->array_items, a->capacity*drj_array_item_size(a));
+    }
+    ctx->arrays.count = 0;
+    ctx->arrays.free_array = 0;
+    // The interned tables just need their indexes emptied.
+    if(ctx->interned_objects.capacity)
+        drj_memset(ctx->interned_objects.data+ctx->interned_objects.capacity, 0xff, sizeof(uint32_t)*2*ctx->interned_objects.capacity);
+    ctx->interned_objects.count = 0;
+    if(ctx->interned_arrays.capacity)
+        drj_memset(ctx->interned_arrays.data+ctx->interned_arrays.capacity, 0xff, sizeof(uint32_t)*2*ctx->interned_arrays.capacity);
+    ctx->interned_arrays.count = 0;
+    // Shapes are made of atoms, so they go too.
+    for(size_t i = 0; i < ctx->shapes.capacity; i++){
+        DrjShape* shape = ctx->shapes.data[i];
+        if(shape){
+            drj_free(ctx, shape, drj_shape_size(shape->count));
+            ctx->shapes.data[i] = NULL;
         }
     }
-#elif defined(__LP64__) || defined(_WIN64)
-    // SWAR path: scan for backslashes in 8-byte chunks using bit tricks
-    while(in_pos + 8 <= length){
-        uint64_t chunk;
-        drj_memcpy(&chunk, escaped + in_pos, 8);
+    ctx->shapes.count = 0;
+    ctx->gc.count = 0;
+    ctx->gc.phase = DRJ_GC_IDLE;
+    ctx->gc.overflowed = 0;
+    // The magic keys are the first atoms, and aren't copied, so they can
+    // stay. If drjson_create_ctx couldn't make them all, it's tried again.
+    if(ctx->magic_keys.items.bits && drj_atom_get_idx(ctx->magic_keys.items) == 3)
+        drj_atom_table_reset(&ctx->atoms, &ctx->allocator, 4);
+    else {
+        drj_atom_table_reset(&ctx->atoms, &ctx->allocator, 0);
+        drj_atomize_magic_keys(ctx);
+    }
+}
 
-        // Find backslashes using "has zero byte" trick
-        // XOR with backslash pattern, then detect zeros
-        uint64_t backslash_pattern = 0x5C5C5C5C5C5C5C5CULL; // '\\' repeated
-        uint64_t xored = chunk ^ backslash_pattern;
 
-        // Detect if any byte is zero: (x - 0x01...) & ~x & 0x80...
-        uint64_t has_zero = (xored - 0x0101010101010101ULL) & ~xored & 0x8080808080808080ULL;
+DRJSON_API
+DrJsonValue
+drjson_make_string(DrJsonContext* ctx, const char* s, size_t length){
+    DrJsonAtom atom;
+    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, s, (uint32_t)length, 1, &atom);
+    if(err)
+        return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom");
+    return drjson_atom_to_value(atom);
+}
 
-        if(has_zero == 0){
-            // No backslashes, copy 8 bytes directly
-            drj_memcpy(outstring + out_pos, &chunk, 8);
-            in_pos += 8;
-            out_pos += 8;
-        }
-        else {
-            // Found backslash, process this chunk byte by byte then continue SWAR
-            size_t chunk_start = in_pos;
-            size_t chunk_end = chunk_start + 8;
+static const char*_Nonnull const DrJsonKindNames[] = {
+    [DRJSON_ERROR]         = "error",
+    [DRJSON_NUMBER]        = "number",
+    [DRJSON_INTEGER]       = "integer",
+    [DRJSON_UINTEGER]      = "uinteger",
+    [DRJSON_STRING]        = "string",
+    [DRJSON_ARRAY]         = "array",
+    [DRJSON_OBJECT]        = "object",
+    [DRJSON_NULL]          = "null",
+    [DRJSON_BOOL]          = "bool",
+    [DRJSON_ARRAY_VIEW]    = "array view",
+    [DRJSON_OBJECT_KEYS]   = "object keys",
+    [DRJSON_OBJECT_VALUES] = "object values",
+    [DRJSON_OBJECT_ITEMS]  = "object items",
+    [DRJSON_LAZY_NUMBER]   = "number",
+};
 
-            while(in_pos < chunk_end){
-                char c = escaped[in_pos++];
+static const size_t DrJsonKindNameLengths[] = {
+    [DRJSON_ERROR]         = sizeof("error")-1,
+    [DRJSON_NUMBER]        = sizeof("number")-1,
+    [DRJSON_INTEGER]       = sizeof("integer")-1,
+    [DRJSON_UINTEGER]      = sizeof("uinteger")-1,
+    [DRJSON_STRING]        = sizeof("string")-1,
+    [DRJSON_ARRAY]         = sizeof("array")-1,
+    [DRJSON_OBJECT]        = sizeof("object")-1,
+    [DRJSON_NULL]          = sizeof("null")-1,
+    [DRJSON_BOOL]          = sizeof("bool")-1,
+    [DRJSON_ARRAY_VIEW]    = sizeof("array view")-1,
+    [DRJSON_OBJECT_KEYS]   = sizeof("object keys")-1,
+    [DRJSON_OBJECT_VALUES] = sizeof("object values")-1,
+    [DRJSON_OBJECT_ITEMS]  = sizeof("object items")-1,
+    [DRJSON_LAZY_NUMBER]   = sizeof("number")-1,
+};
 
-                if(c != '\\'){
-                    outstring[out_pos++] = c;
-                    continue;
-                }
+static const char*_Nonnull const DrJsonErrorNames[] = {
+    [DRJSON_ERROR_NONE]           = "No error",
+    [DRJSON_ERROR_UNEXPECTED_EOF] = "Unexpected End of Input",
+    [DRJSON_ERROR_ALLOC_FAILURE]  = "Allocation Failure",
+    [DRJSON_ERROR_MISSING_KEY]    = "Missing Key",
+    [DRJSON_ERROR_INDEX_ERROR]    = "Index Error",
+    [DRJSON_ERROR_INVALID_CHAR]   = "Invalid Char",
+    [DRJSON_ERROR_INVALID_VALUE]  = "Invalid Value",
+    [DRJSON_ERROR_TOO_DEEP]       = "Too Many Levels of Nesting",
+    [DRJSON_ERROR_TYPE_ERROR]     = "Invalid type for operation",
+    [DRJSON_ERROR_INVALID_ERROR]  = "Error is Invalid",
+    [DRJSON_ERROR_TRAILING_CONTENT] = "Trailing Content After Value",
+    [DRJSON_ERROR_IO]             = "IO Error",
+};
 
-                // Handle escape sequence
-                if(in_pos >= length) return 1; // Trailing backslash
+static const size_t DrJsonErrorNameLengths[] = {
+    [DRJSON_ERROR_NONE]           = sizeof("No error")-1,
+    [DRJSON_ERROR_UNEXPECTED_EOF] = sizeof("Unexpected End of Input")-1,
+    [DRJSON_ERROR_ALLOC_FAILURE]  = sizeof("Allocation Failure")-1,
+    [DRJSON_ERROR_MISSING_KEY]    = sizeof("Missing Key")-1,
+    [DRJSON_ERROR_INDEX_ERROR]    = sizeof("Index Error")-1,
+    [DRJSON_ERROR_INVALID_CHAR]   = sizeof("Invalid Char")-1,
+    [DRJSON_ERROR_INVALID_VALUE]  = sizeof("Invalid Value")-1,
+    [DRJSON_ERROR_TOO_DEEP]       = sizeof("Too Many Levels of Nesting")-1,
+    [DRJSON_ERROR_TYPE_ERROR]     = sizeof("Invalid type for operation")-1,
+    [DRJSON_ERROR_INVALID_ERROR]  = sizeof("Error is Invalid")-1,
+    [DRJSON_ERROR_TRAILING_CONTENT] = sizeof("Trailing Content After Value")-1,
+    [DRJSON_ERROR_IO]             = sizeof("IO Error")-1,
+};
 
-                char escape = escaped[in_pos++];
-                switch(escape){
-                    case '"':  outstring[out_pos++] = '"'; break;
-                    case '\\': outstring[out_pos++] = '\\'; break;
-                    case '/':  outstring[out_pos++] = '/'; break;
-                    case 'b':  outstring[out_pos++] = '\b'; break;
-                    case 'f':  outstring[out_pos++] = '\f'; break;
-                    case 'n':  outstring[out_pos++] = '\n'; break;
-                    case 'r':  outstring[out_pos++] = '\r'; break;
-                    case 't':  outstring[out_pos++] = '\t'; break;
-                    case 'u': {
-                        // Unicode escape: \uXXXX
-                        if(in_pos + 4 > length) return 1;
+static inline
+const char*
+drjson_get_error_name(DrJsonValue v){
+    return DrJsonErrorNames[v.error_code];
+}
 
-                        // Parse 4 hex digits
-                        uint32_t codepoint = 0;
-                        for(int i = 0; i < 4; i++){
-                            char hex = escaped[in_pos++];
-                            uint32_t digit;
-                            if(hex >= '0' && hex <= '9')
-                                digit = hex - '0';
-                            else if(hex >= 'a' && hex <= 'f')
-                                digit = hex - 'a' + 10;
-                            else if(hex >= 'A' && hex <= 'F')
-                                digit = hex - 'A' + 10;
-                            else
-                                return 1; // Invalid hex digit
-                            codepoint = (codepoint << 4) | digit;
-                        }
+static inline
+size_t
+drjson_get_error_name_length(DrJsonValue v){
+    return DrJsonErrorNameLengths[v.error_code];
+}
 
-                        // Handle UTF-16 surrogate pairs
-                        if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
-                            // High surrogate, expect low surrogate
-                            if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
-                                return 1;
-                            in_pos += 2;
+DRJSON_API
+const char*
+drjson_error_name(DrJsonErrorCode code, size_t*_Nullable length){
+    if(code < 0  || code > DRJSON_ERROR_IO)
+        code = DRJSON_ERROR_INVALID_ERROR;
+    if(length) *length = DrJsonErrorNameLengths[code];
+    return DrJsonErrorNames[code];
+}
 
-                            uint32_t low_surrogate = 0;
-                            for(int i = 0; i < 4; i++){
-                                char hex = escaped[in_pos++];
-                                uint32_t digit;
-                                if(hex >= '0' && hex <= '9')
-                                    digit = hex - '0';
-                                else if(hex >= 'a' && hex <= 'f')
-                                    digit = hex - 'a' + 10;
-                                else if(hex >= 'A' && hex <= 'F')
-                                    digit = hex - 'A' + 10;
-                                else
-                                    return 1;
-                                low_surrogate = (low_surrogate << 4) | digit;
-                            }
+DRJSON_API
+const char*
+drjson_kind_name(DrJsonKind kind, size_t*_Nullable length){
+    if(kind < 0 || kind > DRJSON_LAZY_NUMBER)
+        kind = DRJSON_ERROR;
+    if(length) *length = DrJsonKindNameLengths[kind];
+    return DrJsonKindNames[kind];
+}
 
-                            if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
-                                return 1; // Invalid low surrogate
+static
+void
+drj_mark(DrJsonContext* ctx, DrJsonValue v){
+#ifdef DRJ_DEBUG
+    fprintf(stderr, "mark\n");
+#endif
+    switch(v.kind){
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
+        case DRJSON_OBJECT_ITEMS:
+        case DRJSON_OBJECT_VALUES:{
+            DrJsonObject* odata = ctx->objects.data;
+            DrJsonObject* object = &odata[v.object_idx];
+            if(!object->capacity) return;
+            if(object->marked) return;
+            object->marked = 1;
+            DrjObjSlots slots = drj_obj_slots(object);
+            for(size_t i = 0; i < object->count; i++)
+                drj_mark(ctx, drj_obj_pair(slots, i).value);
+        }break;
 
-                            // Combine surrogates into codepoint
-                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
-                        }
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:{
+            DrJsonArray* adata = ctx->arrays.data;
+            DrJsonArray* array = &adata[v.array_idx];
+            if(!array->capacity) return;
+            if(array->marked) return;
+            array->marked = 1;
+            if(array->packed) return;
+            for(size_t i = 0; i < array->count; i++)
+                drj_mark(ctx, array->array_items[i]);
+        }break;
+        default:
+            return;
+    }
+}
 
-                        // Encode as UTF-8
-                        if(codepoint <= 0x7F){
-                            outstring[out_pos++] = (char)codepoint;
-                        }
-                        else if(codepoint <= 0x7FF){
-                            outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else if(codepoint <= 0xFFFF){
-                            outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else if(codepoint <= 0x10FFFF){
-                            outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                            outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                        }
-                        else {
-                            return 1; // Invalid codepoint
-                        }
-                        break;
-                    }
-                    default:
-                        return 1; // Invalid escape sequence
-                }
+#define DRJ_FREE_IDX (UINT32_MAX-1)
+static
+void
+drj_free_obj(DrJsonContext* ctx, DrJsonObject* o){
+    size_t o_idx = o - ctx->objects.data;
+    #ifdef DRJ_DEBUG
+    fprintf(stderr, "Freeing object: %p (%zu)\n", (void*)o, o_idx);
+    assert(!o->freed);
+    o->freed = 1;
+    #endif
+    if(o->read_only){
+        o->read_only = 0;
+        uint32_t hash = hash_align8(o->object_items, o->count*sizeof(DrJsonObjectPair));
+        uint32_t idx = fast_reduce32(hash, (uint32_t)ctx->interned_objects.capacity*2);
+        uint32_t* idxes = (uint32_t*)(ctx->interned_objects.data+ctx->interned_objects.capacity);
+        DrjHashIdx* hi = ctx->interned_objects.data;
+        #ifdef DRJ_DEBUG
+        uint32_t found_idx = -1;
+        for(size_t i = 0; i < 2*ctx->interned_objects.capacity; i++){
+            if(hi[i].idx == (uint32_t)o_idx){
+                found_idx = (uint32_t)i;
+                break;
             }
-            // Continue with SWAR for next chunk
+        }
+        assert(found_idx != (uint32_t)-1);
+        #endif
+        for(;;){
+            uint32_t i = idxes[idx];
+            assert(i != UINT32_MAX);
+            if(i != UINT32_MAX && hi[i].idx == (uint32_t)o_idx){
+                #ifdef DRJ_DEBUG
+                assert(i == found_idx);
+                #endif
+                assert(hi[i].hash == hash);
+                hi[i].idx = DRJ_FREE_IDX;
+                break;
+            }
+            idx++;
+            if(idx == (uint32_t)(2*ctx->interned_objects.capacity)) idx = 0;
         }
     }
-#endif
-
-    // Scalar path: process remaining bytes
-    while(in_pos < length){
-        char c = escaped[in_pos++];
-
-        if(c != '\\'){
-            outstring[out_pos++] = c;
-            continue;
+    if(o->capacity){
+        drj_free(ctx, o->object_items, drj_obj_items_size(o));
+        o->object_items = NULL;
+        o->capacity = 0;
+        o->shaped = 0;
+    }
+    if(o_idx == ctx->objects.count-1){
+        ctx->objects.count--;
+    }
+    else {
+        if(o_idx <= UINT32_MAX/2 && o_idx){
+            o->count = ctx->objects.free_object;
+            ctx->objects.free_object = o_idx;
         }
+    }
+}
 
-        // Handle escape sequence
-        if(in_pos >= length) return 1; // Trailing backslash
-
-        char escape = escaped[in_pos++];
-        switch(escape){
-            case '"':  outstring[out_pos++] = '"'; break;
-            case '\\': outstring[out_pos++] = '\\'; break;
-            case '/':  outstring[out_pos++] = '/'; break;
-            case 'b':  outstring[out_pos++] = '\b'; break;
-            case 'f':  outstring[out_pos++] = '\f'; break;
-            case 'n':  outstring[out_pos++] = '\n'; break;
-            case 'r':  outstring[out_pos++] = '\r'; break;
-            case 't':  outstring[out_pos++] = '\t'; break;
-            case 'u': {
-                // Unicode escape: \uXXXX
-                if(in_pos + 4 > length) return 1;
-
-                // Parse 4 hex digits
-                uint32_t codepoint = 0;
-                for(int i = 0; i < 4; i++){
-                    char hex = escaped[in_pos++];
-                    uint32_t digit;
-                    if(hex >= '0' && hex <= '9')
-                        digit = hex - '0';
-                    else if(hex >= 'a' && hex <= 'f')
-                        digit = hex - 'a' + 10;
-                    else if(hex >= 'A' && hex <= 'F')
-                        digit = hex - 'A' + 10;
-                    else
-                        return 1; // Invalid hex digit
-                    codepoint = (codepoint << 4) | digit;
-                }
-
-                // Handle UTF-16 surrogate pairs
-                if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
-                    // High surrogate, expect low surrogate
-                    if(in_pos + 6 > length || escaped[in_pos] != '\\' || escaped[in_pos+1] != 'u')
-                        return 1;
-                    in_pos += 2;
-
-                    uint32_t low_surrogate = 0;
-                    for(int i = 0; i < 4; i++){
-                        char hex = escaped[in_pos++];
-                        uint32_t digit;
-                        if(hex >= '0' && hex <= '9')
-                            digit = hex - '0';
-                        else if(hex >= 'a' && hex <= 'f')
-                            digit = hex - 'a' + 10;
-                        else if(hex >= 'A' && hex <= 'F')
-                            digit = hex - 'A' + 10;
-                        else
-                            return 1;
-                        low_surrogate = (low_surrogate << 4) | digit;
-                    }
-
-                    if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
-                        return 1; // Invalid low surrogate
-
-                    // Combine surrogates into codepoint
-                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low_surrogate - 0xDC00);
-                }
+static inline
+uint32_t
+drj_array_hash(const DrJsonArray* a){
+    return hash_align8(a->array_items, a->count*drj_array_item_size(a)) + a->packed;
+}
 
-                // Encode as UTF-8
-                if(codepoint <= 0x7F){
-                    outstring[out_pos++] = (char)codepoint;
-                }
-                else if(codepoint <= 0x7FF){
-                    outstring[out_pos++] = (char)(0xC0 | (codepoint >> 6));
-                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                }
-                else if(codepoint <= 0xFFFF){
-                    outstring[out_pos++] = (char)(0xE0 | (codepoint >> 12));
-                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                }
-                else if(codepoint <= 0x10FFFF){
-                    outstring[out_pos++] = (char)(0xF0 | (codepoint >> 18));
-                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
-                    outstring[out_pos++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                    outstring[out_pos++] = (char)(0x80 | (codepoint & 0x3F));
-                }
-                else {
-                    return 1; // Invalid codepoint
-                }
+static
+void
+drj_free_array(DrJsonContext* ctx, DrJsonArray* a){
+    size_t a_idx = a - ctx->arrays.data;
+#ifdef DRJ_DEBUG
+    fprintf(stderr, "Freeing array: %p (%zu)\n", (void*)a, a_idx);
+    assert(!a->freed);
+    a->freed = 1;
+#endif
+    if(a->read_only){
+        a->read_only = 0;
+        // fprintf(stderr, "Freeing interned array: %p (%zu)\n", a, a_idx);
+        uint32_t hash = drj_array_hash(a);
+        uint32_t idx = fast_reduce32(hash, (uint32_t)ctx->interned_arrays.capacity*2);
+        uint32_t* idxes = (uint32_t*)(ctx->interned_arrays.data+ctx->interned_arrays.capacity);
+        DrjHashIdx* hi = ctx->interned_arrays.data;
+        #ifdef DRJ_DEBUG
+        uint32_t found_idx = -1;
+        for(size_t i = 0; i < 2*ctx->interned_arrays.capacity; i++){
+            if(hi[i].idx == (uint32_t)a_idx){
+                found_idx = (uint32_t)i;
                 break;
             }
-            default:
-                return 1; // Invalid escape sequence
+        }
+        assert(found_idx != (uint32_t)-1);
+        #endif
+        for(;;){
+            uint32_t i = idxes[idx];
+            assert(i != UINT32_MAX);
+            if(i != UINT32_MAX && hi[i].idx == (uint32_t)a_idx){
+                #ifdef DRJ_DEBUG
+                assert(i == found_idx);
+                #endif
+                assert(hi[i].hash == hash);
+                hi[i].idx = DRJ_FREE_IDX;
+                break;
+            }
+            idx++;
+            if(idx == (uint32_t)(2*ctx->interned_arrays.capacity)) idx = 0;
+        }
+    }
+    if(a->capacity){
+        drj_free(ctx, a->array_items, a->capacity*drj_array_item_size(a));
+        a->array_items = NULL;
+        a->packed = 0;
+        a->capacity = 0;
+    }
+    if(a_idx == ctx->arrays.count-1){
+        ctx->arrays.count--;
+    }
+    else {
+        if(a_idx <= UINT32_MAX/2 && a_idx){
+            a->count = ctx->arrays.free_array;
+            ctx->arrays.free_array = a_idx;
+        }
+    }
+}
+static
+void
+drj_sweep(DrJsonContext* ctx){
+#ifdef DRJ_DEBUG
+    fprintf(stderr, "sweep\n");
+#endif
+    {
+        DrJsonObject* odata = ctx->objects.data;
+        for(size_t i = ctx->objects.count; i--;){
+            DrJsonObject* o = &odata[i];
+            if(!o->capacity) continue;
+            if(o->marked){
+                o->marked = 0;
+                continue;
+            }
+            drj_free_obj(ctx, o);
         }
     }
+    {
+        DrJsonArray* adata = ctx->arrays.data;
+        for(size_t i = ctx->arrays.count; i--;){
+            DrJsonArray* a = &adata[i];
+            if(!a->capacity) continue;
+            if(a->marked){
+                a->marked = 0;
+                continue;
+            }
+            drj_free_array(ctx, a);
 
-    *outlength = out_pos;
-    return 0;
+        }
+    }
 }
 
 DRJSON_API
-DRJSON_WARN_UNUSED
 int
-drjson_unescape_string_value(DrJsonContext* ctx, DrJsonValue v, char* restrict buff, size_t buffsize, size_t* restrict outlength){
-    int err;
-    const char* esc; size_t len;
-    err = drj_get_str_and_len(ctx, v, &esc, &len);
-    if(err) return err;
-    if(buffsize < len) return 1;
-    return drjson_unescape_string(esc, len, buff, outlength);
+drjson_gc(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount){
+#ifdef DRJ_DEBUG
+    fprintf(stderr, "gc\n");
+#endif
+    // Marks left by an unfinished incremental collection would stop
+    // drj_mark early, so finish that one first.
+    if(ctx->gc.phase != DRJ_GC_IDLE)
+        (void)drjson_gc_step(ctx, roots, rootcount, SIZE_MAX);
+    for(size_t i = 0; i < rootcount; i++)
+        drj_mark(ctx, roots[i]);
+    drj_sweep(ctx);
+    return 0;
 }
 
-// Normalize user input by doing liberal unescape + strict escape in single pass
-// This handles user input from TUI where:
-// - Valid escape sequences (\n, \t, etc.) should be preserved
-// - Invalid escape sequences (\x) should have backslash escaped
-// - Unescaped special chars (") should be escaped
-// Returns: 0 on success, 1 on error
-// outstring must have at least 'length * 2' bytes available (worst case)
-// *outlength will be set to actual output length
-DRJSON_API
-DRJSON_WARN_UNUSED
-int
-drjson_normalize_user_input(const char* restrict input, size_t length, char* restrict outstring, size_t* restrict outlength){
-    if(!outlength) return 1;
-    if(!length){
-        *outlength = 0;
-        return 0;
+// Blackens a gray container. Returns roughly how much work that was.
+static
+size_t
+drj_gc_scan(DrJsonContext* ctx, size_t tagged){
+    size_t idx = tagged >> 1;
+    if(tagged & 1){
+        DrJsonArray* array = &ctx->arrays.data[idx];
+        array->marked = 1;
+        if(!array->capacity || array->packed) return 1;
+        for(size_t i = 0; i < array->count; i++)
+            drj_gc_shade(ctx, array->array_items[i]);
+        return 1 + array->count;
     }
-    if(!input || !outstring) return 1;
-
-    size_t in_pos = 0;
-    size_t out_pos = 0;
+    DrJsonObject* object = &ctx->objects.data[idx];
+    object->marked = 1;
+    if(!object->capacity) return 1;
+    DrjObjSlots slots = drj_obj_slots(object);
+    for(size_t i = 0; i < object->count; i++)
+        drj_gc_shade(ctx, drj_obj_pair(slots, i).value);
+    return 1 + object->count;
+}
 
-    while(in_pos < length){
-        char c = input[in_pos];
+// Some gray containers were lost, so mark everything again at once.
+static
+void
+drj_gc_remark(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount){
+    for(size_t i = 0; i < ctx->objects.count; i++)
+        ctx->objects.data[i].marked = 0;
+    for(size_t i = 0; i < ctx->arrays.count; i++)
+        ctx->arrays.data[i].marked = 0;
+    ctx->gc.count = 0;
+    ctx->gc.overflowed = 0;
+    for(size_t i = 0; i < rootcount; i++)
+        drj_mark(ctx, roots[i]);
+}
 
-        if(c == '\\'){
-            // Check if this is a valid escape sequence
-            if(in_pos + 1 < length){
-                char next = input[in_pos + 1];
-                // Check for valid JSON escape characters
-                if(next == '"' || next == '\\' || next == '/' ||
-                   next == 'b' || next == 'f' || next == 'n' ||
-                   next == 'r' || next == 't'){
-                    // Valid escape sequence - pass through as-is
-                    outstring[out_pos++] = c;
-                    outstring[out_pos++] = next;
-                    in_pos += 2;
-                    continue;
-                }
-                else if(next == 'u'){
-                    // Unicode escape sequence \uXXXX
-                    // Validate that we have 4 hex digits
-                    if(in_pos + 5 < length){
-                        int valid = 1;
-                        for(int i = 0; i < 4; i++){
-                            char hex = input[in_pos + 2 + i];
-                            if(!((hex >= '0' && hex <= '9') ||
-                                 (hex >= 'a' && hex <= 'f') ||
-                                 (hex >= 'A' && hex <= 'F'))){
-                                valid = 0;
-                                break;
-                            }
-                        }
-                        if(valid){
-                            // Valid unicode escape - pass through
-                            outstring[out_pos++] = '\\';
-                            outstring[out_pos++] = 'u';
-                            outstring[out_pos++] = input[in_pos + 2];
-                            outstring[out_pos++] = input[in_pos + 3];
-                            outstring[out_pos++] = input[in_pos + 4];
-                            outstring[out_pos++] = input[in_pos + 5];
-                            in_pos += 6;
-                            continue;
-                        }
-                    }
-                    // Invalid unicode escape - fall through to escape the backslash
-                }
-                // Invalid escape sequence - escape the backslash
-                outstring[out_pos++] = '\\';
-                outstring[out_pos++] = '\\';
-                in_pos++;
-                continue;
-            }
-            else {
-                // Trailing backslash - escape it
-                outstring[out_pos++] = '\\';
-                outstring[out_pos++] = '\\';
-                in_pos++;
-                continue;
-            }
-        }
-        else if(c == '"'){
-            // Unescaped quote - needs escaping
-            outstring[out_pos++] = '\\';
-            outstring[out_pos++] = '"';
-            in_pos++;
-        }
-        else if((unsigned char)c < 32){
-            // Control character - escape it
-            switch(c){
-                case '\b':
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 'b';
-                    break;
-                case '\f':
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 'f';
-                    break;
-                case '\n':
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 'n';
-                    break;
-                case '\r':
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 'r';
-                    break;
-                case '\t':
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 't';
-                    break;
-                default:{
-                    // Other control chars - use \u00xx format
-                    const char* const hex = "0123456789abcdef";
-                    outstring[out_pos++] = '\\';
-                    outstring[out_pos++] = 'u';
-                    outstring[out_pos++] = '0';
-                    outstring[out_pos++] = '0';
-                    outstring[out_pos++] = hex[((unsigned char)c & 0xf0) >> 4];
-                    outstring[out_pos++] = hex[((unsigned char)c & 0xf)];
-                    break;
-                }
-            }
-            in_pos++;
+DRJSON_API
+int
+drjson_gc_step(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount, size_t budget){
+    size_t work = 0;
+    if(ctx->gc.phase == DRJ_GC_IDLE){
+        ctx->gc.phase = DRJ_GC_MARK;
+        ctx->gc.overflowed = 0;
+        ctx->gc.allocated = 0;
+    }
+    if(ctx->gc.phase == DRJ_GC_MARK){
+        size_t extra = ctx->gc.allocated < SIZE_MAX / DRJ_GC_ALLOC_WORK? ctx->gc.allocated * DRJ_GC_ALLOC_WORK : SIZE_MAX;
+        ctx->gc.allocated = 0;
+        budget = budget < SIZE_MAX - extra? budget + extra : SIZE_MAX;
+        // The roots aren't behind the barrier, so they are shaded every
+        // step. Marking is done when that finds nothing new.
+        for(size_t i = 0; i < rootcount; i++)
+            drj_gc_shade(ctx, roots[i]);
+        while(ctx->gc.count && work < budget)
+            work += drj_gc_scan(ctx, ctx->gc.gray[--ctx->gc.count]);
+        if(ctx->gc.count)
+            return 0;
+        if(ctx->gc.overflowed)
+            drj_gc_remark(ctx, roots, rootcount);
+        ctx->gc.phase = DRJ_GC_SWEEP;
+        ctx->gc.sweep_objects = ctx->objects.count;
+        ctx->gc.sweep_arrays = ctx->arrays.count;
+    }
+    // Like drj_sweep, but every mark is cleared, including on empty
+    // containers.
+    while(ctx->gc.sweep_objects){
+        if(work >= budget) return 0;
+        work++;
+        DrJsonObject* o = &ctx->objects.data[--ctx->gc.sweep_objects];
+        if(o->marked){
+            o->marked = 0;
+            continue;
         }
-        else {
-            // Normal character - pass through
-            outstring[out_pos++] = c;
-            in_pos++;
+        if(o->capacity)
+            drj_free_obj(ctx, o);
+    }
+    while(ctx->gc.sweep_arrays){
+        if(work >= budget) return 0;
+        work++;
+        DrJsonArray* a = &ctx->arrays.data[--ctx->gc.sweep_arrays];
+        if(a->marked){
+            a->marked = 0;
+            continue;
         }
+        if(a->capacity)
+            drj_free_array(ctx, a);
     }
+    ctx->gc.phase = DRJ_GC_IDLE;
+    return 1;
+}
+
+#if DRJ_HAVE_THREADS
+// Just what drjson_gc_parallel needs. The counters are longs for the
+// Interlocked functions.
+#if defined(_MSC_VER) && !defined(__clang__)
+force_inline
+uint64_t
+drj_atomic_or64(volatile uint64_t* p, uint64_t bits){
+    return (uint64_t)InterlockedOr64((volatile LONG64*)p, (LONG64)bits);
+}
+
+force_inline
+uint64_t
+drj_atomic_load64(volatile uint64_t* p){
+    return *p;
+}
+
+force_inline
+long
+drj_atomic_add(volatile long* p, long n){
+    return InterlockedExchangeAdd(p, n) + n;
+}
+
+force_inline
+long
+drj_atomic_load(volatile long* p){
+    return InterlockedOr(p, 0);
+}
+
+force_inline
+void
+drj_atomic_store(volatile long* p, long v){
+    (void)InterlockedExchange(p, v);
+}
+
+force_inline
+long
+drj_atomic_xchg(volatile long* p, long v){
+    return InterlockedExchange(p, v);
+}
+#else
+force_inline
+uint64_t
+drj_atomic_or64(volatile uint64_t* p, uint64_t bits){
+    return __atomic_fetch_or(p, bits, __ATOMIC_RELAXED);
+}
 
-    *outlength = out_pos;
-    return 0;
+force_inline
+uint64_t
+drj_atomic_load64(volatile uint64_t* p){
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
 }
 
-// Normalize user input and atomize it in one operation
-// This is the common pattern: normalize user input from editor/UI, then intern it
-// Handles memory allocation internally for the normalization buffer
-// Returns: 0 on success, 1 on error
-DRJSON_API
-DRJSON_WARN_UNUSED
-int
-drjson_normalize_and_atomize(DrJsonContext* ctx, const char* restrict input, size_t length, DrJsonAtom* outatom){
-    if(!outatom) return 1;
-    if(!length){
-        return drjson_atomize(ctx, "", 0, outatom);
-    }
-    if(!input) return 1;
+force_inline
+long
+drj_atomic_add(volatile long* p, long n){
+    return __atomic_add_fetch(p, n, __ATOMIC_SEQ_CST);
+}
 
-    // Allocate buffer for normalization (worst case: length * 2)
-    size_t buffer_size = length * 2;
-    char* normalized = drj_alloc(ctx, buffer_size);
-    if(!normalized) return 1;
+force_inline
+long
+drj_atomic_load(volatile long* p){
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
 
-    size_t normalized_len;
-    int err = drjson_normalize_user_input(input, length, normalized, &normalized_len);
-    if(err){
-        drj_free(ctx, normalized, buffer_size);
-        return err;
-    }
+force_inline
+void
+drj_atomic_store(volatile long* p, long v){
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
 
-    // Atomize the normalized string
-    err = drjson_atomize(ctx, normalized, normalized_len, outatom);
-    drj_free(ctx, normalized, buffer_size);
-    return err;
+force_inline
+long
+drj_atomic_xchg(volatile long* p, long v){
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQUIRE);
 }
+#endif
 
-DRJSON_API
+// For spin waits: the first few spins just pause, later ones give the core
+// away, in case there are more threads than cores.
+force_inline
 void
-drjson_get_line_column(const DrJsonParseContext* ctx, size_t* line, size_t* column){
-    size_t lin = 0;
-    size_t col = 0;
-    // just do it the slow way, whatever.
-    for(const char* c = ctx->begin; c != ctx->cursor; c++){
-        switch(*c){
-            case '\n':
-                lin++;
-                col = 0;
-                break;
-            default:
-                col++;
-                break;
-        }
+drj_spin(unsigned spins){
+    if(spins < 64){
+        #if defined(_MSC_VER) && !defined(__clang__)
+            YieldProcessor();
+        #elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+            __builtin_ia32_pause();
+        #endif
+    }
+    else {
+        #ifdef _WIN32
+            SwitchToThread();
+        #else
+            sched_yield();
+        #endif
     }
-    *line = lin;
-    *column = col;
 }
 
-DRJSON_API
+enum {
+    // How many gray containers a marker keeps where the others can steal
+    // them.
+    DRJ_PAR_SHARED = 256,
+};
+
+typedef struct DrjParGC DrjParGC;
+typedef struct DrjParMarker DrjParMarker;
+struct DrjParMarker {
+    DrjParGC* gc;
+    size_t id;
+    // Gray containers only this marker touches, as in ctx->gc.gray.
+    size_t*_Nullable stack;
+    size_t count;
+    size_t capacity;
+    // The slots this marker freed, linked through count as in the free
+    // lists, to be joined into one list afterwards.
+    size_t free_objects, last_object;
+    size_t free_arrays, last_array;
+    size_t read_only_dead; // left for drj_free_obj/drj_free_array
+    char _pad[64];
+    // The work that can be stolen, behind a spin lock. The owner moves
+    // some of its stack here whenever it's empty.
+    volatile long lock;
+    volatile long shared_count;
+    size_t shared[DRJ_PAR_SHARED];
+    char _pad2[64];
+};
+
+struct DrjParGC {
+    DrJsonContext* ctx;
+    // The mark bits, one per table slot. Setting one is the test-and-set
+    // that decides which marker scans a container.
+    uint64_t* object_marks;
+    uint64_t* array_marks;
+    DrjParMarker* markers;
+    size_t nmarkers;
+    volatile long go; // set once all the threads that could be made are
+    volatile long idle; // markers that ran out of work
+    volatile long failed; // a stack didn't grow, so the marks are incomplete
+};
+
+force_inline
 void
-drjson_ctx_free_all(DrJsonContext* ctx){
-    if(ctx->allocator.free_all){
-        ctx->allocator.free_all(ctx->allocator.user_pointer);
-        return;
+drj_par_lock(DrjParMarker* m){
+    for(unsigned spins = 0; drj_atomic_xchg(&m->lock, 1); spins++)
+        drj_spin(spins);
+}
+
+force_inline
+void
+drj_par_unlock(DrjParMarker* m){
+    drj_atomic_store(&m->lock, 0);
+}
+
+static inline
+void
+drj_par_shade(DrjParGC* gc, DrjParMarker* m, DrJsonValue v){
+    size_t idx;
+    uint64_t* marks;
+    _Bool has_work;
+    switch(v.kind){
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
+        case DRJSON_OBJECT_ITEMS:
+        case DRJSON_OBJECT_VALUES:
+            idx = v.object_idx;
+            marks = gc->object_marks;
+            break;
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:
+            idx = v.array_idx;
+            marks = gc->array_marks;
+            break;
+        default:
+            return;
     }
-    if(!ctx->allocator.free)
-        return;
-    for(size_t i = 0; i < ctx->atoms.count; i++){
-        DrjAtomStr* astrs = ctx->atoms.data;
-        DrjAtomStr* a = &astrs[i];
-        if(!a->allocated) continue;
-        drj_free(ctx, a->pointer, a->length);
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+    // Most containers are only referred to once, but checking first keeps
+    // the shared ones from bouncing between cores.
+    if(drj_atomic_load64(&marks[idx/64]) & bit) return;
+    if(drj_atomic_or64(&marks[idx/64], bit) & bit) return;
+    if(marks == gc->object_marks)
+        has_work = gc->ctx->objects.data[idx].capacity != 0;
+    else {
+        const DrJsonArray* a = &gc->ctx->arrays.data[idx];
+        has_work = a->capacity && !a->packed;
     }
-    ctx->allocator.free(ctx->allocator.user_pointer, ctx->atoms.data, drj_atom_table_size_for(ctx->atoms.capacity));
-    // XXX
-    //  We don't free the atom table or the atoms!
-    // Release strings
-
-    // Free each object
-    for(size_t i = 0; i < ctx->objects.count; i++){
-        DrJsonObject* odata = ctx->objects.data;
-        DrJsonObject* o = &odata[i];
-        if(o->capacity)
-            drj_free(ctx, o->object_items, drjson_size_for_object_of_length(o->capacity));
+    if(!has_work) return;
+    if(m->count == m->capacity){
+        size_t cap = m->capacity * 2;
+        size_t* stack = drj_realloc(gc->ctx, m->stack, m->capacity*sizeof *stack, cap*sizeof *stack);
+        if(!stack){
+            drj_atomic_store(&gc->failed, 1);
+            return;
+        }
+        m->stack = stack;
+        m->capacity = cap;
     }
-    // Then the objects array
-    if(ctx->objects.data)
-        drj_free(ctx, ctx->objects.data, ctx->objects.capacity*sizeof (DrJsonObject));
-    // Free interned objects
-    if(ctx->interned_objects.capacity)
-        drj_free(ctx, ctx->interned_objects.data, ctx->interned_objects.capacity*sizeof(uint32_t)*4);
+    m->stack[m->count++] = idx << 1 | (marks == gc->array_marks);
+}
 
-    // Free each array
-    for(size_t i = 0; i < ctx->arrays.count; i++){
-        DrJsonArray* adata = ctx->arrays.data;
-        DrJsonArray* a = &adata[i];
-        if(a->capacity)
-            drj_free(ctx, a->array_items,a->capacity*sizeof *a->array_items);
+// Deleted pairs' values are null, so tombstones need no special care here.
+static inline
+void
+drj_par_scan(DrjParGC* gc, DrjParMarker* m, size_t tagged){
+    size_t idx = tagged >> 1;
+    if(tagged & 1){
+        const DrJsonArray* array = &gc->ctx->arrays.data[idx];
+        for(size_t i = 0; i < array->count; i++)
+            drj_par_shade(gc, m, array->array_items[i]);
+        return;
     }
-    // Free arrays array
-    if(ctx->arrays.data)
-        drj_free(ctx, ctx->arrays.data, ctx->arrays.capacity*sizeof(DrJsonArray));
-
-    // Free interned arrays
-    if(ctx->interned_arrays.capacity)
-        drj_free(ctx, ctx->interned_arrays.data, ctx->interned_arrays.capacity*sizeof(uint32_t)*4);
+    const DrJsonObject* object = &gc->ctx->objects.data[idx];
+    DrjObjSlots slots = drj_obj_slots(object);
+    for(size_t i = 0; i < object->count; i++)
+        drj_par_shade(gc, m, drj_obj_pair(slots, i).value);
+}
 
-    #ifndef DRJ_DONT_FREE_CTX
-        drj_free(ctx, ctx, sizeof *ctx);
-    #endif
+// Moves items from the top of a marker's shared work to the thief's
+// stack, which always has room for DRJ_PAR_SHARED of them.
+static
+_Bool
+drj_par_steal(DrjParMarker* thief, DrjParMarker* victim){
+    if(!drj_atomic_load(&victim->shared_count)) return 0;
+    drj_par_lock(victim);
+    long n = victim->shared_count;
+    // Take all of our own, half of anyone else's.
+    long take = thief == victim? n : (n+1)/2;
+    for(long i = n - take; i < n; i++)
+        thief->stack[thief->count++] = victim->shared[i];
+    drj_atomic_store(&victim->shared_count, n - take);
+    drj_par_unlock(victim);
+    return take != 0;
 }
 
+static
+void
+drj_par_mark(DrjParGC* gc, DrjParMarker* m){
+    for(;;){
+        while(m->count){
+            drj_par_scan(gc, m, m->stack[--m->count]);
+            if(m->count > 1 && !drj_atomic_load(&m->shared_count)){
+                drj_par_lock(m);
+                size_t n = m->count / 2;
+                if(n > DRJ_PAR_SHARED) n = DRJ_PAR_SHARED;
+                m->count -= n;
+                drj_memcpy(m->shared, m->stack + m->count, n * sizeof *m->stack);
+                drj_atomic_store(&m->shared_count, (long)n);
+                drj_par_unlock(m);
+            }
+        }
+        _Bool stole = 0;
+        for(size_t i = 0; i < gc->nmarkers && !stole; i++)
+            stole = drj_par_steal(m, &gc->markers[(m->id + i) % gc->nmarkers]);
+        if(stole) continue;
+        // Nobody adds work without having some, so once every marker is
+        // idle the marking is done.
+        drj_atomic_add(&gc->idle, 1);
+        for(unsigned spins = 0;; spins++){
+            if(drj_atomic_load(&gc->idle) == (long)gc->nmarkers)
+                return;
+            _Bool any = 0;
+            for(size_t i = 0; i < gc->nmarkers && !any; i++)
+                any = drj_atomic_load(&gc->markers[i].shared_count) != 0;
+            if(any){
+                drj_atomic_add(&gc->idle, -1);
+                break;
+            }
+            drj_spin(spins);
+        }
+    }
+}
 
-DRJSON_API
-DrJsonValue
-drjson_make_string(DrJsonContext* ctx, const char* s, size_t length){
-    DrJsonAtom atom;
-    int err = drj_atomize_str(&ctx->atoms, &ctx->allocator, s, (uint32_t)length, 1, &atom);
-    if(err)
-        return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom");
-    return drjson_atom_to_value(atom);
+// Frees the dead containers in this marker's share of the tables. Interned
+// ones have to be taken out of the interned tables, so they are left for
+// afterwards.
+static
+void
+drj_par_sweep(DrjParGC* gc, DrjParMarker* m){
+    DrJsonContext* ctx = gc->ctx;
+    size_t n = gc->nmarkers;
+    size_t lo = ctx->objects.count * m->id / n, hi = ctx->objects.count * (m->id + 1) / n;
+    m->free_objects = m->last_object = 0;
+    for(size_t i = hi; i-- > lo;){
+        if(gc->object_marks[i/64] >> (i%64) & 1) continue;
+        DrJsonObject* o = &ctx->objects.data[i];
+        // Before the capacity, as empty interned ones are in the table too.
+        if(o->read_only){
+            m->read_only_dead++;
+            continue;
+        }
+        if(o->capacity){
+            drj_free(ctx, o->object_items, drj_obj_items_size(o));
+            o->object_items = NULL;
+            o->capacity = 0;
+            o->shaped = 0;
+        }
+        if(!i || i > UINT32_MAX/2) continue;
+        o->count = m->free_objects;
+        m->free_objects = i;
+        if(!m->last_object) m->last_object = i;
+    }
+    lo = ctx->arrays.count * m->id / n;
+    hi = ctx->arrays.count * (m->id + 1) / n;
+    m->free_arrays = m->last_array = 0;
+    for(size_t i = hi; i-- > lo;){
+        if(gc->array_marks[i/64] >> (i%64) & 1) continue;
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(a->read_only){
+            m->read_only_dead++;
+            continue;
+        }
+        if(a->capacity){
+            drj_free(ctx, a->array_items, a->capacity*drj_array_item_size(a));
+            a->array_items = NULL;
+            a->packed = 0;
+            a->capacity = 0;
+        }
+        if(!i || i > UINT32_MAX/2) continue;
+        a->count = m->free_arrays;
+        m->free_arrays = i;
+        if(!m->last_array) m->last_array = i;
+    }
 }
 
-static const char*_Nonnull const DrJsonKindNames[] = {
-    [DRJSON_ERROR]         = "error",
-    [DRJSON_NUMBER]        = "number",
-    [DRJSON_INTEGER]       = "integer",
-    [DRJSON_UINTEGER]      = "uinteger",
-    [DRJSON_STRING]        = "string",
-    [DRJSON_ARRAY]         = "array",
-    [DRJSON_OBJECT]        = "object",
-    [DRJSON_NULL]          = "null",
-    [DRJSON_BOOL]          = "bool",
-    [DRJSON_ARRAY_VIEW]    = "array view",
-    [DRJSON_OBJECT_KEYS]   = "object keys",
-    [DRJSON_OBJECT_VALUES] = "object values",
-    [DRJSON_OBJECT_ITEMS]  = "object items",
-};
+static
+void
+drj_par_work(DrjParMarker* m){
+    DrjParGC* gc = m->gc;
+    for(unsigned spins = 0; !drj_atomic_load(&gc->go); spins++)
+        drj_spin(spins);
+    drj_par_mark(gc, m);
+    // Everyone has stopped marking, so `failed` is final.
+    if(!drj_atomic_load(&gc->failed))
+        drj_par_sweep(gc, m);
+}
 
-static const size_t DrJsonKindNameLengths[] = {
-    [DRJSON_ERROR]         = sizeof("error")-1,
-    [DRJSON_NUMBER]        = sizeof("number")-1,
-    [DRJSON_INTEGER]       = sizeof("integer")-1,
-    [DRJSON_UINTEGER]      = sizeof("uinteger")-1,
-    [DRJSON_STRING]        = sizeof("string")-1,
-    [DRJSON_ARRAY]         = sizeof("array")-1,
-    [DRJSON_OBJECT]        = sizeof("object")-1,
-    [DRJSON_NULL]          = sizeof("null")-1,
-    [DRJSON_BOOL]          = sizeof("bool")-1,
-    [DRJSON_ARRAY_VIEW]    = sizeof("array view")-1,
-    [DRJSON_OBJECT_KEYS]   = sizeof("object keys")-1,
-    [DRJSON_OBJECT_VALUES] = sizeof("object values")-1,
-    [DRJSON_OBJECT_ITEMS]  = sizeof("object items")-1,
-};
+#ifdef _WIN32
+typedef HANDLE DrjThread;
 
-static const char*_Nonnull const DrJsonErrorNames[] = {
-    [DRJSON_ERROR_NONE]           = "No error",
-    [DRJSON_ERROR_UNEXPECTED_EOF] = "Unexpected End of Input",
-    [DRJSON_ERROR_ALLOC_FAILURE]  = "Allocation Failure",
-    [DRJSON_ERROR_MISSING_KEY]    = "Missing Key",
-    [DRJSON_ERROR_INDEX_ERROR]    = "Index Error",
-    [DRJSON_ERROR_INVALID_CHAR]   = "Invalid Char",
-    [DRJSON_ERROR_INVALID_VALUE]  = "Invalid Value",
-    [DRJSON_ERROR_TOO_DEEP]       = "Too Many Levels of Nesting",
-    [DRJSON_ERROR_TYPE_ERROR]     = "Invalid type for operation",
-    [DRJSON_ERROR_INVALID_ERROR]  = "Error is Invalid",
-    [DRJSON_ERROR_TRAILING_CONTENT] = "Trailing Content After Value",
-};
+static
+DWORD WINAPI
+drj_par_thread(LPVOID p){
+    drj_par_work(p);
+    return 0;
+}
 
-static const size_t DrJsonErrorNameLengths[] = {
-    [DRJSON_ERROR_NONE]           = sizeof("No error")-1,
-    [DRJSON_ERROR_UNEXPECTED_EOF] = sizeof("Unexpected End of Input")-1,
-    [DRJSON_ERROR_ALLOC_FAILURE]  = sizeof("Allocation Failure")-1,
-    [DRJSON_ERROR_MISSING_KEY]    = sizeof("Missing Key")-1,
-    [DRJSON_ERROR_INDEX_ERROR]    = sizeof("Index Error")-1,
-    [DRJSON_ERROR_INVALID_CHAR]   = sizeof("Invalid Char")-1,
-    [DRJSON_ERROR_INVALID_VALUE]  = sizeof("Invalid Value")-1,
-    [DRJSON_ERROR_TOO_DEEP]       = sizeof("Too Many Levels of Nesting")-1,
-    [DRJSON_ERROR_TYPE_ERROR]     = sizeof("Invalid type for operation")-1,
-    [DRJSON_ERROR_INVALID_ERROR]  = sizeof("Error is Invalid")-1,
-    [DRJSON_ERROR_TRAILING_CONTENT] = sizeof("Trailing Content After Value")-1,
-};
+static inline
+_Bool
+drj_thread_start(DrjThread* t, DrjParMarker* m){
+    *t = CreateThread(NULL, 0, drj_par_thread, m, 0, NULL);
+    return *t != NULL;
+}
 
 static inline
-const char*
-drjson_get_error_name(DrJsonValue v){
-    return DrJsonErrorNames[v.error_code];
+void
+drj_thread_join(DrjThread t){
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+#else
+typedef pthread_t DrjThread;
+
+static
+void*_Nullable
+drj_par_thread(void* p){
+    drj_par_work(p);
+    return NULL;
 }
 
 static inline
-size_t
-drjson_get_error_name_length(DrJsonValue v){
-    return DrJsonErrorNameLengths[v.error_code];
+_Bool
+drj_thread_start(DrjThread* t, DrjParMarker* m){
+    return pthread_create(t, NULL, drj_par_thread, m) == 0;
 }
 
-DRJSON_API
-const char*
-drjson_error_name(DrJsonErrorCode code, size_t*_Nullable length){
-    if(code < 0  || code > DRJSON_ERROR_INVALID_ERROR)
-        code = DRJSON_ERROR_INVALID_ERROR;
-    if(length) *length = DrJsonErrorNameLengths[code];
-    return DrJsonErrorNames[code];
+static inline
+void
+drj_thread_join(DrjThread t){
+    pthread_join(t, NULL);
 }
+#endif
+#endif
 
 DRJSON_API
-const char*
-drjson_kind_name(DrJsonKind kind, size_t*_Nullable length){
-    if(kind < 0 || kind > DRJSON_OBJECT_ITEMS)
-        kind = DRJSON_ERROR;
-    if(length) *length = DrJsonKindNameLengths[kind];
-    return DrJsonKindNames[kind];
+int
+drjson_gc_parallel(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount, size_t nthreads){
+#if !DRJ_HAVE_THREADS
+    (void)nthreads;
+    return drjson_gc(ctx, roots, rootcount);
+#else
+    if(nthreads <= 1)
+        return drjson_gc(ctx, roots, rootcount);
+    if(nthreads > 1024) nthreads = 1024;
+    if(ctx->gc.phase != DRJ_GC_IDLE)
+        (void)drjson_gc_step(ctx, roots, rootcount, SIZE_MAX);
+    size_t owords = (ctx->objects.count + 63) / 64, awords = (ctx->arrays.count + 63) / 64;
+    DrjParGC gc = {
+        .ctx = ctx,
+        .object_marks = owords? drj_alloc(ctx, owords * sizeof(uint64_t)) : NULL,
+        .array_marks = awords? drj_alloc(ctx, awords * sizeof(uint64_t)) : NULL,
+        .markers = drj_alloc(ctx, nthreads * sizeof(DrjParMarker)),
+    };
+    DrjThread* threads = drj_alloc(ctx, nthreads * sizeof *threads);
+    _Bool ok = (!owords || gc.object_marks) && (!awords || gc.array_marks) && gc.markers && threads;
+    size_t nmarkers = 0;
+    if(ok){
+        for(; nmarkers < nthreads; nmarkers++){
+            size_t* stack = drj_alloc(ctx, DRJ_PAR_SHARED * sizeof *stack);
+            if(!stack) break;
+            gc.markers[nmarkers] = (DrjParMarker){
+                .gc = &gc,
+                .id = nmarkers,
+                .stack = stack,
+                .capacity = DRJ_PAR_SHARED,
+            };
+        }
+        ok = nmarkers == nthreads;
+    }
+    size_t nstarted = 1;
+    if(ok){
+        if(owords) drj_memset(gc.object_marks, 0, owords * sizeof(uint64_t));
+        if(awords) drj_memset(gc.array_marks, 0, awords * sizeof(uint64_t));
+        gc.nmarkers = nthreads;
+        for(size_t i = 0; i < rootcount; i++)
+            drj_par_shade(&gc, &gc.markers[0], roots[i]);
+        // The threads wait for `go`, so if some can't be made, the rest
+        // just split the work fewer ways.
+        for(; nstarted < nthreads; nstarted++)
+            if(!drj_thread_start(&threads[nstarted], &gc.markers[nstarted]))
+                break;
+        gc.nmarkers = nstarted;
+        drj_atomic_store(&gc.go, 1);
+        drj_par_work(&gc.markers[0]);
+        for(size_t i = 1; i < nstarted; i++)
+            drj_thread_join(threads[i]);
+        ok = !gc.failed;
+    }
+    if(ok){
+        // Join up the free lists in table order.
+        size_t free_objects = 0, free_arrays = 0, read_only_dead = 0;
+        for(size_t i = nstarted; i--;){
+            DrjParMarker* m = &gc.markers[i];
+            if(m->free_objects){
+                ctx->objects.data[m->last_object].count = (uint32_t)free_objects;
+                free_objects = m->free_objects;
+            }
+            if(m->free_arrays){
+                ctx->arrays.data[m->last_array].count = (uint32_t)free_arrays;
+                free_arrays = m->free_arrays;
+            }
+            read_only_dead += m->read_only_dead;
+        }
+        ctx->objects.free_object = free_objects;
+        ctx->arrays.free_array = free_arrays;
+        for(size_t i = ctx->objects.count; read_only_dead && i--;){
+            DrJsonObject* o = &ctx->objects.data[i];
+            if(o->read_only && !(gc.object_marks[i/64] >> (i%64) & 1)){
+                drj_free_obj(ctx, o);
+                read_only_dead--;
+            }
+        }
+        for(size_t i = ctx->arrays.count; read_only_dead && i--;){
+            DrJsonArray* a = &ctx->arrays.data[i];
+            if(a->read_only && !(gc.array_marks[i/64] >> (i%64) & 1)){
+                drj_free_array(ctx, a);
+                read_only_dead--;
+            }
+        }
+    }
+    for(size_t i = 0; i < nmarkers; i++)
+        drj_free(ctx, gc.markers[i].stack, gc.markers[i].capacity * sizeof *gc.markers[i].stack);
+    if(gc.markers) drj_free(ctx, gc.markers, nthreads * sizeof(DrjParMarker));
+    if(threads) drj_free(ctx, threads, nthreads * sizeof *threads);
+    if(gc.object_marks) drj_free(ctx, gc.object_marks, owords * sizeof(uint64_t));
+    if(gc.array_marks) drj_free(ctx, gc.array_marks, awords * sizeof(uint64_t));
+    if(!ok)
+        return drjson_gc(ctx, roots, rootcount);
+    return 0;
+#endif
 }
 
-static
-void
-drj_mark(DrJsonContext* ctx, DrJsonValue v){
-#ifdef DRJ_DEBUG
-    fprintf(stderr, "mark\n");
-#endif
+static inline
+DrJsonValue
+drj_remap_value(const size_t*_Nullable omap, const size_t*_Nullable amap, DrJsonValue v){
     switch(v.kind){
         case DRJSON_OBJECT:
         case DRJSON_OBJECT_KEYS:
         case DRJSON_OBJECT_ITEMS:
-        case DRJSON_OBJECT_VALUES:{
-            DrJsonObject* odata = ctx->objects.data;
-            DrJsonObject* object = &odata[v.object_idx];
-            if(!object->capacity) return;
-            if(object->marked) return;
-            object->marked = 1;
-            DrJsonObjectPair* pairs = drj_obj_get_pairs(object->object_items, object->capacity);
-            for(size_t i = 0; i < object->count; i++)
-                drj_mark(ctx, pairs[i].value);
-        }break;
-
+        case DRJSON_OBJECT_VALUES:
+            v.object_idx = omap[v.object_idx];
+            return v;
         case DRJSON_ARRAY:
-        case DRJSON_ARRAY_VIEW:{
-            DrJsonArray* adata = ctx->arrays.data;
-            DrJsonArray* array = &adata[v.array_idx];
-            if(!array->capacity) return;
-            if(array->marked) return;
-            array->marked = 1;
-            for(size_t i = 0; i < array->count; i++)
-                drj_mark(ctx, array->array_items[i]);
-        }break;
+        case DRJSON_ARRAY_VIEW:
+            v.array_idx = amap[v.array_idx];
+            return v;
         default:
-            return;
+            return v;
     }
 }
 
-#define DRJ_FREE_IDX (UINT32_MAX-1)
+// Points an interned table at the moved containers (or, without a map,
+// where they already are). Their contents changed too, so they are
+// rehashed.
 static
 void
-drj_free_obj(DrJsonContext* ctx, DrJsonObject* o){
-    size_t o_idx = o - ctx->objects.data;
-    #ifdef DRJ_DEBUG
-    fprintf(stderr, "Freeing object: %p (%zu)\n", (void*)o, o_idx);
-    assert(!o->freed);
-    o->freed = 1;
-    #endif
-    if(o->read_only){
-        o->read_only = 0;
-        uint32_t hash = hash_align8(o->object_items, o->count*sizeof(DrJsonObjectPair));
-        uint32_t idx = fast_reduce32(hash, (uint32_t)ctx->interned_objects.capacity*2);
-        uint32_t* idxes = (uint32_t*)(ctx->interned_objects.data+ctx->interned_objects.capacity);
-        DrjHashIdx* hi = ctx->interned_objects.data;
-        #ifdef DRJ_DEBUG
-        uint32_t found_idx = -1;
-        for(size_t i = 0; i < 2*ctx->interned_objects.capacity; i++){
-            if(hi[i].idx == (uint32_t)o_idx){
-                found_idx = (uint32_t)i;
-                break;
-            }
+drj_interned_remap(const DrJsonContext* ctx, DrjHashIdx*_Nullable hi, size_t* count, size_t capacity, const size_t*_Nullable map, _Bool arrays){
+    if(!capacity) return;
+    uint32_t* idxes = (uint32_t*)(hi+capacity);
+    drj_memset(idxes, 0xff, sizeof(uint32_t)*2*capacity);
+    size_t n = 0;
+    for(size_t i = 0; i < *count; i++){
+        if(hi[i].idx == DRJ_FREE_IDX) continue;
+        size_t moved = map? map[hi[i].idx] : hi[i].idx;
+        // Collected, so dropped like a freed entry.
+        if(moved == SIZE_MAX){
+            hi[i].idx = DRJ_FREE_IDX;
+            continue;
         }
-        assert(found_idx != (uint32_t)-1);
-        #endif
-        for(;;){
-            uint32_t i = idxes[idx];
-            assert(i != UINT32_MAX);
-            if(i != UINT32_MAX && hi[i].idx == (uint32_t)o_idx){
-                #ifdef DRJ_DEBUG
-                assert(i == found_idx);
-                #endif
-                assert(hi[i].hash == hash);
-                hi[i].idx = DRJ_FREE_IDX;
-                break;
-            }
+        uint32_t c_idx = (uint32_t)moved;
+        uint32_t hash;
+        if(arrays)
+            hash = drj_array_hash(&ctx->arrays.data[c_idx]);
+        else {
+            const DrJsonObject* o = &ctx->objects.data[c_idx];
+            hash = hash_align8(o->object_items, o->count*sizeof(DrJsonObjectPair));
+        }
+        uint32_t idx = fast_reduce32(hash, (uint32_t)capacity*2);
+        while(idxes[idx] != UINT32_MAX){
             idx++;
-            if(idx == (uint32_t)(2*ctx->interned_objects.capacity)) idx = 0;
+            if(idx == capacity*2) idx = 0;
         }
+        hi[n] = (DrjHashIdx){.hash = hash, .idx = c_idx};
+        idxes[idx] = (uint32_t)n;
+        n++;
     }
-    if(o->capacity){
-        drj_free(ctx, o->object_items, drjson_size_for_object_of_length(o->capacity));
-        o->object_items = NULL;
-        o->capacity = 0;
+    *count = n;
+}
+
+DRJSON_API
+int
+drjson_gc_compact(DrJsonContext* ctx, DrJsonValue*_Null_unspecified roots, size_t rootcount, DrJsonRemap*_Nullable remap){
+    if(remap) *remap = (DrJsonRemap){0};
+    if(ctx->gc.phase != DRJ_GC_IDLE)
+        (void)drjson_gc_step(ctx, roots, rootcount, SIZE_MAX);
+    size_t ocount = ctx->objects.count, acount = ctx->arrays.count;
+    size_t* omap = ocount? drj_alloc(ctx, ocount*sizeof *omap) : NULL;
+    size_t* amap = acount? drj_alloc(ctx, acount*sizeof *amap) : NULL;
+    // Unlike drj_mark, shading marks the empty containers that are
+    // reachable, which is what tells them apart from free slots.
+    ctx->gc.phase = DRJ_GC_MARK;
+    ctx->gc.overflowed = 0;
+    for(size_t i = 0; i < rootcount; i++)
+        drj_gc_shade(ctx, roots[i]);
+    while(ctx->gc.count)
+        (void)drj_gc_scan(ctx, ctx->gc.gray[--ctx->gc.count]);
+    if(ctx->gc.overflowed || (ocount && !omap) || (acount && !amap)){
+        if(omap) drj_free(ctx, omap, ocount*sizeof *omap);
+        if(amap) drj_free(ctx, amap, acount*sizeof *amap);
+        // Just collect.
+        (void)drjson_gc_step(ctx, roots, rootcount, SIZE_MAX);
+        return 1;
     }
-    if(o_idx == ctx->objects.count-1){
-        ctx->objects.count--;
+    ctx->gc.phase = DRJ_GC_IDLE;
+    // Dead containers are freed before anything is rewritten, as freeing
+    // an interned one finds it by its old contents and index. Interned
+    // ones are freed even when empty, to take them out of their table.
+    size_t n = 0;
+    for(size_t i = 0; i < ocount; i++){
+        DrJsonObject* o = &ctx->objects.data[i];
+        if(!o->marked){
+            omap[i] = SIZE_MAX;
+            if(o->capacity || o->read_only) drj_free_obj(ctx, o);
+            continue;
+        }
+        o->marked = 0;
+        omap[i] = n;
+        if(i != n) ctx->objects.data[n] = *o;
+        n++;
     }
-    else {
-        if(o_idx <= UINT32_MAX/2 && o_idx){
-            o->count = ctx->objects.free_object;
-            ctx->objects.free_object = o_idx;
+    ctx->objects.count = n;
+    ctx->objects.free_object = 0;
+    n = 0;
+    for(size_t i = 0; i < acount; i++){
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(!a->marked){
+            amap[i] = SIZE_MAX;
+            if(a->capacity || a->read_only) drj_free_array(ctx, a);
+            continue;
+        }
+        a->marked = 0;
+        amap[i] = n;
+        if(i != n) ctx->arrays.data[n] = *a;
+        n++;
+    }
+    ctx->arrays.count = n;
+    ctx->arrays.free_array = 0;
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        DrJsonObject* o = &ctx->objects.data[i];
+        if(!o->capacity) continue;
+        DrjObjSlots slots = drj_obj_slots(o);
+        for(size_t j = 0; j < o->count; j++){
+            DrJsonValue* v = (DrJsonValue*)(slots.values + j * slots.value_stride);
+            *v = drj_remap_value(omap, amap, *v);
+        }
+    }
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(!a->capacity || a->packed) continue;
+        for(size_t j = 0; j < a->count; j++)
+            a->array_items[j] = drj_remap_value(omap, amap, a->array_items[j]);
+    }
+    for(size_t i = 0; i < rootcount; i++)
+        roots[i] = drj_remap_value(omap, amap, roots[i]);
+    drj_interned_remap(ctx, ctx->interned_objects.data, &ctx->interned_objects.count, ctx->interned_objects.capacity, omap, 0);
+    drj_interned_remap(ctx, ctx->interned_arrays.data, &ctx->interned_arrays.count, ctx->interned_arrays.capacity, amap, 1);
+    // Give back what the tables no longer need. If that fails they are
+    // just left bigger.
+    size_t ocap = ctx->objects.count < 8? 8 : ctx->objects.count;
+    if(ocap < ctx->objects.capacity){
+        DrJsonObject* p = drj_realloc(ctx, ctx->objects.data, ctx->objects.capacity*sizeof *p, ocap*sizeof *p);
+        if(p){
+            ctx->objects.data = p;
+            ctx->objects.capacity = ocap;
+        }
+    }
+    size_t acap = ctx->arrays.count < 8? 8 : ctx->arrays.count;
+    if(acap < ctx->arrays.capacity){
+        DrJsonArray* p = drj_realloc(ctx, ctx->arrays.data, ctx->arrays.capacity*sizeof *p, acap*sizeof *p);
+        if(p){
+            ctx->arrays.data = p;
+            ctx->arrays.capacity = acap;
         }
     }
+    if(ctx->gc.gray){
+        drj_free(ctx, ctx->gc.gray, ctx->gc.capacity*sizeof *ctx->gc.gray);
+        ctx->gc.gray = NULL;
+        ctx->gc.capacity = 0;
+    }
+    if(remap){
+        *remap = (DrJsonRemap){
+            .objects = omap, .object_count = ocount,
+            .arrays = amap, .array_count = acount,
+        };
+        return 0;
+    }
+    if(omap) drj_free(ctx, omap, ocount*sizeof *omap);
+    if(amap) drj_free(ctx, amap, acount*sizeof *amap);
+    return 0;
 }
 
-static
+DRJSON_API
+DrJsonValue
+drjson_remap_value(const DrJsonRemap* remap, DrJsonValue v){
+    switch(v.kind){
+        case DRJSON_OBJECT:
+        case DRJSON_OBJECT_KEYS:
+        case DRJSON_OBJECT_ITEMS:
+        case DRJSON_OBJECT_VALUES:
+            if(v.object_idx >= remap->object_count) return v;
+            break;
+        case DRJSON_ARRAY:
+        case DRJSON_ARRAY_VIEW:
+            if(v.array_idx >= remap->array_count) return v;
+            break;
+        default:
+            return v;
+    }
+    v = drj_remap_value(remap->objects, remap->arrays, v);
+    if(v.object_idx == SIZE_MAX)
+        return drjson_make_error(DRJSON_ERROR_INVALID_VALUE, "Value was collected");
+    return v;
+}
+
+DRJSON_API
 void
-drj_free_array(DrJsonContext* ctx, DrJsonArray* a){
-    size_t a_idx = a - ctx->arrays.data;
-#ifdef DRJ_DEBUG
-    fprintf(stderr, "Freeing array: %p (%zu)\n", (void*)a, a_idx);
-    assert(!a->freed);
-    a->freed = 1;
-#endif
-    if(a->read_only){
-        a->read_only = 0;
-        // fprintf(stderr, "Freeing interned array: %p (%zu)\n", a, a_idx);
-        uint32_t hash = hash_align8(a->array_items, a->count*sizeof *a->array_items);
-        uint32_t idx = fast_reduce32(hash, (uint32_t)ctx->interned_arrays.capacity*2);
-        uint32_t* idxes = (uint32_t*)(ctx->interned_arrays.data+ctx->interned_arrays.capacity);
-        DrjHashIdx* hi = ctx->interned_arrays.data;
-        #ifdef DRJ_DEBUG
-        uint32_t found_idx = -1;
-        for(size_t i = 0; i < 2*ctx->interned_arrays.capacity; i++){
-            if(hi[i].idx == (uint32_t)a_idx){
-                found_idx = (uint32_t)i;
-                break;
-            }
+drjson_remap_free(const DrJsonContext* ctx, DrJsonRemap* remap){
+    if(remap->objects) drj_free(ctx, remap->objects, remap->object_count*sizeof *remap->objects);
+    if(remap->arrays) drj_free(ctx, remap->arrays, remap->array_count*sizeof *remap->arrays);
+    *remap = (DrJsonRemap){0};
+}
+
+// For drjson_gc_atoms, which maps old atom indices to new ones (UINT32_MAX
+// for dead atoms).
+static inline
+DrJsonAtom
+drj_atom_move(const uint32_t* map, DrJsonAtom a){
+    return drj_make_atom(map[drj_atom_get_idx(a)], drj_atom_get_hash(a));
+}
+
+static inline
+void
+drj_atoms_mark_value(uint32_t* map, DrJsonValue v){
+    if(v.kind == DRJSON_STRING)
+        map[drj_atom_get_idx(v.atom)] = 0;
+}
+
+// Renumbers a string's atom, or copies a lazy number's text into the new
+// string chunks if it was in the old ones. Once a copy fails, the rest of
+// the text is left where it is.
+static inline
+void
+drj_atoms_move_value(DrJsonContext* ctx, const uint32_t* map, _Bool* failed, DrJsonValue* v){
+    if(v->kind == DRJSON_STRING)
+        v->atom = drj_atom_move(map, v->atom);
+    else if(v->kind == DRJSON_LAZY_NUMBER && v->_lowned && !*failed){
+        const char* text = drj_atom_copy_str(&ctx->atoms, &ctx->allocator, v->number_text, v->number_len);
+        if(text) v->number_text = text;
+        else *failed = 1;
+    }
+}
+
+DRJSON_API
+int
+drjson_gc_atoms(DrJsonContext* ctx, DrJsonValue*_Null_unspecified roots, size_t rootcount){
+    (void)drjson_gc(ctx, roots, rootcount);
+    DrjAtomTable* table = &ctx->atoms;
+    uint32_t count = table->count;
+    if(!count) return 0;
+    uint32_t* map = drj_alloc(ctx, count*sizeof *map);
+    if(!map) return 1;
+    // Dropping the shapes with dead keys breaks the probe sequences of the
+    // ones left, so they go into a new table.
+    size_t scap = ctx->shapes.capacity;
+    DrjShape** shapes = NULL;
+    if(scap){
+        shapes = drj_alloc(ctx, scap*sizeof *shapes);
+        if(!shapes){
+            drj_free(ctx, map, count*sizeof *map);
+            return 1;
         }
-        assert(found_idx != (uint32_t)-1);
-        #endif
-        for(;;){
-            uint32_t i = idxes[idx];
-            assert(i != UINT32_MAX);
-            if(i != UINT32_MAX && hi[i].idx == (uint32_t)a_idx){
-                #ifdef DRJ_DEBUG
-                assert(i == found_idx);
-                #endif
-                assert(hi[i].hash == hash);
-                hi[i].idx = DRJ_FREE_IDX;
-                break;
+        drj_memset(shapes, 0, scap*sizeof *shapes);
+    }
+    drj_memset(map, 0xff, count*sizeof *map);
+    // Everything left after drjson_gc is live, except free slots, which
+    // have no capacity.
+    map[drj_atom_get_idx(ctx->magic_keys.length)] = 0;
+    map[drj_atom_get_idx(ctx->magic_keys.keys)] = 0;
+    map[drj_atom_get_idx(ctx->magic_keys.values)] = 0;
+    map[drj_atom_get_idx(ctx->magic_keys.items)] = 0;
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        DrJsonObject* o = &ctx->objects.data[i];
+        if(!o->capacity) continue;
+        // The keys are renumbered below, which tombstones can't be.
+        if(drj_obj_tombstone_count(o)) drj_obj_compact(o);
+        DrjObjSlots slots = drj_obj_slots(o);
+        for(size_t j = 0; j < o->count; j++){
+            DrJsonObjectPair pair = drj_obj_pair(slots, j);
+            map[drj_atom_get_idx(pair.atom)] = 0;
+            drj_atoms_mark_value(map, pair.value);
+        }
+    }
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        const DrJsonArray* a = &ctx->arrays.data[i];
+        if(!a->capacity || a->packed) continue;
+        for(size_t j = 0; j < a->count; j++)
+            drj_atoms_mark_value(map, a->array_items[j]);
+    }
+    for(size_t i = 0; i < rootcount; i++)
+        drj_atoms_mark_value(map, roots[i]);
+    DrjAtomStr* strs = table->data;
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < count; i++){
+        if(map[i] == UINT32_MAX) continue;
+        map[i] = n;
+        strs[n++] = strs[i];
+    }
+    // The live strings are copied into new chunks so the old ones can all
+    // be freed, along with whatever dead strings were in them.
+    DrjStringChunk* old_chunks = table->chunks;
+    table->chunks = NULL;
+    table->string_cursor = NULL;
+    table->string_remaining = 0;
+    _Bool failed = 0;
+    for(uint32_t i = 0; i < n && !failed; i++){
+        if(!strs[i].allocated) continue;
+        const char* p = drj_atom_copy_str(table, &ctx->allocator, strs[i].pointer, strs[i].length);
+        if(p) strs[i].pointer = p;
+        else failed = 1;
+    }
+    ctx->magic_keys.length = drj_atom_move(map, ctx->magic_keys.length);
+    ctx->magic_keys.keys = drj_atom_move(map, ctx->magic_keys.keys);
+    ctx->magic_keys.values = drj_atom_move(map, ctx->magic_keys.values);
+    ctx->magic_keys.items = drj_atom_move(map, ctx->magic_keys.items);
+    for(size_t i = 0; i < ctx->objects.count; i++){
+        DrJsonObject* o = &ctx->objects.data[i];
+        if(!o->capacity) continue;
+        DrjObjSlots slots = drj_obj_slots(o);
+        for(size_t j = 0; j < o->count; j++){
+            // Shaped objects' keys are their shape's, which are done below.
+            if(!o->shaped){
+                DrJsonAtom* key = (DrJsonAtom*)(slots.keys + j * slots.key_stride);
+                *key = drj_atom_move(map, *key);
             }
-            idx++;
-            if(idx == (uint32_t)(2*ctx->interned_arrays.capacity)) idx = 0;
+            drj_atoms_move_value(ctx, map, &failed, (DrJsonValue*)(slots.values + j * slots.value_stride));
         }
     }
-    if(a->capacity){
-        drj_free(ctx, a->array_items, a->capacity*sizeof *a->array_items);
-        a->array_items = NULL;
-        a->capacity = 0;
+    for(size_t i = 0; i < ctx->arrays.count; i++){
+        DrJsonArray* a = &ctx->arrays.data[i];
+        if(!a->capacity || a->packed) continue;
+        for(size_t j = 0; j < a->count; j++)
+            drj_atoms_move_value(ctx, map, &failed, &a->array_items[j]);
     }
-    if(a_idx == ctx->arrays.count-1){
-        ctx->arrays.count--;
+    for(size_t i = 0; i < rootcount; i++)
+        drj_atoms_move_value(ctx, map, &failed, &roots[i]);
+    if(failed){
+        // Whatever wasn't copied is still in the old chunks, so keep them.
+        DrjStringChunk** tail = &table->chunks;
+        while(*tail) tail = &(*tail)->next;
+        *tail = old_chunks;
     }
     else {
-        if(a_idx <= UINT32_MAX/2 && a_idx){
-            a->count = ctx->arrays.free_array;
-            ctx->arrays.free_array = a_idx;
+        for(DrjStringChunk* chunk = old_chunks; chunk;){
+            DrjStringChunk* next = chunk->next;
+            drj_free(ctx, chunk, chunk->size);
+            chunk = next;
         }
     }
-}
-static
-void
-drj_sweep(DrJsonContext* ctx){
-#ifdef DRJ_DEBUG
-    fprintf(stderr, "sweep\n");
-#endif
-    {
-        DrJsonObject* odata = ctx->objects.data;
-        for(size_t i = ctx->objects.count; i--;){
-            DrJsonObject* o = &odata[i];
-            if(!o->capacity) continue;
-            if(o->marked){
-                o->marked = 0;
+    // No live object uses a shape with a dead key.
+    if(scap){
+        size_t live = 0;
+        for(size_t i = 0; i < scap; i++){
+            DrjShape* shape = ctx->shapes.data[i];
+            if(!shape) continue;
+            _Bool dead = 0;
+            for(uint32_t k = 0; k < shape->count && !dead; k++)
+                dead = map[drj_atom_get_idx(shape->keys[k])] == UINT32_MAX;
+            if(dead){
+                drj_free(ctx, shape, drj_shape_size(shape->count));
                 continue;
             }
-            drj_free_obj(ctx, o);
+            // The shape's index is by the atoms' hashes, which don't change.
+            for(uint32_t k = 0; k < shape->count; k++)
+                shape->keys[k] = drj_atom_move(map, shape->keys[k]);
+            shape->hash = hash_align8(shape->keys, shape->count * sizeof *shape->keys);
+            size_t k = fast_reduce32(shape->hash, (uint32_t)scap);
+            while(shapes[k]) k = k + 1 == scap? 0 : k + 1;
+            shapes[k] = shape;
+            live++;
         }
+        drj_free(ctx, ctx->shapes.data, scap*sizeof *shapes);
+        ctx->shapes.data = shapes;
+        ctx->shapes.count = live;
     }
-    {
-        DrJsonArray* adata = ctx->arrays.data;
-        for(size_t i = ctx->arrays.count; i--;){
-            DrJsonArray* a = &adata[i];
-            if(!a->capacity) continue;
-            if(a->marked){
-                a->marked = 0;
-                continue;
-            }
-            drj_free_array(ctx, a);
-
+    drj_free(ctx, map, count*sizeof *map);
+    // Interned objects and arrays are hashed by their atoms too.
+    drj_interned_remap(ctx, ctx->interned_objects.data, &ctx->interned_objects.count, ctx->interned_objects.capacity, NULL, 0);
+    drj_interned_remap(ctx, ctx->interned_arrays.data, &ctx->interned_arrays.count, ctx->interned_arrays.capacity, NULL, 1);
+    // Rebuild the index from scratch, smaller if most atoms died. An
+    // unfinished incremental grow is simply dropped.
+    uint32_t ngroups = 2*table->capacity/DRJ_ATOM_GROUP;
+    if(table->old_groups){
+        drj_free(ctx, table->old_groups, table->old_ngroups * sizeof(DrjAtomGroup));
+        drj_free(ctx, table->ready, (ngroups+63)/64 * sizeof(uint64_t));
+        table->old_groups = NULL;
+        table->ready = NULL;
+        table->old_ngroups = 0;
+    }
+    uint32_t cap = table->capacity;
+    while(cap > 32 && n <= cap/4)
+        cap /= 2;
+    if(cap != table->capacity){
+        uint32_t new_ngroups = 2*cap/DRJ_ATOM_GROUP;
+        DrjAtomGroup* groups = drj_alloc(ctx, new_ngroups * sizeof *groups);
+        void* data = groups? drj_realloc(ctx, table->data, table->capacity * sizeof(DrjAtomStr), cap * sizeof(DrjAtomStr)) : NULL;
+        if(data){
+            drj_free(ctx, table->groups, ngroups * sizeof *groups);
+            table->groups = groups;
+            table->data = data;
+            table->capacity = cap;
+            ngroups = new_ngroups;
         }
+        else if(groups)
+            drj_free(ctx, groups, new_ngroups * sizeof *groups);
     }
-}
-
-DRJSON_API
-int
-drjson_gc(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount){
-#ifdef DRJ_DEBUG
-    fprintf(stderr, "gc\n");
-#endif
-    for(size_t i = 0; i < rootcount; i++)
-        drj_mark(ctx, roots[i]);
-    drj_sweep(ctx);
+    table->count = n;
+    for(uint32_t g = 0; g < ngroups; g++)
+        drj_memset(table->groups[g].ctrl, DRJ_ATOM_EMPTY, sizeof table->groups[g].ctrl);
+    strs = table->data;
+    for(uint32_t i = 0; i < n; i++)
+        drj_atom_table_reinsert(table, strs[i].hash, i);
+    drj_memset(table->short_atoms, 0, sizeof table->short_atoms);
     return 0;
 }
 
@@ -4091,16 +8072,18 @@ drj_dupe_array_ronly(DrJsonContext* ctx, DrJsonValue src_val){
     DrJsonArray* src = &ctx->arrays.data[src_val.array_idx];
     DrJsonArray* dst = &ctx->arrays.data[new_idx];
     uint32_t cap = src->count;
-    DrJsonValue* items = drj_alloc(ctx, cap * sizeof *items);
+    size_t size = drj_array_item_size(src);
+    void* items = drj_alloc(ctx, cap * size);
     if(!items) return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom when duping array");
     *dst = (DrJsonArray){
         .count = cap,
         .capacity = cap,
         .array_items = items,
-        .marked = 0,
+        .marked = dst->marked, // by alloc_array
+        .packed = src->packed,
         .read_only = 1,
     };
-    drj_memcpy(items, src->array_items, cap*sizeof *items);
+    drj_memcpy(items, src->array_items, cap*size);
     return (DrJsonValue){.kind=DRJSON_ARRAY, .array_idx=new_idx};
 }
 
@@ -4111,10 +8094,13 @@ drj_intern_array(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
     DrJsonArray* adata = ctx->arrays.data;
     DrJsonArray* array = &adata[val.array_idx];
     if(array->read_only) return val;
+    // Interned arrays are compared byte for byte, so arrays that can be
+    // packed always are.
+    if(!array->packed && drj_array_pack(ctx, array))
+        return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom when interning array");
     size_t count = array->count;
-    DrJsonValue* items = array->array_items;
-    for(size_t i = 0; i < count; i++){
-        if(!drj_is_ro(ctx, items[i]))
+    for(size_t i = 0; i < count && !array->packed; i++){
+        if(!drj_is_ro(ctx, array->array_items[i]))
             return drjson_make_error(DRJSON_ERROR_TYPE_ERROR, "All values of array must be read only to be interned");
     }
     // assume we're going to insert for purpose of checking capacity.
@@ -4145,7 +8131,7 @@ drj_intern_array(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
         ctx->interned_arrays.data = data;
         ctx->interned_arrays.count = count;
     }
-    uint32_t hash = hash_align8(items, count * sizeof *items);
+    uint32_t hash = drj_array_hash(array);
     uint32_t* idxes = (uint32_t*)(ctx->interned_arrays.data+ctx->interned_arrays.capacity);
     uint32_t idx = fast_reduce32(hash, (uint32_t)ctx->interned_arrays.capacity*2);
     DrjHashIdx* hi = ctx->interned_arrays.data;
@@ -4169,8 +8155,8 @@ drj_intern_array(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
         else if(hi[i].hash == hash){
             uint32_t a_idx = hi[i].idx;
             DrJsonArray* a = &ctx->arrays.data[a_idx];
-            if(a->count == array->count){
-                if(!a->count || memcmp(a->array_items, array->array_items, a->count*sizeof *a->array_items) == 0){
+            if(a->count == array->count && a->packed == array->packed){
+                if(!a->count || memcmp(a->array_items, array->array_items, a->count*drj_array_item_size(a)) == 0){
                     if(consume) drj_free_array(ctx, array);
                     return (DrJsonValue){.kind=DRJSON_ARRAY, .array_idx=a_idx};
                 }
@@ -4198,23 +8184,14 @@ drj_dupe_object_ronly(DrJsonContext* ctx, DrJsonValue src_val){
         .count = cap,
         .capacity = cap,
         .object_items = items,
-        .marked = 0,
+        .marked = dst->marked, // by alloc_obj
         .read_only = 1,
     };
-    uint32_t* idxes = (uint32_t*)((char*)items + sizeof(DrJsonObjectPair)*cap);
-    drj_memcpy(items, src->object_items, cap*sizeof(DrJsonObjectPair));
-    drj_memset(idxes, 0xff, cap*2*sizeof *idxes);
-    DrJsonObjectPair* pairs = items;
-    for(size_t i = 0; i < cap; i++){
-        DrjAtomStr str = drj_get_atom_str(&ctx->atoms, pairs[i].atom);
-        uint32_t hash = str.hash;
-        uint32_t idx = fast_reduce32(hash, cap*2);
-        while(idxes[idx] != UINT32_MAX){
-            idx++;
-            if(idx == cap*2) idx = 0;
-        }
-        idxes[idx] = i;
-    }
+    DrJsonHashIndex* idxes; DrJsonObjectPair* pairs;
+    drj_get_obj_ptrs(items, cap, &idxes, &pairs);
+    drj_memcpy(pairs, src->object_items, cap*sizeof(DrJsonObjectPair));
+    if(drj_obj_has_index(cap))
+        drj_obj_rebuild_index(idxes, pairs, cap, cap);
     return (DrJsonValue){.kind = DRJSON_OBJECT, .object_idx=new_idx};
 }
 
@@ -4225,6 +8202,10 @@ drj_intern_object(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
     DrJsonObject* odata = ctx->objects.data;
     DrJsonObject* object = &odata[val.object_idx];
     if(object->read_only) return val;
+    // Interned objects are hashed and compared as DrJsonObjectPairs.
+    if(object->shaped && drj_obj_unshare(ctx, object))
+        return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom when interning object");
+    if(drj_obj_tombstone_count(object)) drj_obj_compact(object);
     size_t count = object->count;
     DrJsonObjectPair* pairs = object->object_items;
     for(size_t i = 0; i < count; i++){
@@ -4286,7 +8267,7 @@ drj_intern_object(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
             uint32_t o_idx = hi[i].idx;
             DrJsonObject* o = &ctx->objects.data[o_idx];
             if(o->count == object->count){
-                if(memcmp(o->object_items, object->object_items, o->count*sizeof(DrJsonObjectPair)) == 0){
+                if(!o->count || memcmp(o->object_items, object->object_items, o->count*sizeof(DrJsonObjectPair)) == 0){
                     if(consume) drj_free_obj(ctx, object);
                     return (DrJsonValue){.kind=DRJSON_OBJECT, .object_idx=o_idx};
                 }
@@ -4340,6 +8321,7 @@ drjson_intern_value(DrJsonContext* ctx, DrJsonValue val, _Bool consume){
 #ifdef DRJ_HAVE_SIMD
 #undef DRJ_HAVE_SIMD
 #undef DRJ_SIMD_WIDTH
+#undef DRJ_BLOCK_SIZE
 #endif
 
 #ifdef __clang__
@@ -114,6 +114,15 @@ DRJSON_API
 void
 drjson_ctx_free_all(DrJsonContext* ctx);
 
+// Drops every value and atom (other than the ones made by drjson_create_ctx)
+// and closes the files, but keeps the tables, their indexes and the string
+// storage, to be filled again. A context reused this way for similar work,
+// such as one request after another, stops allocating anything but the
+// objects' and arrays' items.
+DRJSON_API
+void
+drjson_ctx_reset(DrJsonContext* ctx);
+
 //------------------------------------------------------------
 
 
@@ -132,6 +141,7 @@ enum DrJsonErrorCode {
     DRJSON_ERROR_TYPE_ERROR     = 8,
     DRJSON_ERROR_INVALID_ERROR  = 9,
     DRJSON_ERROR_TRAILING_CONTENT = 10,
+    DRJSON_ERROR_IO             = 11,
 };
 
 typedef enum DrJsonErrorCode DrJsonErrorCode;
@@ -202,6 +212,7 @@ enum DrJsonKind {
     DRJSON_OBJECT_KEYS   = 0xa,
     DRJSON_OBJECT_VALUES = 0xb,
     DRJSON_OBJECT_ITEMS  = 0xc,
+    DRJSON_LAZY_NUMBER   = 0xd, // unconverted number text, see DRJSON_PARSE_FLAG_LAZY_NUMBERS
 };
 typedef enum DrJsonKind DrJsonKind;
 
@@ -225,6 +236,11 @@ struct DrJsonValue {
             uint16_t error_code;
             uint32_t err_len;
         };
+        struct {
+            uint16_t _lkind;
+            uint16_t _lowned; // number_text is in the context's string chunks
+            uint32_t number_len;
+        };
     };
     union {
         // DRJSON_NUMBER
@@ -239,6 +255,9 @@ struct DrJsonValue {
         // DRJSON_STRING
         DrJsonAtom atom;
 
+        // DRJSON_LAZY_NUMBER
+        const char* number_text; // number_len bytes, not nul terminated.
+
         // DRJSON_ERROR
         const char* err_mess; // pointer to a c-string literal, nul terminated.
                               // Length is also given.  Be aware of shared
@@ -271,13 +290,24 @@ _Static_assert(sizeof(DrJsonValue) == 2*sizeof(void*), "");
 static inline
 int
 drjson_is_numeric(DrJsonValue v){
-    return v.kind == DRJSON_NUMBER || v.kind == DRJSON_INTEGER || v.kind == DRJSON_UINTEGER;
+    return v.kind == DRJSON_NUMBER || v.kind == DRJSON_INTEGER || v.kind == DRJSON_UINTEGER || v.kind == DRJSON_LAZY_NUMBER;
 }
 
+// Converts a DRJSON_LAZY_NUMBER to the DRJSON_NUMBER, DRJSON_INTEGER or
+// DRJSON_UINTEGER it would have been parsed as without
+// DRJSON_PARSE_FLAG_LAZY_NUMBERS. Other values are returned unchanged, so
+// call this before reading .number, .integer or .uinteger of values
+// parsed with that flag.
+DRJSON_API
+DrJsonValue
+drjson_resolve_number(DrJsonValue v);
+
 // shallow equality (although it does compare strings)
 static inline
 int
 drjson_eq(DrJsonValue a, DrJsonValue b){
+    if(a.kind == DRJSON_LAZY_NUMBER) a = drjson_resolve_number(a);
+    if(b.kind == DRJSON_LAZY_NUMBER) b = drjson_resolve_number(b);
     if((a.kind == DRJSON_INTEGER  || a.kind == DRJSON_UINTEGER) && (b.kind == DRJSON_INTEGER || b.kind == DRJSON_UINTEGER)){
         return a.uinteger == b.uinteger;
     }
@@ -452,6 +482,10 @@ drjson_object_items(DrJsonValue o){
 //
 
 typedef struct DrJsonParseContext DrJsonParseContext;
+// Nesting deeper than this is an error unless the parse is told otherwise.
+// Printing and gc recurse, so raise it with care.
+#define DRJSON_DEFAULT_MAX_DEPTH 100
+
 struct DrJsonParseContext {
     const char* cursor; // initialize to string
     const char* end; // initialize to string + length
@@ -460,6 +494,10 @@ struct DrJsonParseContext {
     DrJsonContext* ctx; //
     _Bool _copy_strings;
     _Bool _read_only_objects;
+    _Bool _lazy_numbers;
+    // Deepest nesting allowed. 0 (the default when zero-initialized) means
+    // DRJSON_DEFAULT_MAX_DEPTH.
+    int max_depth;
 };
 
 enum {
@@ -469,6 +507,20 @@ enum {
     DRJSON_PARSE_FLAG_INTERN_OBJECTS = 0x4,
     DRJSON_PARSE_FLAG_ERROR_ON_TRAILING = 0x8,
     DRJSON_PARSE_FLAG_NDJSON = 0x10, // Parse newline-delimited JSON (multiple top-level values into array)
+    // Only accept RFC 8259 JSON: no comments, bare or single quoted
+    // strings, colors or hex, and ',' and ':' are required where json puts
+    // them. Faster than the default liberal syntax. With
+    // DRJSON_PARSE_FLAG_BRACELESS_OBJECT, the document is the members of
+    // an object.
+    DRJSON_PARSE_FLAG_STRICT = 0x20,
+    // Numbers that would need converting (fractions, exponents, very long
+    // integers) are kept as DRJSON_LAZY_NUMBER: the source text, converted
+    // by drjson_resolve_number when asked and printed back byte for byte.
+    // Plain integers are still converted while scanning, as that is as
+    // cheap as finding their end, and so are numbers not spelled as json
+    // allows (leading '+' or zeros). The text is copied unless
+    // DRJSON_PARSE_FLAG_NO_COPY_STRINGS is given.
+    DRJSON_PARSE_FLAG_LAZY_NUMBERS = 0x40,
 };
 
 DRJSON_API
@@ -485,6 +537,93 @@ DRJSON_API
 DrJsonValue
 drjson_parse_string(DrJsonContext* ctx, const char* text, size_t length, unsigned flags);
 
+// Checks that text would parse with drjson_parse (at the default max
+// depth) without building anything: no context, allocations or atoms.
+// Returns DRJSON_ERROR_NONE, or the error drjson_parse would have
+// returned, with its line and column.
+DRJSON_API
+DrJsonErrorCode
+drjson_validate(const char* text, size_t length, unsigned flags, size_t*_Nullable line, size_t*_Nullable column);
+
+#ifndef DRJSON_NO_IO
+// Maps the file at path into memory that lives as long as the ctx (or
+// until drjson_ctx_unmap_file), so strings parsed out of it with
+// DRJSON_PARSE_FLAG_NO_COPY_STRINGS can point straight into it. Files that
+// can't be mapped (pipes, ttys) are read into memory from the ctx's
+// allocator instead. The file must not be truncated while mapped.
+// Returns 0 on success, nonzero on failure with errno set.
+DRJSON_API
+int
+drjson_ctx_map_file(DrJsonContext* ctx, const char* path, const char*_Nullable*_Nonnull text, size_t* length);
+
+// Releases a file mapped by drjson_ctx_map_file (text is what it returned)
+// before the ctx is freed, for long lived contexts that load many files.
+// Atoms and the text of lazy numbers in the ctx's arrays and objects that
+// point into the file are copied into the ctx first. Anything else that
+// points into it (lazy numbers held outside the ctx, strings gotten from
+// atoms before) is left dangling.
+// Returns 0 on success, nonzero if text isn't a mapped file of the ctx or
+// copying failed, in which case the file stays mapped.
+DRJSON_API
+int
+drjson_ctx_unmap_file(DrJsonContext* ctx, const char* text);
+
+// Parses the file at path, mapped as with drjson_ctx_map_file. Strings are
+// never copied (DRJSON_PARSE_FLAG_NO_COPY_STRINGS is implied).
+// If the file can't be read, returns a DRJSON_ERROR_IO error with errno
+// set. For parse errors, line and column (if given) are set to where it
+// happened, and the file is unmapped again.
+DRJSON_API
+DrJsonValue
+drjson_parse_file(DrJsonContext* ctx, const char* path, unsigned flags, size_t*_Nullable line, size_t*_Nullable column);
+#endif
+
+//
+// Push parsing.
+//
+// For input that arrives in pieces (sockets, pipes), feed it to a push
+// parser as it is read instead of buffering the whole document. Partial
+// state is kept between calls. Strings are always copied into the context
+// (DRJSON_PARSE_FLAG_NO_COPY_STRINGS is ignored) so chunks can be reused
+// as soon as drjson_parse_feed returns; only a token that straddles a
+// chunk boundary is buffered by the parser.
+//
+// The result is the same as parsing the concatenation of the chunks with
+// drjson_parse.
+//
+typedef struct DrJsonPushParser DrJsonPushParser;
+
+DRJSON_API
+DRJSON_WARN_UNUSED
+DrJsonPushParser*_Nullable
+drjson_push_parser_create(DrJsonContext* ctx, unsigned flags);
+
+// Defaults to DRJSON_DEFAULT_MAX_DEPTH.
+DRJSON_API
+void
+drjson_push_parser_set_max_depth(DrJsonPushParser* parser, int max_depth);
+
+// Frees the parser, but not anything it parsed.
+DRJSON_API
+void
+drjson_push_parser_free(DrJsonPushParser* parser);
+
+DRJSON_API
+int // 0 on success, 1 if the document has an error (see drjson_parse_finish)
+drjson_parse_feed(DrJsonPushParser* parser, const char* chunk, size_t length);
+
+// Signals the end of the input and returns the parsed document or the
+// error. Further calls return the same value.
+DRJSON_API
+DrJsonValue
+drjson_parse_finish(DrJsonPushParser* parser);
+
+// Position of the error (if there was one), otherwise of the end of the
+// input fed so far.
+DRJSON_API
+void
+drjson_push_parser_get_line_column(const DrJsonPushParser* parser, size_t* line, size_t* column);
+
 //------------------------------------------------------------
 
 ///////////////////////
@@ -608,6 +747,25 @@ DRJSON_API
 int // 0 on success, 1 on error
 drjson_array_move_item(const DrJsonContext* ctx, DrJsonValue array, size_t from_idx, size_t to_idx);
 
+// Arrays parsed with every item the same kind of number are stored as just
+// the numbers. These return them without copying, or NULL if the array isn't
+// stored that way (or isn't an array). The pointer is good until the array
+// is next changed.
+// Integers parse as DRJSON_UINTEGER unless they're negative, so an array
+// of them with any negatives is drjson_array_integers, otherwise it is
+// drjson_array_uintegers.
+DRJSON_API
+const double*_Nullable
+drjson_array_numbers(const DrJsonContext* ctx, DrJsonValue array, size_t* count);
+
+DRJSON_API
+const int64_t*_Nullable
+drjson_array_integers(const DrJsonContext* ctx, DrJsonValue array, size_t* count);
+
+DRJSON_API
+const uint64_t*_Nullable
+drjson_array_uintegers(const DrJsonContext* ctx, DrJsonValue array, size_t* count);
+
 static inline
 int64_t
 drjson_array_len(const DrJsonContext* ctx, DrJsonValue v){
@@ -676,6 +834,27 @@ DRJSON_WARN_UNUSED
 int
 drjson_path_parse_greedy(const DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path, const char* _Nullable * _Nonnull remainder);
 
+// Like drjson_path_parse, but keys that aren't in the ctx yet are
+// atomized, so the path can be made before the document is parsed (see
+// drjson_parse_projected).
+DRJSON_API
+DRJSON_WARN_UNUSED
+int // 0 on success
+drjson_path_parse_intern(DrJsonContext* ctx, const char* path_str, size_t path_len, DrJsonPath* path);
+
+// Parses only what it takes to evaluate the paths. Values a path ends at
+// are parsed whole, containers on the way only get the members or items
+// on a path, and everything else is skipped without being built. Each
+// path evaluates to the same value on the result as on a full parse.
+// Array items before a wanted index are null and later ones are left out.
+//
+// Skipped text is only checked for balanced brackets and quotes, even
+// with DRJSON_PARSE_FLAG_STRICT. Path keys must already be atoms: make
+// the paths with drjson_path_parse_intern or drjson_atomize.
+DRJSON_API
+DrJsonValue
+drjson_parse_projected(DrJsonParseContext* ctx, unsigned flags, const DrJsonPath* paths, size_t npaths);
+
 
 //------------------------------------------------------------
 
@@ -852,12 +1031,95 @@ drjson_normalize_and_atomize(DrJsonContext* ctx, const char* restrict input, siz
 
 //
 // Implements mark+sweep gc for objects and arrays in the ctx.
-// Note that strings are not gc'd.
+// Note that strings are not gc'd (see drjson_gc_atoms).
 //
 DRJSON_API
 int
 drjson_gc(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount);
 
+//
+// Does about `budget` units of work (values scanned or table slots swept)
+// of an incremental collection, so a big context can be collected in small
+// slices between other work. Returns 1 when a collection has finished, 0
+// if it needs more steps.
+//
+// Values may be changed between steps through the drjson_object_* and
+// drjson_array_* functions, but everything that has to survive must be
+// reachable from the roots given to each step. Containers made while a
+// collection is running survive it, and each one adds a few units to the
+// next step's budget so the marking keeps up with the allocating. A single
+// object or array is scanned in one go, so a step can go over budget by the
+// largest container's length.
+// Calling drjson_gc finishes a running collection first.
+//
+DRJSON_API
+int
+drjson_gc_step(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount, size_t budget);
+
+//
+// Collects like drjson_gc, but marks and sweeps with `nthreads` threads
+// (the calling one included). Each marker has a stack of containers to
+// scan and lets the others steal from it when they run out; the mark bits
+// are kept on the side and set atomically. Each thread then sweeps its own
+// range of the tables.
+//
+// The context's allocator is called from all of the threads at once, so it
+// has to be thread safe, as malloc is. With 1 thread, or where threads
+// aren't available, this is drjson_gc.
+//
+DRJSON_API
+int
+drjson_gc_parallel(DrJsonContext* ctx, const DrJsonValue*_Null_unspecified roots, size_t rootcount, size_t nthreads);
+
+// Where drjson_gc_compact moved things. Indexed by the old object_idx or
+// array_idx, SIZE_MAX for what was collected.
+typedef struct DrJsonRemap DrJsonRemap;
+struct DrJsonRemap {
+    size_t*_Nullable objects;
+    size_t object_count;
+    size_t*_Nullable arrays;
+    size_t array_count;
+};
+
+//
+// Collects like drjson_gc, then slides the live objects and arrays to the
+// front of their tables and shrinks them. Indices inside the context and
+// in `roots` are rewritten; any other handles can be fixed with the remap
+// if one is asked for (free it with drjson_remap_free). Interned objects
+// and arrays stay interned.
+//
+// Returns 1 if there wasn't the memory to compact, in which case it was
+// only a collection and there is no remap.
+//
+DRJSON_API
+int
+drjson_gc_compact(DrJsonContext* ctx, DrJsonValue*_Null_unspecified roots, size_t rootcount, DrJsonRemap*_Nullable remap);
+
+// Returns where v is after the compaction, or an error if it was
+// collected. Values that aren't objects or arrays are returned as is.
+DRJSON_API
+DrJsonValue
+drjson_remap_value(const DrJsonRemap* remap, DrJsonValue v);
+
+DRJSON_API
+void
+drjson_remap_free(const DrJsonContext* ctx, DrJsonRemap* remap);
+
+//
+// Collects like drjson_gc, then also the atoms that no live key or string
+// value uses, and frees their copied strings. The atoms left are
+// renumbered and their strings (and the text of lazy numbers) moved, which
+// is rewritten inside the context and in `roots`. Any other atoms or
+// values held across this call, such as ones from drjson_atomize, are no
+// longer valid and have to be atomized or looked up again.
+//
+// Returns 1 if there wasn't the memory to collect the atoms, in which case
+// it was only a collection.
+//
+DRJSON_API
+int
+drjson_gc_atoms(DrJsonContext* ctx, DrJsonValue*_Null_unspecified roots, size_t rootcount);
+
 
 
 #ifdef __clang__
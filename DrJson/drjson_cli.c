@@ -28,87 +28,56 @@
 #endif
 #endif
 
-// Chose to use libc's FILE api instead of OS APIs for portability.
-
-force_inline
-warn_unused
-long long
-file_size_from_fp(FILE* fp){
-    long long result = 0;
-    // sadly, the only way in standard c to do this.
-    if(fseek(fp, 0, SEEK_END))
-        goto errored;
-    result = ftell(fp);
-    if(result < 0)
-        goto errored;
-    if(fseek(fp, 0, SEEK_SET))
-        goto errored;
-    return result;
-
-    errored:
-    return -1;
-}
-
-
-
+// Feeds the parser a buffer at a time, so only tokens that straddle reads
+// are ever copied.
 static inline
 int
-read_file_streamed(FILE* fp, LongString* out){
-    size_t nalloced = 1024;
-    size_t used = 0;
-    char* buff = malloc(nalloced);
+parse_file_streamed(DrJsonContext* jctx, FILE* fp, unsigned flags, DrJsonValue* out, size_t* line, size_t* column){
+    DrJsonPushParser* p = drjson_push_parser_create(jctx, flags);
+    if(!p) return -1;
+    enum {BUFF_SIZE=64*1024};
+    char* buff = malloc(BUFF_SIZE);
+    if(!buff){
+        drjson_push_parser_free(p);
+        return -1;
+    }
+    int status = 0;
     for(;;){
-        size_t remainder = nalloced - used;
-        size_t nread = fread(buff+used, 1, remainder, fp);
-        if(nread == remainder){
-            nalloced *= 2;
-            char* newbuff = realloc(buff, nalloced);
-            if(!newbuff){
-                free(buff);
-                return -1;
-            }
-            buff = newbuff;
-        }
-        used += nread;
-        if(nread != remainder){
-            if(feof(fp)) break;
-            else{
-                free(buff);
-                return -1;
-            }
+        size_t nread = fread(buff, 1, BUFF_SIZE, fp);
+        if(drjson_parse_feed(p, buff, nread))
+            break;
+        if(nread != BUFF_SIZE){
+            if(!feof(fp))
+                status = -1;
+            break;
         }
     }
-    buff = realloc(buff, used+1);
-    buff[used] = 0;
-    *out = (LongString){used, buff};
-    return 0;
+    free(buff);
+    if(status == 0){
+        *out = drjson_parse_finish(p);
+        drjson_push_parser_get_line_column(p, line, column);
+    }
+    drjson_push_parser_free(p);
+    return status;
 }
 
+// Stacked queries apply one after another, so together they are a single
+// path into the document. Returns 0 if they aren't (yet) valid paths.
 static inline
-int
-read_file(const char* filepath, LongString* out){
-    int status = -1;
-    FILE* fp = fopen(filepath, "rb");
-    if(!fp) return -1;
-    long long size = file_size_from_fp(fp);
-    if(size <= 0){
-        status = read_file_streamed(fp, out);
-        goto finally;
-    }
-    size_t nbytes = size;
-    char* text = malloc(nbytes+1);
-    if(!text) goto finally;
-    size_t fread_result = fread(text, 1, nbytes, fp);
-    if(fread_result != nbytes){
-        free(text);
-        goto finally;
+_Bool
+queries_to_path(DrJsonContext* jctx, const LongString* queries, int nqueries, DrJsonPath* path){
+    path->count = 0;
+    for(int i = 0; i < nqueries; i++){
+        DrJsonPath p;
+        if(drjson_path_parse_intern(jctx, queries[i].text, queries[i].length, &p))
+            return 0;
+        for(size_t s = 0; s < p.count; s++){
+            if(path->count == DRJSON_PATH_MAX_DEPTH)
+                return 0;
+            path->segments[path->count++] = p.segments[s];
+        }
     }
-    text[nbytes] = '\0';
-    *out = (LongString){nbytes, text};
-    status = 0;
-finally:
-    fclose(fp);
-    return status;
+    return 1;
 }
 
 static GiTabCompletionFunc drj_completer;
@@ -140,6 +109,7 @@ main(int argc, const char* const* argv){
     _Bool pretty = 0;
     _Bool interactive = 0;
     _Bool intern = 0;
+    _Bool verbatim_numbers = 0;
     _Bool gc = 0;
     int indent = 0;
     ArgToParse kw_args[] = {
@@ -167,6 +137,11 @@ main(int argc, const char* const* argv){
             .dest = ARGDEST(&ndjson),
             .help = "Parse newline-delimited JSON (multiple top-level values into an array)",
         },
+        {
+            .name = SV("--verbatim-numbers"),
+            .dest = ARGDEST(&verbatim_numbers),
+            .help = "Print numbers exactly as they were written instead of converting them",
+        },
         {
             .name = SV("-p"),
             .altname1 = SV("--pretty"),
@@ -261,40 +236,54 @@ main(int argc, const char* const* argv){
         indent = 80;
     if(indent)
         pretty = 1;
-    LongString jsonstr = {0};
-    int read_status = -1;
+    DrJsonAllocator allocator = drjson_stdc_allocator();
+    DrJsonContext* jctx = drjson_create_ctx(allocator);
+    unsigned flags = DRJSON_PARSE_FLAG_NONE;
+    if(braceless) flags |= DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
+    if(ndjson) flags |= DRJSON_PARSE_FLAG_NDJSON;
+    if(intern) flags |= DRJSON_PARSE_FLAG_INTERN_OBJECTS;
+    if(verbatim_numbers) flags |= DRJSON_PARSE_FLAG_LAZY_NUMBERS;
+    DrJsonValue document;
+    size_t l = 0, c = 0;
     if(jsonpath.length){
-        read_status = read_file(jsonpath.text, &jsonstr);
-        if(read_status != 0){
-            fprintf(stderr, "Unable to read data from '%s': %s\n", jsonpath.text, strerror(errno));
-            return 1;
+        // Only what the queries will look at needs to be built.
+        DrJsonPath projection;
+        int nqueries = kw_args[QUERY_KWARG].num_parsed;
+        if(nqueries && !interactive && queries_to_path(jctx, queries, nqueries, &projection)){
+            const char* text;
+            size_t length;
+            if(drjson_ctx_map_file(jctx, jsonpath.text, &text, &length) != 0){
+                fprintf(stderr, "Unable to read data from '%s': %s\n", jsonpath.text, strerror(errno));
+                return 1;
+            }
+            DrJsonParseContext ctx = {
+                .ctx = jctx,
+                .begin = text,
+                .cursor = text,
+                .end = text+length,
+                .depth = 0,
+            };
+            document = drjson_parse_projected(&ctx, flags | DRJSON_PARSE_FLAG_NO_COPY_STRINGS, &projection, 1);
+            if(document.kind == DRJSON_ERROR)
+                drjson_get_line_column(&ctx, &l, &c);
+        }
+        else {
+            document = drjson_parse_file(jctx, jsonpath.text, flags, &l, &c);
+            if(document.kind == DRJSON_ERROR && document.error_code == DRJSON_ERROR_IO){
+                fprintf(stderr, "Unable to read data from '%s': %s\n", jsonpath.text, strerror(errno));
+                return 1;
+            }
         }
     }
     else {
-        read_status = read_file_streamed(stdin, &jsonstr);
+        // Parse as it arrives instead of buffering all of stdin.
+        int read_status = parse_file_streamed(jctx, stdin, flags, &document, &l, &c);
         if(read_status != 0){
             fprintf(stderr, "Unable to read data from stdin: %s\n", strerror(errno));
             return 1;
         }
     }
-    DrJsonAllocator allocator = drjson_stdc_allocator();
-    DrJsonContext* jctx = drjson_create_ctx(allocator);
-    DrJsonParseContext ctx = {
-        .ctx = jctx,
-        .begin = jsonstr.text,
-        .cursor = jsonstr.text,
-        .end = jsonstr.text+jsonstr.length,
-        .depth = 0,
-    };
-    unsigned flags = DRJSON_PARSE_FLAG_NONE;
-    if(braceless) flags |= DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
-    if(ndjson) flags |= DRJSON_PARSE_FLAG_NDJSON;
-    if(intern) flags |= DRJSON_PARSE_FLAG_INTERN_OBJECTS;
-    flags |= DRJSON_PARSE_FLAG_NO_COPY_STRINGS;
-    DrJsonValue document = drjson_parse(&ctx, flags);
     if(document.kind == DRJSON_ERROR){
-        size_t l, c;
-        drjson_get_line_column(&ctx, &l, &c);
         drjson_print_error_fp(stderr,  jsonpath.text, jsonpath.length, l, c, document);
         return 1;
     }
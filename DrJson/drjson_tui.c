@@ -209,6 +209,7 @@ struct JsonNav {
     DrJsonContext* jctx;      // DrJson context
     DrJsonValue root;         // Root document value
     char filename[1024];       // Name of file being viewed
+    const char*_Nullable file_text; // Mapping root was parsed from, released when another file is loaded
     DrJsonAllocator allocator; // Allocator for nav's dynamic memory
 
     // Flattened view (rebuilt when expansion state changes)
@@ -2586,35 +2587,54 @@ enum {
     CMD_QUICK_QUIT = 2,
 };
 
+// Like drjson_parse_file, but hands back the mapping in *text so it can be
+// released with drjson_ctx_unmap_file once another file replaces it. On a
+// parse error the mapping is released here.
+static
+DrJsonValue
+parse_mapped_file(DrJsonContext* jctx, const char* filepath, unsigned flags, const char*_Nullable*_Nonnull text, size_t* line, size_t* col){
+    *text = NULL;
+    *line = 0;
+    *col = 0;
+    const char* mapped;
+    size_t length;
+    if(drjson_ctx_map_file(jctx, filepath, &mapped, &length) != 0)
+        return drjson_make_error(DRJSON_ERROR_IO, "Unable to read file");
+    DrJsonParseContext pctx = {
+        .ctx = jctx,
+        .begin = mapped,
+        .cursor = mapped,
+        .end = mapped + length,
+    };
+    DrJsonValue result = drjson_parse(&pctx, flags | DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+    if(result.kind == DRJSON_ERROR){
+        drjson_get_line_column(&pctx, line, col);
+        if(length) drjson_ctx_unmap_file(jctx, mapped);
+        return result;
+    }
+    if(length) *text = mapped;
+    return result;
+}
+
 // Command handlers
 
 static
 int
 nav_load_file(JsonNav* nav, const char* filepath, _Bool use_braceless, _Bool use_ndjson){
-    LongString file_content = {0};
-    if(read_file(filepath, &file_content) != 0){
-        nav_set_messagef(nav, "Error: Could not read file '%s'", filepath);
-        return CMD_ERROR;
-    }
-
-    DrJsonParseContext pctx = {
-        .ctx = nav->jctx,
-        .begin = file_content.text,
-        .cursor = file_content.text,
-        .end = file_content.text + file_content.length,
-        .depth = 0,
-    };
     unsigned parse_flags = DRJSON_PARSE_FLAG_ERROR_ON_TRAILING;
     if(globals.intern) parse_flags |= DRJSON_PARSE_FLAG_INTERN_OBJECTS;
     if(use_braceless) parse_flags |= DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
     if(use_ndjson) parse_flags |= DRJSON_PARSE_FLAG_NDJSON;
-    DrJsonValue new_root = drjson_parse(&pctx, parse_flags);
+    size_t line=0, col=0;
+    const char* text;
+    DrJsonValue new_root = parse_mapped_file(nav->jctx, filepath, parse_flags, &text, &line, &col);
+    if(new_root.kind == DRJSON_ERROR && new_root.error_code == DRJSON_ERROR_IO){
+        nav_set_messagef(nav, "Error: Could not read file '%s': %s", filepath, strerror(errno));
+        return CMD_ERROR;
+    }
 
     if(new_root.kind == DRJSON_ERROR){
-        size_t line=0, col=0;
-        drjson_get_line_column(&pctx, &line, &col);
         nav_set_messagef(nav, "Error parsing '%s': %s at line %zu col %zu", filepath, new_root.err_mess, line, col);
-        free((void*)file_content.text);
 
         // Keep jump list roots alive during GC
         DrJsonValue* gc_roots = nav->allocator.alloc(nav->allocator.user_pointer, (nav->jump_list.count + 1) * sizeof(DrJsonValue));
@@ -2632,8 +2652,6 @@ nav_load_file(JsonNav* nav, const char* filepath, _Bool use_braceless, _Bool use
         return CMD_ERROR;
     }
 
-    free((void*)file_content.text); // done with this now
-
     // Clear jump list since we're loading a new file
     nav->jump_list.count = 0;
     nav->jump_list.current = 0;
@@ -2643,6 +2661,10 @@ nav_load_file(JsonNav* nav, const char* filepath, _Bool use_braceless, _Bool use
     nav->was_opened_with_ndjson = use_ndjson;
     nav_reinit(nav);
     drjson_gc(nav->jctx, &nav->root, 1);
+    // Anything from the old file that is still used gets copied first.
+    if(nav->file_text)
+        drjson_ctx_unmap_file(nav->jctx, nav->file_text);
+    nav->file_text = text;
 
     return CMD_OK;
 }
@@ -4130,6 +4152,11 @@ cmd_sort(JsonNav* nav, CmdArgs* args){
         }
 
         DrJsonArray* arr = &nav->jctx->arrays.data[val.array_idx];
+        // Sorted in place as DrJsonValues.
+        if(arr->packed && drj_array_unpack(nav->jctx, arr)){
+            nav_set_messagef(nav, "Error: Failed to allocate memory for sorting.");
+            return CMD_ERROR;
+        }
 
         if(query_str){
             // --- Sort array by query ---
@@ -7390,32 +7417,25 @@ main(int argc, const char*_Nonnull const*_Nonnull argv){
     #endif
     begin_tui();
     atexit(end_tui);
-    LongString jsonstr = {0};
-    if(read_file(jsonpath.text, &jsonstr) != 0){
-        fprintf(stderr, "Unable to read data from '%s': %s\n", jsonpath.text, strerror(errno));
-        return 1;
-    }
-    DrJsonParseContext ctx = {
-        .ctx = jctx,
-        .begin = jsonstr.text,
-        .cursor = jsonstr.text,
-        .end = jsonstr.text+jsonstr.length,
-        .depth = 0,
-    };
-    unsigned flags = DRJSON_PARSE_FLAG_NO_COPY_STRINGS | DRJSON_PARSE_FLAG_ERROR_ON_TRAILING;
+    unsigned flags = DRJSON_PARSE_FLAG_ERROR_ON_TRAILING;
     if(braceless) flags |= DRJSON_PARSE_FLAG_BRACELESS_OBJECT;
     if(ndjson) flags |= DRJSON_PARSE_FLAG_NDJSON;
     if(globals.intern) flags |= DRJSON_PARSE_FLAG_INTERN_OBJECTS;
-    DrJsonValue document = drjson_parse(&ctx, flags);
+    size_t l, c;
+    const char* document_text;
+    DrJsonValue document = parse_mapped_file(jctx, jsonpath.text, flags, &document_text, &l, &c);
+    if(document.kind == DRJSON_ERROR && document.error_code == DRJSON_ERROR_IO){
+        fprintf(stderr, "Unable to read data from '%s': %s\n", jsonpath.text, strerror(errno));
+        return 1;
+    }
     if(document.kind == DRJSON_ERROR){
-        size_t l, c;
-        drjson_get_line_column(&ctx, &l, &c);
         drjson_print_error_fp(stderr,  jsonpath.text, jsonpath.length, l, c, document);
         return 1;
     }
     // Initialize navigation
     JsonNav nav = {0};
     nav_init(&nav, jctx, document, jsonpath.text, allocator);
+    nav.file_text = document_text;
     nav.was_opened_with_braceless = braceless;  // Track initial file's braceless state
     nav.was_opened_with_ndjson = ndjson;  // Track initial file's ndjson state
 
@@ -424,8 +424,9 @@ DrjPyCtx_mem(PyObject* s){
     Py_ssize_t obj_slop = 0;
     for(size_t i = 0; i < self->ctx.objects.count; i++){
         DrJsonObject* object = &odata[i];
-        objects += drjson_size_for_object_of_length(object->capacity);
-        obj_slop += drjson_size_for_object_of_length(object->capacity) - drjson_size_for_object_of_length(object->count);
+        objects += drj_obj_items_size(object);
+        if(!object->shaped)
+            obj_slop += drjson_size_for_object_of_length(object->capacity) - drjson_size_for_object_of_length(object->count);
     }
     Py_ssize_t array_array = sizeof(DrJsonArray)*self->ctx.arrays.capacity;
     Py_ssize_t arrays = 0;
@@ -433,8 +434,8 @@ DrjPyCtx_mem(PyObject* s){
     DrJsonArray* adata = self->ctx.arrays.data;
     for(size_t i = 0; i < self->ctx.arrays.count; i++){
         DrJsonArray* array = &adata[i];
-        arrays += array->capacity * sizeof *array->array_items;
-        arr_slop += (array->capacity * sizeof *array->array_items) - (array->count * sizeof *array->array_items);
+        arrays += array->capacity * drj_array_item_size(array);
+        arr_slop += (array->capacity - array->count) * drj_array_item_size(array);
     }
     Py_ssize_t usage = atom_size + object_array + objects + array_array + arrays;
     return Py_BuildValue("nnnnnnnn", usage, object_array, objects, obj_slop, array_array, arrays, arr_slop, atom_size);
@@ -1009,12 +1010,12 @@ DrjVal_mem(PyObject* s){
         case DRJSON_ARRAY:{
             const DrJsonArray* adata = self->ctx->ctx.arrays.data;
             const DrJsonArray* array = &adata[self->value.array_idx];
-            usage = array->capacity * sizeof *array->array_items;
+            usage = array->capacity * drj_array_item_size(array);
         }break;
         case DRJSON_OBJECT:{
             DrJsonObject* odata = self->ctx->ctx.objects.data;
             DrJsonObject* object = &odata[self->value.object_idx];
-            usage = drjson_size_for_object_of_length(object->capacity);
+            usage = drj_obj_items_size(object);
         }break;
     }
     return PyLong_FromSsize_t(usage);
@@ -10,7 +10,9 @@
 #endif
 typedef struct Allocation Allocation;
 struct Allocation {
-    const void* ptr;
+    // Kept as an integer as it is only hashed and compared. As a pointer,
+    // gcc assumes the new allocation's bytes are read when it is passed in.
+    uintptr_t addr;
     size_t sz;
     _Bool freed;
     BacktraceArray* alloc_trace;
@@ -42,16 +44,16 @@ static TestAllocator test_allocator;
 
 static inline
 uint32_t
-hash_ptr(const void* ptr){
-    uintptr_t data[1] = {(uintptr_t)ptr};
+hash_addr(uintptr_t addr){
+    uintptr_t data[1] = {addr};
     uint32_t hash = hash_align8(data, sizeof data);
     return hash;
 }
 
 static
 Allocation*
-test_getsert(TestAllocator* ta, const void* ptr){
-    uint32_t hash = hash_ptr(ptr);
+test_getsert(TestAllocator* ta, uintptr_t addr){
+    uint32_t hash = hash_addr(addr);
     uint32_t idx = fast_reduce32(hash, TEST_ALLOCATOR_CAP*2);
     for(;;){
         uint32_t i = ta->idxes[idx];
@@ -60,12 +62,12 @@ test_getsert(TestAllocator* ta, const void* ptr){
             Allocation* a = &ta->allocations[ta->cursor++];
             ta->idxes[idx] = (uint32_t)ta->cursor; // index of slot +1
             *a = (Allocation){
-                .ptr = ptr,
+                .addr = addr,
             };
             return a;
         }
         Allocation* a = &ta->allocations[i-1];
-        if(a->ptr == ptr){
+        if(a->addr == addr){
             return a;
         }
         idx++;
@@ -75,8 +77,8 @@ test_getsert(TestAllocator* ta, const void* ptr){
 
 static
 Allocation*_Nullable
-test_get(TestAllocator* ta, const void* ptr){
-    uint32_t hash = hash_ptr(ptr);
+test_get(TestAllocator* ta, uintptr_t addr){
+    uint32_t hash = hash_addr(addr);
     uint32_t idx = fast_reduce32(hash, TEST_ALLOCATOR_CAP*2);
     for(;;){
         uint32_t i = ta->idxes[idx];
@@ -84,7 +86,7 @@ test_get(TestAllocator* ta, const void* ptr){
             return NULL;
         }
         Allocation* a = &ta->allocations[i-1];
-        if(a->ptr == ptr){
+        if(a->addr == addr){
             return a;
         }
         idx++;
@@ -99,7 +101,7 @@ test_alloc(void* up, size_t size){
     void* p = malloc(size);
     if(!p) return NULL;
     assert(ta->cursor < 256*256*2);
-    Allocation* a = test_getsert(ta, p);
+    Allocation* a = test_getsert(ta, (uintptr_t)p);
     a->sz = size;
     if(a->free_trace) free_bt(a->free_trace);
     a->free_trace = NULL;
@@ -113,7 +115,7 @@ void
 record_free(void* up, const void*_Null_unspecified ptr, size_t size){
     if(!ptr) return;
     TestAllocator* ta = up;
-    Allocation* a = test_get(ta, ptr);
+    Allocation* a = test_get(ta, (uintptr_t)ptr);
     if(!a){
         bt();
         assert(!"freeing wild pointer");
@@ -164,7 +166,7 @@ test_realloc(void* up, void*_Nullable ptr, size_t old_sz, size_t new_sz){
         drj_memcpy(p, ptr, new_sz);
     free(ptr);
 
-    Allocation* a = test_getsert(ta, p);
+    Allocation* a = test_getsert(ta, (uintptr_t)p);
     a->sz = new_sz;
     assert(!a->freed);
     return p;
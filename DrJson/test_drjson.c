@@ -18,6 +18,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#else
+#include <windows.h>
 #endif
 
 #ifdef __clang__
@@ -50,6 +53,30 @@ static TestFunc TestArrayMove;
 static TestFunc TestObjectMove;
 static TestFunc TestNDJSON;
 static TestFunc TestNDJSONRoundTrip;
+static TestFunc TestBlockBoundaries;
+static TestFunc TestPushParser;
+static TestFunc TestMaxDepth;
+static TestFunc TestStrict;
+static TestFunc TestStringEscapes;
+static TestFunc TestNumbers;
+static TestFunc TestParsedContainers;
+static TestFunc TestProjection;
+static TestFunc TestValidate;
+static TestFunc TestParseFile;
+static TestFunc TestCopiedAtoms;
+static TestFunc TestAtomTableGrowth;
+static TestFunc TestSmallObjects;
+static TestFunc TestShapes;
+static TestFunc TestObjectTombstones;
+static TestFunc TestShortAtoms;
+static TestFunc TestPackedArrays;
+static TestFunc TestLazyNumbers;
+static TestFunc TestIncrementalGC;
+static TestFunc TestCompactingGC;
+static TestFunc TestAtomGC;
+static TestFunc TestParallelGC;
+static TestFunc TestCtxReset;
+static TestFunc TestAtomGroupProbing;
 
 int main(int argc, char*_Nullable*_Nonnull argv){
     RegisterTest(TestSimpleParsing);
@@ -79,6 +106,30 @@ int main(int argc, char*_Nullable*_Nonnull argv){
     RegisterTest(TestObjectMove);
     RegisterTest(TestNDJSON);
     RegisterTest(TestNDJSONRoundTrip);
+    RegisterTest(TestBlockBoundaries);
+    RegisterTest(TestPushParser);
+    RegisterTest(TestMaxDepth);
+    RegisterTest(TestStrict);
+    RegisterTest(TestStringEscapes);
+    RegisterTest(TestNumbers);
+    RegisterTest(TestParsedContainers);
+    RegisterTest(TestProjection);
+    RegisterTest(TestValidate);
+    RegisterTest(TestParseFile);
+    RegisterTest(TestCopiedAtoms);
+    RegisterTest(TestAtomTableGrowth);
+    RegisterTest(TestSmallObjects);
+    RegisterTest(TestShapes);
+    RegisterTest(TestObjectTombstones);
+    RegisterTest(TestShortAtoms);
+    RegisterTest(TestPackedArrays);
+    RegisterTest(TestLazyNumbers);
+    RegisterTest(TestIncrementalGC);
+    RegisterTest(TestCompactingGC);
+    RegisterTest(TestAtomGC);
+    RegisterTest(TestParallelGC);
+    RegisterTest(TestCtxReset);
+    RegisterTest(TestAtomGroupProbing);
     return test_main(argc, argv, NULL);
 }
 
@@ -185,6 +236,10 @@ TestFunction(TestIntern){
         TestExpectTrue(drjson_eq(vs[0], vs[5]));
         TestExpectTrue(drjson_eq(vs[2], vs[4]));
         TestExpectFalse(drjson_eq(vs[0], vs[2]));
+        DrJsonValue w = drjson_query(ctx, vs[2], "goodbye", strlen("goodbye"));
+        TestAssertEquals((int)w.kind, DRJSON_STRING);
+        TestExpectTrue(drjson_eq(w, drjson_query(ctx, vs[0], "hello", strlen("hello"))));
+        TestExpectEquals((int)drjson_query(ctx, vs[0], "goodbye", strlen("goodbye")).kind, DRJSON_ERROR);
 
         drjson_gc(ctx, (DrJsonValue[]){vs[0], vs[1]}, 2);
         TestExpectTrue(drjson_eq(vs[0], vs[1]));
@@ -192,6 +247,34 @@ TestFunction(TestIntern){
         drjson_ctx_free_all(ctx);
         assert_all_freed();
     }
+    {
+        // Interning without consuming makes a copy. Enough keys that the
+        // copy's index has collisions.
+        char example[4096];
+        size_t len = 0;
+        for(int i = 0; i < 100; i++)
+            len += (size_t)snprintf(example+len, sizeof example - len, "k%d %d ", i, i);
+        DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+        DrJsonParseContext pctx = {
+            .begin = example,
+            .cursor = example,
+            .end = example + len,
+            .ctx = ctx,
+        };
+        DrJsonValue v = drjson_parse(&pctx, DRJSON_PARSE_FLAG_BRACELESS_OBJECT);
+        TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+        v = drjson_intern_value(ctx, v, 0);
+        TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+        for(int i = 0; i < 100; i++){
+            char key[16];
+            int klen = snprintf(key, sizeof key, "k%d", i);
+            DrJsonValue item = drjson_object_get_item(ctx, v, key, (size_t)klen);
+            TestAssertEquals((int)item.kind, DRJSON_UINTEGER);
+            TestExpectEquals(item.uinteger, (uint64_t)i);
+        }
+        drjson_ctx_free_all(ctx);
+        assert_all_freed();
+    }
     {
         const char* example = "["
             "[{hello world} {hello world} {goodbye world} {hello world} {goodbye world} {hello world}]"
@@ -1731,7 +1814,7 @@ TestFunction(TestPrintToFd){
     drjson_get_line_column(&pctx, &error_line, &error_column);
 
     // Test drjson_print_error_mem first (easier to verify)
-    char mem_buffer[512];
+    char mem_buffer[512] = {0}; // drjson_print_error_mem doesn't nul terminate
     err = drjson_print_error_mem(mem_buffer, sizeof(mem_buffer), "test.json", 9, error_line, error_column, error_val);
     TestAssertFalse(err);
     size_t mem_len = strlen(mem_buffer);
@@ -2394,6 +2477,1092 @@ TestFunction(TestNDJSONRoundTrip){
     TESTEND();
 }
 
+TestFunction(TestBlockBoundaries){
+    TESTBEGIN();
+    // The parser skips whitespace and scans strings a block at a time.
+    // Slide whitespace runs, comments, escapes and the liberal syntax
+    // across block boundaries and check we always get the same document.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    const char* expected_text = "{a: \"x\\\"y\", b: [1, 'two', #fff, 0x10, true], c: null}";
+    DrJsonValue expected = drjson_parse_string(ctx, expected_text, strlen(expected_text), DRJSON_PARSE_FLAG_NONE);
+    TestAssertEquals((int)expected.kind, DRJSON_OBJECT);
+    char buff[4096];
+    for(int pad = 0; pad < 150; pad++){
+        for(int style = 0; style < 4; style++){
+            char space[200];
+            memset(space, style & 1? '\n' : ' ', pad);
+            space[pad] = 0;
+            if(style & 2 && pad > 6){
+                // bury a comment in the whitespace run (bare identifiers
+                // can contain '/' and '*', so keep it separated)
+                memcpy(space + pad/2 - 3, " /**/ ", 6);
+            }
+            int n = snprintf(buff, sizeof buff,
+                "%s{%sa%s:%s\"x\\\"y\"%s,%sb:[%s1%s'two'%s#fff,%s0x10%strue]%s// c\nc = null%s}%s",
+                space, space, space, space, space, space, space, space, space, space, space, space, space, space);
+            TestAssert(n > 0 && (size_t)n < sizeof buff);
+            DrJsonValue v = drjson_parse_string(ctx, buff, (size_t)n, DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+            TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+            TestExpectTrue(drjson_deep_eq(ctx, v, expected));
+        }
+    }
+    // Strings whose closing quote lands on either side of a block edge,
+    // with and without an escaped quote shortly before it.
+    for(int len = 0; len < 140; len++){
+        for(int esc = 0; esc < 2; esc++){
+            buff[0] = '"';
+            memset(buff+1, 'a', len);
+            if(esc && len >= 2){
+                buff[len-1] = '\\';
+                buff[len] = '"';
+            }
+            buff[len+1] = '"';
+            memset(buff+len+2, ' ', 80);
+            DrJsonValue v = drjson_parse_string(ctx, buff, len+2+80, DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+            TestAssertEquals((int)v.kind, DRJSON_STRING);
+            const char* str = ""; size_t slen = 0;
+            int err = drjson_get_str_and_len(ctx, v, &str, &slen);
+            TestAssertFalse(err);
+            TestAssertEquals((int)slen, len);
+            TestAssert(memcmp(str, buff+1, slen) == 0);
+        }
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+static
+DrJsonValue
+push_parse_in_chunks(DrJsonContext* ctx, const char* text, size_t length, unsigned flags, size_t chunk, size_t first){
+    DrJsonPushParser* p = drjson_push_parser_create(ctx, flags);
+    if(!p) return drjson_make_error(DRJSON_ERROR_ALLOC_FAILURE, "oom");
+    size_t offset = 0;
+    if(first && first <= length){
+        drjson_parse_feed(p, text, first);
+        offset = first;
+    }
+    while(offset < length){
+        size_t n = length - offset < chunk? length - offset : chunk;
+        if(drjson_parse_feed(p, text+offset, n))
+            break;
+        offset += n;
+    }
+    DrJsonValue v = drjson_parse_finish(p);
+    drjson_push_parser_free(p);
+    return v;
+}
+
+TestFunction(TestPushParser){
+    TESTBEGIN();
+    // Feeding a document in pieces must give the same result as parsing
+    // it all at once, wherever the pieces are split.
+    struct {
+        const char* text;
+        unsigned flags;
+    } cases[] = {
+        {"{a: \"x\\\"y\\\\\", b: [1, 'two', #fff, 0x10, true, -1.5e3], c: null, d: {}, e: []}", DRJSON_PARSE_FLAG_NONE},
+        {"  // comment\n /* block * / ** */ [1 2 3 /usr/bin +4 \"\\\\\" ''] /* trailing */", DRJSON_PARSE_FLAG_ERROR_ON_TRAILING},
+        {"[1 2] 3", DRJSON_PARSE_FLAG_NONE},
+        {"[1 2] 3", DRJSON_PARSE_FLAG_ERROR_ON_TRAILING},
+        {"[1 2] /", DRJSON_PARSE_FLAG_ERROR_ON_TRAILING},
+        {"12345678901234567890", DRJSON_PARSE_FLAG_NONE},
+        {"hello", DRJSON_PARSE_FLAG_NONE},
+        {"a: 1\nb = [x y z] // c\nc: {d: e}", DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        {"{\"a\":1}\n{\"b\":[2,3]}\n\n\"s\"\n4\n", DRJSON_PARSE_FLAG_NDJSON},
+        {"a: 1 b: 2\n// skip\nc: {d: 3}\n\ne: \"f\"", DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        {"a: [1\nb: 2", DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        {"a: \"b\nc\"", DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        {"{a: {b: [1, {c: 2}]}}", DRJSON_PARSE_FLAG_INTERN_OBJECTS},
+        {"", DRJSON_PARSE_FLAG_NONE},
+        {"[1, 2", DRJSON_PARSE_FLAG_NONE},
+        {"{a: 1, b", DRJSON_PARSE_FLAG_NONE},
+        {"{a: ]}", DRJSON_PARSE_FLAG_NONE},
+        {"\"unterminated", DRJSON_PARSE_FLAG_NONE},
+        {"[1 /* unterminated", DRJSON_PARSE_FLAG_NONE},
+        {"a: 1 b:", DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        // A bare '/' is only a comment if '/' or '*' follows it.
+        {"[/ 1]", DRJSON_PARSE_FLAG_NONE},
+        {"[1/]", DRJSON_PARSE_FLAG_NONE},
+        {"[1/'x' a/\"y\" /{}]", DRJSON_PARSE_FLAG_NONE},
+        {"/]", DRJSON_PARSE_FLAG_NONE},
+        {"{a/: b/}", DRJSON_PARSE_FLAG_NONE},
+        {"[1] /", DRJSON_PARSE_FLAG_NONE},
+        {"a: 1/\nb: /\n/\n", DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT},
+        {" {\"a\" : [1, -2.5e3, true, false, null, \"x\\\"\"], \"b\": {}}", DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING},
+        {"[1, 2,]", DRJSON_PARSE_FLAG_STRICT},
+        {"{\"a\" 1}", DRJSON_PARSE_FLAG_STRICT},
+        {"\"a\": 1, \"b\": 2\n\"c\": 3", DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_BRACELESS_OBJECT|DRJSON_PARSE_FLAG_NDJSON},
+    };
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    for(size_t i = 0; i < arrlen(cases); i++){
+        const char* text = cases[i].text;
+        size_t length = strlen(text);
+        unsigned flags = cases[i].flags;
+        DrJsonValue expected = drjson_parse_string(ctx, text, length, flags);
+        size_t chunks[] = {1, 2, 3, 5, 7, 64};
+        for(size_t c = 0; c < arrlen(chunks) + length + 1; c++){
+            // Either fixed size chunks or two pieces split at every offset.
+            size_t chunk = c < arrlen(chunks)? chunks[c] : length + 1;
+            size_t first = c < arrlen(chunks)? 0 : c - arrlen(chunks);
+            DrJsonValue v = push_parse_in_chunks(ctx, text, length, flags, chunk, first);
+            if(expected.kind == DRJSON_ERROR){
+                TestExpectEquals((int)v.kind, DRJSON_ERROR);
+                TestExpectEquals((int)v.error_code, (int)expected.error_code);
+            }
+            else {
+                TestExpectTrue(drjson_deep_eq(ctx, v, expected));
+            }
+            if(TEST_stats.failures){
+                TestPrintf("case %zu: '%s', chunk %zu, first %zu\n", i, text, chunk, first);
+                goto finally;
+            }
+        }
+    }
+    // Nesting limit is the same as for drjson_parse_string.
+    {
+        char buff[256];
+        for(int depth = 99; depth < 102; depth++){
+            memset(buff, '[', depth);
+            memset(buff+depth, ']', depth);
+            DrJsonValue expected = drjson_parse_string(ctx, buff, 2*depth, 0);
+            DrJsonValue v = push_parse_in_chunks(ctx, buff, 2*depth, 0, 7, 0);
+            TestExpectEquals((int)v.kind, (int)expected.kind);
+        }
+    }
+    // Line and column of an error.
+    {
+        const char* text = "[1,\n 2,\n  }]";
+        DrJsonPushParser* p = drjson_push_parser_create(ctx, DRJSON_PARSE_FLAG_NONE);
+        TestAssert(p);
+        int err = 0;
+        for(size_t i = 0; i < strlen(text) && !err; i++)
+            err = drjson_parse_feed(p, text+i, 1);
+        TestExpectTrue(err);
+        size_t line = 0, column = 0;
+        drjson_push_parser_get_line_column(p, &line, &column);
+        TestExpectEquals(line, 2);
+        TestExpectEquals(column, 2);
+        DrJsonValue v = drjson_parse_finish(p);
+        TestExpectEquals((int)v.kind, DRJSON_ERROR);
+        drjson_push_parser_free(p);
+    }
+    finally:
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestMaxDepth){
+    TESTBEGIN();
+    // The parser doesn't recurse, so the nesting limit is just an option.
+    enum {DEPTH=20000};
+    char* text = malloc(2*DEPTH);
+    TestAssert(text);
+    memset(text, '[', DEPTH);
+    memset(text+DEPTH, ']', DEPTH);
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    DrJsonValue v = drjson_parse_string(ctx, text, 2*DEPTH, DRJSON_PARSE_FLAG_NONE);
+    TestExpectEquals((int)v.kind, DRJSON_ERROR);
+    TestExpectEquals((int)v.error_code, DRJSON_ERROR_TOO_DEEP);
+    for(int max_depth = DEPTH-1; max_depth <= DEPTH; max_depth++){
+        DrJsonParseContext pctx = {
+            .begin = text,
+            .cursor = text,
+            .end = text + 2*DEPTH,
+            .ctx = ctx,
+            .max_depth = max_depth,
+        };
+        v = drjson_parse(&pctx, DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+        if(max_depth < DEPTH){
+            TestExpectEquals((int)v.error_code, DRJSON_ERROR_TOO_DEEP);
+            continue;
+        }
+        TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        int depth = 1;
+        for(;;){
+            int64_t len = drjson_len(ctx, v);
+            if(!len) break;
+            TestAssertEquals(len, 1);
+            v = drjson_get_by_index(ctx, v, 0);
+            depth++;
+        }
+        TestExpectEquals(depth, DEPTH);
+    }
+    {
+        DrJsonPushParser* p = drjson_push_parser_create(ctx, DRJSON_PARSE_FLAG_NONE);
+        TestAssert(p);
+        drjson_push_parser_set_max_depth(p, DEPTH);
+        for(size_t i = 0; i < 2*DEPTH; i += 1000)
+            TestExpectFalse(drjson_parse_feed(p, text+i, 1000));
+        v = drjson_parse_finish(p);
+        TestExpectEquals((int)v.kind, DRJSON_ARRAY);
+        drjson_push_parser_free(p);
+    }
+    free(text);
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestStrict){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    // Strict json parses to the same thing either way.
+    const char* valid[] = {
+        "{\"a\": [1, -2, 3.5, -0.25e-3, 1E10, true, false, null], \"b\": {\"c\": \"d\\\"\\\\\\n\"}, \"e\": [], \"f\": {}}",
+        " [ ] ",
+        "\t\r\n\"string\"\n",
+        "12345678901234567890",
+        "[[[[1]], [[2]]]]",
+        "[0, -0, 0.5, 10, 1e5, 1E-5, -0.0e+0]",
+        "\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\uD83D\\ude00 0123456789abcdef\"",
+    };
+    for(size_t i = 0; i < arrlen(valid); i++){
+        DrJsonValue expected = drjson_parse_string(ctx, valid[i], strlen(valid[i]), DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+        TestAssertNotEqual((int)expected.kind, DRJSON_ERROR);
+        DrJsonValue v = drjson_parse_string(ctx, valid[i], strlen(valid[i]), DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+        TestExpectTrue(drjson_deep_eq(ctx, v, expected));
+    }
+    // The liberal extensions are errors.
+    const char* invalid[] = {
+        "[1 2]",
+        "[1, 2,]",
+        "[,1]",
+        "{\"a\" 1}",
+        "{\"a\" = 1}",
+        "{\"a\": 1,}",
+        "{\"a\": 1 \"b\": 2}",
+        "{a: 1}",
+        "{'a': 1}",
+        "['a']",
+        "[hello]",
+        "[#fff]",
+        "[0x10]",
+        "[+1]",
+        "[.5]",
+        "[1] // comment",
+        "/* comment */ [1]",
+        "[truex]",
+        "{\"a\": 1",
+        "",
+        // Numbers json doesn't have.
+        "01",
+        "-01",
+        "[00]",
+        "1.",
+        "1.e5",
+        "[1e]",
+        "[1E+]",
+        "-",
+        "[1.5.5]",
+        "[1e5e5]",
+        // Raw control characters and escapes json doesn't have.
+        "\"a\tb\"",
+        "[\"a\nb\"]",
+        "{\"\x01\": 1}",
+        "\"0123456789abcdef\x1f\"",
+        "\"\\q\"",
+        "\"\\x41\"",
+        "\"\\'\"",
+        "\"\\u12\"",
+        "\"\\u12g4\"",
+        "{\"a\\0\": 1}",
+    };
+    for(size_t i = 0; i < arrlen(invalid); i++){
+        DrJsonValue v = drjson_parse_string(ctx, invalid[i], strlen(invalid[i]), DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+        TestExpectEquals((int)v.kind, DRJSON_ERROR);
+        if(v.kind != DRJSON_ERROR)
+            TestPrintf("'%s' was accepted\n", invalid[i]);
+        TestExpectNotEquals((int)drjson_validate(invalid[i], strlen(invalid[i]), DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING, NULL, NULL), DRJSON_ERROR_NONE);
+    }
+    // Braceless is the members of an object.
+    {
+        const char* text = "\"a\": 1, \"b\": [2]";
+        DrJsonValue v = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_BRACELESS_OBJECT);
+        TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+        TestExpectEquals(drjson_len(ctx, v), 2);
+        text = "\"a\": 1,";
+        v = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_BRACELESS_OBJECT);
+        TestExpectEquals((int)v.kind, DRJSON_ERROR);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestStringEscapes){
+    TESTBEGIN();
+    // Runs of backslashes and escaped quotes at every offset and across
+    // block boundaries, in both kinds of quotes. Each piece of the body
+    // unescapes to one byte.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    enum {N=300};
+    char buff[8*N+8];
+    char expected[N];
+    char unescaped[8*N];
+    uint32_t rng = 12345;
+    for(int iter = 0; iter < 2000; iter++){
+        char quote = iter & 1? '\'' : '"';
+        int n = iter % N;
+        size_t len = 0;
+        // Pad so the string starts at varying offsets.
+        for(int i = 0; i < iter % 67; i++)
+            buff[len++] = ' ';
+        buff[len++] = quote;
+        size_t body = len;
+        for(int i = 0; i < n; i++){
+            rng = rng * 1103515245u + 12345u;
+            int r = (iter & 2)? (rng >> 16) % 4 : 0;
+            switch(r){
+                case 0: buff[len++] = 'a'; expected[i] = 'a'; break;
+                case 1: buff[len++] = '\\'; buff[len++] = '\\'; expected[i] = '\\'; break;
+                case 2: buff[len++] = '\\'; buff[len++] = quote; expected[i] = quote; break;
+                case 3: buff[len++] = '\\'; buff[len++] = 'n'; expected[i] = '\n'; break;
+            }
+        }
+        buff[len++] = quote;
+        // Something that would be a closing quote if an escape were missed.
+        buff[len++] = ' ';
+        buff[len++] = quote;
+        DrJsonParseContext pctx = {
+            .begin = buff,
+            .cursor = buff,
+            .end = buff + len,
+            .ctx = ctx,
+        };
+        DrJsonValue v = drjson_parse(&pctx, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+        TestAssertEquals((int)v.kind, DRJSON_STRING);
+        TestExpectEquals((size_t)(pctx.cursor - buff), len - 2);
+        const char* str = ""; size_t slen = 0;
+        int err = drjson_get_str_and_len(ctx, v, &str, &slen);
+        TestAssertFalse(err);
+        TestAssertEquals(slen, len - 3 - body);
+        TestAssert(memcmp(str, buff + body, slen) == 0);
+        // There's no \' escape in json.
+        if(quote != '"') continue;
+        size_t ulen = 0;
+        err = drjson_unescape_string_value(ctx, v, unescaped, sizeof unescaped, &ulen);
+        TestAssertFalse(err);
+        TestAssertEquals(ulen, (size_t)n);
+        TestAssert(memcmp(unescaped, expected, n) == 0);
+    }
+    // Escaped quotes used to make the scan quadratic.
+    {
+        enum {LEN=1<<20};
+        char* big = malloc(LEN+2);
+        TestAssert(big);
+        big[0] = '"';
+        for(size_t i = 1; i < LEN; i += 2){
+            big[i] = '\\';
+            big[i+1] = '"';
+        }
+        big[LEN] = 'x';
+        big[LEN+1] = '"';
+        DrJsonValue v = drjson_parse_string(ctx, big, LEN+2, DRJSON_PARSE_FLAG_NO_COPY_STRINGS|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING);
+        TestExpectEquals((int)v.kind, DRJSON_STRING);
+        TestExpectEquals(drjson_len(ctx, v), LEN);
+        free(big);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestNumbers){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    struct {
+        const char* text;
+        DrJsonKind kind;
+        uint64_t u; // also holds int64s
+        double d;
+    } cases[] = {
+        {"0",                      DRJSON_UINTEGER, 0},
+        {"7",                      DRJSON_UINTEGER, 7},
+        {"12345678",               DRJSON_UINTEGER, 12345678},
+        {"123456789",              DRJSON_UINTEGER, 123456789},
+        {"1234567812345678",       DRJSON_UINTEGER, 1234567812345678},
+        {"123456789012345678",     DRJSON_UINTEGER, 123456789012345678},
+        {"1234567890123456789",    DRJSON_UINTEGER, 1234567890123456789},
+        {"18446744073709551615",   DRJSON_UINTEGER, UINT64_MAX},
+        {"-0",                     DRJSON_INTEGER,  0},
+        {"-12345678",              DRJSON_INTEGER,  (uint64_t)-12345678},
+        {"-123456789012345678",    DRJSON_INTEGER,  (uint64_t)-123456789012345678},
+        {"-9223372036854775807",   DRJSON_INTEGER,  (uint64_t)-INT64_MAX},
+        {"-9223372036854775808",   DRJSON_INTEGER,  (uint64_t)INT64_MIN},
+        {"1.5",                    DRJSON_NUMBER,   0, 1.5},
+        {"-12345678.25",           DRJSON_NUMBER,   0, -12345678.25},
+        {"1e3",                    DRJSON_NUMBER,   0, 1e3},
+        {"12345678E-2",            DRJSON_NUMBER,   0, 123456.78},
+        {"1e+2",                   DRJSON_NUMBER,   0, 1e2},
+        // Too big, so they fall back to strings.
+        {"18446744073709551616",   DRJSON_STRING},
+        {"-9223372036854775809",   DRJSON_STRING},
+        {"1-2",                    DRJSON_STRING},
+        {"-",                      DRJSON_STRING},
+    };
+    for(size_t i = 0; i < arrlen(cases); i++){
+        const char* text = cases[i].text;
+        size_t len = strlen(text);
+        // Digits at the very end of the buffer and followed by something.
+        for(int trailing = 0; trailing < 2; trailing++){
+            char buff[64];
+            memcpy(buff, text, len);
+            size_t blen = len;
+            if(trailing){
+                memcpy(buff+blen, ",1", 2);
+                blen += 2;
+            }
+            DrJsonParseContext pctx = {
+                .begin = buff,
+                .cursor = buff,
+                .end = buff + blen,
+                .ctx = ctx,
+            };
+            DrJsonValue v = drjson_parse(&pctx, DRJSON_PARSE_FLAG_NO_COPY_STRINGS);
+            TestExpectEquals((int)v.kind, (int)cases[i].kind);
+            if(v.kind != cases[i].kind){
+                TestReport("%s", text);
+                continue;
+            }
+            TestExpectEquals((size_t)(pctx.cursor - buff), len);
+            switch(v.kind){
+                case DRJSON_UINTEGER: TestExpectEquals(v.uinteger, cases[i].u); break;
+                case DRJSON_INTEGER:  TestExpectEquals(v.integer, (int64_t)cases[i].u); break;
+                case DRJSON_NUMBER:   TestExpectEquals(v.number, cases[i].d); break;
+                default: break;
+            }
+        }
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestParsedContainers){
+    TESTBEGIN();
+    // Containers are filled in when they close, from the parser's scratch
+    // stacks, so check nesting, repeated keys and that they still grow.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    struct {
+        StringView input;
+        const char* expected;
+    } cases[] = {
+        {SV("{\"a\":1,\"b\":2,\"a\":3}"), "{\"a\":3,\"b\":2}"},
+        {SV("[1,{\"x\":[2,3],\"y\":{}},[],[[4]],5]"), "[1,{\"x\":[2,3],\"y\":{}},[],[[4]],5]"},
+        {SV("{\"k\":[{\"k\":1,\"k\":[2]}],\"j\":0}"), "{\"k\":[{\"k\":[2]}],\"j\":0}"},
+    };
+    for(size_t i = 0; i < arrlen(cases); i++){
+        DrJsonValue v = drjson_parse_string(ctx, cases[i].input.text, cases[i].input.length, DRJSON_PARSE_FLAG_NONE);
+        TestAssertNotEqual((int)v.kind, DRJSON_ERROR);
+        char buff[256];
+        size_t printed = 0;
+        int err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, cases[i].expected);
+    }
+    {
+        enum {N=1000};
+        char text[16*N];
+        size_t len = 0;
+        text[len++] = '{';
+        for(int i = 0; i < N; i++)
+            len += snprintf(text+len, sizeof text - len, "\"k%d\":%d,", i, i);
+        text[len++] = '}';
+        DrJsonValue o = drjson_parse_string(ctx, text, len, DRJSON_PARSE_FLAG_NONE);
+        TestAssertEquals((int)o.kind, DRJSON_OBJECT);
+        TestExpectEquals(drjson_len(ctx, o), N);
+        // Grows past the exact size it was built at.
+        int err = drjson_object_set_item_copy_key(ctx, o, "extra", 5, drjson_make_int(-1));
+        TestAssertFalse(err);
+        TestExpectEquals(drjson_len(ctx, o), N+1);
+        for(int i = 0; i < N; i++){
+            char key[16];
+            int klen = snprintf(key, sizeof key, "k%d", i);
+            DrJsonValue v = drjson_object_get_item(ctx, o, key, klen);
+            TestAssertEquals((int)v.kind, DRJSON_UINTEGER);
+            TestExpectEquals(v.uinteger, (uint64_t)i);
+        }
+        DrJsonValue a = drjson_parse_string(ctx, "[1,2,3]", 7, DRJSON_PARSE_FLAG_NONE);
+        err = drjson_array_push_item(ctx, a, drjson_make_int(4));
+        TestAssertFalse(err);
+        TestExpectEquals(drjson_len(ctx, a), 4);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestProjection){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    const char* doc =
+        "{\"name\": \"widget\", // a comment with a } in it\n"
+        " \"skip\": {\"a\": [1, {\"b\": \"]}\\\"\"}], 'c': #ff00ff},\n"
+        " tags: [\"x\", \"y\", {\"z\": [10, 20, 30]}, \"w\"],\n"
+        " \"dims\": {\"w\": 3, \"h\": 4.5, \"deep\": {\"er\": [[1], [2, [3]]]}},\n"
+        " \"dup\": 1, \"dup\": {\"v\": 2},\n"
+        " \"esc\\\"aped\": true,\n"
+        " \"s\": \"str\"}";
+    const char* queries[] = {
+        "name", "tags[2].z[1]", "tags[-1]", "tags.length", "dims.keys",
+        "dims.deep.er[1][1][0]", "dup.v", "dup", "skip", "s.x", "tags[9]",
+        "missing", "dims.h", ".\"esc\\\"aped\"", "dims.deep",
+    };
+    DrJsonValue full = drjson_parse_string(ctx, doc, strlen(doc), DRJSON_PARSE_FLAG_NONE);
+    TestAssertNotEqual((int)full.kind, DRJSON_ERROR);
+    // Each query on its own and all of them at once.
+    for(size_t n = 0; n <= arrlen(queries); n++){
+        DrJsonPath paths[arrlen(queries)];
+        size_t first = n == arrlen(queries)? 0 : n;
+        size_t count = n == arrlen(queries)? n : 1;
+        for(size_t i = 0; i < count; i++){
+            int err = drjson_path_parse_intern(ctx, queries[first+i], strlen(queries[first+i]), &paths[i]);
+            TestAssertFalse(err);
+        }
+        DrJsonParseContext pctx = {
+            .begin = doc,
+            .cursor = doc,
+            .end = doc + strlen(doc),
+            .ctx = ctx,
+        };
+        DrJsonValue proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_ERROR_ON_TRAILING, paths, count);
+        TestAssertEquals((int)proj.kind, DRJSON_OBJECT);
+        for(size_t i = 0; i < count; i++){
+            DrJsonValue expected = drjson_evaluate_path(ctx, full, &paths[i]);
+            DrJsonValue got = drjson_evaluate_path(ctx, proj, &paths[i]);
+            TestExpectEquals((int)got.kind, (int)expected.kind);
+            if(expected.kind == DRJSON_ERROR) continue;
+            // Printed, as deep_eq doesn't compare views.
+            char want[512], have[512];
+            size_t printed = 0;
+            int err = drjson_print_value_mem(ctx, want, sizeof want, expected, 0, DRJSON_APPEND_ZERO, &printed);
+            TestAssertFalse(err);
+            err = drjson_print_value_mem(ctx, have, sizeof have, got, 0, DRJSON_APPEND_ZERO, &printed);
+            TestAssertFalse(err);
+            if(!str_eq(want, have))
+                TestReport("%s differs", queries[first+i]);
+            TestExpectEquals2(str_eq, have, want);
+        }
+    }
+    // Nothing else is built.
+    {
+        DrJsonPath path;
+        int err = drjson_path_parse_intern(ctx, "tags[2].z[1]", 12, &path);
+        TestAssertFalse(err);
+        DrJsonParseContext pctx = {.begin = doc, .cursor = doc, .end = doc + strlen(doc), .ctx = ctx};
+        DrJsonValue proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_NONE, &path, 1);
+        char buff[128];
+        size_t printed = 0;
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, proj, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"tags\":[null,null,{\"z\":[null,20]}]}");
+    }
+    // Braceless and ndjson documents.
+    {
+        const char* text = "a 1 b {c 2 d [3 4]}\n";
+        DrJsonPath path;
+        int err = drjson_path_parse_intern(ctx, "b.d[1]", 6, &path);
+        TestAssertFalse(err);
+        DrJsonParseContext pctx = {.begin = text, .cursor = text, .end = text + strlen(text), .ctx = ctx};
+        DrJsonValue proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_BRACELESS_OBJECT, &path, 1);
+        DrJsonValue v = drjson_evaluate_path(ctx, proj, &path);
+        TestAssertEquals((int)v.kind, DRJSON_UINTEGER);
+        TestExpectEquals(v.uinteger, 4);
+        TestExpectEquals(drjson_len(ctx, proj), 1);
+
+        text = "{\"a\": 1}\n{\"a\": 2}\n{\"a\": 3}\n";
+        err = drjson_path_parse_intern(ctx, "[1].a", 5, &path);
+        TestAssertFalse(err);
+        pctx = (DrJsonParseContext){.begin = text, .cursor = text, .end = text + strlen(text), .ctx = ctx};
+        proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_NDJSON, &path, 1);
+        v = drjson_evaluate_path(ctx, proj, &path);
+        TestAssertEquals((int)v.kind, DRJSON_UINTEGER);
+        TestExpectEquals(v.uinteger, 2);
+        // Paths that need the whole document, with leftover segments that
+        // must not be looked at.
+        const char* empty_paths[] = {"[1]", "[-1].a", "length"};
+        for(size_t i = 0; i < arrlen(empty_paths); i++){
+            err = drjson_path_parse_intern(ctx, empty_paths[i], strlen(empty_paths[i]), &path);
+            TestAssertFalse(err);
+            if(i == 0) path.count = 0;
+            pctx = (DrJsonParseContext){.begin = text, .cursor = text, .end = text + strlen(text), .ctx = ctx};
+            proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_NDJSON, &path, 1);
+            DrJsonValue whole = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_NDJSON);
+            TestExpectTrue(drjson_deep_eq(ctx, proj, whole));
+        }
+        text = "a 1 b {c 2 d [3 4]}\n";
+        for(size_t i = 0; i < 2; i++){
+            err = drjson_path_parse_intern(ctx, i? "keys" : "b", i? 4 : 1, &path);
+            TestAssertFalse(err);
+            if(i == 0) path.count = 0;
+            pctx = (DrJsonParseContext){.begin = text, .cursor = text, .end = text + strlen(text), .ctx = ctx};
+            proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_BRACELESS_OBJECT, &path, 1);
+            DrJsonValue whole = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_BRACELESS_OBJECT);
+            TestExpectTrue(drjson_deep_eq(ctx, proj, whole));
+        }
+    }
+    // Errors in skipped text that the skipper can see.
+    {
+        const char* bad[] = {
+            "{\"a\": 1, \"b\": [1, 2}",
+            "{\"a\": 1, \"b\": \"unterminated}",
+            "{\"a\": 1, \"b\": [1, 2]",
+            "{\"a\": 1, \"b\": ) }",
+            "{\"a\": 1} trailing",
+        };
+        DrJsonPath path;
+        int err = drjson_path_parse_intern(ctx, "a", 1, &path);
+        TestAssertFalse(err);
+        for(size_t i = 0; i < arrlen(bad); i++){
+            DrJsonParseContext pctx = {.begin = bad[i], .cursor = bad[i], .end = bad[i] + strlen(bad[i]), .ctx = ctx};
+            DrJsonValue proj = drjson_parse_projected(&pctx, DRJSON_PARSE_FLAG_ERROR_ON_TRAILING, &path, 1);
+            TestExpectEquals((int)proj.kind, DRJSON_ERROR);
+        }
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestValidate){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    const char* docs[] = {
+        "", "  ", "1", "-1.5e3", "true", "null", "nul", "\"str\"", "'single'",
+        "\"unterminated", "\"esc\\\"aped\\n\"", "bare_word", "#ff00ff", "0x1f",
+        "[]", "{}", "[1, 2, 3]", "[1 2 3]", "[1, 2,]", "[1, 2", "[1, 2]]",
+        "{\"a\": 1, \"b\": [true, {\"c\": null}]}", "{\"a\" 1}", "{a: 1 b: 2}",
+        "{\"a\": }", "{\"a\"}", "{\"a\": 1,}", "{1: 2}", "{\"a\": 1", "}",
+        "[1] [2]", "[1]\n  trailing", "// comment\n[1 /* two */ 2]",
+        "[1, /* unterminated", "a 1 b 2", "a 1\nb {c [3 4]}\n", "a", "a 1 b",
+        "{\"a\": 1}\n{\"a\": 2}\n", "{\"a\": 1}\n{\"a\": \n2}\n",
+        "a 1 b 2\nc 3\n", "a 1 b\nc 3\n", "a [1\n2]\n", "[\n1,\n\n  x]",
+        "\"\\u00e9\"", "[1, \x01]", "{\"a\": [1, 2], \"a\": 3}",
+    };
+    unsigned flags[] = {
+        DRJSON_PARSE_FLAG_NONE,
+        DRJSON_PARSE_FLAG_STRICT,
+        DRJSON_PARSE_FLAG_ERROR_ON_TRAILING,
+        DRJSON_PARSE_FLAG_STRICT|DRJSON_PARSE_FLAG_ERROR_ON_TRAILING,
+        DRJSON_PARSE_FLAG_BRACELESS_OBJECT,
+        DRJSON_PARSE_FLAG_NDJSON,
+        DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_STRICT,
+        DRJSON_PARSE_FLAG_NDJSON|DRJSON_PARSE_FLAG_BRACELESS_OBJECT,
+    };
+    for(size_t i = 0; i < arrlen(docs); i++){
+        for(size_t j = 0; j < arrlen(flags); j++){
+            size_t len = strlen(docs[i]);
+            DrJsonParseContext pctx = {.begin = docs[i], .cursor = docs[i], .end = docs[i] + len, .ctx = ctx};
+            DrJsonValue v = drjson_parse(&pctx, flags[j]);
+            DrJsonErrorCode expected = v.kind == DRJSON_ERROR? v.error_code : DRJSON_ERROR_NONE;
+            size_t line = 99, column = 99;
+            DrJsonErrorCode got = drjson_validate(docs[i], len, flags[j], &line, &column);
+            if(got != expected)
+                TestReport("'%s' with flags %#x", docs[i], flags[j]);
+            TestExpectEquals((int)got, (int)expected);
+            if(expected == DRJSON_ERROR_NONE) continue;
+            size_t want_line, want_column;
+            drjson_get_line_column(&pctx, &want_line, &want_column);
+            TestExpectEquals(line, want_line);
+            TestExpectEquals(column, want_column);
+        }
+    }
+    // Nesting is limited like drjson_parse's default.
+    {
+        char deep[2*DRJSON_DEFAULT_MAX_DEPTH+2];
+        for(size_t n = DRJSON_DEFAULT_MAX_DEPTH; n <= DRJSON_DEFAULT_MAX_DEPTH+1; n++){
+            memset(deep, '[', n);
+            memset(deep+n, ']', n);
+            DrJsonValue v = drjson_parse_string(ctx, deep, 2*n, DRJSON_PARSE_FLAG_NONE);
+            DrJsonErrorCode got = drjson_validate(deep, 2*n, DRJSON_PARSE_FLAG_NONE, NULL, NULL);
+            TestExpectEquals((int)got, v.kind == DRJSON_ERROR? (int)v.error_code : DRJSON_ERROR_NONE);
+            // The implicit top level containers don't count.
+            const unsigned root_flags[] = {DRJSON_PARSE_FLAG_BRACELESS_OBJECT, DRJSON_PARSE_FLAG_NDJSON};
+            for(size_t j = 0; j < arrlen(root_flags); j++){
+                unsigned f = root_flags[j];
+                char text[2*DRJSON_DEFAULT_MAX_DEPTH+8];
+                size_t tlen = f == DRJSON_PARSE_FLAG_NDJSON? 0 : 2;
+                memcpy(text, "k ", tlen);
+                memcpy(text+tlen, deep, 2*n);
+                tlen += 2*n;
+                v = drjson_parse_string(ctx, text, tlen, f);
+                got = drjson_validate(text, tlen, f, NULL, NULL);
+                TestExpectEquals((int)got, v.kind == DRJSON_ERROR? (int)v.error_code : DRJSON_ERROR_NONE);
+            }
+        }
+        TestExpectEquals((int)drjson_validate(deep, 2*DRJSON_DEFAULT_MAX_DEPTH+2, DRJSON_PARSE_FLAG_NONE, NULL, NULL), DRJSON_ERROR_TOO_DEEP);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestParseFile){
+    TESTBEGIN();
+#ifndef _WIN32
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char temp_file[] = "/tmp/drjson_test_XXXXXX";
+    int fd = mkstemp(temp_file);
+    TestAssert(fd >= 0);
+    const char text[] = "{\"name\": \"widget\", \"tags\": [\"a\", \"b\"]}";
+    TestAssertEquals(write(fd, text, sizeof text - 1), (ssize_t)(sizeof text - 1));
+    close(fd);
+    {
+        size_t line = 99, column = 99;
+        DrJsonValue v = drjson_parse_file(ctx, temp_file, DRJSON_PARSE_FLAG_NONE, &line, &column);
+        TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+        TestExpectEquals(line, 0);
+        TestExpectEquals(column, 0);
+        char buff[128];
+        size_t printed = 0;
+        int err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"name\":\"widget\",\"tags\":[\"a\",\"b\"]}");
+        const char* mapped; size_t mapped_length;
+        err = drjson_ctx_map_file(ctx, temp_file, &mapped, &mapped_length);
+        TestAssertFalse(err);
+        TestAssertEquals(mapped_length, sizeof text - 1);
+        TestExpectEquals(memcmp(mapped, text, mapped_length), 0);
+    }
+    // Parse errors report where they happened. Atoms point into the
+    // mapped files, so each case gets a new file instead of truncating.
+    unlink(temp_file);
+    char bad_file[] = "/tmp/drjson_test_XXXXXX";
+    fd = mkstemp(bad_file);
+    TestAssert(fd >= 0);
+    const char bad[] = "{\"a\": 1,\n \"b\": [1, 2}";
+    TestAssertEquals(write(fd, bad, sizeof bad - 1), (ssize_t)(sizeof bad - 1));
+    close(fd);
+    {
+        size_t line = 99, column = 99;
+        DrJsonValue v = drjson_parse_file(ctx, bad_file, DRJSON_PARSE_FLAG_NONE, &line, &column);
+        TestAssertEquals((int)v.kind, DRJSON_ERROR);
+        DrJsonValue expected = drjson_parse_string(ctx, bad, sizeof bad - 1, DRJSON_PARSE_FLAG_NONE);
+        TestExpectEquals(v.error_code, expected.error_code);
+        TestExpectEquals(line, 1);
+        TestExpectNotEquals(column, 99);
+        // The file was unmapped, so the atoms made from it were copied.
+        DrJsonAtom a;
+        TestAssertFalse(drjson_atomize(ctx, "b", 1, &a));
+        const char* str; size_t len;
+        TestAssertFalse(drjson_get_atom_str_and_length(ctx, a, &str, &len));
+        TestExpectEquals(len, 1);
+        TestExpectEquals(str[0], 'b');
+    }
+    unlink(bad_file);
+    // Unmapping a file copies out what still points into it.
+    char unmap_file[] = "/tmp/drjson_test_XXXXXX";
+    fd = mkstemp(unmap_file);
+    TestAssert(fd >= 0);
+    const char lazy[] = "{\"pi\": 3.14159, \"unmapped\": [\"yes\", 1e100]}";
+    TestAssertEquals(write(fd, lazy, sizeof lazy - 1), (ssize_t)(sizeof lazy - 1));
+    close(fd);
+    {
+        const char* mapped; size_t mapped_length;
+        int err = drjson_ctx_map_file(ctx, unmap_file, &mapped, &mapped_length);
+        TestAssertFalse(err);
+        DrJsonParseContext pctx = {
+            .ctx = ctx,
+            .begin = mapped,
+            .cursor = mapped,
+            .end = mapped + mapped_length,
+        };
+        DrJsonValue v = drjson_parse(&pctx, DRJSON_PARSE_FLAG_NO_COPY_STRINGS|DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+        TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+        err = drjson_ctx_unmap_file(ctx, mapped);
+        TestAssertFalse(err);
+        // Already unmapped.
+        err = drjson_ctx_unmap_file(ctx, mapped);
+        TestExpectTrue(err);
+        char buff[128];
+        size_t printed = 0;
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"pi\":3.14159,\"unmapped\":[\"yes\",1e100]}");
+    }
+    unlink(unmap_file);
+    // Empty files.
+    char empty_file[] = "/tmp/drjson_test_XXXXXX";
+    fd = mkstemp(empty_file);
+    TestAssert(fd >= 0);
+    close(fd);
+    {
+        DrJsonValue v = drjson_parse_file(ctx, empty_file, DRJSON_PARSE_FLAG_NONE, NULL, NULL);
+        TestAssertEquals((int)v.kind, DRJSON_ERROR);
+        TestExpectEquals(v.error_code, DRJSON_ERROR_UNEXPECTED_EOF);
+        v = drjson_parse_file(ctx, empty_file, DRJSON_PARSE_FLAG_BRACELESS_OBJECT, NULL, NULL);
+        TestExpectEquals((int)v.kind, DRJSON_OBJECT);
+    }
+    unlink(empty_file);
+    // Missing files.
+    {
+        DrJsonValue v = drjson_parse_file(ctx, temp_file, DRJSON_PARSE_FLAG_NONE, NULL, NULL);
+        TestAssertEquals((int)v.kind, DRJSON_ERROR);
+        TestExpectEquals(v.error_code, DRJSON_ERROR_IO);
+    }
+    // Pipes can't be mapped and are read instead.
+    {
+        int fds[2];
+        TestAssertFalse(pipe(fds));
+        const char ndjson[] = "{\"a\": 1}\n{\"a\": 2}\n";
+        TestAssertEquals(write(fds[1], ndjson, sizeof ndjson - 1), (ssize_t)(sizeof ndjson - 1));
+        close(fds[1]);
+        char path[64];
+        snprintf(path, sizeof path, "/dev/fd/%d", fds[0]);
+        DrJsonValue v = drjson_parse_file(ctx, path, DRJSON_PARSE_FLAG_NDJSON, NULL, NULL);
+        close(fds[0]);
+        TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        TestExpectEquals(drjson_len(ctx, v), 2);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+#endif
+    TESTEND();
+}
+
+TestFunction(TestCopiedAtoms){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    // Sizes that fill chunks, straddle them and need chunks of their own.
+    enum {N = 2000, BIG = 300000};
+    static char big[BIG];
+    for(size_t i = 0; i < BIG; i++)
+        big[i] = 'a' + (char)(i % 26);
+    DrJsonAtom atoms[N];
+    for(size_t i = 0; i < N; i++){
+        char buff[64];
+        const char* str = buff;
+        size_t len = (size_t)snprintf(buff, sizeof buff, "%zu-%.*s", i, (int)(i % 40), "0123456789012345678901234567890123456789");
+        if(i % 500 == 7){
+            str = big;
+            len = BIG - i;
+        }
+        int err = drjson_atomize(ctx, str, len, &atoms[i]);
+        TestAssertFalse(err);
+        // Copied, so scribbling on the source doesn't change the atom.
+        if(str == buff) memset(buff, 'x', len);
+    }
+    for(size_t i = 0; i < N; i++){
+        char buff[64];
+        const char* want = buff;
+        size_t want_len = (size_t)snprintf(buff, sizeof buff, "%zu-%.*s", i, (int)(i % 40), "0123456789012345678901234567890123456789");
+        if(i % 500 == 7){
+            want = big;
+            want_len = BIG - i;
+        }
+        const char* str; size_t len;
+        int err = drjson_get_atom_str_and_length(ctx, atoms[i], &str, &len);
+        TestAssertFalse(err);
+        TestAssertEquals(len, want_len);
+        TestExpectEquals(memcmp(str, want, len), 0);
+        DrJsonAtom again;
+        err = drjson_atomize(ctx, want, want_len, &again);
+        TestAssertFalse(err);
+        TestExpectEquals(again.bits, atoms[i].bits);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestAtomTableGrowth){
+    TESTBEGIN();
+    // Big tables move their index over a few slots per insert, so lookups
+    // have to work at every point in between. The first count stops
+    // partway through moving, the second after it's done.
+    static const uint32_t counts[] = {70000, 100000};
+    for(size_t c = 0; c < sizeof counts / sizeof counts[0]; c++){
+        uint32_t n = counts[c];
+        DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+        DrJsonAtom* atoms = malloc(n * sizeof *atoms);
+        TestAssert(atoms);
+        char buff[32];
+        for(uint32_t i = 0; i < n; i++){
+            size_t len = (size_t)snprintf(buff, sizeof buff, "key%u", i);
+            int err = drjson_atomize(ctx, buff, len, &atoms[i]);
+            TestAssertFalse(err);
+            DrJsonAtom a;
+            uint32_t j = i / 2;
+            len = (size_t)snprintf(buff, sizeof buff, "key%u", j);
+            err = drjson_get_atom_no_intern(ctx, buff, len, &a);
+            TestAssertFalse(err);
+            TestAssertEquals(a.bits, atoms[j].bits);
+            len = (size_t)snprintf(buff, sizeof buff, "key%u", i + 1);
+            err = drjson_get_atom_no_intern(ctx, buff, len, &a);
+            TestAssert(err);
+        }
+        for(uint32_t i = 0; i < n; i++){
+            size_t len = (size_t)snprintf(buff, sizeof buff, "key%u", i);
+            DrJsonAtom a;
+            int err = drjson_get_atom_no_intern(ctx, buff, len, &a);
+            TestAssertFalse(err);
+            TestAssertEquals(a.bits, atoms[i].bits);
+            err = drjson_atomize(ctx, buff, len, &a);
+            TestAssertFalse(err);
+            TestAssertEquals(a.bits, atoms[i].bits);
+        }
+        free(atoms);
+        drjson_ctx_free_all(ctx);
+        assert_all_freed();
+    }
+    TESTEND();
+}
+
+TestFunction(TestSmallObjects){
+    TESTBEGIN();
+    // Small objects scan their keys and only get a hash index once they
+    // grow, so check objects on both sides of that and across it.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    enum {N = 40};
+    DrJsonAtom keys[N+1];
+    for(int i = 0; i <= N; i++){
+        char buff[16];
+        int len = snprintf(buff, sizeof buff, "k%d", i);
+        int err = drjson_atomize(ctx, buff, (size_t)len, &keys[i]);
+        TestAssertFalse(err);
+    }
+    for(int n = 0; n <= N; n++){
+        DrJsonValue o = drjson_make_object(ctx);
+        for(int i = 0; i < n; i++){
+            int err = drjson_object_set_item_atom(ctx, o, keys[i], drjson_make_int(i));
+            TestAssertFalse(err);
+        }
+        // Setting again replaces the value and keeps the position.
+        if(n){
+            int err = drjson_object_set_item_atom(ctx, o, keys[0], drjson_make_int(100));
+            TestAssertFalse(err);
+            TestAssertEquals(drjson_object_get_item_atom(ctx, o, keys[0]).integer, 100);
+            err = drjson_object_set_item_atom(ctx, o, keys[0], drjson_make_int(0));
+            TestAssertFalse(err);
+        }
+        TestAssertEquals(drjson_len(ctx, o), n);
+        TestAssertEquals((int)drjson_object_get_item_atom(ctx, o, keys[N]).kind, DRJSON_ERROR);
+        // A key that's already there can't be inserted or renamed to.
+        if(n >= 2){
+            TestExpectTrue(drjson_object_insert_item_at_index(ctx, o, keys[1], drjson_make_null(), 0));
+            TestExpectTrue(drjson_object_replace_key_atom(ctx, o, keys[0], keys[1]));
+        }
+        // Delete the even keys, rename k1 to kN and put k0 back in front.
+        for(int i = 0; i < n; i += 2)
+            TestExpectFalse(drjson_object_delete_item_atom(ctx, o, keys[i]));
+        TestExpectTrue(drjson_object_delete_item_atom(ctx, o, keys[0]));
+        if(n >= 2)
+            TestExpectFalse(drjson_object_replace_key_atom(ctx, o, keys[1], keys[N]));
+        TestExpectFalse(drjson_object_insert_item_at_index(ctx, o, keys[0], drjson_make_int(0), 0));
+        TestAssertEquals(drjson_len(ctx, o), 1 + n/2);
+        TestAssertEquals(drjson_get_by_index(ctx, drjson_object_keys(o), 0).atom.bits, keys[0].bits);
+        for(int i = 0; i <= N; i++){
+            DrJsonAtom key = keys[i];
+            DrJsonValue v = drjson_object_get_item_atom(ctx, o, key);
+            _Bool present = i == 0 || (i < n && i % 2 && i != 1) || (i == N && n >= 2);
+            if(!present){
+                TestExpectEquals((int)v.kind, DRJSON_ERROR);
+                continue;
+            }
+            TestAssertEquals((int)v.kind, DRJSON_INTEGER);
+            TestExpectEquals(v.integer, i == N? 1 : i);
+        }
+    }
+    // Parsed objects, including ones with repeated keys.
+    const char* example = "[{a 1 b 2 a 3} {a 1 b 2 c 3 d 4 e 5 f 6 g 7 h 8 i 9 j 10 a 11}]";
+    DrJsonValue v = drjson_parse_string(ctx, example, strlen(example), 0);
+    TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+    for(size_t i = 0; i < 2; i++){
+        DrJsonValue o = drjson_get_by_index(ctx, v, i);
+        TestExpectEquals(drjson_len(ctx, o), i? 10 : 2);
+        DrJsonValue a = drjson_query(ctx, o, "a", 1);
+        TestAssertEquals((int)a.kind, DRJSON_UINTEGER);
+        TestExpectEquals(a.uinteger, i? 11 : 3);
+        DrJsonAtom first;
+        int err = drjson_atomize(ctx, "a", 1, &first);
+        TestAssertFalse(err);
+        TestExpectEquals(drjson_get_by_index(ctx, drjson_object_keys(o), 0).atom.bits, first.bits);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestShapes){
+    TESTBEGIN();
+    // Parsed objects with the same keys share them. Changing one mustn't
+    // change the others.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    const char* example =
+        "[{a 1 b 2 c 3} {a 4 b 5 c 6} {a 7 b 8 c 9} {a 10 b 11 c 12} {a 13 b 14 c 15} {a 16 b 17 c 18} {a 19 b 20 c 21}"
+        " {k0 0 k1 1 k2 2 k3 3 k4 4 k5 5 k6 6 k7 7 k8 8 k9 9 k10 10 k11 11}"
+        " {k0 1 k1 2 k2 3 k3 4 k4 5 k5 6 k6 7 k7 8 k8 9 k9 10 k10 11 k11 12}]";
+    DrJsonValue v = drjson_parse_string(ctx, example, strlen(example), 0);
+    TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+    DrJsonValue o[9];
+    for(size_t i = 0; i < 9; i++)
+        o[i] = drjson_get_by_index(ctx, v, i);
+    DrJsonAtom a, b, c, d;
+    TestAssertFalse(drjson_atomize(ctx, "a", 1, &a));
+    TestAssertFalse(drjson_atomize(ctx, "b", 1, &b));
+    TestAssertFalse(drjson_atomize(ctx, "c", 1, &c));
+    TestAssertFalse(drjson_atomize(ctx, "d", 1, &d));
+
+    // Replacing a value.
+    TestAssertFalse(drjson_object_set_item_atom(ctx, o[0], b, drjson_make_int(-1)));
+    // Adding a key.
+    TestAssertFalse(drjson_object_set_item_atom(ctx, o[1], d, drjson_make_int(-2)));
+    // Deleting one, and one that isn't there.
+    TestAssertFalse(drjson_object_delete_item_atom(ctx, o[2], a));
+    TestAssert(drjson_object_delete_item_atom(ctx, o[3], d));
+    // Renaming, reordering, inserting and clearing.
+    TestAssertFalse(drjson_object_replace_key_atom(ctx, o[3], c, d));
+    TestAssertFalse(drjson_object_move_item(ctx, o[4], 0, 2));
+    TestAssertFalse(drjson_object_insert_item_at_index(ctx, o[5], d, drjson_make_int(-3), 1));
+    TestAssertFalse(drjson_clear(ctx, o[6]));
+    // Big enough that the keys have a hash index.
+    DrJsonAtom k0, k11;
+    TestAssertFalse(drjson_atomize(ctx, "k0", 2, &k0));
+    TestAssertFalse(drjson_atomize(ctx, "k11", 3, &k11));
+    TestAssertFalse(drjson_object_set_item_atom(ctx, o[7], k11, drjson_make_int(-4)));
+    TestAssert(drjson_object_delete_item_atom(ctx, o[8], a));
+    TestAssertFalse(drjson_object_delete_item_atom(ctx, o[8], k0));
+    TestAssertEquals(drjson_query(ctx, o[8], "k11", 3).integer, 12);
+
+    drjson_gc(ctx, &v, 1);
+    const char* want =
+        "[{\"a\":1,\"b\":-1,\"c\":3},"
+        "{\"a\":4,\"b\":5,\"c\":6,\"d\":-2},"
+        "{\"b\":8,\"c\":9},"
+        "{\"a\":10,\"b\":11,\"d\":12},"
+        "{\"b\":14,\"c\":15,\"a\":13},"
+        "{\"a\":16,\"d\":-3,\"b\":17,\"c\":18},"
+        "{},"
+        "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":-4},"
+        "{\"k1\":2,\"k2\":3,\"k3\":4,\"k4\":5,\"k5\":6,\"k6\":7,\"k7\":8,\"k8\":9,\"k9\":10,\"k10\":11,\"k11\":12}]";
+    char buff[1024];
+    size_t printed = 0;
+    int err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+    TestAssertFalse(err);
+    TestExpectEquals2(str_eq, buff, want);
+    for(size_t i = 0; i < 9; i++){
+        DrJsonValue items = drjson_object_items(o[i]);
+        int64_t n = drjson_len(ctx, o[i]);
+        TestAssertEquals(drjson_len(ctx, items), 2*n);
+        for(int64_t k = 0; k < n; k++){
+            DrJsonValue key = drjson_get_by_index(ctx, items, 2*k);
+            DrJsonValue value = drjson_get_by_index(ctx, items, 2*k+1);
+            TestExpectTrue(drjson_eq(drjson_get_by_index(ctx, drjson_object_keys(o[i]), k), key));
+            TestExpectTrue(drjson_eq(drjson_get_by_index(ctx, drjson_object_values(o[i]), k), value));
+            TestExpectTrue(drjson_eq(drjson_object_get_item_atom(ctx, o[i], key.atom), value));
+        }
+    }
+    // Interning without consuming copies the object out of its shape.
+    DrJsonValue copy = drjson_intern_value(ctx, o[2], 0);
+    TestAssertEquals((int)copy.kind, DRJSON_OBJECT);
+    TestExpectTrue(drjson_deep_eq(ctx, copy, o[2]));
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
 #ifdef __clang__
 #pragma clang assume_nonnull end
 #endif
@@ -2403,3 +3572,903 @@ TestFunction(TestNDJSONRoundTrip){
 #endif
 
 #include "test_allocator.c"
+
+TestFunction(TestObjectTombstones){
+    TESTBEGIN();
+    // Deleting from a big object leaves tombstones that are compacted away
+    // later, so mix deletes with everything that looks at the pairs.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    enum {N = 300};
+    DrJsonAtom keys[N];
+    for(int i = 0; i < N; i++){
+        char buff[16];
+        int len = snprintf(buff, sizeof buff, "k%d", i);
+        int err = drjson_atomize(ctx, buff, (size_t)len, &keys[i]);
+        TestAssertFalse(err);
+    }
+    DrJsonValue o = drjson_make_object(ctx);
+    for(int i = 0; i < N; i++){
+        int err = drjson_object_set_item_atom(ctx, o, keys[i], drjson_make_int(i));
+        TestAssertFalse(err);
+    }
+    // Delete the keys that aren't multiples of 3, front to back.
+    int len = N;
+    for(int i = 0; i < N; i++){
+        if(i % 3 == 0) continue;
+        TestExpectFalse(drjson_object_delete_item_atom(ctx, o, keys[i]));
+        TestExpectTrue(drjson_object_delete_item_atom(ctx, o, keys[i]));
+        len--;
+        TestAssertEquals(drjson_len(ctx, o), len);
+        TestAssertEquals(drjson_len(ctx, drjson_object_items(o)), 2*len);
+        TestExpectEquals((int)drjson_object_get_item_atom(ctx, o, keys[i]).kind, DRJSON_ERROR);
+        TestExpectEquals(drjson_object_get_item_atom(ctx, o, keys[i/3*3]).integer, i/3*3);
+        if(i % 50 == 1){
+            // Reading counts around the tombstones instead of squeezing
+            // them out, so readers never write to the object.
+            #ifdef DRJSON_UNITY
+            uint32_t count = ctx->objects.data[o.object_idx].count;
+            uint32_t tombstones = drj_obj_tombstone_count(&ctx->objects.data[o.object_idx]);
+            TestExpectTrue(i != 1 || tombstones);
+            #endif
+            DrJsonValue k = drjson_get_by_index(ctx, drjson_object_keys(o), -1);
+            TestExpectEquals(k.atom.bits, keys[N-1].bits);
+            k = drjson_get_by_index(ctx, drjson_object_keys(o), 1);
+            TestExpectEquals(k.atom.bits, keys[i+1 < 3? i+1 : 3].bits);
+            DrJsonValue v = drjson_get_by_index(ctx, drjson_object_items(o), 3);
+            TestExpectEquals(v.integer, i+1 < 3? i+1 : 3);
+            static char text[8192];
+            size_t printed = 0;
+            int err = drjson_print_value_mem(ctx, text, sizeof text, o, 0, 0, &printed);
+            TestAssertFalse(err);
+            DrJsonValue copy = drjson_parse_string(ctx, text, printed, 0);
+            TestExpectNotEquals((int)copy.kind, DRJSON_ERROR);
+            TestExpectTrue(drjson_deep_eq(ctx, o, copy));
+            err = drjson_print_value_mem(ctx, text, sizeof text, o, 0, DRJSON_PRETTY_PRINT, &printed);
+            TestAssertFalse(err);
+            copy = drjson_parse_string(ctx, text, printed, 0);
+            TestExpectTrue(drjson_deep_eq(ctx, copy, o));
+            #ifdef DRJSON_UNITY
+            TestExpectEquals((uint32_t)ctx->objects.data[o.object_idx].count, count);
+            TestExpectEquals(drj_obj_tombstone_count(&ctx->objects.data[o.object_idx]), tombstones);
+            #endif
+        }
+    }
+    TestAssertEquals(drjson_len(ctx, o), N/3);
+    for(int i = 0; i < N/3; i++){
+        DrJsonValue k = drjson_get_by_index(ctx, drjson_object_keys(o), i);
+        TestExpectEquals(k.atom.bits, keys[3*i].bits);
+        DrJsonValue v = drjson_get_by_index(ctx, drjson_object_values(o), i);
+        TestExpectEquals(v.integer, 3*i);
+    }
+    // Delete down to a few keys, then put some back; new keys go at the end.
+    for(int i = 3; i < N; i += 3)
+        TestExpectFalse(drjson_object_delete_item_atom(ctx, o, keys[i]));
+    TestAssertEquals(drjson_len(ctx, o), 1);
+    for(int i = 1; i < 3; i++){
+        int err = drjson_object_set_item_atom(ctx, o, keys[i], drjson_make_int(i));
+        TestAssertFalse(err);
+    }
+    {
+        char buff[64];
+        size_t printed = 0;
+        int err = drjson_print_value_mem(ctx, buff, sizeof buff, o, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"k0\":0,\"k1\":1,\"k2\":2}");
+    }
+    // Tombstones in the middle are skipped when printing and comparing,
+    // and don't stop renaming, moving or inserting.
+    DrJsonValue p = drjson_make_object(ctx);
+    for(int i = 0; i < 20; i++){
+        int err = drjson_object_set_item_atom(ctx, p, keys[i], drjson_make_int(i));
+        TestAssertFalse(err);
+    }
+    for(int i = 3; i < 20; i++){
+        TestExpectFalse(drjson_object_delete_item_atom(ctx, p, keys[i]));
+        if(i == 4) TestExpectFalse(drjson_deep_eq(ctx, o, p));
+    }
+    TestExpectTrue(drjson_deep_eq(ctx, o, p));
+    TestExpectFalse(drjson_object_set_item_atom(ctx, p, keys[5], drjson_make_int(5)));
+    TestExpectFalse(drjson_object_delete_item_atom(ctx, p, keys[1]));
+    TestExpectFalse(drjson_object_replace_key_atom(ctx, p, keys[5], keys[6]));
+    TestExpectFalse(drjson_object_move_item(ctx, p, 2, 0));
+    TestExpectFalse(drjson_object_delete_item_atom(ctx, p, keys[0]));
+    TestExpectFalse(drjson_object_insert_item_at_index(ctx, p, keys[7], drjson_make_int(7), 1));
+    drjson_gc(ctx, &p, 1);
+    {
+        char buff[64];
+        size_t printed = 0;
+        int err = drjson_print_value_mem(ctx, buff, sizeof buff, p, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"k6\":5,\"k7\":7,\"k2\":2}");
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestShortAtoms){
+    TESTBEGIN();
+    // Short strings are remembered in a small cache keyed by their bytes.
+    // Strings that differ in a single byte, at every length around the
+    // cutoffs, must still get their own atoms.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    enum {MAXLEN = 20};
+    DrJsonAtom atoms[MAXLEN+1][MAXLEN+1];
+    char buff[MAXLEN+1];
+    for(int round = 0; round < 2; round++){
+        for(int len = 1; len <= MAXLEN; len++){
+            // The unchanged string, then with each byte changed in turn.
+            for(int pos = -1; pos < len; pos++){
+                memset(buff, 'a', (size_t)len);
+                if(pos >= 0) buff[pos] = 'b';
+                DrJsonAtom a;
+                int err = drjson_atomize(ctx, buff, (size_t)len, &a);
+                TestAssertFalse(err);
+                const char* str; size_t slen;
+                err = drjson_get_atom_str_and_length(ctx, a, &str, &slen);
+                TestAssertFalse(err);
+                TestAssertEquals((int)slen, len);
+                TestExpectFalse(memcmp(str, buff, (size_t)len));
+                if(round)
+                    TestExpectEquals(a.bits, atoms[len][pos+1].bits);
+                else
+                    atoms[len][pos+1] = a;
+            }
+        }
+    }
+    for(int len = 1; len <= MAXLEN; len++)
+        for(int i = 0; i <= len; i++)
+            for(int j = 0; j < i; j++)
+                TestExpectNotEquals(atoms[len][i].bits, atoms[len][j].bits);
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestPackedArrays){
+    TESTBEGIN();
+    // Arrays of one kind of number are stored packed and unpacked again
+    // when they get anything else. Neither should be visible except through
+    // the span accessors.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char buff[128];
+    size_t printed, count;
+    int err;
+    {
+        const char* example = "[[1.5 2.5 -3.0] [-1 -2] [1 2 3] [1 1.5] [1 \"a\"] [] [1 -2]]";
+        DrJsonValue v = drjson_parse_string(ctx, example, strlen(example), 0);
+        TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        const double* d = drjson_array_numbers(ctx, drjson_get_by_index(ctx, v, 0), &count);
+        TestAssert(d);
+        TestAssertEquals(count, 3);
+        TestExpectEquals(d[2], -3.0);
+        TestExpectEquals((int)drjson_get_by_index(ctx, drjson_get_by_index(ctx, v, 0), 1).kind, DRJSON_NUMBER);
+        const int64_t* i = drjson_array_integers(ctx, drjson_get_by_index(ctx, v, 1), &count);
+        TestAssert(i);
+        TestAssertEquals(count, 2);
+        TestExpectEquals(i[1], -2);
+        TestExpectFalse(drjson_array_numbers(ctx, drjson_get_by_index(ctx, v, 1), &count) != NULL);
+        const uint64_t* u = drjson_array_uintegers(ctx, drjson_get_by_index(ctx, v, 2), &count);
+        TestAssert(u);
+        TestAssertEquals(count, 3);
+        TestExpectEquals(u[0], 1);
+        for(int k = 3; k < 6; k++){
+            DrJsonValue a = drjson_get_by_index(ctx, v, k);
+            TestExpectFalse(drjson_array_numbers(ctx, a, &count) != NULL);
+            TestExpectFalse(drjson_array_integers(ctx, a, &count) != NULL);
+            TestExpectFalse(drjson_array_uintegers(ctx, a, &count) != NULL);
+        }
+        // Parsed integers are unsigned unless negative, which packing keeps.
+        DrJsonValue mixed = drjson_get_by_index(ctx, v, 6);
+        i = drjson_array_integers(ctx, mixed, &count);
+        TestAssert(i);
+        TestAssertEquals(count, 2);
+        TestExpectEquals(i[0], 1);
+        TestExpectEquals((int)drjson_get_by_index(ctx, mixed, 0).kind, DRJSON_UINTEGER);
+        TestExpectEquals((int)drjson_get_by_index(ctx, mixed, 1).kind, DRJSON_INTEGER);
+        // A non-negative DRJSON_INTEGER would come back unsigned.
+        TestExpectFalse(drjson_array_push_item(ctx, mixed, drjson_make_int(3)));
+        TestExpectFalse(drjson_array_integers(ctx, mixed, &count) != NULL);
+        TestExpectEquals((int)drjson_get_by_index(ctx, mixed, 0).kind, DRJSON_UINTEGER);
+        TestExpectEquals((int)drjson_get_by_index(ctx, mixed, 2).kind, DRJSON_INTEGER);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[[1.5,2.5,-3],[-1,-2],[1,2,3],[1,1.5],[1,\"a\"],[],[1,-2,3]]");
+    }
+    {
+        // Changes that keep the kind keep it packed.
+        const char* example = "[1 2 3]";
+        DrJsonValue a = drjson_parse_string(ctx, example, strlen(example), 0);
+        DrJsonValue three = drjson_get_by_index(ctx, a, 2);
+        TestExpectFalse(drjson_array_push_item(ctx, a, three));
+        TestExpectFalse(drjson_array_insert_item(ctx, a, 0, three));
+        TestExpectFalse(drjson_array_swap_items(ctx, a, 1, 2));
+        TestExpectFalse(drjson_array_move_item(ctx, a, 4, 1));
+        TestExpectEquals(drjson_array_del_item(ctx, a, 2).uinteger, 2);
+        TestExpectEquals(drjson_array_pop_item(ctx, a).uinteger, 3);
+        TestExpectFalse(drjson_array_set_by_index(ctx, a, 0, three));
+        TestAssert(drjson_array_uintegers(ctx, a, &count));
+        TestExpectEquals(count, 3);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, a, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[3,3,1]");
+        // Anything else unpacks it.
+        TestExpectFalse(drjson_array_set_by_index(ctx, a, 1, drjson_make_int(-1)));
+        TestExpectFalse(drjson_array_uintegers(ctx, a, &count) != NULL);
+        TestExpectFalse(drjson_array_push_item(ctx, a, drjson_make_null()));
+        TestExpectEquals((int)drjson_get_by_index(ctx, a, 0).kind, DRJSON_UINTEGER);
+        TestExpectEquals((int)drjson_get_by_index(ctx, a, 1).kind, DRJSON_INTEGER);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, a, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[3,-1,1,null]");
+        drjson_gc(ctx, &a, 1);
+    }
+    {
+        // A packed array and the same numbers pushed one at a time are
+        // equal, and intern to the same array.
+        const char* example = "[1 2 3]";
+        DrJsonValue parsed = drjson_parse_string(ctx, example, strlen(example), 0);
+        DrJsonValue pushed = drjson_make_array(ctx);
+        for(int k = 1; k <= 3; k++)
+            TestExpectFalse(drjson_array_push_item(ctx, pushed, drjson_get_by_index(ctx, parsed, k-1)));
+        TestExpectFalse(drjson_array_uintegers(ctx, pushed, &count) != NULL);
+        TestExpectTrue(drjson_deep_eq(ctx, parsed, pushed));
+        DrJsonValue a = drjson_intern_value(ctx, parsed, 0);
+        DrJsonValue b = drjson_intern_value(ctx, pushed, 1);
+        TestAssertEquals((int)a.kind, DRJSON_ARRAY);
+        TestAssertEquals((int)b.kind, DRJSON_ARRAY);
+        TestExpectEquals(a.array_idx, b.array_idx);
+        TestExpectTrue(drjson_array_push_item(ctx, a, drjson_make_null()));
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestLazyNumbers){
+    TESTBEGIN();
+    // With DRJSON_PARSE_FLAG_LAZY_NUMBERS, numbers print back exactly as
+    // written and convert to what an eager parse would have given.
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char buff[256];
+    size_t printed;
+    int err;
+    const char* example = "[1.50,1e5,-0,0.0,18446744073709551615,-0.0,3,2.5E-3,-12]";
+    {
+        DrJsonValue lazy = drjson_parse_string(ctx, example, strlen(example), DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+        TestAssertEquals((int)lazy.kind, DRJSON_ARRAY);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, lazy, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, example);
+        DrJsonValue eager = drjson_parse_string(ctx, example, strlen(example), 0);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, eager, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[1.5,100000,0,0,18446744073709551615,-0,3,0.0025,-12]");
+        TestExpectTrue(drjson_deep_eq(ctx, lazy, eager));
+        for(int64_t i = 0; i < drjson_len(ctx, lazy); i++){
+            DrJsonValue l = drjson_get_by_index(ctx, lazy, i);
+            DrJsonValue e = drjson_get_by_index(ctx, eager, i);
+            TestExpectTrue(drjson_is_numeric(l));
+            TestExpectTrue(drjson_eq(l, e));
+            DrJsonValue r = drjson_resolve_number(l);
+            TestExpectEquals((int)r.kind, (int)e.kind);
+            TestExpectEquals(r.uinteger, e.uinteger);
+        }
+        // Plain integers are converted while parsing anyway.
+        TestExpectEquals((int)drjson_get_by_index(ctx, lazy, 0).kind, DRJSON_LAZY_NUMBER);
+        TestExpectEquals((int)drjson_get_by_index(ctx, lazy, 6).kind, DRJSON_UINTEGER);
+        TestExpectEquals((int)drjson_get_by_index(ctx, lazy, 8).kind, DRJSON_INTEGER);
+        TestExpectEquals2(str_eq, drjson_kind_name(DRJSON_LAZY_NUMBER, NULL), "number");
+        TestExpectFalse(drjson_eq(drjson_get_by_index(ctx, lazy, 0), drjson_make_number(1.25)));
+    }
+    {
+        // What isn't a number is still a bare string, and what json
+        // wouldn't spell that way is converted as before.
+        const char* text = "[2024-01-02, 99999999999999999999999, +1.5, 1.5., 007]";
+        DrJsonValue v = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+        TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        TestExpectEquals((int)drjson_get_by_index(ctx, v, 0).kind, DRJSON_STRING);
+        TestExpectEquals((int)drjson_get_by_index(ctx, v, 1).kind, DRJSON_STRING);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[\"2024-01-02\",\"99999999999999999999999\",1.5,1.5,7]");
+    }
+    {
+        // Without copying, the text points into the source.
+        char text[] = "{\"a\": 0.1, \"b\": [1e-7]}";
+        DrJsonValue v = drjson_parse_string(ctx, text, strlen(text), DRJSON_PARSE_FLAG_LAZY_NUMBERS|DRJSON_PARSE_FLAG_NO_COPY_STRINGS|DRJSON_PARSE_FLAG_STRICT);
+        DrJsonValue a = drjson_query(ctx, v, "a", 1);
+        TestAssertEquals((int)a.kind, DRJSON_LAZY_NUMBER);
+        TestExpectTrue(a.number_text == text+6);
+        TestExpectEquals(a.number_len, 3);
+        TestExpectEquals(drjson_resolve_number(a).number, 0.1);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_PRETTY_PRINT|DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\n  \"a\": 0.1,\n  \"b\": [1e-7]\n}");
+    }
+    {
+        // The push parser copies, as its chunks are the caller's to reuse.
+        for(size_t chunk = 1; chunk < strlen(example); chunk++){
+            DrJsonValue v = push_parse_in_chunks(ctx, example, strlen(example), DRJSON_PARSE_FLAG_LAZY_NUMBERS, chunk, 0);
+            TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+            err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+            TestAssertFalse(err);
+            TestExpectEquals2(str_eq, buff, example);
+        }
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestIncrementalGC){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char buff[128];
+    size_t printed;
+    int err;
+    {
+        const char* example = "[{x: {v: 1}}, {y: 0}]";
+        DrJsonValue root = drjson_parse_string(ctx, example, strlen(example), 0);
+        TestAssertEquals((int)root.kind, DRJSON_ARRAY);
+        DrJsonValue h1 = drjson_get_by_index(ctx, root, 0);
+        DrJsonValue h2 = drjson_get_by_index(ctx, root, 1);
+        DrJsonValue c = drjson_query(ctx, h1, "x", 1);
+        DrJsonValue garbage = drjson_make_object(ctx);
+        TestExpectFalse(drjson_object_set_item_copy_key(ctx, garbage, "g", 1, drjson_make_array(ctx)));
+        // Scans the root, then the second holder.
+        TestExpectEquals(drjson_gc_step(ctx, &root, 1, 1), 0);
+        TestExpectEquals(drjson_gc_step(ctx, &root, 1, 1), 0);
+        // Moving c from the unscanned holder to the scanned one would lose
+        // it without the barrier.
+        TestExpectFalse(drjson_object_set_item_copy_key(ctx, h2, "c", 1, c));
+        TestExpectFalse(drjson_object_delete_item(ctx, h1, "x", 1));
+        // Made while marking, so it survives this collection.
+        DrJsonValue fresh = drjson_make_object(ctx);
+        TestExpectFalse(drjson_object_set_item_copy_key(ctx, fresh, "f", 1, drjson_make_uint(2)));
+        TestExpectFalse(drjson_array_push_item(ctx, root, fresh));
+        int steps = 0;
+        while(!drjson_gc_step(ctx, &root, 1, 1))
+            steps++;
+        TestExpectTrue(steps > 2);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, root, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[{},{\"y\":0,\"c\":{\"v\":1}},{\"f\":2}]");
+        // The garbage was the newest object, so its slot is reused first.
+        DrJsonValue again = drjson_make_object(ctx);
+        TestExpectEquals(again.object_idx, garbage.object_idx);
+        // A full collection in the middle of an incremental one finishes it.
+        TestExpectEquals(drjson_gc_step(ctx, &root, 1, 1), 0);
+        drjson_gc(ctx, &root, 1);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, root, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[{},{\"y\":0,\"c\":{\"v\":1}},{\"f\":2}]");
+        // With enough budget it's one step.
+        TestExpectEquals(drjson_gc_step(ctx, &root, 1, SIZE_MAX), 1);
+        TestExpectEquals(drjson_gc_step(ctx, NULL, 0, SIZE_MAX), 1);
+    }
+    {
+        // A mutator that keeps allocating, at every pace, mustn't keep the
+        // smallest steps from finishing.
+        DrJsonValue root = drjson_make_array(ctx);
+        for(int i = 0; i < 100; i++){
+            DrJsonValue o = drjson_make_object(ctx);
+            TestExpectFalse(drjson_object_set_item_copy_key(ctx, o, "i", 1, drjson_make_int(i)));
+            TestExpectFalse(drjson_array_push_item(ctx, root, o));
+        }
+        for(int pace = 1; pace <= 3; pace++){
+            int steps = 0;
+            for(int done = 0; !done && steps < 10000; steps++){
+                if(steps % pace == 0){
+                    DrJsonValue o = drjson_make_object(ctx);
+                    TestExpectFalse(drjson_array_push_item(ctx, root, o));
+                    (void)drjson_make_array(ctx); // garbage
+                }
+                done = drjson_gc_step(ctx, &root, 1, 1);
+            }
+            TestExpectTrue(steps < 10000);
+        }
+        TestExpectTrue(drjson_len(ctx, root) > 100);
+        TestExpectEquals(drjson_query(ctx, root, "[99].i", 6).integer, 99);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestCompactingGC){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char before[256], after[256];
+    size_t printed;
+    int err;
+    {
+        const char* g = "{garbage: [1, {x: []}]}";
+        const char* doc = "[{a: [1, {b: 2}]}, {c: {}}, [[]], [1.5, 2.5]]";
+        const char* ro = "{k: [1, 2], l: {m: 3}}";
+        DrJsonValue roots[2];
+        DrJsonValue garbage = drjson_parse_string(ctx, g, strlen(g), 0);
+        roots[0] = drjson_parse_string(ctx, doc, strlen(doc), 0);
+        TestAssertEquals((int)roots[0].kind, DRJSON_ARRAY);
+        DrJsonValue more_garbage = drjson_parse_string(ctx, g, strlen(g), 0);
+        roots[1] = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)roots[1].kind, DRJSON_OBJECT);
+        DrJsonValue handle = drjson_query(ctx, roots[0], "[1].c", 5);
+        TestAssertEquals((int)handle.kind, DRJSON_OBJECT);
+        err = drjson_print_value_mem(ctx, before, sizeof before, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        DrJsonRemap remap;
+        TestAssertFalse(drjson_gc_compact(ctx, roots, 2, &remap));
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, before);
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[1], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, "{\"k\":[1,2],\"l\":{\"m\":3}}");
+        // The garbage was made first, so the live objects moved down.
+        TestExpectTrue(roots[0].array_idx < remap.array_count);
+        TestExpectEquals(remap.objects[garbage.object_idx], SIZE_MAX);
+        TestExpectEquals((int)drjson_remap_value(&remap, more_garbage).kind, DRJSON_ERROR);
+        DrJsonValue moved = drjson_remap_value(&remap, handle);
+        TestAssertEquals((int)moved.kind, DRJSON_OBJECT);
+        TestExpectEquals(moved.object_idx, drjson_query(ctx, roots[0], "[1].c", 5).object_idx);
+        TestExpectTrue(moved.object_idx < handle.object_idx);
+        size_t live = 0;
+        for(size_t i = 0; i < remap.object_count; i++)
+            live += remap.objects[i] != SIZE_MAX;
+        drjson_remap_free(ctx, &remap);
+        // The table has no holes, so new objects go at the end.
+        TestExpectEquals(drjson_make_object(ctx).object_idx, live);
+        // The empty object survived and still works.
+        TestExpectFalse(drjson_object_set_item_copy_key(ctx, moved, "d", 1, drjson_make_uint(4)));
+        // Interned values are found under their new index.
+        DrJsonValue same = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestExpectEquals(same.object_idx, roots[1].object_idx);
+        TestAssertFalse(drjson_gc_compact(ctx, roots, 2, NULL));
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, "[{\"a\":[1,{\"b\":2}]},{\"c\":{\"d\":4}},[[]],[1.5,2.5]]");
+        drjson_gc(ctx, roots, 2);
+    }
+    {
+        // Interned empty containers have no items, but still have to come
+        // out of the interned tables when they are compacted away.
+        DrJsonValue roots[1] = {drjson_make_array(ctx)};
+        for(int i = 0; i < 2; i++){
+            DrJsonValue e = drjson_parse_string(ctx, "{}", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+            TestAssertEquals((int)e.kind, DRJSON_OBJECT);
+            DrJsonValue a = drjson_parse_string(ctx, "[]", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+            TestAssertEquals((int)a.kind, DRJSON_ARRAY);
+            TestAssertFalse(drjson_gc_compact(ctx, roots, 1, NULL));
+        }
+        DrJsonValue e = drjson_parse_string(ctx, "[{}, []]", 8, DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)e.kind, DRJSON_ARRAY);
+        TestExpectFalse(drjson_array_push_item(ctx, roots[0], e));
+        TestAssertFalse(drjson_gc_compact(ctx, roots, 1, NULL));
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, "[[{},[]]]");
+        DrJsonValue same = drjson_parse_string(ctx, "{}", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestExpectEquals(same.object_idx, drjson_query(ctx, roots[0], "[0][0]", 6).object_idx);
+        drjson_gc(ctx, roots, 1);
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+TestFunction(TestAtomGC){
+    TESTBEGIN();
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    char buff[256];
+    size_t printed;
+    int err;
+    DrJsonAtom atom;
+    {
+        const char* doc = "{name: keep, list: [x, {p: 1, q: 2}, {p: 3, q: 4}], n: 1.25e0, length: 1}";
+        DrJsonValue roots[2];
+        roots[0] = drjson_parse_string(ctx, doc, strlen(doc), DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+        TestAssertEquals((int)roots[0].kind, DRJSON_OBJECT);
+        for(int i = 0; i < 50; i++){
+            char garbage[64];
+            int len = snprintf(garbage, sizeof garbage, "[{dead%d: gone%d, z: 2.5}, {dead%d: 1, z: 3}]", i, i, i);
+            DrJsonValue v = drjson_parse_string(ctx, garbage, (size_t)len, DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+            TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        }
+        const char* ro = "[tag, [inner]]";
+        roots[1] = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)roots[1].kind, DRJSON_ARRAY);
+        TestAssertFalse(drjson_get_atom_no_intern(ctx, "dead7", 5, &atom));
+        TestAssertFalse(drjson_gc_atoms(ctx, roots, 2));
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "dead7", 5, &atom));
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "gone7", 5, &atom));
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "z", 1, &atom));
+        TestExpectFalse(drjson_get_atom_no_intern(ctx, "keep", 4, &atom));
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "{\"name\":\"keep\",\"list\":[\"x\",{\"p\":1,\"q\":2},{\"p\":3,\"q\":4}],\"n\":1.25e0,\"length\":1}");
+        // Lookups go through the rebuilt atom table and shapes.
+        TestExpectEquals(drjson_query(ctx, roots[0], "list[2].q", 9).uinteger, 4);
+        TestExpectEquals((int)drjson_object_get_item(ctx, roots[0], "name", 4).kind, DRJSON_STRING);
+        TestExpectEquals(drjson_query(ctx, roots[0], "list.length", 11).uinteger, 3);
+        TestExpectEquals(drjson_object_get_item(ctx, roots[0], "length", 6).uinteger, 1);
+        const char* again = "[{p: 5, q: 6}, {p: 7, q: 8}, {dead7: x}]";
+        DrJsonValue v = drjson_parse_string(ctx, again, strlen(again), 0);
+        TestAssertEquals((int)v.kind, DRJSON_ARRAY);
+        TestExpectEquals(drjson_query(ctx, v, "[1].q", 5).uinteger, 8);
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[{\"p\":5,\"q\":6},{\"p\":7,\"q\":8},{\"dead7\":\"x\"}]");
+        // Interned arrays are found by their new atoms.
+        DrJsonValue same = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestExpectEquals(same.array_idx, roots[1].array_idx);
+        // Collecting again with nothing dead changes nothing.
+        TestAssertFalse(drjson_gc_atoms(ctx, roots, 2));
+        err = drjson_print_value_mem(ctx, buff, sizeof buff, roots[1], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, buff, "[\"tag\",[\"inner\"]]");
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "dead7", 5, &atom));
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+// The test allocator isn't thread safe, so drjson_gc_parallel gets it
+// behind a lock.
+typedef struct LockedAllocator LockedAllocator;
+struct LockedAllocator {
+    DrJsonAllocator inner;
+#ifdef _WIN32
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static void
+locked_acquire(LockedAllocator* la){
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&la->lock);
+#else
+    pthread_mutex_lock(&la->lock);
+#endif
+}
+
+static void
+locked_release(LockedAllocator* la){
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&la->lock);
+#else
+    pthread_mutex_unlock(&la->lock);
+#endif
+}
+
+static void*_Nullable
+locked_alloc(void*_Null_unspecified up, size_t size){
+    LockedAllocator* la = up;
+    locked_acquire(la);
+    void* p = la->inner.alloc(la->inner.user_pointer, size);
+    locked_release(la);
+    return p;
+}
+
+static void*_Nullable
+locked_realloc(void*_Null_unspecified up, void*_Nullable data, size_t orig_size, size_t new_size){
+    LockedAllocator* la = up;
+    locked_acquire(la);
+    void* p = la->inner.realloc(la->inner.user_pointer, data, orig_size, new_size);
+    locked_release(la);
+    return p;
+}
+
+static void
+locked_free(void*_Null_unspecified up, const void*_Nullable data, size_t size){
+    LockedAllocator* la = up;
+    locked_acquire(la);
+    la->inner.free(la->inner.user_pointer, data, size);
+    locked_release(la);
+}
+
+TestFunction(TestParallelGC){
+    TESTBEGIN();
+    LockedAllocator la = {.inner = get_test_allocator()};
+#ifdef _WIN32
+    InitializeSRWLock(&la.lock);
+#else
+    pthread_mutex_init(&la.lock, NULL);
+#endif
+    DrJsonAllocator allocator = {
+        .user_pointer = &la,
+        .alloc = locked_alloc,
+        .realloc = locked_realloc,
+        .free = locked_free,
+    };
+    DrJsonContext* ctx = drjson_create_ctx(allocator);
+    static char before[1<<17], after[1<<17];
+    size_t printed;
+    int err;
+    {
+        // Enough containers that the markers have to share them, with
+        // garbage mixed in all through the tables.
+        DrJsonValue roots[2];
+        roots[0] = drjson_make_array(ctx);
+        size_t first_garbage = SIZE_MAX;
+        for(int i = 0; i < 3000; i++){
+            DrJsonValue o = drjson_make_object(ctx);
+            if(i % 3 == 1){
+                if(first_garbage == SIZE_MAX) first_garbage = o.object_idx;
+                TestAssertFalse(drjson_object_set_item_copy_key(ctx, o, "dead", 4, drjson_make_array(ctx)));
+                continue;
+            }
+            DrJsonValue list = drjson_make_array(ctx);
+            TestAssertFalse(drjson_array_push_item(ctx, list, drjson_make_uint((uint64_t)i)));
+            TestAssertFalse(drjson_array_push_item(ctx, list, drjson_make_object(ctx)));
+            TestAssertFalse(drjson_object_set_item_copy_key(ctx, o, "i", 1, drjson_make_uint((uint64_t)i)));
+            TestAssertFalse(drjson_object_set_item_copy_key(ctx, o, "list", 4, list));
+            TestAssertFalse(drjson_array_push_item(ctx, roots[0], o));
+        }
+        const char* shaped = "[{a: [1, 2], b: {c: [x]}}, {a: [3], b: {c: []}}]";
+        TestAssertFalse(drjson_array_push_item(ctx, roots[0], drjson_parse_string(ctx, shaped, strlen(shaped), 0)));
+        const char* ro = "{k: [1, 2], l: {m: 3}}";
+        const char* ro_garbage = "{k: [3, 4]}";
+        roots[1] = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)roots[1].kind, DRJSON_OBJECT);
+        DrJsonValue interned_garbage = drjson_parse_string(ctx, ro_garbage, strlen(ro_garbage), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)interned_garbage.kind, DRJSON_OBJECT);
+        err = drjson_print_value_mem(ctx, before, sizeof before, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestAssertFalse(drjson_gc_parallel(ctx, roots, 2, 4));
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, before);
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[1], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, "{\"k\":[1,2],\"l\":{\"m\":3}}");
+        // The free list starts at the first slot that was freed.
+        TestExpectEquals(drjson_make_object(ctx).object_idx, first_garbage);
+        // Interned values are still found, and the dead one was removed.
+        DrJsonValue same = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestExpectEquals(same.object_idx, roots[1].object_idx);
+        DrJsonValue again = drjson_parse_string(ctx, ro_garbage, strlen(ro_garbage), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)again.kind, DRJSON_OBJECT);
+        // More threads than containers, and the serial fallback.
+        TestAssertFalse(drjson_gc_parallel(ctx, roots, 2, 64));
+        TestAssertFalse(drjson_gc_parallel(ctx, roots, 2, 1));
+        err = drjson_print_value_mem(ctx, after, sizeof after, roots[0], 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, before);
+        // Without roots everything goes, and slot 0 is never reused.
+        TestAssertFalse(drjson_gc_parallel(ctx, NULL, 0, 3));
+        TestExpectEquals(drjson_make_object(ctx).object_idx, 1);
+    }
+    {
+        // Dead interned empty containers must leave the interned tables
+        // before their slots are reused.
+        DrJsonValue root = drjson_make_array(ctx);
+        for(int i = 0; i < 2; i++){
+            TestAssertEquals((int)drjson_parse_string(ctx, "{}", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS).kind, DRJSON_OBJECT);
+            TestAssertEquals((int)drjson_parse_string(ctx, "[]", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS).kind, DRJSON_ARRAY);
+            TestAssertFalse(drjson_gc_parallel(ctx, &root, 1, 4));
+            DrJsonValue o = drjson_make_object(ctx);
+            DrJsonValue a = drjson_make_array(ctx);
+            // Interning again doesn't find the new, mutable, ones.
+            TestExpectNotEquals(drjson_parse_string(ctx, "{}", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS).object_idx, o.object_idx);
+            TestExpectNotEquals(drjson_parse_string(ctx, "[]", 2, DRJSON_PARSE_FLAG_INTERN_OBJECTS).array_idx, a.array_idx);
+            TestAssertFalse(drjson_object_set_item_copy_key(ctx, o, "x", 1, drjson_make_uint(1)));
+            TestAssertFalse(drjson_array_push_item(ctx, root, o));
+            TestAssertFalse(drjson_array_push_item(ctx, a, drjson_make_uint(2)));
+            TestAssertFalse(drjson_array_push_item(ctx, root, a));
+        }
+        DrJsonValue e = drjson_parse_string(ctx, "[{}, []]", 8, DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+        TestAssertEquals((int)e.kind, DRJSON_ARRAY);
+        TestAssertFalse(drjson_array_push_item(ctx, root, e));
+        TestAssertFalse(drjson_gc(ctx, &root, 1));
+        TestAssertFalse(drjson_gc_parallel(ctx, &root, 1, 4));
+        err = drjson_print_value_mem(ctx, after, sizeof after, root, 0, DRJSON_APPEND_ZERO, &printed);
+        TestAssertFalse(err);
+        TestExpectEquals2(str_eq, after, "[{\"x\":1},[2],{\"x\":1},[2],[{},[]]]");
+    }
+    drjson_ctx_free_all(ctx);
+#ifndef _WIN32
+    pthread_mutex_destroy(&la.lock);
+#endif
+    assert_all_freed();
+    TESTEND();
+}
+
+typedef struct CountingAllocator CountingAllocator;
+struct CountingAllocator {
+    DrJsonAllocator inner;
+    size_t allocs, reallocs;
+};
+
+static void*_Nullable
+counting_alloc(void*_Null_unspecified up, size_t size){
+    CountingAllocator* ca = up;
+    ca->allocs++;
+    return ca->inner.alloc(ca->inner.user_pointer, size);
+}
+
+static void*_Nullable
+counting_realloc(void*_Null_unspecified up, void*_Nullable data, size_t orig_size, size_t new_size){
+    CountingAllocator* ca = up;
+    ca->reallocs++;
+    return ca->inner.realloc(ca->inner.user_pointer, data, orig_size, new_size);
+}
+
+static void
+counting_free(void*_Null_unspecified up, const void*_Nullable data, size_t size){
+    CountingAllocator* ca = up;
+    ca->inner.free(ca->inner.user_pointer, data, size);
+}
+
+TestFunction(TestCtxReset){
+    TESTBEGIN();
+    CountingAllocator ca = {.inner = get_test_allocator()};
+    DrJsonAllocator allocator = {
+        .user_pointer = &ca,
+        .alloc = counting_alloc,
+        .realloc = counting_realloc,
+        .free = counting_free,
+    };
+    DrJsonContext* ctx = drjson_create_ctx(allocator);
+    char first[512], buff[512];
+    size_t printed;
+    int err;
+    DrJsonAtom atom;
+    {
+        const char* doc = "{name: request, n: 12.50, records: [{a: 1, b: xx}, {a: 2, b: yy}], "
+            "words: [alpha, beta, gamma, delta, epsilon, zeta, eta, theta, iota, kappa]}";
+        const char* ro = "{k: [1, 2]}";
+        DrJsonValue v, interned;
+        size_t allocs[4], reallocs[4];
+        for(int round = 0; round < 4; round++){
+            if(round) drjson_ctx_reset(ctx);
+            allocs[round] = ca.allocs;
+            reallocs[round] = ca.reallocs;
+            v = drjson_parse_string(ctx, doc, strlen(doc), DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+            TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+            interned = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+            TestAssertEquals((int)interned.kind, DRJSON_OBJECT);
+            TestAssertFalse(drjson_atomize(ctx, "only this round", 15, &atom));
+            allocs[round] = ca.allocs - allocs[round];
+            reallocs[round] = ca.reallocs - reallocs[round];
+            err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+            TestAssertFalse(err);
+            if(!round)
+                memcpy(first, buff, printed);
+            else
+                TestExpectEquals2(str_eq, buff, first);
+            // The magic keys still work.
+            TestExpectEquals(drjson_query(ctx, v, "words.length", 12).uinteger, 10);
+            TestExpectEquals(drjson_query(ctx, v, "records[1].b.length", 19).uinteger, 2);
+            DrJsonValue same = drjson_parse_string(ctx, ro, strlen(ro), DRJSON_PARSE_FLAG_INTERN_OBJECTS);
+            TestExpectEquals(same.object_idx, interned.object_idx);
+        }
+        // The tables and string chunks were kept, so only the first round
+        // made them. The rest only allocate items (which the parser also
+        // shrinks to fit).
+        TestExpectTrue(allocs[0] > allocs[1]);
+        TestExpectTrue(reallocs[0] > reallocs[1]);
+        for(int round = 2; round < 4; round++){
+            TestExpectEquals(allocs[round], allocs[1]);
+            TestExpectEquals(reallocs[round], reallocs[1]);
+        }
+        // Reset forgets the atoms it made.
+        drjson_ctx_reset(ctx);
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "only this round", 15, &atom));
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, "request", 7, &atom));
+        TestExpectFalse(drjson_get_atom_no_intern(ctx, "length", 6, &atom));
+        TestExpectEquals(drjson_make_object(ctx).object_idx, 0);
+        // With many atoms the whole index is cleared instead, and then a
+        // small round in the big table only clears its own.
+        for(int round = 0; round < 2; round++){
+            for(int i = 0; i < (round? 10 : 1000); i++){
+                char key[32];
+                int len = snprintf(key, sizeof key, "key %d", i);
+                TestAssertFalse(drjson_atomize(ctx, key, (size_t)len, &atom));
+            }
+            v = drjson_parse_string(ctx, doc, strlen(doc), 0);
+            TestAssertEquals((int)v.kind, DRJSON_OBJECT);
+            drjson_ctx_reset(ctx);
+            TestExpectTrue(drjson_get_atom_no_intern(ctx, "key 5", 5, &atom));
+            TestExpectTrue(drjson_get_atom_no_intern(ctx, "alpha", 5, &atom));
+            v = drjson_parse_string(ctx, doc, strlen(doc), DRJSON_PARSE_FLAG_LAZY_NUMBERS);
+            err = drjson_print_value_mem(ctx, buff, sizeof buff, v, 0, DRJSON_APPEND_ZERO, &printed);
+            TestAssertFalse(err);
+            TestExpectEquals2(str_eq, buff, first);
+            TestExpectEquals(drjson_query(ctx, v, "words.length", 12).uinteger, 10);
+        }
+    }
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}
+
+// Finds strings that drj_hash_str hashes to `tag` in the low 7 bits (the
+// atom index's control byte) and to at least min_hash.
+static
+void
+probe_strings(char (*out)[16], size_t n, uint32_t tag, uint32_t min_hash, uint32_t* counter){
+    for(size_t i = 0; i < n;){
+        int len = snprintf(out[i], sizeof out[i], "p%u", (*counter)++);
+        uint32_t h = hash_align1(out[i], (size_t)len);
+        if(!h) h = 1024;
+        if((h & 0x7f) == tag && h >= min_hash)
+            i++;
+    }
+}
+
+TestFunction(TestAtomGroupProbing){
+    TESTBEGIN();
+    // Every string here has the same tag, so each probe matches every
+    // occupied slot and has to tell them apart by the full string. Half
+    // of them hash high enough to land in the last group of any index of
+    // up to 256 groups, so once that group is full their probes wrap
+    // around to the first.
+    enum {N = 48};
+    static char wrap[N][16], anywhere[N][16], absent[N][16];
+    uint32_t counter = 0;
+    probe_strings(wrap, N, 0x2a, 0xff000000, &counter);
+    probe_strings(anywhere, N, 0x2a, 0, &counter);
+    probe_strings(absent, N, 0x2a, 0xff000000, &counter);
+    const char* strs[2*N];
+    for(size_t i = 0; i < N; i++){
+        strs[2*i] = wrap[i];
+        strs[2*i+1] = anywhere[i];
+    }
+    DrJsonContext* ctx = drjson_create_ctx(get_test_allocator());
+    DrJsonAtom atoms[2*N];
+    DrJsonAtom a;
+    // The index starts at 4 groups and is rebuilt as it grows, so check
+    // lookups after every insert.
+    for(size_t i = 0; i < 2*N; i++){
+        int err = drjson_atomize(ctx, strs[i], strlen(strs[i]), &atoms[i]);
+        TestAssertFalse(err);
+        for(size_t j = 0; j <= i; j++){
+            err = drjson_get_atom_no_intern(ctx, strs[j], strlen(strs[j]), &a);
+            TestAssertFalse(err);
+            TestAssertEquals(a.bits, atoms[j].bits);
+        }
+        if(i + 1 < 2*N)
+            TestExpectTrue(drjson_get_atom_no_intern(ctx, strs[i+1], strlen(strs[i+1]), &a));
+        for(size_t j = 0; j < N; j++)
+            TestExpectTrue(drjson_get_atom_no_intern(ctx, absent[j], strlen(absent[j]), &a));
+    }
+    // drjson_gc_atoms renumbers the survivors and builds a new index.
+    // Keep every other string.
+    DrJsonValue keep = drjson_make_array(ctx);
+    for(size_t i = 0; i < 2*N; i += 2){
+        DrJsonValue v = drjson_make_string(ctx, strs[i], strlen(strs[i]));
+        TestAssertEquals((int)v.kind, DRJSON_STRING);
+        TestAssertFalse(drjson_array_push_item(ctx, keep, v));
+        v = drjson_make_string(ctx, strs[i+1], strlen(strs[i+1]));
+        TestAssertEquals((int)v.kind, DRJSON_STRING);
+    }
+    TestAssertFalse(drjson_gc_atoms(ctx, &keep, 1));
+    for(size_t i = 0; i < 2*N; i++){
+        int err = drjson_get_atom_no_intern(ctx, strs[i], strlen(strs[i]), &a);
+        if(i & 1){
+            TestExpectTrue(err);
+            continue;
+        }
+        TestAssertFalse(err);
+        DrJsonValue v = drjson_get_by_index(ctx, keep, (int64_t)(i/2));
+        TestAssertEquals((int)v.kind, DRJSON_STRING);
+        TestExpectEquals(a.bits, v.atom.bits);
+    }
+    for(size_t j = 0; j < N; j++)
+        TestExpectTrue(drjson_get_atom_no_intern(ctx, absent[j], strlen(absent[j]), &a));
+    // Atomizing again after the rebuild probes past the survivors.
+    for(size_t i = 1; i < 2*N; i += 2){
+        TestAssertFalse(drjson_atomize(ctx, strs[i], strlen(strs[i]), &atoms[i]));
+        TestAssertFalse(drjson_get_atom_no_intern(ctx, strs[i], strlen(strs[i]), &a));
+        TestExpectEquals(a.bits, atoms[i].bits);
+    }
+    for(size_t i = 0; i < 2*N; i += 2)
+        TestExpectFalse(drjson_get_atom_no_intern(ctx, strs[i], strlen(strs[i]), &a));
+    drjson_ctx_free_all(ctx);
+    assert_all_freed();
+    TESTEND();
+}